@@ -0,0 +1,101 @@
+use std::path::Path;
+use std::time::Instant;
+
+use ble_copro_stream_server::capture::{CaptureReader, Pacing};
+use ble_copro_stream_server::stream_message::ChannelMessage;
+use ble_copro_stream_server::{StreamChannelError, StreamServer};
+
+fn print_message(message: &ChannelMessage) {
+    match message {
+        ChannelMessage::Xiaomi(record) => println!("Xiaomi record: {}", record),
+        ChannelMessage::LinkyTic(record) => println!("LinkyTic record: {}", record),
+        ChannelMessage::DeviceHealth(record) => println!("Device health: {}", record),
+        ChannelMessage::Snapshot(snapshot) => println!("Snapshot: {}", snapshot),
+        _ => {}
+    }
+}
+
+fn is_end(e: &StreamChannelError) -> bool {
+    matches!(e, StreamChannelError::IoError(e) if e.kind() == std::io::ErrorKind::UnexpectedEof)
+}
+
+/// Record the traffic of every dongle into `dir`
+async fn record(dir: &Path) {
+    let mut server = StreamServer::init("192.0.3.1", 4000)
+        .await
+        .expect("Failed to start server");
+    server.set_capture_dir(dir);
+
+    loop {
+        let mut channel = server.accept().await.expect("Failed to accept connection");
+
+        tokio::spawn(async move {
+            loop {
+                match channel.next().await {
+                    Ok(message) => print_message(&message),
+                    Err(e) => {
+                        eprintln!("Error: {}", e);
+                        break;
+                    }
+                }
+            }
+        });
+    }
+}
+
+/// Replay a capture at its original pace, or as fast as possible and report the
+/// decoding throughput
+async fn replay(path: &Path, pacing: Pacing) {
+    let reader = CaptureReader::open(path).expect("Failed to open capture");
+    let mut replay = reader.replay(pacing);
+    let start = Instant::now();
+    let mut messages = 0u64;
+
+    loop {
+        match replay.next().await {
+            Ok(message) => {
+                messages += 1;
+                if pacing == Pacing::Original {
+                    print_message(&message);
+                }
+            }
+            Err(e) if is_end(&e) => break,
+            Err(e) => eprintln!("Error: {}", e),
+        }
+    }
+
+    let elapsed = start.elapsed().as_secs_f64();
+    println!(
+        "{} messages, {} bytes in {:.3} s ({:.0} messages/s, {:.1} MB/s), {} unknown frames, {} CRC errors",
+        messages,
+        reader.len(),
+        elapsed,
+        messages as f64 / elapsed,
+        reader.len() as f64 / elapsed / 1e6,
+        replay.unknown_frames(),
+        replay.frame_stats().crc_errors
+    );
+}
+
+/// capture record <dir>
+/// capture replay <file> [--fast]
+#[tokio::main]
+async fn main() {
+    let args: Vec<String> = std::env::args().collect();
+
+    match (args.get(1).map(String::as_str), args.get(2)) {
+        (Some("record"), Some(dir)) => record(Path::new(dir)).await,
+        (Some("replay"), Some(path)) => {
+            let pacing = if args.iter().any(|arg| arg == "--fast") {
+                Pacing::Fast
+            } else {
+                Pacing::Original
+            };
+            replay(Path::new(path), pacing).await
+        }
+        _ => {
+            eprintln!("Usage: capture record <dir> | capture replay <file> [--fast]");
+            std::process::exit(1);
+        }
+    }
+}
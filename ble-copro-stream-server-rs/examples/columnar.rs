@@ -0,0 +1,65 @@
+use std::time::Duration;
+
+use ble_copro_stream_server::columnar::{ColumnarBatch, ColumnarBatcher};
+use ble_copro_stream_server::StreamServer;
+
+/// Assemble the records of the dongle into columnar batches of up to 256 rows,
+/// flushed at least every 10 seconds
+#[tokio::main]
+async fn main() {
+    let server = StreamServer::init("192.0.3.1", 4000)
+        .await
+        .expect("Failed to start server");
+
+    loop {
+        let mut channel = server.accept().await.expect("Failed to accept connection");
+        let mut batcher = ColumnarBatcher::new(256, Duration::from_secs(10));
+
+        loop {
+            let mut batches = Vec::new();
+
+            let frame = match batcher.deadline() {
+                Some(deadline) => {
+                    tokio::time::timeout_at(deadline.into(), channel.next_raw()).await
+                }
+                None => Ok(channel.next_raw().await),
+            };
+
+            let disconnected = matches!(frame, Ok(Err(_)));
+
+            match frame {
+                Ok(Ok(frame)) => match batcher.push(&frame) {
+                    Ok(batch) => batches.extend(batch),
+                    Err(e) => eprintln!("Invalid record: {}", e),
+                },
+                Ok(Err(e)) => {
+                    eprintln!("Error: {}", e);
+                    batches.extend(batcher.flush());
+                }
+                Err(_) => batches.extend(batcher.flush_expired(std::time::Instant::now())),
+            }
+
+            for batch in batches {
+                match batch {
+                    ColumnarBatch::Xiaomi(batch) => {
+                        let temperature = batch.temperature_celsius();
+                        let mean = temperature.iter().sum::<f32>() / temperature.len() as f32;
+                        println!(
+                            "Xiaomi batch: {} rows {} devices mean temperature: {:.2} °C",
+                            batch.len(),
+                            batch.macs.len(),
+                            mean
+                        );
+                    }
+                    ColumnarBatch::LinkyTic(batch) => {
+                        println!("LinkyTic batch: {} rows", batch.len());
+                    }
+                }
+            }
+
+            if disconnected {
+                break;
+            }
+        }
+    }
+}
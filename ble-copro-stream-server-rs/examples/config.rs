@@ -0,0 +1,79 @@
+use ble_copro_stream_server::config_client::{
+    ConfigClient, ConfigKey, DEFAULT_CONFIG_PORT, DEFAULT_DEVICE_IP,
+};
+
+fn usage() -> ! {
+    eprintln!(
+        "usage: config <get|set|set-volatile|reset> <key> [channel id (hex)] [value]\n\
+         keys: scan-interval scan-window log-level channel-enable channel-priority \
+         channel-weight\n      \
+         deadband-temperature deadband-humidity deadband-battery deadband-papp \
+         deadband-base deadband-heartbeat deadband-suppressed\n\
+         env: COPRO_DEVICE_IP (default {})",
+        DEFAULT_DEVICE_IP
+    );
+    std::process::exit(1)
+}
+
+/// Read or tune the configuration of a dongle, e.g.
+/// `config set channel-weight fa30fa42 4`
+#[tokio::main]
+async fn main() {
+    let args: Vec<String> = std::env::args().skip(1).collect();
+    let (op, key) = match args.as_slice() {
+        [op, key, ..] => (op.as_str(), key.as_str()),
+        _ => usage(),
+    };
+    let mut rest = args[2..].iter();
+
+    let key = match key {
+        "scan-interval" => ConfigKey::ScanInterval,
+        "scan-window" => ConfigKey::ScanWindow,
+        "log-level" => ConfigKey::LogLevel,
+        "deadband-temperature" => ConfigKey::DeadbandXiaomiTemperature,
+        "deadband-humidity" => ConfigKey::DeadbandXiaomiHumidity,
+        "deadband-battery" => ConfigKey::DeadbandXiaomiBattery,
+        "deadband-papp" => ConfigKey::DeadbandLinkyPapp,
+        "deadband-base" => ConfigKey::DeadbandLinkyBase,
+        "deadband-heartbeat" => ConfigKey::DeadbandHeartbeat,
+        "deadband-suppressed" => ConfigKey::DeadbandSuppressed,
+        "channel-enable" | "channel-priority" | "channel-weight" => {
+            let channel_id = rest
+                .next()
+                .and_then(|s| u32::from_str_radix(s, 16).ok())
+                .unwrap_or_else(|| usage());
+            match key {
+                "channel-enable" => ConfigKey::ChannelEnable(channel_id),
+                "channel-priority" => ConfigKey::ChannelPriority(channel_id),
+                _ => ConfigKey::ChannelWeight(channel_id),
+            }
+        }
+        _ => usage(),
+    };
+    let mut value = || {
+        rest.next()
+            .and_then(|s| s.parse::<u32>().ok())
+            .unwrap_or_else(|| usage())
+    };
+
+    let ip = std::env::var("COPRO_DEVICE_IP").unwrap_or_else(|_| DEFAULT_DEVICE_IP.to_string());
+    let mut client = ConfigClient::connect(&ip, DEFAULT_CONFIG_PORT)
+        .await
+        .expect("Failed to connect to the device");
+
+    let result = match op {
+        "get" => client.get(key).await,
+        "set" => client.set(key, value()).await,
+        "set-volatile" => client.set_volatile(key, value()).await,
+        "reset" => client.reset(key).await,
+        _ => usage(),
+    };
+
+    match result {
+        Ok(value) => println!("{:?} = {}", key, value),
+        Err(e) => {
+            eprintln!("Error: {}", e);
+            std::process::exit(1);
+        }
+    }
+}
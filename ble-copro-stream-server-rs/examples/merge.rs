@@ -0,0 +1,79 @@
+use std::time::Instant;
+
+use ble_copro_stream_server::merge::RecordMerger;
+use ble_copro_stream_server::stream_message::ChannelMessage;
+use ble_copro_stream_server::StreamServer;
+use tokio::sync::mpsc;
+
+/// Accept any number of dongles and print each measurement once, with the
+/// best RSSI among the dongles which heard it
+#[tokio::main]
+async fn main() {
+    let server = StreamServer::init("192.0.3.1", 4000)
+        .await
+        .expect("Failed to start server");
+    let (tx, mut rx) = mpsc::channel::<ChannelMessage>(256);
+
+    tokio::spawn(async move {
+        loop {
+            let mut channel = server.accept().await.expect("Failed to accept connection");
+            let tx = tx.clone();
+
+            tokio::spawn(async move {
+                loop {
+                    match channel.next().await {
+                        Ok(message) => {
+                            if tx.send(message).await.is_err() {
+                                break;
+                            }
+                        }
+                        Err(e) => {
+                            eprintln!("Error: {}", e);
+                            break;
+                        }
+                    }
+                }
+            });
+        }
+    });
+
+    let mut merger = RecordMerger::default();
+    let mut reported = 0;
+
+    loop {
+        // push() emits the expired records as well, the timeout only matters
+        // when no message comes in
+        let received = match merger.deadline() {
+            Some(deadline) => tokio::time::timeout_at(deadline.into(), rx.recv())
+                .await
+                .ok(),
+            None => Some(rx.recv().await),
+        };
+
+        let messages = match received {
+            Some(Some(message)) => merger.push(message, Instant::now()),
+            Some(None) => break,
+            None => merger.flush_expired(Instant::now()),
+        };
+
+        for message in messages {
+            match message {
+                ChannelMessage::Xiaomi(record) => println!("Xiaomi record: {}", record),
+                ChannelMessage::LinkyTic(record) => println!("LinkyTic record: {}", record),
+                ChannelMessage::DeviceHealth(record) => println!("Device health: {}", record),
+                _ => {}
+            }
+        }
+
+        let stats = merger.stats();
+        if stats.received >= reported + 100 {
+            reported = stats.received;
+            println!(
+                "Merged {} duplicates out of {} records ({:.0} %)",
+                stats.duplicates,
+                stats.received,
+                stats.duplicate_ratio() * 100.0
+            );
+        }
+    }
+}
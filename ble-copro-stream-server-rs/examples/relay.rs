@@ -0,0 +1,57 @@
+use ble_copro_stream_server::{
+    frame::FrameFormat, xiaomi::XiaomiHandler, RawFrameWriter, StreamServer,
+};
+use tokio::net::TcpStream;
+
+/// Forward every frame of the dongle to an upstream service, unchanged
+#[tokio::main]
+async fn main() {
+    let upstream = std::env::args()
+        .nth(1)
+        .unwrap_or_else(|| "127.0.0.1:5000".to_string());
+
+    let server = StreamServer::init("192.0.3.1", 4000)
+        .await
+        .expect("Failed to start server");
+
+    loop {
+        let mut channel = server.accept().await.expect("Failed to accept connection");
+        let output = TcpStream::connect(&upstream)
+            .await
+            .expect("Failed to connect upstream");
+        let mut writer = RawFrameWriter::new(output, FrameFormat::V1);
+
+        loop {
+            match channel.next_raw().await {
+                Ok(frame) => {
+                    // Typed decoding is only paid for when needed
+                    if frame.is::<XiaomiHandler>() && std::env::var_os("RELAY_VERBOSE").is_some() {
+                        if let Ok(record) = frame.decode::<XiaomiHandler>() {
+                            println!("Xiaomi record: {}", record);
+                        }
+                    }
+
+                    if let Err(e) = writer.write(&frame).await {
+                        eprintln!("Upstream error: {}", e);
+                        break;
+                    }
+                }
+                Err(e) => {
+                    eprintln!("Error: {}", e);
+                    break;
+                }
+            }
+
+            // Sensor frames are sparse, forward them right away
+            if writer.flush().await.is_err() {
+                break;
+            }
+        }
+
+        let (frames, bytes) = writer.stats();
+        println!(
+            "Connection closed, relayed {} frames ({} bytes)",
+            frames, bytes
+        );
+    }
+}
@@ -0,0 +1,60 @@
+use std::time::Duration;
+
+use ble_copro_stream_server::serial::SerialChannel;
+use ble_copro_stream_server::stream_message::ChannelMessage;
+
+/// Print the records of a dongle streaming over a serial port, e.g.
+/// `serial /dev/ttyACM0`, or the pseudo terminal reported by a `native_sim`
+/// build (`uart connected to pseudotty: /dev/pts/N`)
+#[tokio::main]
+async fn main() {
+    let path = std::env::args()
+        .nth(1)
+        .unwrap_or_else(|| "/dev/ttyACM0".to_string());
+
+    loop {
+        let mut channel = match SerialChannel::open(&path) {
+            Ok(channel) => channel,
+            Err(e) => {
+                eprintln!("Failed to open {}: {}", path, e);
+                tokio::time::sleep(Duration::from_secs(1)).await;
+                continue;
+            }
+        };
+
+        loop {
+            match channel.next().await {
+                Ok(message) => match message {
+                    ChannelMessage::Xiaomi(record) => {
+                        println!("Xiaomi record: {}", record);
+                    }
+                    ChannelMessage::LinkyTic(record) => {
+                        println!("LinkyTic record: {}", record);
+                    }
+                    ChannelMessage::DeviceHealth(record) => {
+                        println!("Device health: {}", record);
+                    }
+                    ChannelMessage::Latency(histogram) => {
+                        println!("Latency {}", histogram);
+                    }
+                    ChannelMessage::Snapshot(snapshot) => {
+                        println!("Snapshot {}", snapshot);
+                    }
+                    _ => {
+                        eprintln!("Unhandled message");
+                    }
+                },
+                Err(e) => {
+                    eprintln!("Error: {}", e);
+                    break;
+                }
+            }
+        }
+
+        println!(
+            "Port closed, dropped frames: {}",
+            channel.frame_stats().crc_errors
+        );
+        tokio::time::sleep(Duration::from_secs(1)).await;
+    }
+}
@@ -0,0 +1,62 @@
+use std::time::{SystemTime, UNIX_EPOCH};
+
+use ble_copro_stream_server::series::{SeriesStore, DEFAULT_RETENTION};
+use ble_copro_stream_server::StreamServer;
+
+fn now_ms() -> u64 {
+    SystemTime::now()
+        .duration_since(UNIX_EPOCH)
+        .map(|d| d.as_millis() as u64)
+        .unwrap_or(0)
+}
+
+/// Keep the last 24 hours of every sensor in memory and print the last hour of
+/// each sensor heard
+#[tokio::main]
+async fn main() {
+    let server = StreamServer::init("192.0.3.1", 4000)
+        .await
+        .expect("Failed to start server");
+    let mut store = SeriesStore::default();
+
+    loop {
+        let mut channel = server.accept().await.expect("Failed to accept connection");
+
+        while let Ok(message) = channel.next().await {
+            let now = now_ms();
+            if !store.push(&message, now) {
+                continue;
+            }
+
+            let stats = store.stats();
+            if stats.samples % 100 != 0 {
+                continue;
+            }
+
+            println!(
+                "{} series, {} samples in {} bytes ({:.2} bytes per sample, {} hours retention)",
+                stats.series,
+                stats.samples,
+                stats.allocated_bytes,
+                stats.bytes_per_sample(),
+                DEFAULT_RETENTION.as_secs() / 3600
+            );
+
+            for addr in store.addresses() {
+                let samples = store.range(addr, now.saturating_sub(3600 * 1000), now);
+                let kind = store.kind(addr).expect("Series without kind");
+
+                if let Some(last) = samples.last() {
+                    println!(
+                        "  {} {:?}: {} samples last hour, last {:?} = {:?}",
+                        addr,
+                        kind,
+                        samples.len(),
+                        kind.columns(),
+                        last.values
+                    );
+                }
+            }
+        }
+    }
+}
@@ -18,6 +18,15 @@ async fn main() {
                     ChannelMessage::LinkyTic(record) => {
                         println!("LinkyTic record: {}", record);
                     }
+                    ChannelMessage::DeviceHealth(record) => {
+                        println!("Device health: {}", record);
+                    }
+                    ChannelMessage::Latency(histogram) => {
+                        println!("Latency {}", histogram);
+                    }
+                    ChannelMessage::Snapshot(snapshot) => {
+                        println!("Snapshot {}", snapshot);
+                    }
                     _ => {
                         eprintln!("Unhandled message");
                     }
@@ -0,0 +1,80 @@
+use std::sync::Arc;
+use std::time::Duration;
+
+use ble_copro_stream_server::influx::InfluxWriter;
+use ble_copro_stream_server::mqtt::MqttWriter;
+use ble_copro_stream_server::sink::{Sink, SinkConfig};
+use ble_copro_stream_server::StreamServer;
+
+/// Forward the records of any number of dongles to InfluxDB or to an MQTT
+/// broker:
+///
+/// sink influx http://localhost:8086/write?db=ble
+/// sink mqtt localhost:1883
+#[tokio::main]
+async fn main() {
+    let args: Vec<String> = std::env::args().collect();
+    let usage = "Usage: sink influx <write URL> | sink mqtt <host:port>";
+
+    let config = SinkConfig::default();
+    let sink = match (args.get(1).map(String::as_str), args.get(2)) {
+        (Some("influx"), Some(url)) => {
+            let mut writer = InfluxWriter::new(url).expect("Invalid URL");
+            if let Ok(token) = std::env::var("INFLUX_TOKEN") {
+                writer.set_token(&token);
+            }
+            Sink::spawn(writer, config)
+        }
+        (Some("mqtt"), Some(addr)) => Sink::spawn(MqttWriter::new(addr), config),
+        _ => {
+            eprintln!("{}", usage);
+            std::process::exit(1);
+        }
+    };
+    let sink = Arc::new(sink);
+
+    let reporter = sink.clone();
+    tokio::spawn(async move {
+        let mut interval = tokio::time::interval(Duration::from_secs(10));
+        loop {
+            interval.tick().await;
+            let stats = reporter.stats();
+            println!(
+                "Sink: {} received, {} written in {} batches, {} dropped, {} retries, last error: {:?}",
+                stats.received,
+                stats.written,
+                stats.batches,
+                stats.dropped,
+                stats.retries,
+                stats.last_error
+            );
+        }
+    });
+
+    let server = StreamServer::init("192.0.3.1", 4000)
+        .await
+        .expect("Failed to start server");
+
+    loop {
+        let mut channel = server.accept().await.expect("Failed to accept connection");
+        let sink = sink.clone();
+
+        tokio::spawn(async move {
+            loop {
+                match channel.next().await {
+                    Ok(message) => {
+                        // Waits while the sink falls behind, the dongle
+                        // buffers meanwhile
+                        if sink.send(message).await.is_err() {
+                            break;
+                        }
+                    }
+                    Err(e) => {
+                        eprintln!("Error: {}", e);
+                        break;
+                    }
+                }
+            }
+        });
+    }
+}
@@ -0,0 +1,481 @@
+//! Export of columnar batches through the Arrow C data interface
+//! (<https://arrow.apache.org/docs/format/CDataInterface.html>), `arrow` feature.
+//!
+//! A batch is exported as a struct array, one child per column, which Arrow
+//! implementations import as a record batch (e.g. `arrow::ffi::from_ffi()`,
+//! `pyarrow.RecordBatch._import_from_c()`). Column buffers are handed over as
+//! is, without copy, and freed by the release callback of the consumer.
+//!
+//! The `mac` column is dictionary encoded: uint16 indices into a
+//! `fixed_size_binary(6)` dictionary, most significant byte first.
+
+use std::any::Any;
+use std::ffi::{c_char, c_void, CString};
+use std::ptr;
+
+use crate::ble::BleAddress;
+use crate::columnar::{ColumnarBatch, LinkyTicBatch, XiaomiBatch};
+
+/// `struct ArrowSchema` of the C data interface
+#[repr(C)]
+#[derive(Debug)]
+pub struct ArrowSchema {
+    pub format: *const c_char,
+    pub name: *const c_char,
+    pub metadata: *const c_char,
+    pub flags: i64,
+    pub n_children: i64,
+    pub children: *mut *mut ArrowSchema,
+    pub dictionary: *mut ArrowSchema,
+    pub release: Option<unsafe extern "C" fn(*mut ArrowSchema)>,
+    pub private_data: *mut c_void,
+}
+
+/// `struct ArrowArray` of the C data interface
+#[repr(C)]
+#[derive(Debug)]
+pub struct ArrowArray {
+    pub length: i64,
+    pub null_count: i64,
+    pub offset: i64,
+    pub n_buffers: i64,
+    pub n_children: i64,
+    pub buffers: *mut *const c_void,
+    pub children: *mut *mut ArrowArray,
+    pub dictionary: *mut ArrowArray,
+    pub release: Option<unsafe extern "C" fn(*mut ArrowArray)>,
+    pub private_data: *mut c_void,
+}
+
+struct SchemaPrivate {
+    _format: CString,
+    _name: CString,
+    children: Vec<*mut ArrowSchema>,
+    dictionary: *mut ArrowSchema,
+}
+
+struct ArrayPrivate {
+    /// Owners of the buffers
+    _columns: Vec<Box<dyn Any>>,
+    buffers: Vec<*const c_void>,
+    children: Vec<*mut ArrowArray>,
+    dictionary: *mut ArrowArray,
+}
+
+unsafe extern "C" fn schema_release(schema: *mut ArrowSchema) {
+    if schema.is_null() || (*schema).release.is_none() {
+        return;
+    }
+
+    let private = Box::from_raw((*schema).private_data as *mut SchemaPrivate);
+    // Children moved out by the consumer have their release set to None
+    for child in private.children.iter().chain(Some(&private.dictionary)) {
+        if !child.is_null() {
+            drop(Box::from_raw(*child));
+        }
+    }
+
+    (*schema).release = None;
+}
+
+unsafe extern "C" fn array_release(array: *mut ArrowArray) {
+    if array.is_null() || (*array).release.is_none() {
+        return;
+    }
+
+    let private = Box::from_raw((*array).private_data as *mut ArrayPrivate);
+    for child in private.children.iter().chain(Some(&private.dictionary)) {
+        if !child.is_null() {
+            drop(Box::from_raw(*child));
+        }
+    }
+
+    (*array).release = None;
+}
+
+impl Drop for ArrowSchema {
+    fn drop(&mut self) {
+        if let Some(release) = self.release {
+            unsafe { release(self) }
+        }
+    }
+}
+
+impl Drop for ArrowArray {
+    fn drop(&mut self) {
+        if let Some(release) = self.release {
+            unsafe { release(self) }
+        }
+    }
+}
+
+impl ArrowSchema {
+    fn new(
+        format: &str,
+        name: &str,
+        children: Vec<ArrowSchema>,
+        dictionary: Option<ArrowSchema>,
+    ) -> ArrowSchema {
+        let format = CString::new(format).unwrap();
+        let name = CString::new(name).unwrap();
+        let mut private = Box::new(SchemaPrivate {
+            children: children
+                .into_iter()
+                .map(|c| Box::into_raw(Box::new(c)))
+                .collect(),
+            dictionary: dictionary.map_or(ptr::null_mut(), |d| Box::into_raw(Box::new(d))),
+            _format: format,
+            _name: name,
+        });
+
+        ArrowSchema {
+            format: private._format.as_ptr(),
+            name: private._name.as_ptr(),
+            metadata: ptr::null(),
+            flags: 0,
+            n_children: private.children.len() as i64,
+            children: private.children.as_mut_ptr(),
+            dictionary: private.dictionary,
+            release: Some(schema_release),
+            private_data: Box::into_raw(private) as *mut c_void,
+        }
+    }
+
+    /// Move the schema to a consumer allocated `ArrowSchema`
+    ///
+    /// # Safety
+    /// `out` must be valid for writes, its previous content is not released.
+    pub unsafe fn export(self, out: *mut ArrowSchema) {
+        ptr::write(out, self);
+    }
+}
+
+impl ArrowArray {
+    fn new(
+        length: usize,
+        columns: Vec<Box<dyn Any>>,
+        buffers: Vec<*const c_void>,
+        children: Vec<ArrowArray>,
+        dictionary: Option<ArrowArray>,
+    ) -> ArrowArray {
+        let mut private = Box::new(ArrayPrivate {
+            _columns: columns,
+            buffers,
+            children: children
+                .into_iter()
+                .map(|c| Box::into_raw(Box::new(c)))
+                .collect(),
+            dictionary: dictionary.map_or(ptr::null_mut(), |d| Box::into_raw(Box::new(d))),
+        });
+
+        ArrowArray {
+            length: length as i64,
+            null_count: 0,
+            offset: 0,
+            n_buffers: private.buffers.len() as i64,
+            n_children: private.children.len() as i64,
+            buffers: private.buffers.as_mut_ptr(),
+            children: private.children.as_mut_ptr(),
+            dictionary: private.dictionary,
+            release: Some(array_release),
+            private_data: Box::into_raw(private) as *mut c_void,
+        }
+    }
+
+    /// Move the array to a consumer allocated `ArrowArray`
+    ///
+    /// # Safety
+    /// `out` must be valid for writes, its previous content is not released.
+    pub unsafe fn export(self, out: *mut ArrowArray) {
+        ptr::write(out, self);
+    }
+}
+
+/// Non nullable primitive column, no validity buffer
+fn primitive<T: 'static>(name: &str, format: &str, values: Vec<T>) -> (ArrowSchema, ArrowArray) {
+    let buffers = vec![ptr::null(), values.as_ptr() as *const c_void];
+    let array = ArrowArray::new(values.len(), vec![Box::new(values)], buffers, vec![], None);
+
+    (ArrowSchema::new(format, name, vec![], None), array)
+}
+
+/// uint16 indices into a fixed_size_binary(6) dictionary
+fn mac_column(name: &str, indices: Vec<u16>, macs: &[BleAddress]) -> (ArrowSchema, ArrowArray) {
+    let bytes: Vec<u8> = macs.iter().flat_map(|addr| addr.mac).collect();
+    let dict_buffers = vec![ptr::null(), bytes.as_ptr() as *const c_void];
+    let dictionary = ArrowArray::new(
+        macs.len(),
+        vec![Box::new(bytes)],
+        dict_buffers,
+        vec![],
+        None,
+    );
+
+    let buffers = vec![ptr::null(), indices.as_ptr() as *const c_void];
+    let array = ArrowArray::new(
+        indices.len(),
+        vec![Box::new(indices)],
+        buffers,
+        vec![],
+        Some(dictionary),
+    );
+    let schema = ArrowSchema::new(
+        "S",
+        name,
+        vec![],
+        Some(ArrowSchema::new("w:6", "", vec![], None)),
+    );
+
+    (schema, array)
+}
+
+fn struct_column(
+    length: usize,
+    fields: Vec<(ArrowSchema, ArrowArray)>,
+) -> (ArrowSchema, ArrowArray) {
+    let (schemas, arrays): (Vec<_>, Vec<_>) = fields.into_iter().unzip();
+
+    (
+        ArrowSchema::new("+s", "", schemas, None),
+        ArrowArray::new(length, vec![], vec![ptr::null()], arrays, None),
+    )
+}
+
+impl XiaomiBatch {
+    /// Columns: uptime_ms, mac, rssi, temperature (centi-degrees), humidity
+    /// (centi-percents), battery_mv, battery_percent
+    pub fn into_arrow(self) -> (ArrowSchema, ArrowArray) {
+        let length = self.len();
+
+        struct_column(
+            length,
+            vec![
+                primitive("uptime_ms", "L", self.uptime_ms),
+                mac_column("mac", self.mac_index, &self.macs),
+                primitive("rssi", "c", self.rssi),
+                primitive("temperature", "s", self.temperature),
+                primitive("humidity", "S", self.humidity),
+                primitive("battery_mv", "S", self.battery_mv),
+                primitive("battery_percent", "C", self.battery_percent),
+            ],
+        )
+    }
+}
+
+impl LinkyTicBatch {
+    /// Columns: uptime_ms, mac, rssi, flags, base, iinst, ptec, papp
+    pub fn into_arrow(self) -> (ArrowSchema, ArrowArray) {
+        let length = self.len();
+
+        struct_column(
+            length,
+            vec![
+                primitive("uptime_ms", "L", self.uptime_ms),
+                mac_column("mac", self.mac_index, &self.macs),
+                primitive("rssi", "c", self.rssi),
+                primitive("flags", "I", self.flags),
+                primitive("base", "I", self.base),
+                primitive("iinst", "S", self.iinst),
+                primitive("ptec", "S", self.ptec),
+                primitive("papp", "I", self.papp),
+            ],
+        )
+    }
+}
+
+impl ColumnarBatch {
+    pub fn into_arrow(self) -> (ArrowSchema, ArrowArray) {
+        match self {
+            ColumnarBatch::Xiaomi(batch) => batch.into_arrow(),
+            ColumnarBatch::LinkyTic(batch) => batch.into_arrow(),
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::ffi::CStr;
+    use std::mem::MaybeUninit;
+    use std::sync::atomic::{AtomicUsize, Ordering};
+
+    use crate::ble::BleType;
+
+    fn xiaomi_batch() -> XiaomiBatch {
+        XiaomiBatch {
+            uptime_ms: vec![1000, 2000, 3000],
+            mac_index: vec![0, 1, 0],
+            rssi: vec![-70, -80, -75],
+            temperature: vec![2150, -420, 0],
+            humidity: vec![4550, 4600, 4650],
+            battery_mv: vec![2950, 2940, 2930],
+            battery_percent: vec![87, 86, 85],
+            macs: vec![
+                BleAddress {
+                    mac: [0xa4, 0xc1, 0x38, 0x12, 0x34, 0x56],
+                    ble_type: BleType::Public,
+                },
+                BleAddress {
+                    mac: [0xa4, 0xc1, 0x38, 0xab, 0xcd, 0xef],
+                    ble_type: BleType::Public,
+                },
+            ],
+        }
+    }
+
+    unsafe fn str_of(s: *const c_char) -> &'static str {
+        CStr::from_ptr(s).to_str().unwrap()
+    }
+
+    unsafe fn values<T: Copy>(array: &ArrowArray) -> Vec<T> {
+        assert_eq!(array.n_buffers, 2);
+        assert!((*array.buffers).is_null(), "no validity buffer");
+        let data = *array.buffers.add(1) as *const T;
+        std::slice::from_raw_parts(data, array.length as usize).to_vec()
+    }
+
+    /// Export as a consumer does, to C allocated structures
+    fn export(batch: ColumnarBatch) -> (Box<ArrowSchema>, Box<ArrowArray>) {
+        let (schema, array) = batch.into_arrow();
+        let mut c_schema = Box::new(MaybeUninit::<ArrowSchema>::uninit());
+        let mut c_array = Box::new(MaybeUninit::<ArrowArray>::uninit());
+
+        unsafe {
+            schema.export(c_schema.as_mut_ptr());
+            array.export(c_array.as_mut_ptr());
+            (
+                Box::from_raw(Box::into_raw(c_schema) as *mut ArrowSchema),
+                Box::from_raw(Box::into_raw(c_array) as *mut ArrowArray),
+            )
+        }
+    }
+
+    #[test]
+    fn test_xiaomi_export() {
+        let (schema, array) = export(ColumnarBatch::Xiaomi(xiaomi_batch()));
+
+        unsafe {
+            assert_eq!(str_of(schema.format), "+s");
+            assert_eq!(schema.n_children, 7);
+            assert_eq!(array.length, 3);
+            assert_eq!(array.null_count, 0);
+            assert_eq!(array.n_buffers, 1);
+            assert_eq!(array.n_children, 7);
+
+            let fields: Vec<(&str, &str)> = (0..7)
+                .map(|i| {
+                    let child = &**schema.children.add(i);
+                    (str_of(child.name), str_of(child.format))
+                })
+                .collect();
+            assert_eq!(
+                fields,
+                [
+                    ("uptime_ms", "L"),
+                    ("mac", "S"),
+                    ("rssi", "c"),
+                    ("temperature", "s"),
+                    ("humidity", "S"),
+                    ("battery_mv", "S"),
+                    ("battery_percent", "C"),
+                ]
+            );
+
+            let column = |i: usize| &**array.children.add(i);
+            assert_eq!(values::<u64>(column(0)), [1000, 2000, 3000]);
+            assert_eq!(values::<u16>(column(1)), [0, 1, 0]);
+            assert_eq!(values::<i8>(column(2)), [-70, -80, -75]);
+            assert_eq!(values::<i16>(column(3)), [2150, -420, 0]);
+            assert_eq!(values::<u8>(column(6)), [87, 86, 85]);
+
+            // fixed_size_binary(6) dictionary of the mac column
+            let dict_schema = &*(**schema.children.add(1)).dictionary;
+            assert_eq!(str_of(dict_schema.format), "w:6");
+            let dict = &*column(1).dictionary;
+            assert_eq!(dict.length, 2);
+            let bytes = std::slice::from_raw_parts(*dict.buffers.add(1) as *const u8, 12);
+            assert_eq!(
+                bytes,
+                [0xa4, 0xc1, 0x38, 0x12, 0x34, 0x56, 0xa4, 0xc1, 0x38, 0xab, 0xcd, 0xef]
+            );
+        }
+    }
+
+    #[test]
+    fn test_linky_export() {
+        let batch = LinkyTicBatch {
+            uptime_ms: vec![500],
+            mac_index: vec![0],
+            rssi: vec![-60],
+            flags: vec![1],
+            base: vec![123456],
+            iinst: vec![5],
+            ptec: vec![0],
+            papp: vec![1200],
+            macs: xiaomi_batch().macs[..1].to_vec(),
+        };
+        let (schema, array) = export(ColumnarBatch::LinkyTic(batch));
+
+        unsafe {
+            assert_eq!(schema.n_children, 8);
+            assert_eq!(array.length, 1);
+            let papp = &**array.children.add(7);
+            assert_eq!(str_of((**schema.children.add(7)).name), "papp");
+            assert_eq!(values::<u32>(papp), [1200]);
+        }
+    }
+
+    static DROPPED: AtomicUsize = AtomicUsize::new(0);
+
+    #[repr(transparent)]
+    struct Counted(#[allow(dead_code)] u8);
+
+    impl Drop for Counted {
+        fn drop(&mut self) {
+            DROPPED.fetch_add(1, Ordering::SeqCst);
+        }
+    }
+
+    #[test]
+    fn test_release() {
+        let (mut schema, mut array) = struct_column(
+            2,
+            vec![
+                primitive("a", "C", vec![Counted(1), Counted(2)]),
+                primitive("b", "C", vec![Counted(3), Counted(4)]),
+            ],
+        );
+
+        unsafe {
+            // The consumer moves the second column out, marking it released
+            let child = *array.children.add(1);
+            let moved = ptr::read(child);
+            (*child).release = None;
+            let child = *schema.children.add(1);
+            let moved_schema = ptr::read(child);
+            (*child).release = None;
+
+            (array.release.unwrap())(&mut array);
+            (schema.release.unwrap())(&mut schema);
+            assert!(array.release.is_none());
+            assert!(schema.release.is_none());
+            assert_eq!(
+                DROPPED.load(Ordering::SeqCst),
+                2,
+                "only the buffers of the kept column are freed"
+            );
+
+            assert_eq!(str_of(moved_schema.name), "b");
+            assert_eq!(moved.length, 2);
+            assert_eq!(*(*moved.buffers.add(1) as *const u8), 3);
+
+            // Released structures are not released twice when dropped
+            drop(array);
+            drop(schema);
+            drop(moved);
+            drop(moved_schema);
+        }
+
+        assert_eq!(DROPPED.load(Ordering::SeqCst), 4);
+    }
+}
@@ -0,0 +1,310 @@
+//! Latest value cache keyed by `BleAddress`.
+//!
+//! The cache is split into independently locked shards so that updates from
+//! several channels and concurrent readers rarely contend. A lookup is a single
+//! hash map access in one shard.
+
+use std::collections::HashMap;
+use std::sync::RwLock;
+use std::time::{Duration, Instant};
+
+use crate::{
+    ble::BleAddress, linky::LinkyTicRecord, stream_message::ChannelMessage, xiaomi::XiaomiRecord,
+};
+
+pub const DEFAULT_SHARDS: usize = 16;
+
+#[derive(Debug, Clone)]
+pub enum LatestValue {
+    Xiaomi(XiaomiRecord),
+    LinkyTic(LinkyTicRecord),
+}
+
+#[derive(Debug, Clone)]
+pub struct CacheEntry {
+    pub value: LatestValue,
+    pub first_seen: Instant,
+    pub last_seen: Instant,
+    pub count: u64,
+}
+
+impl CacheEntry {
+    /// Time elapsed since the last message of the device
+    pub fn age(&self) -> Duration {
+        self.last_seen.elapsed()
+    }
+}
+
+type Shard = RwLock<HashMap<BleAddress, CacheEntry>>;
+
+pub struct LatestValueCache {
+    shards: Box<[Shard]>,
+}
+
+impl Default for LatestValueCache {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl LatestValueCache {
+    pub fn new() -> LatestValueCache {
+        Self::with_shards(DEFAULT_SHARDS)
+    }
+
+    pub fn with_shards(shards: usize) -> LatestValueCache {
+        let shards = (0..shards.max(1))
+            .map(|_| RwLock::new(HashMap::new()))
+            .collect();
+
+        LatestValueCache { shards }
+    }
+
+    fn shard(&self, addr: &BleAddress) -> &Shard {
+        // The last bytes of the MAC are device specific, the first ones are
+        // shared by all devices of a manufacturer.
+        let key = (addr.mac[5] as usize) | (addr.mac[4] as usize) << 8;
+        &self.shards[key % self.shards.len()]
+    }
+
+    /// Record `message` as the latest value of its device, control and device
+    /// health messages are ignored. The records of a snapshot only fill the
+    /// devices missing from the cache: they may be older than the values
+    /// already received, e.g. from another dongle.
+    pub fn update(&self, message: &ChannelMessage) {
+        match message {
+            ChannelMessage::Snapshot(snapshot) => {
+                for record in &snapshot.records {
+                    self.insert(record, false);
+                }
+            }
+            message => self.insert(message, true),
+        }
+    }
+
+    fn insert(&self, message: &ChannelMessage, replace: bool) {
+        let (addr, value) = match message {
+            ChannelMessage::Xiaomi(record) => {
+                (record.ble_addr, LatestValue::Xiaomi(record.clone()))
+            }
+            ChannelMessage::LinkyTic(record) => {
+                (record.ble_addr, LatestValue::LinkyTic(record.clone()))
+            }
+            _ => return,
+        };
+
+        let now = Instant::now();
+        let mut shard = self.shard(&addr).write().unwrap_or_else(|e| e.into_inner());
+
+        match shard.get_mut(&addr) {
+            Some(entry) => {
+                if replace {
+                    entry.value = value;
+                    entry.last_seen = now;
+                    entry.count += 1;
+                }
+            }
+            None => {
+                shard.insert(
+                    addr,
+                    CacheEntry {
+                        value,
+                        first_seen: now,
+                        last_seen: now,
+                        count: 1,
+                    },
+                );
+            }
+        }
+    }
+
+    pub fn get(&self, addr: &BleAddress) -> Option<CacheEntry> {
+        let shard = self.shard(addr).read().unwrap_or_else(|e| e.into_inner());
+        shard.get(addr).cloned()
+    }
+
+    pub fn age(&self, addr: &BleAddress) -> Option<Duration> {
+        let shard = self.shard(addr).read().unwrap_or_else(|e| e.into_inner());
+        shard.get(addr).map(CacheEntry::age)
+    }
+
+    pub fn remove(&self, addr: &BleAddress) -> Option<CacheEntry> {
+        let mut shard = self.shard(addr).write().unwrap_or_else(|e| e.into_inner());
+        shard.remove(addr)
+    }
+
+    pub fn len(&self) -> usize {
+        self.shards
+            .iter()
+            .map(|shard| shard.read().unwrap_or_else(|e| e.into_inner()).len())
+            .sum()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.len() == 0
+    }
+
+    /// Consistent copy of the whole cache: all shards are read locked at the
+    /// same time, so no update can be observed partially.
+    pub fn snapshot(&self) -> Vec<(BleAddress, CacheEntry)> {
+        let guards: Vec<_> = self
+            .shards
+            .iter()
+            .map(|shard| shard.read().unwrap_or_else(|e| e.into_inner()))
+            .collect();
+
+        guards
+            .iter()
+            .flat_map(|shard| shard.iter().map(|(addr, entry)| (*addr, entry.clone())))
+            .collect()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::device_health::DeviceHealthHandler;
+    use crate::linky::LinkyTicHandler;
+    use crate::snapshot::Snapshot;
+    use crate::timestamp::Timestamp;
+    use crate::xiaomi::XiaomiHandler;
+    use crate::StreamChannelHandler;
+
+    fn addr(device: u16) -> BleAddress {
+        let [hi, lo] = device.to_be_bytes();
+        BleAddress::new([0xa4, 0xc1, 0x38, 0x00, hi, lo], 0)
+    }
+
+    fn xiaomi(device: u16, battery_mv: u16) -> ChannelMessage {
+        let mut data = [0u8; 24];
+        data[0..6].copy_from_slice(&addr(device).mac);
+        data[21..23].copy_from_slice(&battery_mv.to_le_bytes());
+        ChannelMessage::Xiaomi(XiaomiHandler::parse_message(&data).unwrap())
+    }
+
+    fn linky(device: u16) -> ChannelMessage {
+        let mut data = [0u8; 85];
+        data[0..6].copy_from_slice(&addr(device).mac);
+        ChannelMessage::LinkyTic(LinkyTicHandler::parse_message(&data).unwrap())
+    }
+
+    fn battery_mv(entry: &CacheEntry) -> u16 {
+        match &entry.value {
+            LatestValue::Xiaomi(record) => record.measurement.battery_mv,
+            value => panic!("unexpected value {:?}", value),
+        }
+    }
+
+    #[test]
+    fn update_and_lookup() {
+        let cache = LatestValueCache::new();
+        assert!(cache.is_empty());
+        assert!(cache.get(&addr(1)).is_none());
+
+        cache.update(&xiaomi(1, 2900));
+        cache.update(&xiaomi(1, 2950));
+        cache.update(&linky(2));
+        assert_eq!(cache.len(), 2);
+
+        let entry = cache.get(&addr(1)).unwrap();
+        assert_eq!(battery_mv(&entry), 2950);
+        assert_eq!(entry.count, 2);
+        assert!(entry.first_seen <= entry.last_seen);
+        assert!(matches!(
+            cache.get(&addr(2)).unwrap().value,
+            LatestValue::LinkyTic(_)
+        ));
+
+        // Same MAC, other address type
+        let random = BleAddress::new(addr(1).mac, 1);
+        assert!(cache.get(&random).is_none());
+
+        assert_eq!(battery_mv(&cache.remove(&addr(1)).unwrap()), 2950);
+        assert!(cache.get(&addr(1)).is_none());
+        assert_eq!(cache.len(), 1);
+    }
+
+    #[test]
+    fn ignored_messages() {
+        let cache = LatestValueCache::new();
+        let mut health = [0u8; 49];
+        health[0..6].copy_from_slice(&addr(1).mac);
+
+        cache.update(&ChannelMessage::DeviceHealth(
+            DeviceHealthHandler::parse_message(&health).unwrap(),
+        ));
+        assert!(cache.is_empty());
+    }
+
+    #[test]
+    fn snapshot_fills_missing_devices() {
+        let cache = LatestValueCache::new();
+        cache.update(&xiaomi(1, 2950));
+
+        cache.update(&ChannelMessage::Snapshot(Snapshot {
+            seq: 1,
+            timestamp: Timestamp::Uptime(0),
+            records: vec![xiaomi(1, 2500), xiaomi(2, 2600)],
+            count: 2,
+        }));
+
+        let entry = cache.get(&addr(1)).unwrap();
+        assert_eq!(battery_mv(&entry), 2950);
+        assert_eq!(entry.count, 1);
+        assert_eq!(battery_mv(&cache.get(&addr(2)).unwrap()), 2600);
+    }
+
+    #[test]
+    fn snapshot_across_shards() {
+        for shards in [1, 3, DEFAULT_SHARDS] {
+            let cache = LatestValueCache::with_shards(shards);
+
+            // Devices spread over the two MAC bytes used to pick the shard
+            let devices: Vec<u16> = (0..100).map(|i| i * 257).collect();
+            for &device in &devices {
+                cache.update(&xiaomi(device, device));
+            }
+            assert_eq!(cache.len(), devices.len());
+
+            let mut snapshot = cache.snapshot();
+            snapshot.sort_by_key(|(addr, _)| addr.mac);
+            assert_eq!(
+                snapshot.iter().map(|(addr, _)| *addr).collect::<Vec<_>>(),
+                devices
+                    .iter()
+                    .map(|&device| addr(device))
+                    .collect::<Vec<_>>()
+            );
+            assert!(snapshot
+                .iter()
+                .all(|(addr, entry)| battery_mv(entry)
+                    == u16::from_be_bytes([addr.mac[4], addr.mac[5]])));
+        }
+
+        // Zero shards are rounded up to one
+        let cache = LatestValueCache::with_shards(0);
+        cache.update(&xiaomi(1, 2950));
+        assert_eq!(cache.snapshot().len(), 1);
+    }
+
+    #[test]
+    fn last_seen_age() {
+        let cache = LatestValueCache::new();
+        assert!(cache.age(&addr(1)).is_none());
+
+        cache.update(&xiaomi(1, 2950));
+        std::thread::sleep(Duration::from_millis(50));
+
+        let age = cache.age(&addr(1)).unwrap();
+        assert!(age >= Duration::from_millis(50));
+        assert!(cache.get(&addr(1)).unwrap().age() >= age);
+
+        // A new message resets the age, not the first seen time
+        let first_seen = cache.get(&addr(1)).unwrap().first_seen;
+        cache.update(&xiaomi(1, 2900));
+        let entry = cache.get(&addr(1)).unwrap();
+        assert!(entry.age() < age);
+        assert_eq!(entry.first_seen, first_seen);
+        assert!(entry.last_seen - entry.first_seen >= Duration::from_millis(50));
+    }
+}
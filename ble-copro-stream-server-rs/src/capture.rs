@@ -0,0 +1,770 @@
+//! Capture of the received byte stream and replay (`capture` feature).
+//!
+//! [`CaptureWriter`] tees every chunk of bytes read from a connection, with
+//! its arrival time, into a capture file: garbage and partial frames included,
+//! so that resynchronisation bugs replay as they happened.
+//! [`CaptureReader`] maps the file and [`Replay`] feeds it through the same
+//! frame decoder and record parsers as a [`StreamChannel`](crate::stream_channel::StreamChannel),
+//! at the original pace or as fast as possible.
+//!
+//! File layout (little endian):
+//!  - 8 bytes: magic `BLECPCAP`
+//!  - 1 byte: version (1)
+//!  - 1 byte: frame format (1: v1, 2: v2)
+//!  - 6 bytes: reserved
+//!  - 8 bytes: capture start, µs since the Unix epoch
+//!  - chunks: LEB128 delay since the previous chunk (µs), LEB128 length, bytes
+//!
+//! A file cut short (e.g. the process was killed) is read up to its last
+//! complete chunk.
+
+use std::fs::File;
+use std::io::{BufWriter, Write};
+use std::os::fd::AsRawFd;
+use std::path::Path;
+use std::sync::Arc;
+use std::time::{Duration, SystemTime, UNIX_EPOCH};
+
+use byteorder::{ByteOrder, LittleEndian};
+use thiserror::Error;
+use tokio::time::Instant;
+
+use crate::cache::LatestValueCache;
+use crate::frame::{
+    FrameDecoder, FrameDecoderStats, FrameFormat, FRAME_V1_HEADER_SIZE, FRAME_V2_CRC_SIZE,
+    FRAME_V2_HEADER_SIZE,
+};
+use crate::raw_frame::RawFrame;
+use crate::snapshot::SnapshotAssembler;
+use crate::stream_message::ChannelMessage;
+use crate::StreamChannelError;
+
+pub const CAPTURE_MAGIC: &[u8; 8] = b"BLECPCAP";
+pub const CAPTURE_VERSION: u8 = 1;
+pub const CAPTURE_HEADER_SIZE: usize = 24;
+
+const CAPTURE_BUFFER_SIZE: usize = 64 * 1024;
+
+/// Buffered chunks are written out at least this often, a crash loses less
+const CAPTURE_FLUSH_PERIOD: Duration = Duration::from_secs(1);
+
+#[derive(Error, Debug)]
+pub enum CaptureError {
+    #[error("IO error: {0}")]
+    IoError(#[from] std::io::Error),
+    #[error("Invalid capture header")]
+    InvalidHeader,
+    #[error("Unsupported capture version {0}")]
+    UnsupportedVersion(u8),
+}
+
+fn put_varint(mut value: u64, out: &mut Vec<u8>) {
+    while value >= 0x80 {
+        out.push(value as u8 | 0x80);
+        value >>= 7;
+    }
+    out.push(value as u8);
+}
+
+/// Returns the value and its size, None if truncated or longer than 64 bits
+fn get_varint(data: &[u8]) -> Option<(u64, usize)> {
+    let mut value = 0u64;
+
+    for (i, &byte) in data.iter().enumerate().take(10) {
+        value |= ((byte & 0x7f) as u64) << (7 * i);
+        if byte & 0x80 == 0 {
+            return Some((value, i + 1));
+        }
+    }
+
+    None
+}
+
+pub struct CaptureWriter {
+    out: BufWriter<File>,
+    start: std::time::Instant,
+    last_us: u64,
+    last_flush: std::time::Instant,
+    scratch: Vec<u8>,
+    chunks: u64,
+    bytes: u64,
+}
+
+impl CaptureWriter {
+    /// Create (or truncate) the capture file at `path`, `format` is the frame
+    /// format of the captured stream
+    pub fn create(path: impl AsRef<Path>, format: FrameFormat) -> std::io::Result<CaptureWriter> {
+        let mut out = BufWriter::with_capacity(CAPTURE_BUFFER_SIZE, File::create(path)?);
+
+        let start_us = SystemTime::now()
+            .duration_since(UNIX_EPOCH)
+            .map_or(0, |elapsed| elapsed.as_micros() as u64);
+
+        let mut header = [0u8; CAPTURE_HEADER_SIZE];
+        header[0..8].copy_from_slice(CAPTURE_MAGIC);
+        header[8] = CAPTURE_VERSION;
+        header[9] = match format {
+            FrameFormat::V1 => 1,
+            FrameFormat::V2 => 2,
+        };
+        LittleEndian::write_u64(&mut header[16..24], start_us);
+        out.write_all(&header)?;
+
+        let now = std::time::Instant::now();
+
+        Ok(CaptureWriter {
+            out,
+            start: now,
+            last_us: 0,
+            last_flush: now,
+            scratch: Vec::with_capacity(20),
+            chunks: 0,
+            bytes: 0,
+        })
+    }
+
+    /// Append `data`, received now
+    pub fn write(&mut self, data: &[u8]) -> std::io::Result<()> {
+        let now_us = self.start.elapsed().as_micros() as u64;
+
+        self.scratch.clear();
+        put_varint(now_us - self.last_us, &mut self.scratch);
+        put_varint(data.len() as u64, &mut self.scratch);
+        self.out.write_all(&self.scratch)?;
+        self.out.write_all(data)?;
+
+        self.last_us = now_us;
+        self.chunks += 1;
+        self.bytes += data.len() as u64;
+
+        if self.last_flush.elapsed() >= CAPTURE_FLUSH_PERIOD {
+            self.flush()?;
+        }
+
+        Ok(())
+    }
+
+    pub fn flush(&mut self) -> std::io::Result<()> {
+        self.last_flush = std::time::Instant::now();
+        self.out.flush()
+    }
+
+    /// (chunks, bytes) captured so far
+    pub fn stats(&self) -> (u64, u64) {
+        (self.chunks, self.bytes)
+    }
+}
+
+/// Bytes received in one read
+#[derive(Debug, Clone, Copy)]
+pub struct CaptureChunk<'a> {
+    /// Arrival time since the capture start
+    pub offset: Duration,
+    pub data: &'a [u8],
+}
+
+pub struct CaptureChunks<'a> {
+    data: &'a [u8],
+    offset_us: u64,
+    truncated: bool,
+}
+
+impl CaptureChunks<'_> {
+    /// Whether the iteration stopped on an incomplete chunk
+    pub fn is_truncated(&self) -> bool {
+        self.truncated
+    }
+}
+
+impl<'a> Iterator for CaptureChunks<'a> {
+    type Item = CaptureChunk<'a>;
+
+    fn next(&mut self) -> Option<Self::Item> {
+        if self.data.is_empty() {
+            return None;
+        }
+
+        let chunk = get_varint(self.data).and_then(|(delay, n)| {
+            let (len, m) = get_varint(&self.data[n..])?;
+            let start = n + m;
+            let end = start.checked_add(usize::try_from(len).ok()?)?;
+            let bytes = self.data.get(start..end)?;
+
+            Some((delay, bytes, end))
+        });
+
+        let Some((delay, bytes, end)) = chunk else {
+            self.truncated = true;
+            self.data = &[];
+            return None;
+        };
+
+        self.offset_us += delay;
+        self.data = &self.data[end..];
+
+        Some(CaptureChunk {
+            offset: Duration::from_micros(self.offset_us),
+            data: bytes,
+        })
+    }
+}
+
+/// Read-only mapping of a capture file
+pub struct CaptureReader {
+    _file: File,
+    ptr: *const u8,
+    len: usize,
+    format: FrameFormat,
+    start_time: SystemTime,
+}
+
+// The mapping is owned by the reader and never written
+unsafe impl Send for CaptureReader {}
+unsafe impl Sync for CaptureReader {}
+
+impl CaptureReader {
+    pub fn open(path: impl AsRef<Path>) -> Result<CaptureReader, CaptureError> {
+        let file = File::open(path)?;
+        let len = file.metadata()?.len() as usize;
+
+        if len < CAPTURE_HEADER_SIZE {
+            return Err(CaptureError::InvalidHeader);
+        }
+
+        let ptr = unsafe {
+            libc::mmap(
+                std::ptr::null_mut(),
+                len,
+                libc::PROT_READ,
+                libc::MAP_PRIVATE,
+                file.as_raw_fd(),
+                0,
+            )
+        };
+
+        if ptr == libc::MAP_FAILED {
+            return Err(CaptureError::IoError(std::io::Error::last_os_error()));
+        }
+
+        // Replay reads the file once, front to back
+        unsafe {
+            libc::madvise(ptr, len, libc::MADV_SEQUENTIAL);
+        }
+
+        let mut reader = CaptureReader {
+            _file: file,
+            ptr: ptr as *const u8,
+            len,
+            format: FrameFormat::V1,
+            start_time: UNIX_EPOCH,
+        };
+
+        let header = &reader.bytes()[..CAPTURE_HEADER_SIZE];
+        if &header[0..8] != CAPTURE_MAGIC {
+            return Err(CaptureError::InvalidHeader);
+        }
+        if header[8] != CAPTURE_VERSION {
+            return Err(CaptureError::UnsupportedVersion(header[8]));
+        }
+
+        let format = match header[9] {
+            1 => FrameFormat::V1,
+            2 => FrameFormat::V2,
+            _ => return Err(CaptureError::InvalidHeader),
+        };
+        let start_time =
+            UNIX_EPOCH + Duration::from_micros(LittleEndian::read_u64(&header[16..24]));
+
+        reader.format = format;
+        reader.start_time = start_time;
+
+        Ok(reader)
+    }
+
+    fn bytes(&self) -> &[u8] {
+        unsafe { std::slice::from_raw_parts(self.ptr, self.len) }
+    }
+
+    /// Frame format of the captured stream
+    pub fn format(&self) -> FrameFormat {
+        self.format
+    }
+
+    /// Wall clock time of the capture start
+    pub fn start_time(&self) -> SystemTime {
+        self.start_time
+    }
+
+    /// Size of the file, header included
+    pub fn len(&self) -> usize {
+        self.len
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.len == CAPTURE_HEADER_SIZE
+    }
+
+    /// Captured chunks, borrowing the mapping
+    pub fn chunks(&self) -> CaptureChunks<'_> {
+        CaptureChunks {
+            data: &self.bytes()[CAPTURE_HEADER_SIZE..],
+            offset_us: 0,
+            truncated: false,
+        }
+    }
+
+    pub fn replay(&self, pacing: Pacing) -> Replay<'_> {
+        Replay {
+            chunks: self.chunks(),
+            format: self.format,
+            pacing,
+            base: None,
+            pending: &[],
+            decoder: FrameDecoder::new(),
+            cache: None,
+            snapshot: SnapshotAssembler::new(),
+            unknown_frames: 0,
+        }
+    }
+}
+
+impl Drop for CaptureReader {
+    fn drop(&mut self) {
+        unsafe {
+            libc::munmap(self.ptr as *mut libc::c_void, self.len);
+        }
+    }
+}
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum Pacing {
+    /// Chunks are delivered with the delays they were received with
+    Original,
+    /// No delay, e.g. to measure the decoding throughput
+    Fast,
+}
+
+/// Stream of the frames of a capture, with the interface of a `StreamChannel`.
+/// The end of the capture is reported as an `UnexpectedEof` IO error, like a
+/// closed connection.
+pub struct Replay<'a> {
+    chunks: CaptureChunks<'a>,
+    format: FrameFormat,
+    pacing: Pacing,
+    /// Replay start and offset of the first chunk
+    base: Option<(Instant, Duration)>,
+    /// v1 frames left in the current chunk, parsed in place
+    pending: &'a [u8],
+    /// v2 frames are reassembled across chunks
+    decoder: FrameDecoder,
+    cache: Option<Arc<LatestValueCache>>,
+    snapshot: SnapshotAssembler,
+    unknown_frames: u64,
+}
+
+impl<'a> Replay<'a> {
+    /// Resynchronisation statistics, only relevant to the v2 frame format
+    pub fn frame_stats(&self) -> FrameDecoderStats {
+        self.decoder.stats()
+    }
+
+    /// Number of frames of unknown channels skipped by `next()`
+    pub fn unknown_frames(&self) -> u64 {
+        self.unknown_frames
+    }
+
+    /// Update `cache` with every message yielded by `next()`
+    pub fn set_cache(&mut self, cache: Arc<LatestValueCache>) {
+        self.cache = Some(cache);
+    }
+
+    async fn next_chunk(&mut self) -> Result<&'a [u8], StreamChannelError> {
+        let chunk = self
+            .chunks
+            .next()
+            .ok_or_else(|| std::io::Error::from(std::io::ErrorKind::UnexpectedEof))?;
+
+        if self.pacing == Pacing::Original {
+            let (start, first) = *self.base.get_or_insert((Instant::now(), chunk.offset));
+            tokio::time::sleep_until(start + chunk.offset.saturating_sub(first)).await;
+        }
+
+        Ok(chunk.data)
+    }
+
+    /// Next frame of any channel, without decoding it
+    pub async fn next_raw(&mut self) -> Result<RawFrame<'_>, StreamChannelError> {
+        match self.format {
+            FrameFormat::V1 => {
+                // The channel captures v1 frames whole, one per chunk
+                while self.pending.is_empty() {
+                    self.pending = self.next_chunk().await?;
+                }
+
+                let pending = std::mem::take(&mut self.pending);
+                if pending.len() < FRAME_V1_HEADER_SIZE {
+                    return Err(StreamChannelError::InvalidMessageHeader);
+                }
+
+                let channel_id = LittleEndian::read_u32(&pending[0..4]);
+                let total = FRAME_V1_HEADER_SIZE + LittleEndian::read_u16(&pending[4..6]) as usize;
+                if pending.len() < total {
+                    return Err(StreamChannelError::InvalidMessageLength);
+                }
+
+                self.pending = &pending[total..];
+
+                Ok(RawFrame::new(
+                    channel_id,
+                    FrameFormat::V1,
+                    &pending[FRAME_V1_HEADER_SIZE..total],
+                    &pending[..total],
+                ))
+            }
+            FrameFormat::V2 => {
+                let (header, payload) = loop {
+                    if let Some(frame) = self.decoder.decode_range() {
+                        break frame;
+                    }
+
+                    let chunk = self.next_chunk().await?;
+                    self.decoder.extend(chunk);
+                };
+
+                let buf = self.decoder.buffer();
+                let bytes = payload.start - FRAME_V2_HEADER_SIZE..payload.end + FRAME_V2_CRC_SIZE;
+
+                Ok(RawFrame::new(
+                    header.channel_id,
+                    FrameFormat::V2,
+                    &buf[payload],
+                    &buf[bytes],
+                ))
+            }
+        }
+    }
+
+    /// Same as `StreamChannel::next()`: frames of unknown channels are skipped
+    /// and snapshot bursts are yielded as a single `ChannelMessage::Snapshot`.
+    pub async fn next(&mut self) -> Result<ChannelMessage, StreamChannelError> {
+        loop {
+            let message = match self.next_raw().await?.to_message() {
+                Err(StreamChannelError::UnhandledChannelId) => {
+                    self.unknown_frames += 1;
+                    continue;
+                }
+                message => message?,
+            };
+
+            let message = match message {
+                ChannelMessage::SnapshotPart(part) => match self.snapshot.push(part) {
+                    Some(snapshot) => ChannelMessage::Snapshot(snapshot),
+                    None => continue,
+                },
+                message => message,
+            };
+
+            if let Some(cache) = &self.cache {
+                cache.update(&message);
+            }
+
+            return Ok(message);
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::path::PathBuf;
+
+    use crate::frame::encode_v2;
+    use crate::xiaomi::XiaomiHandler;
+    use crate::StreamChannelHandler;
+
+    fn test_path(name: &str) -> PathBuf {
+        std::env::temp_dir().join(format!(
+            "ble-copro-capture-{}-{}.bin",
+            name,
+            std::process::id()
+        ))
+    }
+
+    fn chunk(delay_us: u64, data: &[u8], out: &mut Vec<u8>) {
+        put_varint(delay_us, out);
+        put_varint(data.len() as u64, out);
+        out.extend_from_slice(data);
+    }
+
+    fn chunks(data: &[u8]) -> CaptureChunks<'_> {
+        CaptureChunks {
+            data,
+            offset_us: 0,
+            truncated: false,
+        }
+    }
+
+    fn write_capture(path: &Path, format: FrameFormat, chunks: &[&[u8]]) {
+        let mut writer = CaptureWriter::create(path, format).unwrap();
+        for chunk in chunks {
+            writer.write(chunk).unwrap();
+        }
+        writer.flush().unwrap();
+    }
+
+    fn xiaomi_payload(device: u8) -> Vec<u8> {
+        let mut data = vec![0u8; 24];
+        data[0..6].copy_from_slice(&[0xa4, 0xc1, 0x38, 0x00, 0x00, device]);
+        LittleEndian::write_i16(&mut data[17..19], 2150);
+        data
+    }
+
+    fn v1_frame(channel_id: u32, payload: &[u8]) -> Vec<u8> {
+        let mut out = vec![0u8; FRAME_V1_HEADER_SIZE];
+        LittleEndian::write_u32(&mut out[0..4], channel_id);
+        LittleEndian::write_u16(&mut out[4..6], payload.len() as u16);
+        out.extend_from_slice(payload);
+        out
+    }
+
+    fn is_eof(result: Result<ChannelMessage, StreamChannelError>) -> bool {
+        matches!(result, Err(StreamChannelError::IoError(e)) if e.kind() == std::io::ErrorKind::UnexpectedEof)
+    }
+
+    #[test]
+    fn varint_round_trip() {
+        for (value, size) in [
+            (0, 1),
+            (127, 1),
+            (128, 2),
+            (16_383, 2),
+            (16_384, 3),
+            (u32::MAX as u64, 5),
+            (u64::MAX, 10),
+        ] {
+            let mut out = Vec::new();
+            put_varint(value, &mut out);
+            assert_eq!(out.len(), size, "{}", value);
+
+            // Trailing bytes are left alone
+            out.push(0x55);
+            assert_eq!(get_varint(&out), Some((value, size)));
+            assert_eq!(get_varint(&out[..size - 1]), None, "truncated {}", value);
+        }
+
+        assert_eq!(get_varint(&[]), None);
+        // More than 10 bytes
+        assert_eq!(get_varint(&[0x80; 11]), None);
+    }
+
+    #[test]
+    fn chunk_parser() {
+        let mut data = Vec::new();
+        chunk(0, b"abc", &mut data);
+        chunk(1500, b"", &mut data);
+        chunk(200_000, &[0u8; 300], &mut data);
+
+        let parsed: Vec<_> = chunks(&data)
+            .map(|c| (c.offset.as_micros(), c.data.len()))
+            .collect();
+        assert_eq!(parsed, [(0, 3), (1500, 0), (201_500, 300)]);
+
+        let mut iter = chunks(&data);
+        assert_eq!(iter.by_ref().count(), 3);
+        assert!(!iter.is_truncated());
+    }
+
+    #[test]
+    fn chunk_parser_truncated() {
+        let mut data = Vec::new();
+        chunk(10, b"first", &mut data);
+        let complete = data.len();
+        chunk(20_000, &[0x42; 200], &mut data);
+
+        // Cut in the delay, in the length, and in the bytes of the last chunk
+        for cut in [complete + 1, complete + 4, complete + 5, data.len() - 1] {
+            let mut iter = chunks(&data[..cut]);
+            assert_eq!(iter.next().unwrap().data, b"first");
+            assert!(iter.next().is_none(), "cut at {}", cut);
+            assert!(iter.is_truncated(), "cut at {}", cut);
+            assert!(iter.next().is_none());
+        }
+
+        // Length beyond the address space
+        let mut data = Vec::new();
+        put_varint(0, &mut data);
+        put_varint(u64::MAX, &mut data);
+        let mut iter = chunks(&data);
+        assert!(iter.next().is_none());
+        assert!(iter.is_truncated());
+    }
+
+    #[test]
+    fn reader_round_trip() {
+        let path = test_path("round-trip");
+        write_capture(
+            &path,
+            FrameFormat::V2,
+            &[b"\x00garbage", b"", &[0xb1; 1000]],
+        );
+
+        let reader = CaptureReader::open(&path).unwrap();
+        assert_eq!(reader.format(), FrameFormat::V2);
+        assert!(reader.start_time().elapsed().unwrap() < Duration::from_secs(60));
+        assert!(!reader.is_empty());
+
+        let mut iter = reader.chunks();
+        let parsed: Vec<_> = iter.by_ref().collect();
+        assert!(!iter.is_truncated());
+        assert_eq!(parsed.len(), 3);
+        assert_eq!(parsed[0].data, b"\x00garbage");
+        assert!(parsed[1].data.is_empty());
+        assert_eq!(parsed[2].data, [0xb1; 1000]);
+        assert!(parsed.windows(2).all(|w| w[0].offset <= w[1].offset));
+
+        drop(reader);
+        std::fs::remove_file(&path).unwrap();
+    }
+
+    #[test]
+    fn reader_truncated_file() {
+        let path = test_path("truncated");
+        write_capture(&path, FrameFormat::V1, &[b"one", b"two", b"three"]);
+
+        // Killed while writing the last chunk
+        let len = std::fs::metadata(&path).unwrap().len();
+        File::options()
+            .write(true)
+            .open(&path)
+            .unwrap()
+            .set_len(len - 2)
+            .unwrap();
+
+        let reader = CaptureReader::open(&path).unwrap();
+        let mut iter = reader.chunks();
+        let parsed: Vec<_> = iter.by_ref().map(|c| c.data).collect();
+        assert_eq!(parsed, [b"one", b"two"]);
+        assert!(iter.is_truncated());
+
+        drop(reader);
+        std::fs::remove_file(&path).unwrap();
+    }
+
+    #[tokio::test]
+    async fn reader_empty_body() {
+        let path = test_path("empty");
+        write_capture(&path, FrameFormat::V1, &[]);
+
+        let reader = CaptureReader::open(&path).unwrap();
+        assert_eq!(reader.len(), CAPTURE_HEADER_SIZE);
+        assert!(reader.is_empty());
+
+        let mut iter = reader.chunks();
+        assert!(iter.next().is_none());
+        assert!(!iter.is_truncated());
+        assert!(is_eof(reader.replay(Pacing::Original).next().await));
+
+        drop(reader);
+        std::fs::remove_file(&path).unwrap();
+    }
+
+    #[test]
+    fn reader_invalid_header() {
+        let path = test_path("header");
+        let mut header = [0u8; CAPTURE_HEADER_SIZE];
+        header[0..8].copy_from_slice(CAPTURE_MAGIC);
+        header[8] = CAPTURE_VERSION;
+        header[9] = 1;
+
+        let open = |bytes: &[u8]| {
+            std::fs::write(&path, bytes).unwrap();
+            CaptureReader::open(&path).map(|_| ())
+        };
+
+        assert!(open(&header).is_ok());
+        // Empty file, and cut in the header
+        assert!(matches!(open(&[]), Err(CaptureError::InvalidHeader)));
+        assert!(matches!(
+            open(&header[..CAPTURE_HEADER_SIZE - 1]),
+            Err(CaptureError::InvalidHeader)
+        ));
+
+        let mut bad = header;
+        bad[0] = b'X';
+        assert!(matches!(open(&bad), Err(CaptureError::InvalidHeader)));
+
+        let mut bad = header;
+        bad[8] = 2;
+        assert!(matches!(
+            open(&bad),
+            Err(CaptureError::UnsupportedVersion(2))
+        ));
+
+        let mut bad = header;
+        bad[9] = 3;
+        assert!(matches!(open(&bad), Err(CaptureError::InvalidHeader)));
+
+        assert!(matches!(
+            CaptureReader::open(test_path("missing")),
+            Err(CaptureError::IoError(_))
+        ));
+
+        std::fs::remove_file(&path).unwrap();
+    }
+
+    #[tokio::test]
+    async fn replay_v1() {
+        let path = test_path("replay-v1");
+        let xiaomi = v1_frame(XiaomiHandler::CHANNEL_ID, &xiaomi_payload(1));
+        let unknown = v1_frame(0x12345678, b"skipped");
+        let frames = [xiaomi.clone(), unknown, xiaomi].concat();
+        write_capture(&path, FrameFormat::V1, &[&frames]);
+
+        let reader = CaptureReader::open(&path).unwrap();
+        let mut replay = reader.replay(Pacing::Fast);
+
+        // Frames sharing a chunk are parsed in place
+        for _ in 0..2 {
+            match replay.next().await {
+                Ok(ChannelMessage::Xiaomi(record)) => {
+                    assert_eq!(record.ble_addr.mac[5], 1);
+                    assert_eq!(record.measurement.temperature, 21.5);
+                }
+                other => panic!("unexpected message: {:?}", other),
+            }
+        }
+        assert!(is_eof(replay.next().await));
+        assert_eq!(replay.unknown_frames(), 1);
+
+        drop(reader);
+        std::fs::remove_file(&path).unwrap();
+    }
+
+    #[tokio::test]
+    async fn replay_v2_across_chunks() {
+        let path = test_path("replay-v2");
+        let mut stream = b"noise".to_vec();
+        encode_v2(XiaomiHandler::CHANNEL_ID, &xiaomi_payload(2), &mut stream);
+        encode_v2(XiaomiHandler::CHANNEL_ID, &xiaomi_payload(3), &mut stream);
+
+        // Frames split at arbitrary points
+        let (a, rest) = stream.split_at(11);
+        let (b, c) = rest.split_at(30);
+        write_capture(&path, FrameFormat::V2, &[a, b, c]);
+
+        let reader = CaptureReader::open(&path).unwrap();
+        let mut replay = reader.replay(Pacing::Original);
+
+        for device in [2, 3] {
+            match replay.next().await {
+                Ok(ChannelMessage::Xiaomi(record)) => assert_eq!(record.ble_addr.mac[5], device),
+                other => panic!("unexpected message: {:?}", other),
+            }
+        }
+        assert!(is_eof(replay.next().await));
+        assert_eq!(replay.frame_stats().skipped_bytes, 5);
+
+        drop(reader);
+        std::fs::remove_file(&path).unwrap();
+    }
+}
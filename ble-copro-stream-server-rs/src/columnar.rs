@@ -0,0 +1,477 @@
+//! Struct-of-arrays batches of sensor records, for analytics consumers.
+//!
+//! Records are decoded straight from the frame payloads into integer columns,
+//! in the firmware units (centi-degrees, centi-percents, ...). Unit conversions
+//! are done over whole columns, see [`centi_to_f32`], instead of per record as
+//! `parse_message()` does.
+//!
+//! The MAC column is dictionary encoded: `mac_index` points into the `macs` of
+//! the batch, which lists the addresses of its records only. With the
+//! `arrow` feature, batches can be exported through the Arrow C data interface,
+//! see [`crate::arrow_ffi`].
+
+use std::collections::HashMap;
+use std::time::{Duration, Instant};
+
+use byteorder::{ByteOrder, LittleEndian};
+use thiserror::Error;
+
+use crate::ble::BleAddress;
+use crate::linky::LinkyTicHandler;
+use crate::raw_frame::RawFrame;
+use crate::xiaomi::XiaomiHandler;
+
+const XIAOMI_RECORD_SIZE: usize = 24;
+const LINKY_TIC_RECORD_SIZE: usize = 85;
+
+#[derive(Error, Debug, PartialEq, Eq)]
+pub enum ColumnarError {
+    #[error("Invalid message Length")]
+    InvalidMessageLength,
+    /// The dictionary of the batch is full (65536 devices)
+    #[error("Too many devices in the batch")]
+    TooManyDevices,
+}
+
+/// Convert a column of centi-units (e.g. centi-degrees) to floats, the loop is
+/// simple enough for the compiler to vectorise it.
+pub fn centi_to_f32<T: Copy + Into<f32>>(src: &[T], dst: &mut Vec<f32>) {
+    dst.clear();
+    dst.extend(src.iter().map(|&v| v.into() / 100.0));
+}
+
+/// Dictionary of the addresses of a batch
+#[derive(Debug, Default, Clone)]
+struct MacDictionary {
+    macs: Vec<BleAddress>,
+    index: HashMap<BleAddress, u16>,
+}
+
+impl MacDictionary {
+    /// Index of `addr`, None if the dictionary is full
+    fn lookup(&mut self, addr: BleAddress) -> Option<u16> {
+        if let Some(&i) = self.index.get(&addr) {
+            return Some(i);
+        }
+
+        let i = u16::try_from(self.macs.len()).ok()?;
+        self.macs.push(addr);
+        self.index.insert(addr, i);
+        Some(i)
+    }
+
+    fn take(&mut self) -> Vec<BleAddress> {
+        self.index.clear();
+        std::mem::take(&mut self.macs)
+    }
+}
+
+fn payload_addr(data: &[u8]) -> BleAddress {
+    let mut mac = [0; 6];
+    mac.copy_from_slice(&data[0..6]);
+    BleAddress::new(mac, data[6])
+}
+
+#[derive(Debug, Default, Clone)]
+pub struct XiaomiBatch {
+    /// Device uptime (ms) of the measurement
+    pub uptime_ms: Vec<u64>,
+    pub mac_index: Vec<u16>,
+    pub rssi: Vec<i8>,
+    /// Centi-degrees Celsius
+    pub temperature: Vec<i16>,
+    /// Centi-percents
+    pub humidity: Vec<u16>,
+    pub battery_mv: Vec<u16>,
+    pub battery_percent: Vec<u8>,
+    /// `mac_index` dictionary
+    pub macs: Vec<BleAddress>,
+}
+
+impl XiaomiBatch {
+    pub fn len(&self) -> usize {
+        self.uptime_ms.len()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.uptime_ms.is_empty()
+    }
+
+    fn push(&mut self, data: &[u8], mac_index: u16) {
+        self.mac_index.push(mac_index);
+        self.rssi.push(data[7] as i8);
+        self.uptime_ms
+            .push(LittleEndian::read_i64(&data[9..17]) as u64);
+        self.temperature.push(LittleEndian::read_i16(&data[17..19]));
+        self.humidity.push(LittleEndian::read_u16(&data[19..21]));
+        self.battery_mv.push(LittleEndian::read_u16(&data[21..23]));
+        self.battery_percent.push(data[23]);
+    }
+
+    /// Degrees Celsius
+    pub fn temperature_celsius(&self) -> Vec<f32> {
+        let mut out = Vec::with_capacity(self.len());
+        centi_to_f32(&self.temperature, &mut out);
+        out
+    }
+
+    /// Percents
+    pub fn humidity_percent(&self) -> Vec<f32> {
+        let mut out = Vec::with_capacity(self.len());
+        centi_to_f32(&self.humidity, &mut out);
+        out
+    }
+}
+
+#[derive(Debug, Default, Clone)]
+pub struct LinkyTicBatch {
+    /// Device uptime (ms) of the measurement
+    pub uptime_ms: Vec<u64>,
+    pub mac_index: Vec<u16>,
+    pub rssi: Vec<i8>,
+    pub flags: Vec<u32>,
+    /// Index (Wh)
+    pub base: Vec<u32>,
+    /// Instantaneous current (A)
+    pub iinst: Vec<u16>,
+    pub ptec: Vec<u16>,
+    /// Apparent power (VA)
+    pub papp: Vec<u32>,
+    /// `mac_index` dictionary
+    pub macs: Vec<BleAddress>,
+}
+
+impl LinkyTicBatch {
+    pub fn len(&self) -> usize {
+        self.uptime_ms.len()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.uptime_ms.is_empty()
+    }
+
+    fn push(&mut self, data: &[u8], mac_index: u16) {
+        self.mac_index.push(mac_index);
+        self.rssi.push(data[7] as i8);
+        self.flags.push(LittleEndian::read_u32(&data[9..13]));
+        self.uptime_ms
+            .push(LittleEndian::read_i64(&data[13..21]) as u64);
+        self.base.push(LittleEndian::read_u32(&data[22..26]));
+        self.iinst.push(LittleEndian::read_u16(&data[26..28]));
+        self.ptec.push(LittleEndian::read_u16(&data[28..30]));
+        self.papp.push(LittleEndian::read_u32(&data[30..34]));
+    }
+}
+
+#[derive(Debug, Clone)]
+pub enum ColumnarBatch {
+    Xiaomi(XiaomiBatch),
+    LinkyTic(LinkyTicBatch),
+}
+
+/// Batch being filled, its dictionary and the time its first row was pushed
+struct Pending<B> {
+    batch: B,
+    macs: MacDictionary,
+    since: Option<Instant>,
+}
+
+impl<B: Default> Pending<B> {
+    fn new() -> Pending<B> {
+        Pending {
+            batch: B::default(),
+            macs: MacDictionary::default(),
+            since: None,
+        }
+    }
+
+    fn mac_index(&mut self, data: &[u8]) -> Result<u16, ColumnarError> {
+        self.macs
+            .lookup(payload_addr(data))
+            .ok_or(ColumnarError::TooManyDevices)
+    }
+
+    fn take(&mut self) -> (B, Vec<BleAddress>) {
+        self.since = None;
+        (std::mem::take(&mut self.batch), self.macs.take())
+    }
+}
+
+/// Assemble records into columnar batches, flushed once they reach `max_rows`
+/// rows or their first row is older than `max_age`. Xiaomi and Linky TIC
+/// records are batched separately.
+pub struct ColumnarBatcher {
+    max_rows: usize,
+    max_age: Duration,
+    xiaomi: Pending<XiaomiBatch>,
+    linky: Pending<LinkyTicBatch>,
+}
+
+impl ColumnarBatcher {
+    pub fn new(max_rows: usize, max_age: Duration) -> ColumnarBatcher {
+        ColumnarBatcher {
+            max_rows: max_rows.max(1),
+            max_age,
+            xiaomi: Pending::new(),
+            linky: Pending::new(),
+        }
+    }
+
+    /// Append the record carried by `frame`, returns the batch it completed if
+    /// any. Frames of other channels are ignored.
+    ///
+    /// A batch holds up to 65536 distinct devices, the record of a new device
+    /// is rejected with [`ColumnarError::TooManyDevices`] beyond, flush the
+    /// batches to start new dictionaries.
+    pub fn push(&mut self, frame: &RawFrame) -> Result<Option<ColumnarBatch>, ColumnarError> {
+        let data = frame.payload();
+
+        if frame.is::<XiaomiHandler>() {
+            if data.len() < XIAOMI_RECORD_SIZE {
+                return Err(ColumnarError::InvalidMessageLength);
+            }
+
+            let mac_index = self.xiaomi.mac_index(data)?;
+            self.xiaomi.since.get_or_insert_with(Instant::now);
+            self.xiaomi.batch.push(data, mac_index);
+
+            if self.xiaomi.batch.len() >= self.max_rows {
+                return Ok(Some(self.take_xiaomi()));
+            }
+        } else if frame.is::<LinkyTicHandler>() {
+            if data.len() < LINKY_TIC_RECORD_SIZE {
+                return Err(ColumnarError::InvalidMessageLength);
+            }
+
+            let mac_index = self.linky.mac_index(data)?;
+            self.linky.since.get_or_insert_with(Instant::now);
+            self.linky.batch.push(data, mac_index);
+
+            if self.linky.batch.len() >= self.max_rows {
+                return Ok(Some(self.take_linky()));
+            }
+        }
+
+        Ok(None)
+    }
+
+    fn take_xiaomi(&mut self) -> ColumnarBatch {
+        let (mut batch, macs) = self.xiaomi.take();
+        batch.macs = macs;
+        ColumnarBatch::Xiaomi(batch)
+    }
+
+    fn take_linky(&mut self) -> ColumnarBatch {
+        let (mut batch, macs) = self.linky.take();
+        batch.macs = macs;
+        ColumnarBatch::LinkyTic(batch)
+    }
+
+    /// Time at which the oldest pending batch must be flushed, to be used as
+    /// the receive timeout
+    pub fn deadline(&self) -> Option<Instant> {
+        match (self.xiaomi.since, self.linky.since) {
+            (Some(a), Some(b)) => Some(a.min(b) + self.max_age),
+            (Some(t), None) | (None, Some(t)) => Some(t + self.max_age),
+            (None, None) => None,
+        }
+    }
+
+    /// Flush the batches older than `max_age` at `now`
+    pub fn flush_expired(&mut self, now: Instant) -> Vec<ColumnarBatch> {
+        let mut batches = Vec::new();
+
+        if self.xiaomi.since.is_some_and(|t| now >= t + self.max_age) {
+            batches.push(self.take_xiaomi());
+        }
+        if self.linky.since.is_some_and(|t| now >= t + self.max_age) {
+            batches.push(self.take_linky());
+        }
+
+        batches
+    }
+
+    /// Flush every non empty batch, e.g. on disconnection
+    pub fn flush(&mut self) -> Vec<ColumnarBatch> {
+        let mut batches = Vec::new();
+
+        if !self.xiaomi.batch.is_empty() {
+            batches.push(self.take_xiaomi());
+        }
+        if !self.linky.batch.is_empty() {
+            batches.push(self.take_linky());
+        }
+
+        batches
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::frame::FrameFormat;
+    use crate::StreamChannelHandler;
+
+    fn mac(device: u32) -> [u8; 6] {
+        let b = device.to_be_bytes();
+        [0xa4, 0xc1, b[0], b[1], b[2], b[3]]
+    }
+
+    fn xiaomi_record(device: u32, uptime_ms: i64, temperature: i16) -> Vec<u8> {
+        let mut data = vec![0; XIAOMI_RECORD_SIZE];
+        data[0..6].copy_from_slice(&mac(device));
+        data[7] = -70i8 as u8;
+        LittleEndian::write_i64(&mut data[9..17], uptime_ms);
+        LittleEndian::write_i16(&mut data[17..19], temperature);
+        LittleEndian::write_u16(&mut data[19..21], 4550);
+        LittleEndian::write_u16(&mut data[21..23], 2950);
+        data[23] = 87;
+        data
+    }
+
+    fn linky_record(device: u32, uptime_ms: i64, papp: u32) -> Vec<u8> {
+        let mut data = vec![0; LINKY_TIC_RECORD_SIZE];
+        data[0..6].copy_from_slice(&mac(device));
+        LittleEndian::write_i64(&mut data[13..21], uptime_ms);
+        LittleEndian::write_u32(&mut data[30..34], papp);
+        data
+    }
+
+    fn push<H: StreamChannelHandler>(
+        batcher: &mut ColumnarBatcher,
+        data: &[u8],
+    ) -> Result<Option<ColumnarBatch>, ColumnarError> {
+        batcher.push(&RawFrame::new(H::CHANNEL_ID, FrameFormat::V1, data, data))
+    }
+
+    fn xiaomi(batch: Option<ColumnarBatch>) -> XiaomiBatch {
+        match batch {
+            Some(ColumnarBatch::Xiaomi(batch)) => batch,
+            other => panic!("expected a Xiaomi batch, got {:?}", other),
+        }
+    }
+
+    #[test]
+    fn test_batch_columns() {
+        let mut batcher = ColumnarBatcher::new(3, Duration::from_secs(60));
+
+        assert!(
+            push::<XiaomiHandler>(&mut batcher, &xiaomi_record(1, 1000, 2150))
+                .unwrap()
+                .is_none()
+        );
+        assert!(
+            push::<XiaomiHandler>(&mut batcher, &xiaomi_record(2, 2000, -420))
+                .unwrap()
+                .is_none()
+        );
+        let batch =
+            xiaomi(push::<XiaomiHandler>(&mut batcher, &xiaomi_record(1, 3000, 0)).unwrap());
+
+        assert_eq!(batch.len(), 3);
+        assert_eq!(batch.uptime_ms, [1000, 2000, 3000]);
+        assert_eq!(batch.mac_index, [0, 1, 0]);
+        assert_eq!(batch.macs.len(), 2);
+        assert_eq!(batch.macs[0].mac, mac(1));
+        assert_eq!(batch.macs[1].mac, mac(2));
+        assert_eq!(batch.rssi, [-70; 3]);
+        assert_eq!(batch.temperature, [2150, -420, 0]);
+        assert_eq!(batch.temperature_celsius(), [21.5, -4.2, 0.0]);
+        assert_eq!(batch.humidity_percent(), [45.5; 3]);
+        assert_eq!(batch.battery_mv, [2950; 3]);
+        assert_eq!(batch.battery_percent, [87; 3]);
+        assert!(batcher.deadline().is_none());
+    }
+
+    #[test]
+    fn test_dictionary_per_batch() {
+        let mut batcher = ColumnarBatcher::new(2, Duration::from_secs(60));
+
+        push::<XiaomiHandler>(&mut batcher, &xiaomi_record(1, 0, 0)).unwrap();
+        let first = xiaomi(push::<XiaomiHandler>(&mut batcher, &xiaomi_record(2, 0, 0)).unwrap());
+
+        push::<XiaomiHandler>(&mut batcher, &xiaomi_record(3, 0, 0)).unwrap();
+        let second = xiaomi(push::<XiaomiHandler>(&mut batcher, &xiaomi_record(2, 0, 0)).unwrap());
+
+        // Only the devices of the batch, indexed from 0
+        assert_eq!(
+            first.macs.iter().map(|a| a.mac).collect::<Vec<_>>(),
+            [mac(1), mac(2)]
+        );
+        assert_eq!(
+            second.macs.iter().map(|a| a.mac).collect::<Vec<_>>(),
+            [mac(3), mac(2)]
+        );
+        assert_eq!(second.mac_index, [0, 1]);
+    }
+
+    #[test]
+    fn test_dictionary_overflow() {
+        let devices = u16::MAX as u32 + 1;
+        let mut batcher = ColumnarBatcher::new(devices as usize + 2, Duration::from_secs(60));
+
+        for device in 0..devices {
+            push::<XiaomiHandler>(&mut batcher, &xiaomi_record(device, 0, 0)).unwrap();
+        }
+
+        // Known devices still fit, new ones are rejected without being pushed
+        assert_eq!(
+            push::<XiaomiHandler>(&mut batcher, &xiaomi_record(devices, 0, 0)).unwrap_err(),
+            ColumnarError::TooManyDevices
+        );
+        push::<XiaomiHandler>(&mut batcher, &xiaomi_record(devices - 1, 0, 0)).unwrap();
+
+        let batch = match batcher.flush().pop() {
+            Some(ColumnarBatch::Xiaomi(batch)) => batch,
+            other => panic!("expected a Xiaomi batch, got {:?}", other),
+        };
+        assert_eq!(batch.len(), devices as usize + 1);
+        assert_eq!(batch.macs.len(), devices as usize);
+        assert_eq!(batch.mac_index.last(), Some(&u16::MAX));
+
+        // Flushing starts a new dictionary
+        push::<XiaomiHandler>(&mut batcher, &xiaomi_record(devices, 0, 0)).unwrap();
+        assert_eq!(xiaomi(batcher.flush().pop()).mac_index, [0]);
+    }
+
+    #[test]
+    fn test_invalid_length() {
+        let mut batcher = ColumnarBatcher::new(8, Duration::from_secs(60));
+        let data = xiaomi_record(1, 0, 0);
+
+        assert_eq!(
+            push::<XiaomiHandler>(&mut batcher, &data[..XIAOMI_RECORD_SIZE - 1]).unwrap_err(),
+            ColumnarError::InvalidMessageLength
+        );
+        assert_eq!(
+            push::<LinkyTicHandler>(&mut batcher, &data).unwrap_err(),
+            ColumnarError::InvalidMessageLength
+        );
+        assert!(batcher.flush().is_empty());
+    }
+
+    #[test]
+    fn test_flush_expired() {
+        let max_age = Duration::from_secs(10);
+        let mut batcher = ColumnarBatcher::new(8, max_age);
+
+        push::<XiaomiHandler>(&mut batcher, &xiaomi_record(1, 0, 0)).unwrap();
+        push::<LinkyTicHandler>(&mut batcher, &linky_record(2, 500, 1200)).unwrap();
+
+        let deadline = batcher.deadline().unwrap();
+        assert!(batcher.flush_expired(deadline - max_age).is_empty());
+
+        let batches = batcher.flush_expired(deadline + max_age);
+        assert_eq!(batches.len(), 2);
+        match &batches[1] {
+            ColumnarBatch::LinkyTic(batch) => {
+                assert_eq!(batch.uptime_ms, [500]);
+                assert_eq!(batch.papp, [1200]);
+                assert_eq!(batch.macs[0].mac, mac(2));
+            }
+            other => panic!("expected a Linky TIC batch, got {:?}", other),
+        }
+        assert!(batcher.deadline().is_none());
+        assert!(batcher.flush().is_empty());
+    }
+}
@@ -0,0 +1,217 @@
+//! Client of the firmware configuration server (`CONFIG_COPRO_CONFIG_SERVER`).
+//!
+//! Unlike the stream channel, the device is the server: the host connects to
+//! `DEFAULT_DEVICE_IP:DEFAULT_CONFIG_PORT` and sends fixed size requests, each
+//! one answered by a fixed size response. See `include/config_server.h`.
+
+use std::net::SocketAddrV4;
+
+use byteorder::{ByteOrder, LittleEndian};
+use thiserror::Error;
+use tokio::io::{AsyncReadExt, AsyncWriteExt};
+use tokio::net::TcpStream;
+
+use crate::control_channel::ControlStatus;
+
+pub const DEFAULT_DEVICE_IP: &str = "192.0.3.2";
+pub const DEFAULT_CONFIG_PORT: u16 = 4001;
+
+const REQUEST_SIZE: usize = 11;
+const RESPONSE_SIZE: usize = 12;
+
+const OP_GET: u8 = 0x01;
+const OP_SET: u8 = 0x02;
+const OP_SET_VOLATILE: u8 = 0x03;
+const OP_RESET: u8 = 0x04;
+
+/// Configuration keys, see `enum cfg_key` in the firmware
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum ConfigKey {
+    /// BLE scan interval, in 0.625 ms units
+    ScanInterval,
+    /// BLE scan window, in 0.625 ms units, cannot exceed the interval
+    ScanWindow,
+    /// Runtime log level of all firmware modules, 0 (none) to 4 (debug)
+    LogLevel,
+    /// 0 drops the messages of the channel, 1 sends them
+    ChannelEnable(u32),
+    /// Scheduling class of the channel, 0 is the highest priority
+    ChannelPriority(u32),
+    /// Deficit round-robin weight of the channel (1-255)
+    ChannelWeight(u32),
+    /// Xiaomi temperature deadband, in 1e-2 °C (0 reports every measurement)
+    DeadbandXiaomiTemperature,
+    /// Xiaomi humidity deadband, in 1e-2 %
+    DeadbandXiaomiHumidity,
+    /// Xiaomi battery deadband, in mV
+    DeadbandXiaomiBattery,
+    /// Linky apparent power deadband, in VA
+    DeadbandLinkyPapp,
+    /// Linky index deadband, in Wh
+    DeadbandLinkyBase,
+    /// Interval (ms) after which an unchanged measurement is reported anyway,
+    /// 0 disables it
+    DeadbandHeartbeat,
+    /// Measurements suppressed by the deadband since boot, read only
+    DeadbandSuppressed,
+}
+
+impl ConfigKey {
+    /// (key, argument) as sent on the wire
+    fn encode(&self) -> (u16, u32) {
+        match *self {
+            ConfigKey::ScanInterval => (0x0001, 0),
+            ConfigKey::ScanWindow => (0x0002, 0),
+            ConfigKey::LogLevel => (0x0010, 0),
+            ConfigKey::ChannelEnable(channel_id) => (0x0100, channel_id),
+            ConfigKey::ChannelPriority(channel_id) => (0x0101, channel_id),
+            ConfigKey::ChannelWeight(channel_id) => (0x0102, channel_id),
+            ConfigKey::DeadbandXiaomiTemperature => (0x0200, 0),
+            ConfigKey::DeadbandXiaomiHumidity => (0x0201, 0),
+            ConfigKey::DeadbandXiaomiBattery => (0x0202, 0),
+            ConfigKey::DeadbandLinkyPapp => (0x0203, 0),
+            ConfigKey::DeadbandLinkyBase => (0x0204, 0),
+            ConfigKey::DeadbandHeartbeat => (0x0205, 0),
+            ConfigKey::DeadbandSuppressed => (0x0210, 0),
+        }
+    }
+}
+
+#[derive(Error, Debug)]
+pub enum ConfigError {
+    #[error("IO error: {0}")]
+    IoError(#[from] std::io::Error),
+    #[error("Invalid IP address")]
+    InvalidIpAddress,
+    #[error("Device error: {0}")]
+    DeviceError(ControlStatus),
+    #[error("Response does not match the request")]
+    UnexpectedResponse,
+}
+
+pub struct ConfigClient {
+    stream: TcpStream,
+}
+
+impl ConfigClient {
+    pub async fn connect(ip: &str, port: u16) -> Result<ConfigClient, ConfigError> {
+        let ip = ip.parse().map_err(|_| ConfigError::InvalidIpAddress)?;
+        let stream = TcpStream::connect(SocketAddrV4::new(ip, port)).await?;
+
+        Ok(ConfigClient { stream })
+    }
+
+    async fn request(&mut self, op: u8, key: ConfigKey, value: u32) -> Result<u32, ConfigError> {
+        let (key, arg) = key.encode();
+        let mut req = [0u8; REQUEST_SIZE];
+        let mut rsp = [0u8; RESPONSE_SIZE];
+
+        req[0] = op;
+        LittleEndian::write_u16(&mut req[1..3], key);
+        LittleEndian::write_u32(&mut req[3..7], arg);
+        LittleEndian::write_u32(&mut req[7..11], value);
+
+        self.stream.write_all(&req).await?;
+        self.stream.read_exact(&mut rsp).await?;
+
+        // The response echoes the operation, key and argument
+        if rsp[..7] != req[..7] {
+            return Err(ConfigError::UnexpectedResponse);
+        }
+
+        match ControlStatus::from_u8(rsp[7]) {
+            ControlStatus::Ok => Ok(LittleEndian::read_u32(&rsp[8..12])),
+            status => Err(ConfigError::DeviceError(status)),
+        }
+    }
+
+    pub async fn get(&mut self, key: ConfigKey) -> Result<u32, ConfigError> {
+        self.request(OP_GET, key, 0).await
+    }
+
+    /// Apply and persist `value`, returns the value in effect
+    pub async fn set(&mut self, key: ConfigKey, value: u32) -> Result<u32, ConfigError> {
+        self.request(OP_SET, key, value).await
+    }
+
+    /// Apply `value` until the next reboot, returns the value in effect
+    pub async fn set_volatile(&mut self, key: ConfigKey, value: u32) -> Result<u32, ConfigError> {
+        self.request(OP_SET_VOLATILE, key, value).await
+    }
+
+    /// Forget the persisted value and go back to the firmware default. Channel
+    /// keys reset the enable, priority and weight of the channel at once.
+    pub async fn reset(&mut self, key: ConfigKey) -> Result<u32, ConfigError> {
+        self.request(OP_RESET, key, 0).await
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use tokio::net::TcpListener;
+
+    /// Device stand-in answering every request with `status` and the request
+    /// value, or with a mismatching key if `echo` is false
+    async fn device(status: u8, echo: bool) -> u16 {
+        let listener = TcpListener::bind("127.0.0.1:0").await.unwrap();
+        let port = listener.local_addr().unwrap().port();
+
+        tokio::spawn(async move {
+            let (mut stream, _) = listener.accept().await.unwrap();
+            let mut req = [0u8; REQUEST_SIZE];
+
+            while stream.read_exact(&mut req).await.is_ok() {
+                let mut rsp = [0u8; RESPONSE_SIZE];
+                rsp[..7].copy_from_slice(&req[..7]);
+                if !echo {
+                    rsp[1] ^= 0xff;
+                }
+                rsp[7] = status;
+                rsp[8..12].copy_from_slice(&req[7..11]);
+                stream.write_all(&rsp).await.unwrap();
+            }
+        });
+
+        port
+    }
+
+    #[tokio::test]
+    async fn request_ok() {
+        let port = device(0x00, true).await;
+        let mut client = ConfigClient::connect("127.0.0.1", port).await.unwrap();
+
+        let value = client
+            .set(ConfigKey::ChannelWeight(0xFA30FA42), 4)
+            .await
+            .unwrap();
+        assert_eq!(value, 4);
+        let value = client
+            .set_volatile(ConfigKey::ScanWindow, 48)
+            .await
+            .unwrap();
+        assert_eq!(value, 48);
+    }
+
+    #[tokio::test]
+    async fn request_status() {
+        let port = device(0x02, true).await;
+        let mut client = ConfigClient::connect("127.0.0.1", port).await.unwrap();
+
+        match client.get(ConfigKey::LogLevel).await {
+            Err(ConfigError::DeviceError(ControlStatus::Unsupported)) => {}
+            other => panic!("unexpected result: {:?}", other),
+        }
+    }
+
+    #[tokio::test]
+    async fn unexpected_response() {
+        let port = device(0x00, false).await;
+        let mut client = ConfigClient::connect("127.0.0.1", port).await.unwrap();
+
+        assert!(matches!(
+            client.get(ConfigKey::ScanInterval).await,
+            Err(ConfigError::UnexpectedResponse)
+        ));
+    }
+}
@@ -1,14 +1,165 @@
-use crate::{stream_channel::StreamChannelError, StreamChannelHandler};
+use crate::{ble::BleAddress, stream_channel::StreamChannelError, StreamChannelHandler};
+
+/// Control message types, see `enum stream_control_type` in the firmware
+pub const CONTROL_ACK: u8 = 0x01;
+pub const CONTROL_XIAOMI_KEY_SET: u8 = 0x10;
+pub const CONTROL_XIAOMI_KEY_REMOVE: u8 = 0x11;
+pub const CONTROL_LATENCY_EXPORT: u8 = 0x20;
+pub const CONTROL_SNAPSHOT: u8 = 0x30;
+
+pub const XIAOMI_BIND_KEY_SIZE: usize = 16;
+
+/// Status of a request, see `enum stream_control_status` in the firmware. Also
+/// used by the configuration server responses.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum ControlStatus {
+    Ok,
+    /// Malformed request or value out of range
+    Invalid,
+    /// Request or key not supported by the firmware build
+    Unsupported,
+    /// Unknown device, channel or key
+    NotFound,
+    /// Table or queue full
+    NoSpace,
+    /// Retry later
+    Busy,
+    /// Storage or transport failure
+    Io,
+    /// Any other error, with its raw status
+    Error(u8),
+}
+
+impl ControlStatus {
+    pub fn from_u8(status: u8) -> ControlStatus {
+        match status {
+            0x00 => ControlStatus::Ok,
+            0x01 => ControlStatus::Invalid,
+            0x02 => ControlStatus::Unsupported,
+            0x03 => ControlStatus::NotFound,
+            0x04 => ControlStatus::NoSpace,
+            0x05 => ControlStatus::Busy,
+            0x06 => ControlStatus::Io,
+            status => ControlStatus::Error(status),
+        }
+    }
+
+    pub fn is_ok(&self) -> bool {
+        *self == ControlStatus::Ok
+    }
+}
+
+impl std::fmt::Display for ControlStatus {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        match self {
+            ControlStatus::Ok => write!(f, "ok"),
+            ControlStatus::Invalid => write!(f, "invalid request"),
+            ControlStatus::Unsupported => write!(f, "not supported"),
+            ControlStatus::NotFound => write!(f, "not found"),
+            ControlStatus::NoSpace => write!(f, "no space"),
+            ControlStatus::Busy => write!(f, "busy"),
+            ControlStatus::Io => write!(f, "I/O error"),
+            ControlStatus::Error(status) => write!(f, "error 0x{:02x}", status),
+        }
+    }
+}
 
 pub struct ControlHandler;
 
-#[derive(Debug, Default)]
-pub struct ControlMessage;
+/// Control channel message, in both directions: `type (1) | len (1) | data`.
+/// Messages sent by the device are zero padded to a fixed size.
+#[derive(Debug, Default, Clone)]
+pub struct ControlMessage {
+    pub msg_type: u8,
+    pub data: Vec<u8>,
+}
+
+impl ControlMessage {
+    pub fn new(msg_type: u8, data: &[u8]) -> ControlMessage {
+        ControlMessage {
+            msg_type,
+            data: data.to_vec(),
+        }
+    }
+
+    /// Provision the bind key of an encrypted MiBeacon/BTHome device
+    pub fn xiaomi_key_set(addr: &BleAddress, key: &[u8; XIAOMI_BIND_KEY_SIZE]) -> ControlMessage {
+        let mut data = addr.mac.to_vec();
+        data.extend_from_slice(key);
+        ControlMessage::new(CONTROL_XIAOMI_KEY_SET, &data)
+    }
+
+    pub fn xiaomi_key_remove(addr: &BleAddress) -> ControlMessage {
+        ControlMessage::new(CONTROL_XIAOMI_KEY_REMOVE, &addr.mac)
+    }
+
+    /// Request the latency histograms of the firmware (`CONFIG_COPRO_LATENCY_PROBES`),
+    /// sent as `ChannelMessage::Latency` messages, optionally resetting them
+    pub fn latency_export(reset: bool) -> ControlMessage {
+        ControlMessage::new(CONTROL_LATENCY_EXPORT, &[reset as u8])
+    }
+
+    /// Request a snapshot of the last record of every device known by the
+    /// firmware (`CONFIG_COPRO_DEVICE_REGISTRY_SNAPSHOT`), also sent on every
+    /// connection, yielded as a `ChannelMessage::Snapshot`
+    pub fn snapshot_request() -> ControlMessage {
+        ControlMessage::new(CONTROL_SNAPSHOT, &[])
+    }
+
+    /// (request type, status) if this is an acknowledgement
+    pub fn ack(&self) -> Option<(u8, ControlStatus)> {
+        match (self.msg_type, self.data.as_slice()) {
+            (CONTROL_ACK, [request_type, status, ..]) => {
+                Some((*request_type, ControlStatus::from_u8(*status)))
+            }
+            _ => None,
+        }
+    }
+
+    pub fn encode(&self) -> Vec<u8> {
+        let mut buf = Vec::with_capacity(2 + self.data.len());
+        buf.push(self.msg_type);
+        buf.push(self.data.len() as u8);
+        buf.extend_from_slice(&self.data);
+        buf
+    }
+}
 
 impl StreamChannelHandler for ControlHandler {
     const CHANNEL_ID: u32 = 0x00000000;
     type Message = ControlMessage;
-    fn parse_message(_data: &[u8]) -> Result<Self::Message, StreamChannelError> {
-        Ok(ControlMessage)
+    fn parse_message(data: &[u8]) -> Result<Self::Message, StreamChannelError> {
+        match data {
+            [msg_type, len, rest @ ..] => {
+                let len = (*len as usize).min(rest.len());
+                Ok(ControlMessage::new(*msg_type, &rest[..len]))
+            }
+            _ => Ok(ControlMessage::default()),
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn ack_status() {
+        let ack =
+            ControlHandler::parse_message(&[CONTROL_ACK, 2, CONTROL_XIAOMI_KEY_SET, 0x04]).unwrap();
+        assert_eq!(
+            ack.ack(),
+            Some((CONTROL_XIAOMI_KEY_SET, ControlStatus::NoSpace))
+        );
+
+        let ack = ControlHandler::parse_message(&[CONTROL_ACK, 2, CONTROL_SNAPSHOT, 0]).unwrap();
+        assert!(ack.ack().unwrap().1.is_ok());
+
+        // Unknown statuses are never mistaken for a success
+        assert_eq!(ControlStatus::from_u8(0x7a), ControlStatus::Error(0x7a));
+        assert_eq!(ControlStatus::from_u8(0xff), ControlStatus::Error(0xff));
+
+        let other = ControlMessage::new(CONTROL_SNAPSHOT, &[]);
+        assert_eq!(other.ack(), None);
     }
 }
@@ -0,0 +1,219 @@
+use std::fmt::Display;
+
+use byteorder::{ByteOrder, LittleEndian};
+
+use crate::{
+    ble::BleAddress, stream_channel::StreamChannelError, timestamp::Timestamp, StreamChannelHandler,
+};
+
+/// Presence event or health snapshot reported by the firmware device registry
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum DeviceEvent {
+    /// First advertisement of the device, or the first one after a disappearance
+    Appear,
+    /// Nothing received from the device for the firmware timeout
+    Disappear,
+    /// Periodic snapshot of a present device
+    Health,
+    Unknown(u8),
+}
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum DeviceType {
+    Xiaomi,
+    LinkyTic,
+    Unknown(u8),
+}
+
+#[derive(Debug, Clone)]
+pub struct DeviceHealthRecord {
+    pub version: u8,
+    pub ble_addr: BleAddress,
+    pub event: DeviceEvent,
+    pub device_type: DeviceType,
+    pub timestamp: Timestamp,
+    /// Device uptime (ms) of the first and last advertisements
+    pub first_seen: u64,
+    pub last_seen: u64,
+    pub adv_count: u32,
+    pub measurements: u32,
+    /// Measurements missed, from gaps in the device measurement counter
+    pub missed: u32,
+    /// Exponentially weighted moving average of the RSSI (dBm)
+    pub rssi_avg: f32,
+    pub rssi_last: i8,
+    /// Measurements not streamed because they did not move past the deadband
+    /// of the firmware, 0 before version 2
+    pub suppressed: u32,
+}
+
+impl DeviceHealthRecord {
+    /// Ratio of measurements missed, 0 if unknown
+    pub fn loss_ratio(&self) -> f32 {
+        let total = self.measurements + self.missed;
+        if total == 0 {
+            0.0
+        } else {
+            self.missed as f32 / total as f32
+        }
+    }
+}
+
+impl Display for DeviceHealthRecord {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        write!(
+            f,
+            "mac: {} {:?} {:?} timestamp: {} adv: {} meas: {} missed: {} suppressed: {} rssi: {:.1} (last {})",
+            self.ble_addr,
+            self.device_type,
+            self.event,
+            self.timestamp,
+            self.adv_count,
+            self.measurements,
+            self.missed,
+            self.suppressed,
+            self.rssi_avg,
+            self.rssi_last
+        )
+    }
+}
+
+pub struct DeviceHealthHandler;
+
+const DEVICE_RECORD_SIZE: usize = 49;
+const DEVICE_RECORD_V2_SIZE: usize = 53;
+const DEVICE_RSSI_EWMA_SCALE: f32 = 16.0;
+
+impl StreamChannelHandler for DeviceHealthHandler {
+    const CHANNEL_ID: u32 = 0x3d5e1a70;
+    type Message = DeviceHealthRecord;
+
+    fn parse_message(data: &[u8]) -> Result<Self::Message, StreamChannelError> {
+        if data.len() < DEVICE_RECORD_SIZE {
+            return Err(StreamChannelError::InvalidMessageLength);
+        }
+
+        let mut ble_mac = [0; 6];
+        ble_mac.copy_from_slice(&data[0..6]);
+
+        let event = match data[7] {
+            0x01 => DeviceEvent::Appear,
+            0x02 => DeviceEvent::Disappear,
+            0x03 => DeviceEvent::Health,
+            other => DeviceEvent::Unknown(other),
+        };
+
+        let device_type = match data[9] {
+            0x01 => DeviceType::Xiaomi,
+            0x02 => DeviceType::LinkyTic,
+            other => DeviceType::Unknown(other),
+        };
+
+        Ok(DeviceHealthRecord {
+            version: data[8],
+            ble_addr: BleAddress::new(ble_mac, data[6]),
+            event,
+            device_type,
+            timestamp: Timestamp::Uptime(LittleEndian::read_i64(&data[10..18]) as u64),
+            first_seen: LittleEndian::read_i64(&data[18..26]) as u64,
+            last_seen: LittleEndian::read_i64(&data[26..34]) as u64,
+            adv_count: LittleEndian::read_u32(&data[34..38]),
+            measurements: LittleEndian::read_u32(&data[38..42]),
+            missed: LittleEndian::read_u32(&data[42..46]),
+            rssi_avg: LittleEndian::read_i16(&data[46..48]) as f32 / DEVICE_RSSI_EWMA_SCALE,
+            rssi_last: data[48] as i8,
+            suppressed: if data.len() >= DEVICE_RECORD_V2_SIZE {
+                LittleEndian::read_u32(&data[49..53])
+            } else {
+                0
+            },
+        })
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// Health record as serialized by the firmware, `suppressed` only in v2
+    fn record(version: u8) -> Vec<u8> {
+        let mut data = vec![0u8; DEVICE_RECORD_SIZE];
+        data[0..6].copy_from_slice(&[0xa4, 0xc1, 0x38, 0x01, 0x02, 0x03]);
+        data[6] = 1;
+        data[7] = 0x03;
+        data[8] = version;
+        data[9] = 0x01;
+        LittleEndian::write_i64(&mut data[10..18], 600_000);
+        LittleEndian::write_i64(&mut data[18..26], 1_000);
+        LittleEndian::write_i64(&mut data[26..34], 599_000);
+        LittleEndian::write_u32(&mut data[34..38], 120);
+        LittleEndian::write_u32(&mut data[38..42], 30);
+        LittleEndian::write_u32(&mut data[42..46], 10);
+        LittleEndian::write_i16(&mut data[46..48], -1092);
+        data[48] = -70i8 as u8;
+
+        if version >= 2 {
+            data.extend_from_slice(&12u32.to_le_bytes());
+        }
+
+        data
+    }
+
+    #[test]
+    fn decode_v1() {
+        let data = record(1);
+        assert_eq!(data.len(), 49);
+
+        let rec = DeviceHealthHandler::parse_message(&data).unwrap();
+        assert_eq!(rec.version, 1);
+        assert_eq!(
+            rec.ble_addr,
+            BleAddress::new([0xa4, 0xc1, 0x38, 0x01, 0x02, 0x03], 1)
+        );
+        assert_eq!(rec.event, DeviceEvent::Health);
+        assert_eq!(rec.device_type, DeviceType::Xiaomi);
+        assert_eq!(rec.timestamp, Timestamp::Uptime(600_000));
+        assert_eq!((rec.first_seen, rec.last_seen), (1_000, 599_000));
+        assert_eq!((rec.adv_count, rec.measurements, rec.missed), (120, 30, 10));
+        assert_eq!(rec.rssi_avg, -68.25);
+        assert_eq!(rec.rssi_last, -70);
+        assert_eq!(rec.suppressed, 0);
+        assert_eq!(rec.loss_ratio(), 0.25);
+    }
+
+    #[test]
+    fn decode_v2() {
+        let data = record(2);
+        assert_eq!(data.len(), 53);
+
+        let rec = DeviceHealthHandler::parse_message(&data).unwrap();
+        assert_eq!(rec.version, 2);
+        assert_eq!(rec.rssi_last, -70);
+        assert_eq!(rec.suppressed, 12);
+
+        // Truncated v2 field, decoded as v1
+        let rec = DeviceHealthHandler::parse_message(&data[..52]).unwrap();
+        assert_eq!(rec.suppressed, 0);
+    }
+
+    #[test]
+    fn decode_short() {
+        let data = record(1);
+
+        assert!(matches!(
+            DeviceHealthHandler::parse_message(&data[..48]),
+            Err(StreamChannelError::InvalidMessageLength)
+        ));
+    }
+
+    #[test]
+    fn decode_unknown_event_and_type() {
+        let mut data = record(2);
+        data[7] = 0x7f;
+        data[9] = 0x09;
+
+        let rec = DeviceHealthHandler::parse_message(&data).unwrap();
+        assert_eq!(rec.event, DeviceEvent::Unknown(0x7f));
+        assert_eq!(rec.device_type, DeviceType::Unknown(0x09));
+    }
+}
@@ -0,0 +1,354 @@
+//! Stream frame formats.
+//!
+//! v1 (default): `channel_id (4) | len (2) | payload`, a corrupted length leaves
+//! the receiver out of sync for the rest of the connection.
+//!
+//! v2 (firmware `CONFIG_COPRO_STREAM_FRAME_V2`):
+//! `sync (2) | channel_id (4) | len (2) | payload | crc32 (4)`, the CRC-32 (IEEE)
+//! covers channel id, length and payload. On a bad length or CRC the decoder
+//! drops one byte and scans forward to the next sync word.
+//!
+//! Over the serial transport (firmware `CONFIG_COPRO_STREAM_TRANSPORT_SERIAL`),
+//! every v2 frame is COBS encoded and delimited by 0x00, see [`crate::serial`].
+
+use byteorder::{ByteOrder, LittleEndian};
+
+use crate::stream_message::MessageHeader;
+
+pub const FRAME_V1_HEADER_SIZE: usize = 6;
+pub const FRAME_V2_SYNC: u16 = 0xb1c0;
+pub const FRAME_V2_HEADER_SIZE: usize = 8;
+pub const FRAME_V2_CRC_SIZE: usize = 4;
+
+/// Larger lengths are considered corrupted, the firmware never sends more than
+/// `CONFIG_COPRO_STREAM_CHANNEL_MSG_MAX_SIZE` bytes.
+pub const FRAME_V2_PAYLOAD_MAX: usize = 1024;
+
+const FRAME_V2_SYNC_BYTES: [u8; 2] = FRAME_V2_SYNC.to_le_bytes();
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Default)]
+pub enum FrameFormat {
+    #[default]
+    V1,
+    V2,
+}
+
+const fn crc32_table() -> [u32; 256] {
+    let mut table = [0u32; 256];
+    let mut i = 0;
+    while i < 256 {
+        let mut crc = i as u32;
+        let mut j = 0;
+        while j < 8 {
+            crc = if crc & 1 != 0 {
+                (crc >> 1) ^ 0xedb8_8320
+            } else {
+                crc >> 1
+            };
+            j += 1;
+        }
+        table[i] = crc;
+        i += 1;
+    }
+    table
+}
+
+static CRC32_TABLE: [u32; 256] = crc32_table();
+
+/// CRC-32 (IEEE 802.3), same as Zephyr `crc32_ieee()`
+pub fn crc32_ieee(data: &[u8]) -> u32 {
+    !data.iter().fold(!0u32, |crc, &b| {
+        CRC32_TABLE[((crc ^ b as u32) & 0xff) as usize] ^ (crc >> 8)
+    })
+}
+
+/// Encode a v2 frame
+pub fn encode_v2(channel_id: u32, payload: &[u8], out: &mut Vec<u8>) {
+    let start = out.len();
+    out.extend_from_slice(&FRAME_V2_SYNC_BYTES);
+    out.extend_from_slice(&channel_id.to_le_bytes());
+    out.extend_from_slice(&(payload.len() as u16).to_le_bytes());
+    out.extend_from_slice(payload);
+    let crc = crc32_ieee(&out[start + 2..]);
+    out.extend_from_slice(&crc.to_le_bytes());
+}
+
+/// Check a complete v2 frame, e.g. one delimited by the serial transport, and
+/// return its header and payload range
+pub fn parse_v2(frame: &[u8]) -> Option<(MessageHeader, std::ops::Range<usize>)> {
+    if frame.len() < FRAME_V2_HEADER_SIZE + FRAME_V2_CRC_SIZE || frame[0..2] != FRAME_V2_SYNC_BYTES
+    {
+        return None;
+    }
+
+    let channel_id = LittleEndian::read_u32(&frame[2..6]);
+    let len = LittleEndian::read_u16(&frame[6..8]) as usize;
+    if frame.len() != FRAME_V2_HEADER_SIZE + len + FRAME_V2_CRC_SIZE {
+        return None;
+    }
+
+    let crc = LittleEndian::read_u32(&frame[FRAME_V2_HEADER_SIZE + len..]);
+    if crc32_ieee(&frame[2..FRAME_V2_HEADER_SIZE + len]) != crc {
+        return None;
+    }
+
+    Some((
+        MessageHeader::new(channel_id, len as u16),
+        FRAME_V2_HEADER_SIZE..FRAME_V2_HEADER_SIZE + len,
+    ))
+}
+
+#[derive(Debug, Clone, Copy, Default)]
+pub struct FrameDecoderStats {
+    /// Bytes discarded while looking for the next valid frame
+    pub skipped_bytes: u64,
+    /// Candidate frames rejected because of their CRC or length
+    pub crc_errors: u64,
+}
+
+/// Incremental v2 frame decoder, bytes are pushed with [`FrameDecoder::extend`]
+/// and frames pulled with [`FrameDecoder::decode`].
+#[derive(Default)]
+pub struct FrameDecoder {
+    buf: Vec<u8>,
+    start: usize,
+    stats: FrameDecoderStats,
+}
+
+impl FrameDecoder {
+    pub fn new() -> FrameDecoder {
+        Self::default()
+    }
+
+    pub fn stats(&self) -> FrameDecoderStats {
+        self.stats
+    }
+
+    pub fn extend(&mut self, data: &[u8]) {
+        // Reclaim consumed bytes before growing
+        if self.start > 0 && self.start == self.buf.len() {
+            self.buf.clear();
+            self.start = 0;
+        } else if self.start > 4096 {
+            self.buf.drain(..self.start);
+            self.start = 0;
+        }
+
+        self.buf.extend_from_slice(data);
+    }
+
+    fn skip(&mut self, n: usize) {
+        self.start += n;
+        self.stats.skipped_bytes += n as u64;
+    }
+
+    /// Returns the next valid frame as (header, payload range in the buffer
+    /// returned by [`FrameDecoder::buffer`]), or None if more data is needed.
+    pub fn decode_range(&mut self) -> Option<(MessageHeader, std::ops::Range<usize>)> {
+        loop {
+            let avail = &self.buf[self.start..];
+
+            match avail.windows(2).position(|w| w == FRAME_V2_SYNC_BYTES) {
+                Some(0) => {}
+                Some(p) => {
+                    self.skip(p);
+                    continue;
+                }
+                None => {
+                    // Keep a trailing byte which may be the start of a sync word
+                    let keep = usize::from(avail.last() == Some(&FRAME_V2_SYNC_BYTES[0]));
+                    self.skip(avail.len() - keep);
+                    return None;
+                }
+            }
+
+            if avail.len() < FRAME_V2_HEADER_SIZE {
+                return None;
+            }
+
+            let channel_id = LittleEndian::read_u32(&avail[2..6]);
+            let len = LittleEndian::read_u16(&avail[6..8]) as usize;
+
+            if len > FRAME_V2_PAYLOAD_MAX {
+                self.stats.crc_errors += 1;
+                self.skip(1);
+                continue;
+            }
+
+            let total = FRAME_V2_HEADER_SIZE + len + FRAME_V2_CRC_SIZE;
+            if avail.len() < total {
+                return None;
+            }
+
+            let crc = LittleEndian::read_u32(&avail[total - FRAME_V2_CRC_SIZE..total]);
+            if crc32_ieee(&avail[2..FRAME_V2_HEADER_SIZE + len]) != crc {
+                self.stats.crc_errors += 1;
+                self.skip(1);
+                continue;
+            }
+
+            let payload =
+                self.start + FRAME_V2_HEADER_SIZE..self.start + FRAME_V2_HEADER_SIZE + len;
+            self.start += total;
+
+            return Some((MessageHeader::new(channel_id, len as u16), payload));
+        }
+    }
+
+    pub fn buffer(&self) -> &[u8] {
+        &self.buf
+    }
+
+    /// Same as [`FrameDecoder::decode_range`] but copies the payload
+    pub fn decode(&mut self) -> Option<(MessageHeader, Vec<u8>)> {
+        self.decode_range()
+            .map(|(header, range)| (header, self.buf[range].to_vec()))
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn frame(channel_id: u32, payload: &[u8]) -> Vec<u8> {
+        let mut out = Vec::new();
+        encode_v2(channel_id, payload, &mut out);
+        out
+    }
+
+    fn decode_all(decoder: &mut FrameDecoder) -> Vec<(u32, Vec<u8>)> {
+        std::iter::from_fn(|| decoder.decode())
+            .map(|(header, payload)| (header.channel_id, payload))
+            .collect()
+    }
+
+    #[test]
+    fn crc32_check_value() {
+        assert_eq!(crc32_ieee(b"123456789"), 0xcbf4_3926);
+        assert_eq!(crc32_ieee(b""), 0);
+    }
+
+    #[test]
+    fn encode_parse_round_trip() {
+        let bytes = frame(0x12345678, b"hello");
+        assert_eq!(bytes.len(), FRAME_V2_HEADER_SIZE + 5 + FRAME_V2_CRC_SIZE);
+        assert_eq!(bytes[0..2], FRAME_V2_SYNC_BYTES);
+
+        let (header, range) = parse_v2(&bytes).unwrap();
+        assert_eq!(header.channel_id, 0x12345678);
+        assert_eq!(header.message_len, 5);
+        assert_eq!(&bytes[range], b"hello");
+
+        let (_, range) = parse_v2(&frame(1, b"")).unwrap();
+        assert!(range.is_empty());
+    }
+
+    #[test]
+    fn parse_rejects_corruption() {
+        let bytes = frame(1, b"payload");
+
+        // Every single bit flip is detected, by the sync word, length or CRC
+        for i in 0..bytes.len() {
+            for bit in 0..8 {
+                let mut corrupted = bytes.clone();
+                corrupted[i] ^= 1 << bit;
+                assert!(parse_v2(&corrupted).is_none(), "byte {} bit {}", i, bit);
+            }
+        }
+
+        assert!(parse_v2(&bytes[..bytes.len() - 1]).is_none());
+        assert!(parse_v2(&bytes[..FRAME_V2_HEADER_SIZE]).is_none());
+    }
+
+    #[test]
+    fn decode_byte_by_byte() {
+        let mut stream = frame(1, b"first");
+        stream.extend(frame(2, b"second"));
+
+        let mut decoder = FrameDecoder::new();
+        let mut frames = Vec::new();
+        for b in stream {
+            decoder.extend(&[b]);
+            frames.extend(decode_all(&mut decoder));
+        }
+
+        assert_eq!(
+            frames,
+            vec![(1, b"first".to_vec()), (2, b"second".to_vec())]
+        );
+        assert_eq!(decoder.stats().skipped_bytes, 0);
+        assert_eq!(decoder.stats().crc_errors, 0);
+    }
+
+    #[test]
+    fn resync_after_garbage() {
+        let garbage = [0x00, 0xc0, 0x13, 0xb1, 0xc0, 0xff];
+        let mut stream = garbage.to_vec();
+        stream.extend(frame(3, b"data"));
+
+        let mut decoder = FrameDecoder::new();
+        decoder.extend(&stream);
+
+        assert_eq!(decode_all(&mut decoder), vec![(3, b"data".to_vec())]);
+        assert_eq!(decoder.stats().skipped_bytes, garbage.len() as u64);
+    }
+
+    #[test]
+    fn resync_after_crc_error() {
+        let mut corrupted = frame(1, b"corrupted");
+        corrupted[FRAME_V2_HEADER_SIZE] ^= 0x01;
+
+        let mut stream = frame(1, b"before");
+        stream.extend(&corrupted);
+        stream.extend(frame(2, b"after"));
+
+        let mut decoder = FrameDecoder::new();
+        decoder.extend(&stream);
+
+        assert_eq!(
+            decode_all(&mut decoder),
+            vec![(1, b"before".to_vec()), (2, b"after".to_vec())]
+        );
+        assert_eq!(decoder.stats().crc_errors, 1);
+        assert_eq!(decoder.stats().skipped_bytes, corrupted.len() as u64);
+    }
+
+    #[test]
+    fn resync_after_bad_length() {
+        // A corrupted length larger than the maximum is rejected without
+        // waiting for that many bytes
+        let mut corrupted = frame(1, b"x");
+        corrupted[6..8].copy_from_slice(&(FRAME_V2_PAYLOAD_MAX as u16 + 1).to_le_bytes());
+
+        let mut stream = corrupted.clone();
+        stream.extend(frame(2, b"next"));
+
+        let mut decoder = FrameDecoder::new();
+        decoder.extend(&stream);
+
+        assert_eq!(decode_all(&mut decoder), vec![(2, b"next".to_vec())]);
+        assert_eq!(decoder.stats().crc_errors, 1);
+    }
+
+    #[test]
+    fn truncated_frame_waits_for_more_data() {
+        let bytes = frame(1, b"split");
+        let mut decoder = FrameDecoder::new();
+
+        decoder.extend(&bytes[..bytes.len() - 2]);
+        assert!(decoder.decode().is_none());
+
+        decoder.extend(&bytes[bytes.len() - 2..]);
+        assert_eq!(decode_all(&mut decoder), vec![(1, b"split".to_vec())]);
+    }
+
+    #[test]
+    fn sync_word_in_payload() {
+        // A payload containing the sync word does not confuse the decoder
+        let payload = [0xc0, 0xb1, 0xc0, 0xb1, 0x00];
+        let mut decoder = FrameDecoder::new();
+        decoder.extend(&frame(7, &payload));
+
+        assert_eq!(decode_all(&mut decoder), vec![(7, payload.to_vec())]);
+    }
+}
@@ -0,0 +1,463 @@
+//! [`SinkWriter`] posting the batches to an InfluxDB write endpoint, in line
+//! protocol over HTTP/1.1 (`sink` feature).
+//!
+//! One line per record, with nanosecond timestamps (the default precision of
+//! both the 1.x and 2.x APIs):
+//!
+//! ```text
+//! xiaomi,mac=a4:c1:38:01:02:03 temperature=21.5,humidity=45,battery_mv=2950i,battery_percent=85i,rssi=-67i 1700000000000000000
+//! linky_tic,mac=... base=1234567i,papp=850i,iinst=4i,ptec=0i,rssi=-72i 1700000000000000000
+//! device_health,mac=...,type=xiaomi,event=health adv_count=120i,measurements=30i,missed=1i,suppressed=12i,rssi_avg=-68.5,rssi_last=-70i 1700000000000000000
+//! ```
+//!
+//! Connections are kept alive and reused among batches, a stale one is
+//! replaced once without waiting for the sink backoff.
+
+use std::fmt::Write;
+use std::sync::Mutex;
+use std::time::Duration;
+
+use tokio::io::{AsyncReadExt, AsyncWriteExt};
+use tokio::net::TcpStream;
+
+use crate::device_health::{DeviceEvent, DeviceType};
+use crate::sink::{SinkError, SinkRecord, SinkWriter};
+use crate::stream_message::ChannelMessage;
+
+pub const DEFAULT_HTTP_TIMEOUT: Duration = Duration::from_secs(10);
+
+/// Responses with a longer header are rejected
+const HTTP_HEADER_MAX: usize = 16 * 1024;
+
+/// Append the line of `record` to `out`, returns false for records without
+/// line protocol representation
+pub fn encode_line(record: &SinkRecord, out: &mut String) -> bool {
+    let time = record.time_ns();
+
+    match &record.message {
+        ChannelMessage::Xiaomi(r) => {
+            let m = &r.measurement;
+            let _ = writeln!(
+                out,
+                "xiaomi,mac={} temperature={},humidity={},battery_mv={}i,battery_percent={}i,rssi={}i {}",
+                r.ble_addr.mac_string(),
+                m.temperature,
+                m.humidity,
+                m.battery_mv,
+                m.battery_percent,
+                m.rssi,
+                time
+            );
+        }
+        ChannelMessage::LinkyTic(r) => {
+            let m = &r.measurement;
+            let _ = writeln!(
+                out,
+                "linky_tic,mac={} base={}i,papp={}i,iinst={}i,ptec={}i,rssi={}i {}",
+                r.ble_addr.mac_string(),
+                m.base,
+                m.papp,
+                m.iinst,
+                m.ptec,
+                r.rssi,
+                time
+            );
+        }
+        ChannelMessage::DeviceHealth(r) => {
+            let device_type = match r.device_type {
+                DeviceType::Xiaomi => "xiaomi",
+                DeviceType::LinkyTic => "linky_tic",
+                DeviceType::Unknown(_) => "unknown",
+            };
+            let event = match r.event {
+                DeviceEvent::Appear => "appear",
+                DeviceEvent::Disappear => "disappear",
+                DeviceEvent::Health => "health",
+                DeviceEvent::Unknown(_) => "unknown",
+            };
+            let _ = writeln!(
+                out,
+                "device_health,mac={},type={},event={} adv_count={}i,measurements={}i,missed={}i,suppressed={}i,rssi_avg={},rssi_last={}i {}",
+                r.ble_addr.mac_string(),
+                device_type,
+                event,
+                r.adv_count,
+                r.measurements,
+                r.missed,
+                r.suppressed,
+                r.rssi_avg,
+                r.rssi_last,
+                time
+            );
+        }
+        _ => return false,
+    }
+
+    true
+}
+
+pub struct InfluxWriter {
+    /// `host:port` to connect to
+    addr: String,
+    /// Host header
+    host: String,
+    /// Path and query of the write endpoint
+    path: String,
+    token: Option<String>,
+    timeout: Duration,
+    /// Idle keep-alive connections
+    pool: Mutex<Vec<TcpStream>>,
+}
+
+impl InfluxWriter {
+    /// `url` of the write endpoint, plain HTTP only:
+    /// `http://localhost:8086/api/v2/write?org=home&bucket=ble` (InfluxDB 2.x)
+    /// or `http://localhost:8086/write?db=ble` (1.x).
+    pub fn new(url: &str) -> Result<InfluxWriter, SinkError> {
+        let rest = url.strip_prefix("http://").ok_or(SinkError::InvalidUrl)?;
+        let (host, path) = match rest.find('/') {
+            Some(i) => (&rest[..i], &rest[i..]),
+            None => (rest, "/"),
+        };
+
+        if host.is_empty() {
+            return Err(SinkError::InvalidUrl);
+        }
+
+        // The port of "[::1]:8086" follows the last colon, not the one of "[::1]"
+        let has_port = host.rfind(':').is_some_and(|i| !host[i..].contains(']'));
+        let addr = if has_port {
+            host.to_string()
+        } else {
+            format!("{}:80", host)
+        };
+
+        Ok(InfluxWriter {
+            addr,
+            host: host.to_string(),
+            path: path.to_string(),
+            token: None,
+            timeout: DEFAULT_HTTP_TIMEOUT,
+            pool: Mutex::new(Vec::new()),
+        })
+    }
+
+    /// InfluxDB 2.x API token, sent as `Authorization: Token <token>`
+    pub fn set_token(&mut self, token: &str) {
+        self.token = Some(token.to_string());
+    }
+
+    /// Timeout of a whole request, connection included
+    pub fn set_timeout(&mut self, timeout: Duration) {
+        self.timeout = timeout;
+    }
+
+    fn request_head(&self, body_len: usize) -> String {
+        let mut head = format!(
+            "POST {} HTTP/1.1\r\nHost: {}\r\nContent-Type: text/plain; charset=utf-8\r\nContent-Length: {}\r\n",
+            self.path, self.host, body_len
+        );
+        if let Some(token) = &self.token {
+            let _ = write!(head, "Authorization: Token {}\r\n", token);
+        }
+        head.push_str("\r\n");
+
+        head
+    }
+
+    /// Send the request and read the response, returns whether the connection
+    /// can be reused
+    async fn request(
+        &self,
+        stream: &mut TcpStream,
+        head: &str,
+        body: &[u8],
+    ) -> Result<bool, SinkError> {
+        stream.write_all(head.as_bytes()).await?;
+        stream.write_all(body).await?;
+
+        let mut response = Vec::with_capacity(512);
+        let header_end = loop {
+            if let Some(p) = response.windows(4).position(|w| w == b"\r\n\r\n") {
+                break p + 4;
+            }
+            if response.len() > HTTP_HEADER_MAX {
+                return Err(SinkError::InvalidResponse);
+            }
+            if stream.read_buf(&mut response).await? == 0 {
+                return Err(std::io::Error::from(std::io::ErrorKind::UnexpectedEof).into());
+            }
+        };
+
+        let header =
+            std::str::from_utf8(&response[..header_end]).map_err(|_| SinkError::InvalidResponse)?;
+        let mut lines = header.split("\r\n");
+        let status: u16 = lines
+            .next()
+            .and_then(|line| line.split(' ').nth(1))
+            .and_then(|status| status.parse().ok())
+            .ok_or(SinkError::InvalidResponse)?;
+
+        let mut content_length = None;
+        let mut keep_alive = true;
+        for (name, value) in lines.filter_map(|line| line.split_once(':')) {
+            let value = value.trim();
+            if name.eq_ignore_ascii_case("content-length") {
+                content_length = value.parse::<usize>().ok();
+            } else if name.eq_ignore_ascii_case("connection") {
+                keep_alive &= !value.eq_ignore_ascii_case("close");
+            } else if name.eq_ignore_ascii_case("transfer-encoding") {
+                // Chunked bodies are not drained
+                keep_alive = false;
+            }
+        }
+
+        match content_length {
+            Some(len) => {
+                // Drain the body, e.g. the error message, to reuse the connection
+                let remaining = len.saturating_sub(response.len() - header_end) as u64;
+                tokio::io::copy(&mut (&mut *stream).take(remaining), &mut tokio::io::sink())
+                    .await?;
+            }
+            None if status == 204 || status == 304 => {}
+            // Body up to the end of the connection
+            None => keep_alive = false,
+        }
+
+        if !(200..300).contains(&status) {
+            return Err(SinkError::HttpStatus(status));
+        }
+
+        Ok(keep_alive)
+    }
+
+    async fn connect(&self) -> Result<TcpStream, SinkError> {
+        let stream = TcpStream::connect(&self.addr).await?;
+        stream.set_nodelay(true)?;
+
+        Ok(stream)
+    }
+
+    async fn post(&self, body: &[u8]) -> Result<(), SinkError> {
+        let head = self.request_head(body.len());
+        let pooled = self.pool.lock().unwrap().pop();
+
+        let (stream, keep_alive) = match pooled {
+            Some(mut stream) => match self.request(&mut stream, &head, body).await {
+                Err(SinkError::IoError(_)) => {
+                    // Closed by the server while idle
+                    let mut stream = self.connect().await?;
+                    let keep_alive = self.request(&mut stream, &head, body).await?;
+                    (stream, keep_alive)
+                }
+                result => (stream, result?),
+            },
+            None => {
+                let mut stream = self.connect().await?;
+                let keep_alive = self.request(&mut stream, &head, body).await?;
+                (stream, keep_alive)
+            }
+        };
+
+        if keep_alive {
+            self.pool.lock().unwrap().push(stream);
+        }
+
+        Ok(())
+    }
+}
+
+impl SinkWriter for InfluxWriter {
+    async fn write(&self, batch: &[SinkRecord]) -> Result<(), SinkError> {
+        let mut body = String::with_capacity(batch.len() * 128);
+        for record in batch {
+            encode_line(record, &mut body);
+        }
+
+        if body.is_empty() {
+            return Ok(());
+        }
+
+        tokio::time::timeout(self.timeout, self.post(body.as_bytes()))
+            .await
+            .map_err(|_| SinkError::Timeout)?
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::collections::VecDeque;
+    use std::sync::Arc;
+
+    use tokio::net::TcpListener;
+
+    use crate::sink::tests::xiaomi_record;
+
+    const XIAOMI_LINE: &str = "xiaomi,mac=a4:c1:38:00:00:01 temperature=21.5,humidity=45,battery_mv=2950i,battery_percent=85i,rssi=-67i 1700000000000000000\n";
+
+    #[derive(Default)]
+    struct Server {
+        /// Requests received, head and body
+        requests: Vec<(String, String)>,
+        connections: usize,
+    }
+
+    /// HTTP server stand-in answering the requests with `responses` in order
+    async fn server(responses: &[&'static str]) -> (String, Arc<Mutex<Server>>) {
+        let listener = TcpListener::bind("127.0.0.1:0").await.unwrap();
+        let addr = listener.local_addr().unwrap().to_string();
+        let state = Arc::new(Mutex::new(Server::default()));
+        let responses = Arc::new(Mutex::new(VecDeque::from(responses.to_vec())));
+
+        let server = state.clone();
+        tokio::spawn(async move {
+            while let Ok((mut stream, _)) = listener.accept().await {
+                server.lock().unwrap().connections += 1;
+                let server = server.clone();
+                let responses = responses.clone();
+
+                tokio::spawn(async move {
+                    let mut buf = Vec::new();
+                    loop {
+                        let head_end = loop {
+                            if let Some(p) = buf.windows(4).position(|w| w == b"\r\n\r\n") {
+                                break p + 4;
+                            }
+                            if stream.read_buf(&mut buf).await.unwrap_or(0) == 0 {
+                                return;
+                            }
+                        };
+
+                        let head = String::from_utf8(buf[..head_end].to_vec()).unwrap();
+                        let len: usize = head
+                            .lines()
+                            .find_map(|line| line.strip_prefix("Content-Length: "))
+                            .unwrap()
+                            .parse()
+                            .unwrap();
+                        while buf.len() < head_end + len {
+                            stream.read_buf(&mut buf).await.unwrap();
+                        }
+                        let body = String::from_utf8(buf[head_end..head_end + len].to_vec());
+                        buf.drain(..head_end + len);
+                        server.lock().unwrap().requests.push((head, body.unwrap()));
+
+                        let response = responses.lock().unwrap().pop_front().unwrap();
+                        stream.write_all(response.as_bytes()).await.unwrap();
+                        if response.contains("Connection: close") {
+                            return;
+                        }
+                    }
+                });
+            }
+        });
+
+        (addr, state)
+    }
+
+    #[test]
+    fn line_protocol() {
+        let mut out = String::new();
+
+        assert!(encode_line(&xiaomi_record(1), &mut out));
+        assert_eq!(out, XIAOMI_LINE);
+    }
+
+    #[test]
+    fn url() {
+        let writer = InfluxWriter::new("http://localhost:8086/api/v2/write?bucket=ble").unwrap();
+        assert_eq!(writer.addr, "localhost:8086");
+        assert_eq!(writer.path, "/api/v2/write?bucket=ble");
+
+        let writer = InfluxWriter::new("http://[::1]").unwrap();
+        assert_eq!(writer.addr, "[::1]:80");
+        assert_eq!(writer.host, "[::1]");
+        assert_eq!(writer.path, "/");
+
+        assert!(matches!(
+            InfluxWriter::new("https://localhost/write"),
+            Err(SinkError::InvalidUrl)
+        ));
+        assert!(matches!(
+            InfluxWriter::new("http:///write"),
+            Err(SinkError::InvalidUrl)
+        ));
+    }
+
+    #[tokio::test]
+    async fn write_keep_alive() {
+        let (addr, server) = server(&[
+            "HTTP/1.1 204 No Content\r\n\r\n",
+            "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok",
+        ])
+        .await;
+        let mut writer = InfluxWriter::new(&format!("http://{}/write?db=ble", addr)).unwrap();
+        writer.set_token("secret");
+
+        writer.write(&[xiaomi_record(1)]).await.unwrap();
+        writer
+            .write(&[xiaomi_record(1), xiaomi_record(1)])
+            .await
+            .unwrap();
+
+        let server = server.lock().unwrap();
+        assert_eq!(server.connections, 1, "connection reused");
+        assert_eq!(server.requests.len(), 2);
+
+        let (head, body) = &server.requests[0];
+        assert!(head.starts_with("POST /write?db=ble HTTP/1.1\r\n"));
+        assert!(head.contains(&format!("\r\nHost: {}\r\n", addr)));
+        assert!(head.contains("\r\nAuthorization: Token secret\r\n"));
+        assert_eq!(body, XIAOMI_LINE);
+        assert_eq!(server.requests[1].1, XIAOMI_LINE.repeat(2));
+    }
+
+    #[tokio::test]
+    async fn write_connection_close() {
+        let (addr, server) = server(&[
+            "HTTP/1.1 204 No Content\r\nConnection: close\r\n\r\n",
+            "HTTP/1.1 204 No Content\r\n\r\n",
+        ])
+        .await;
+        let writer = InfluxWriter::new(&format!("http://{}/write", addr)).unwrap();
+
+        writer.write(&[xiaomi_record(1)]).await.unwrap();
+        writer.write(&[xiaomi_record(2)]).await.unwrap();
+
+        assert_eq!(server.lock().unwrap().connections, 2);
+    }
+
+    #[tokio::test]
+    async fn write_error_status() {
+        let (addr, server) = server(&[
+            "HTTP/1.1 400 Bad Request\r\nContent-Length: 17\r\n\r\ninvalid field 'x'",
+            "HTTP/1.1 204 No Content\r\n\r\n",
+        ])
+        .await;
+        let writer = InfluxWriter::new(&format!("http://{}/write", addr)).unwrap();
+
+        match writer.write(&[xiaomi_record(1)]).await {
+            Err(SinkError::HttpStatus(400)) => {}
+            other => panic!("unexpected result: {:?}", other),
+        }
+
+        // The failed request does not fail the next one
+        writer.write(&[xiaomi_record(1)]).await.unwrap();
+        assert_eq!(server.lock().unwrap().requests.len(), 2);
+    }
+
+    #[tokio::test]
+    async fn write_timeout() {
+        let listener = TcpListener::bind("127.0.0.1:0").await.unwrap();
+        let addr = listener.local_addr().unwrap();
+        let mut writer = InfluxWriter::new(&format!("http://{}/write", addr)).unwrap();
+        writer.set_timeout(Duration::from_millis(50));
+
+        // Accepted by the backlog, never answered
+        assert!(matches!(
+            writer.write(&[xiaomi_record(1)]).await,
+            Err(SinkError::Timeout)
+        ));
+    }
+}
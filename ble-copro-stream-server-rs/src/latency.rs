@@ -0,0 +1,124 @@
+use std::fmt::Display;
+
+use byteorder::{ByteOrder, LittleEndian};
+
+use crate::{stream_channel::StreamChannelError, StreamChannelHandler};
+
+/// Stage of the firmware advertisement to socket pipeline
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum LatencyStage {
+    /// Advertisement parsing, from `device_found()`
+    Decode,
+    /// Record serialization
+    Serialize,
+    /// `k_msgq_put()`
+    Enqueue,
+    /// Wait in the channel queue until the stream thread picks the record
+    Queue,
+    /// Socket send
+    Send,
+    /// From `device_found()` to the end of the socket send
+    Total,
+    /// CPU time of the stream thread during the send, the difference with
+    /// `Send` is the time it was blocked or preempted
+    SendCpu,
+    Unknown(u8),
+}
+
+/// Log2 histogram of the durations of a stage, bucket 0 counts durations below
+/// 1 us and bucket i durations in [2^(i-1), 2^i) us, the last one is open ended.
+#[derive(Debug, Clone)]
+pub struct LatencyHistogram {
+    pub version: u8,
+    pub stage: LatencyStage,
+    pub count: u32,
+    pub sum_us: u64,
+    pub max_us: u32,
+    pub buckets: Vec<u32>,
+}
+
+impl LatencyHistogram {
+    pub fn mean_us(&self) -> f64 {
+        if self.count == 0 {
+            0.0
+        } else {
+            self.sum_us as f64 / self.count as f64
+        }
+    }
+
+    /// Upper bound (us) of the bucket holding the `q` quantile (0..=1)
+    pub fn quantile_upper_us(&self, q: f64) -> u64 {
+        let target = (q.clamp(0.0, 1.0) * self.count as f64).ceil() as u64;
+        let mut seen = 0u64;
+
+        for (i, &n) in self.buckets.iter().enumerate() {
+            seen += n as u64;
+            if seen >= target && n > 0 {
+                return 1u64 << i;
+            }
+        }
+
+        self.max_us as u64
+    }
+}
+
+impl Display for LatencyHistogram {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        write!(
+            f,
+            "{:?}: count: {} mean: {:.1} us p50 <= {} us p99 <= {} us max: {} us",
+            self.stage,
+            self.count,
+            self.mean_us(),
+            self.quantile_upper_us(0.5),
+            self.quantile_upper_us(0.99),
+            self.max_us
+        )
+    }
+}
+
+pub struct LatencyHandler;
+
+const LATENCY_RECORD_HEADER_SIZE: usize = 19;
+
+impl StreamChannelHandler for LatencyHandler {
+    const CHANNEL_ID: u32 = 0x6c7a0e51;
+    type Message = LatencyHistogram;
+
+    fn parse_message(data: &[u8]) -> Result<Self::Message, StreamChannelError> {
+        if data.len() < LATENCY_RECORD_HEADER_SIZE {
+            return Err(StreamChannelError::InvalidMessageLength);
+        }
+
+        let buckets_count = data[2] as usize;
+        if data.len() < LATENCY_RECORD_HEADER_SIZE + 4 * buckets_count {
+            return Err(StreamChannelError::InvalidMessageLength);
+        }
+
+        let stage = match data[0] {
+            0 => LatencyStage::Decode,
+            1 => LatencyStage::Serialize,
+            2 => LatencyStage::Enqueue,
+            3 => LatencyStage::Queue,
+            4 => LatencyStage::Send,
+            5 => LatencyStage::Total,
+            6 => LatencyStage::SendCpu,
+            other => LatencyStage::Unknown(other),
+        };
+
+        let buckets = data[LATENCY_RECORD_HEADER_SIZE..]
+            .chunks_exact(4)
+            .take(buckets_count)
+            .map(LittleEndian::read_u32)
+            .collect();
+
+        Ok(LatencyHistogram {
+            version: data[1],
+            stage,
+            count: LittleEndian::read_u32(&data[3..7]),
+            sum_us: LittleEndian::read_u64(&data[7..15]),
+            max_us: LittleEndian::read_u32(&data[15..19]),
+            buckets,
+        })
+    }
+}
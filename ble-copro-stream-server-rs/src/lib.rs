@@ -1,12 +1,39 @@
+#[cfg(feature = "arrow")]
+pub mod arrow_ffi;
 pub mod ble;
+pub mod cache;
+#[cfg(feature = "capture")]
+pub mod capture;
+pub mod columnar;
+pub mod config_client;
 pub mod control_channel;
+pub mod device_health;
+pub mod frame;
+#[cfg(feature = "sink")]
+pub mod influx;
+pub mod latency;
 pub mod linky;
+pub mod merge;
+pub mod metrics;
+#[cfg(feature = "sink")]
+pub mod mqtt;
+pub mod raw_frame;
+#[cfg(feature = "serial")]
+pub mod serial;
+pub mod series;
+#[cfg(feature = "sink")]
+pub mod sink;
+pub mod snapshot;
+#[cfg(feature = "storage")]
+pub mod store;
 pub mod stream_channel;
 pub mod stream_message;
 pub mod stream_server;
 pub mod timestamp;
 pub mod xiaomi;
 
+pub use config_client::{ConfigClient, ConfigError, ConfigKey};
+pub use raw_frame::{RawFrame, RawFrameWriter};
 pub use stream_channel::StreamChannelError;
 pub use stream_server::{ServerError, StreamServer, DEFAULT_LISTEN_IP, DEFAULT_LISTEN_PORT};
 pub use timestamp::Timestamp;
@@ -4,7 +4,7 @@ use byteorder::{ByteOrder, LittleEndian};
 
 use crate::{ble::BleAddress, StreamChannelError, StreamChannelHandler, Timestamp};
 
-#[derive(Debug)]
+#[derive(Debug, Clone)]
 pub struct LinkyTicMeasurements {
     pub base: u32,
     pub iinst: u16,
@@ -22,7 +22,7 @@ impl Display for LinkyTicMeasurements {
     }
 }
 
-#[derive(Debug)]
+#[derive(Debug, Clone)]
 pub struct LinkyTicInfos {
     pub acdo: String,
     pub imax: u16,
@@ -39,7 +39,7 @@ impl Display for LinkyTicInfos {
     }
 }
 
-#[derive(Debug)]
+#[derive(Debug, Clone)]
 pub struct LinkyTicRecord {
     pub version: u8,
     pub ble_addr: BleAddress,
@@ -0,0 +1,376 @@
+//! Merge of the records received from several dongles covering overlapping
+//! areas.
+//!
+//! A sensor advertisement heard by N dongles reaches the host N times, with
+//! different RSSI and device uptime timestamps. [`RecordMerger`] sits after the
+//! receive path of all the channels: it holds every Xiaomi and Linky TIC record
+//! for a bounded window and emits a single copy of each measurement, the one
+//! heard with the best RSSI.
+//!
+//! The records carry no measurement counter, a measurement is identified by
+//! the device address and its values: copies received within the window of
+//! the first one are duplicates. Advertisements repeated by the sensor itself
+//! are merged the same way. Other messages (control, device health, latency)
+//! are passed through.
+
+use std::collections::{HashMap, VecDeque};
+use std::time::{Duration, Instant};
+
+use crate::ble::BleAddress;
+use crate::stream_message::ChannelMessage;
+
+pub const DEFAULT_MERGE_WINDOW: Duration = Duration::from_millis(500);
+
+/// Upper bound of the records held, the oldest ones are emitted early beyond
+pub const DEFAULT_MERGE_CAPACITY: usize = 4096;
+
+/// Values identifying a measurement of a device
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
+enum MeasurementKey {
+    Xiaomi {
+        temperature: u32,
+        humidity: u32,
+        battery_mv: u16,
+    },
+    LinkyTic {
+        base: u32,
+        papp: u32,
+        iinst: u16,
+        ptec: u16,
+    },
+}
+
+type Key = (BleAddress, MeasurementKey);
+
+fn message_key(message: &ChannelMessage) -> Option<(Key, i8)> {
+    match message {
+        ChannelMessage::Xiaomi(record) => Some((
+            (
+                record.ble_addr,
+                MeasurementKey::Xiaomi {
+                    temperature: record.measurement.temperature.to_bits(),
+                    humidity: record.measurement.humidity.to_bits(),
+                    battery_mv: record.measurement.battery_mv,
+                },
+            ),
+            record.measurement.rssi,
+        )),
+        ChannelMessage::LinkyTic(record) => Some((
+            (
+                record.ble_addr,
+                MeasurementKey::LinkyTic {
+                    base: record.measurement.base,
+                    papp: record.measurement.papp,
+                    iinst: record.measurement.iinst,
+                    ptec: record.measurement.ptec,
+                },
+            ),
+            record.rssi,
+        )),
+        _ => None,
+    }
+}
+
+struct Pending {
+    /// Best copy so far
+    message: ChannelMessage,
+    rssi: i8,
+}
+
+#[derive(Debug, Clone, Copy, Default)]
+pub struct MergeStats {
+    /// Records pushed
+    pub received: u64,
+    /// Records emitted, one per measurement
+    pub emitted: u64,
+    /// Copies merged into an already held record
+    pub duplicates: u64,
+    /// Held copies replaced by one with a better RSSI
+    pub replaced: u64,
+    /// Records emitted before the end of their window, because of the capacity
+    pub evicted: u64,
+}
+
+impl MergeStats {
+    /// Ratio of the records received that were dropped as duplicates
+    pub fn duplicate_ratio(&self) -> f32 {
+        if self.received == 0 {
+            0.0
+        } else {
+            self.duplicates as f32 / self.received as f32
+        }
+    }
+}
+
+pub struct RecordMerger {
+    window: Duration,
+    capacity: usize,
+    pending: HashMap<Key, Pending>,
+    /// Keys in arrival order of their first copy, hence of expiry
+    expiries: VecDeque<(Instant, Key)>,
+    stats: MergeStats,
+}
+
+impl Default for RecordMerger {
+    fn default() -> Self {
+        Self::new(DEFAULT_MERGE_WINDOW, DEFAULT_MERGE_CAPACITY)
+    }
+}
+
+impl RecordMerger {
+    /// Records are held `window` after their first copy, a window longer than
+    /// the spread of arrival times across dongles (a few tens of ms over USB)
+    /// but shorter than the sensors advertising interval is a good fit.
+    pub fn new(window: Duration, capacity: usize) -> RecordMerger {
+        RecordMerger {
+            window,
+            capacity: capacity.max(1),
+            pending: HashMap::new(),
+            expiries: VecDeque::new(),
+            stats: MergeStats::default(),
+        }
+    }
+
+    pub fn stats(&self) -> MergeStats {
+        self.stats
+    }
+
+    /// Number of records held
+    pub fn len(&self) -> usize {
+        self.pending.len()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.pending.is_empty()
+    }
+
+    /// Push a message received at `now` from any channel. Returns the records
+    /// whose window elapsed at `now`, the records evicted to stay within
+    /// capacity and the message itself if it is not merged.
+    ///
+    /// The expired records are emitted on every push, a steady flow of messages
+    /// does not delay them. `flush_expired()` is only needed when no message
+    /// comes in, see `deadline()`.
+    pub fn push(&mut self, message: ChannelMessage, now: Instant) -> Vec<ChannelMessage> {
+        let mut messages = self.flush_expired(now);
+
+        let Some((key, rssi)) = message_key(&message) else {
+            messages.push(message);
+            return messages;
+        };
+
+        self.stats.received += 1;
+
+        if let Some(pending) = self.pending.get_mut(&key) {
+            self.stats.duplicates += 1;
+
+            if rssi > pending.rssi {
+                pending.message = message;
+                pending.rssi = rssi;
+                self.stats.replaced += 1;
+            }
+
+            return messages;
+        }
+
+        while self.pending.len() >= self.capacity {
+            match self.pop_front() {
+                Some(message) => {
+                    self.stats.evicted += 1;
+                    messages.push(message);
+                }
+                None => break,
+            }
+        }
+
+        self.pending.insert(key, Pending { message, rssi });
+        self.expiries.push_back((now + self.window, key));
+
+        messages
+    }
+
+    fn pop_front(&mut self) -> Option<ChannelMessage> {
+        let (_, key) = self.expiries.pop_front()?;
+        let pending = self.pending.remove(&key)?;
+        self.stats.emitted += 1;
+        Some(pending.message)
+    }
+
+    /// Time at which the oldest held record must be emitted, to be used as the
+    /// receive timeout
+    pub fn deadline(&self) -> Option<Instant> {
+        self.expiries.front().map(|(expiry, _)| *expiry)
+    }
+
+    /// Emit the records whose window elapsed at `now`, in arrival order
+    pub fn flush_expired(&mut self, now: Instant) -> Vec<ChannelMessage> {
+        let mut messages = Vec::new();
+
+        while self.deadline().is_some_and(|expiry| expiry <= now) {
+            messages.extend(self.pop_front());
+        }
+
+        messages
+    }
+
+    /// Emit every held record, e.g. on shutdown
+    pub fn flush(&mut self) -> Vec<ChannelMessage> {
+        let mut messages = Vec::with_capacity(self.pending.len());
+
+        while let Some(message) = self.pop_front() {
+            messages.push(message);
+        }
+
+        messages
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use byteorder::{ByteOrder, LittleEndian};
+
+    use crate::device_health::DeviceHealthHandler;
+    use crate::xiaomi::XiaomiHandler;
+    use crate::StreamChannelHandler;
+
+    const WINDOW: Duration = Duration::from_millis(500);
+
+    fn xiaomi(device: u8, temperature: i16, rssi: i8) -> ChannelMessage {
+        let mut data = [0u8; 24];
+        data[0..6].copy_from_slice(&[0xa4, 0xc1, 0x38, 0x00, 0x00, device]);
+        data[7] = rssi as u8;
+        LittleEndian::write_i16(&mut data[17..19], temperature);
+
+        ChannelMessage::Xiaomi(XiaomiHandler::parse_message(&data).unwrap())
+    }
+
+    fn health() -> ChannelMessage {
+        ChannelMessage::DeviceHealth(DeviceHealthHandler::parse_message(&[0u8; 49]).unwrap())
+    }
+
+    fn rssi(message: &ChannelMessage) -> i8 {
+        match message {
+            ChannelMessage::Xiaomi(record) => record.measurement.rssi,
+            other => panic!("unexpected message: {:?}", other),
+        }
+    }
+
+    #[test]
+    fn duplicates_merged() {
+        let mut merger = RecordMerger::new(WINDOW, 16);
+        let t0 = Instant::now();
+
+        assert!(merger.push(xiaomi(1, 2150, -70), t0).is_empty());
+        assert!(merger
+            .push(xiaomi(1, 2150, -80), t0 + Duration::from_millis(20))
+            .is_empty());
+        // Another measurement of the same device, and another device
+        assert!(merger
+            .push(xiaomi(1, 2160, -70), t0 + Duration::from_millis(30))
+            .is_empty());
+        assert!(merger
+            .push(xiaomi(2, 2150, -70), t0 + Duration::from_millis(40))
+            .is_empty());
+        assert_eq!(merger.len(), 3);
+        assert_eq!(merger.deadline(), Some(t0 + WINDOW));
+
+        let messages = merger.flush_expired(t0 + WINDOW + Duration::from_millis(40));
+        assert_eq!(messages.len(), 3);
+        assert!(merger.is_empty());
+
+        let stats = merger.stats();
+        assert_eq!(stats.received, 4);
+        assert_eq!(stats.emitted, 3);
+        assert_eq!(stats.duplicates, 1);
+        assert_eq!(stats.replaced, 0);
+        assert_eq!(stats.duplicate_ratio(), 0.25);
+    }
+
+    #[test]
+    fn best_rssi_replaces() {
+        let mut merger = RecordMerger::new(WINDOW, 16);
+        let t0 = Instant::now();
+
+        merger.push(xiaomi(1, 2150, -80), t0);
+        merger.push(xiaomi(1, 2150, -60), t0 + Duration::from_millis(10));
+        merger.push(xiaomi(1, 2150, -70), t0 + Duration::from_millis(20));
+
+        let messages = merger.flush();
+        assert_eq!(messages.len(), 1);
+        assert_eq!(rssi(&messages[0]), -60);
+        assert_eq!(merger.stats().replaced, 1);
+        assert_eq!(merger.stats().duplicates, 2);
+    }
+
+    #[test]
+    fn copy_after_window() {
+        let mut merger = RecordMerger::new(WINDOW, 16);
+        let t0 = Instant::now();
+
+        merger.push(xiaomi(1, 2150, -70), t0);
+
+        // The held copy is emitted by the push itself, the late copy is held
+        // as a new measurement
+        let messages = merger.push(xiaomi(1, 2150, -60), t0 + WINDOW);
+        assert_eq!(messages.len(), 1);
+        assert_eq!(rssi(&messages[0]), -70);
+        assert_eq!(merger.len(), 1);
+        assert_eq!(merger.stats().duplicates, 0);
+        assert_eq!(merger.deadline(), Some(t0 + 2 * WINDOW));
+    }
+
+    #[test]
+    fn expired_under_traffic() {
+        let mut merger = RecordMerger::new(WINDOW, 4096);
+        let t0 = Instant::now();
+        let mut emitted = 0;
+
+        // A new measurement every 10 ms, without ever calling flush_expired()
+        for i in 0..200u64 {
+            let now = t0 + Duration::from_millis(i * 10);
+            emitted += merger.push(xiaomi(1, i as i16, -70), now).len();
+            assert!(merger.deadline().unwrap() > now);
+        }
+
+        assert_eq!(emitted, 150);
+        assert_eq!(merger.stats().evicted, 0);
+    }
+
+    #[test]
+    fn capacity_eviction() {
+        let mut merger = RecordMerger::new(WINDOW, 2);
+        let t0 = Instant::now();
+
+        assert!(merger.push(xiaomi(1, 2150, -70), t0).is_empty());
+        assert!(merger.push(xiaomi(2, 2150, -70), t0).is_empty());
+
+        // The oldest record is emitted early to make room
+        let messages = merger.push(xiaomi(3, 2150, -70), t0);
+        assert_eq!(messages.len(), 1);
+        match &messages[0] {
+            ChannelMessage::Xiaomi(record) => assert_eq!(record.ble_addr.mac[5], 1),
+            other => panic!("unexpected message: {:?}", other),
+        }
+        assert_eq!(merger.len(), 2);
+        assert_eq!(merger.stats().evicted, 1);
+    }
+
+    #[test]
+    fn pass_through() {
+        let mut merger = RecordMerger::new(WINDOW, 16);
+        let t0 = Instant::now();
+
+        merger.push(xiaomi(1, 2150, -70), t0);
+
+        let messages = merger.push(health(), t0 + Duration::from_millis(10));
+        assert_eq!(messages.len(), 1);
+        assert!(matches!(messages[0], ChannelMessage::DeviceHealth(_)));
+
+        // Held records expire ahead of the message
+        let messages = merger.push(health(), t0 + WINDOW);
+        assert_eq!(messages.len(), 2);
+        assert!(matches!(messages[0], ChannelMessage::Xiaomi(_)));
+        assert_eq!(merger.stats().received, 1);
+    }
+}
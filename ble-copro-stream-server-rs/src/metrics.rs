@@ -0,0 +1,797 @@
+//! Ingest metrics: atomic counters per channel, per connection and per error
+//! kind, and log-linear (HDR-style) histograms of parse time and inter-arrival
+//! gaps.
+//!
+//! Recording only touches atomics (plus a read lock to find the channel), so a
+//! registry can be shared among all connections of a server. [`MetricsRegistry::snapshot`]
+//! gives a point-in-time copy, [`MetricsRegistry::render_prometheus`] the text
+//! exposition format.
+
+use std::collections::HashMap;
+use std::fmt::Write;
+use std::net::SocketAddr;
+use std::sync::atomic::{AtomicBool, AtomicU64, Ordering};
+use std::sync::{Arc, Mutex, RwLock, Weak};
+use std::time::Instant;
+
+use crate::StreamChannelError;
+
+/// Histogram precision: 2^SUB_BUCKET_BITS buckets per power of two (12.5 %
+/// relative error)
+const SUB_BUCKET_BITS: u32 = 3;
+const SUB_BUCKETS: usize = 1 << SUB_BUCKET_BITS;
+const HISTOGRAM_BUCKETS: usize = SUB_BUCKETS + (64 - SUB_BUCKET_BITS as usize) * SUB_BUCKETS;
+
+/// Prometheus buckets: one per power of two up to 2^PROMETHEUS_BUCKETS_EXP_MAX
+/// (~18 min in ns, ~12 days in us), larger values only count in `+Inf`
+const PROMETHEUS_BUCKETS_EXP_MAX: u32 = 40;
+
+fn bucket_index(value: u64) -> usize {
+    if value < SUB_BUCKETS as u64 {
+        return value as usize;
+    }
+
+    let exp = 63 - value.leading_zeros();
+    let mantissa = (value >> (exp - SUB_BUCKET_BITS)) as usize & (SUB_BUCKETS - 1);
+    SUB_BUCKETS + (exp - SUB_BUCKET_BITS) as usize * SUB_BUCKETS + mantissa
+}
+
+fn bucket_lower_bound(index: usize) -> u64 {
+    if index < SUB_BUCKETS {
+        return index as u64;
+    }
+
+    let exp = ((index - SUB_BUCKETS) / SUB_BUCKETS) as u32 + SUB_BUCKET_BITS;
+    let mantissa = ((index - SUB_BUCKETS) % SUB_BUCKETS) as u64;
+    (SUB_BUCKETS as u64 + mantissa) << (exp - SUB_BUCKET_BITS)
+}
+
+fn bucket_upper_bound(index: usize) -> u64 {
+    if index + 1 < HISTOGRAM_BUCKETS {
+        bucket_lower_bound(index + 1) - 1
+    } else {
+        u64::MAX
+    }
+}
+
+pub struct Histogram {
+    buckets: Box<[AtomicU64]>,
+    count: AtomicU64,
+    sum: AtomicU64,
+    max: AtomicU64,
+}
+
+impl Default for Histogram {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl Histogram {
+    pub fn new() -> Histogram {
+        Histogram {
+            buckets: (0..HISTOGRAM_BUCKETS).map(|_| AtomicU64::new(0)).collect(),
+            count: AtomicU64::new(0),
+            sum: AtomicU64::new(0),
+            max: AtomicU64::new(0),
+        }
+    }
+
+    pub fn record(&self, value: u64) {
+        self.buckets[bucket_index(value)].fetch_add(1, Ordering::Relaxed);
+        self.count.fetch_add(1, Ordering::Relaxed);
+        self.sum.fetch_add(value, Ordering::Relaxed);
+        self.max.fetch_max(value, Ordering::Relaxed);
+    }
+
+    pub fn snapshot(&self) -> HistogramSnapshot {
+        let buckets = self
+            .buckets
+            .iter()
+            .enumerate()
+            .filter_map(|(i, bucket)| match bucket.load(Ordering::Relaxed) {
+                0 => None,
+                count => Some((bucket_upper_bound(i), count)),
+            })
+            .collect();
+
+        HistogramSnapshot {
+            buckets,
+            count: self.count.load(Ordering::Relaxed),
+            sum: self.sum.load(Ordering::Relaxed),
+            max: self.max.load(Ordering::Relaxed),
+        }
+    }
+}
+
+#[derive(Debug, Clone, Default)]
+pub struct HistogramSnapshot {
+    /// Non-empty buckets as (inclusive upper bound, count), in increasing order
+    pub buckets: Vec<(u64, u64)>,
+    pub count: u64,
+    pub sum: u64,
+    pub max: u64,
+}
+
+impl HistogramSnapshot {
+    pub fn mean(&self) -> f64 {
+        match self.count {
+            0 => 0.0,
+            count => self.sum as f64 / count as f64,
+        }
+    }
+
+    /// Upper bound of the bucket containing the `q` quantile (0.0 ..= 1.0)
+    pub fn quantile(&self, q: f64) -> u64 {
+        let rank = (q.clamp(0.0, 1.0) * self.count as f64).ceil() as u64;
+        let mut seen = 0;
+
+        for &(upper, count) in &self.buckets {
+            seen += count;
+            if seen >= rank.max(1) {
+                return upper.min(self.max);
+            }
+        }
+
+        self.max
+    }
+}
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum ErrorKind {
+    InvalidMessageHeader,
+    InvalidMessageData,
+    InvalidMessageLength,
+    UnhandledChannelId,
+    Io,
+}
+
+impl ErrorKind {
+    pub const ALL: [ErrorKind; 5] = [
+        ErrorKind::InvalidMessageHeader,
+        ErrorKind::InvalidMessageData,
+        ErrorKind::InvalidMessageLength,
+        ErrorKind::UnhandledChannelId,
+        ErrorKind::Io,
+    ];
+
+    pub fn label(&self) -> &'static str {
+        match self {
+            ErrorKind::InvalidMessageHeader => "invalid_message_header",
+            ErrorKind::InvalidMessageData => "invalid_message_data",
+            ErrorKind::InvalidMessageLength => "invalid_message_length",
+            ErrorKind::UnhandledChannelId => "unhandled_channel_id",
+            ErrorKind::Io => "io",
+        }
+    }
+}
+
+impl From<&StreamChannelError> for ErrorKind {
+    fn from(error: &StreamChannelError) -> Self {
+        match error {
+            StreamChannelError::InvalidMessageHeader => ErrorKind::InvalidMessageHeader,
+            StreamChannelError::InvalidMessageData => ErrorKind::InvalidMessageData,
+            StreamChannelError::InvalidMessageLength => ErrorKind::InvalidMessageLength,
+            StreamChannelError::UnhandledChannelId => ErrorKind::UnhandledChannelId,
+            StreamChannelError::IoError(_) => ErrorKind::Io,
+        }
+    }
+}
+
+pub struct ChannelMetrics {
+    frames: AtomicU64,
+    bytes: AtomicU64,
+    errors: AtomicU64,
+    /// Arrival time of the last frame, ns since the registry creation + 1 (0 if none)
+    last_arrival: AtomicU64,
+    /// Parse time in ns
+    pub parse_time: Histogram,
+    /// Gap between two consecutive frames of the channel in us
+    pub inter_arrival: Histogram,
+}
+
+impl ChannelMetrics {
+    fn new() -> ChannelMetrics {
+        ChannelMetrics {
+            frames: AtomicU64::new(0),
+            bytes: AtomicU64::new(0),
+            errors: AtomicU64::new(0),
+            last_arrival: AtomicU64::new(0),
+            parse_time: Histogram::new(),
+            inter_arrival: Histogram::new(),
+        }
+    }
+}
+
+pub struct ConnectionMetrics {
+    pub peer: Option<SocketAddr>,
+    pub connected_at: Instant,
+    bytes: AtomicU64,
+    frames: AtomicU64,
+    errors: AtomicU64,
+    closed: AtomicBool,
+}
+
+impl ConnectionMetrics {
+    pub fn add_bytes(&self, bytes: u64) {
+        self.bytes.fetch_add(bytes, Ordering::Relaxed);
+    }
+
+    pub fn close(&self) {
+        self.closed.store(true, Ordering::Relaxed);
+    }
+}
+
+pub struct MetricsRegistry {
+    epoch: Instant,
+    connections_total: AtomicU64,
+    bytes_total: AtomicU64,
+    skipped_bytes: AtomicU64,
+    crc_errors: AtomicU64,
+    errors: [AtomicU64; ErrorKind::ALL.len()],
+    channels: RwLock<HashMap<u32, Arc<ChannelMetrics>>>,
+    connections: Mutex<Vec<Weak<ConnectionMetrics>>>,
+}
+
+impl Default for MetricsRegistry {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl MetricsRegistry {
+    pub fn new() -> MetricsRegistry {
+        MetricsRegistry {
+            epoch: Instant::now(),
+            connections_total: AtomicU64::new(0),
+            bytes_total: AtomicU64::new(0),
+            skipped_bytes: AtomicU64::new(0),
+            crc_errors: AtomicU64::new(0),
+            errors: Default::default(),
+            channels: RwLock::new(HashMap::new()),
+            connections: Mutex::new(Vec::new()),
+        }
+    }
+
+    pub fn channel(&self, channel_id: u32) -> Arc<ChannelMetrics> {
+        if let Some(channel) = self
+            .channels
+            .read()
+            .unwrap_or_else(|e| e.into_inner())
+            .get(&channel_id)
+        {
+            return channel.clone();
+        }
+
+        self.channels
+            .write()
+            .unwrap_or_else(|e| e.into_inner())
+            .entry(channel_id)
+            .or_insert_with(|| Arc::new(ChannelMetrics::new()))
+            .clone()
+    }
+
+    /// Register a new connection, the returned handle is owned by the channel
+    /// and the connection disappears from snapshots once it is dropped.
+    pub fn connection(&self, peer: Option<SocketAddr>) -> Arc<ConnectionMetrics> {
+        let connection = Arc::new(ConnectionMetrics {
+            peer,
+            connected_at: Instant::now(),
+            bytes: AtomicU64::new(0),
+            frames: AtomicU64::new(0),
+            errors: AtomicU64::new(0),
+            closed: AtomicBool::new(false),
+        });
+
+        self.connections_total.fetch_add(1, Ordering::Relaxed);
+        self.connections
+            .lock()
+            .unwrap_or_else(|e| e.into_inner())
+            .push(Arc::downgrade(&connection));
+
+        connection
+    }
+
+    /// Record a received frame (header included in `bytes`) and the time it
+    /// took to parse it, `None` if it was not parsed (raw frames).
+    pub fn record_frame(
+        &self,
+        connection: Option<&ConnectionMetrics>,
+        channel_id: u32,
+        bytes: usize,
+        arrival: Instant,
+        parse_ns: Option<u64>,
+    ) {
+        let channel = self.channel(channel_id);
+        let now = arrival.saturating_duration_since(self.epoch).as_nanos() as u64 + 1;
+        let last = channel.last_arrival.swap(now, Ordering::Relaxed);
+
+        if last != 0 && now > last {
+            channel.inter_arrival.record((now - last) / 1000);
+        }
+
+        channel.frames.fetch_add(1, Ordering::Relaxed);
+        channel.bytes.fetch_add(bytes as u64, Ordering::Relaxed);
+        if let Some(parse_ns) = parse_ns {
+            channel.parse_time.record(parse_ns);
+        }
+        self.bytes_total.fetch_add(bytes as u64, Ordering::Relaxed);
+
+        if let Some(connection) = connection {
+            connection.frames.fetch_add(1, Ordering::Relaxed);
+        }
+    }
+
+    pub fn record_error(
+        &self,
+        connection: Option<&ConnectionMetrics>,
+        channel_id: Option<u32>,
+        error: &StreamChannelError,
+    ) {
+        let kind = ErrorKind::from(error);
+        self.errors[kind as usize].fetch_add(1, Ordering::Relaxed);
+
+        if let Some(channel_id) = channel_id {
+            self.channel(channel_id)
+                .errors
+                .fetch_add(1, Ordering::Relaxed);
+        }
+
+        if let Some(connection) = connection {
+            connection.errors.fetch_add(1, Ordering::Relaxed);
+        }
+    }
+
+    /// Record bytes discarded and candidate frames rejected while resynchronising
+    /// on the v2 frame format.
+    pub fn record_resync(
+        &self,
+        connection: Option<&ConnectionMetrics>,
+        skipped_bytes: u64,
+        crc_errors: u64,
+    ) {
+        if skipped_bytes == 0 && crc_errors == 0 {
+            return;
+        }
+
+        self.skipped_bytes
+            .fetch_add(skipped_bytes, Ordering::Relaxed);
+        self.crc_errors.fetch_add(crc_errors, Ordering::Relaxed);
+
+        if let Some(connection) = connection {
+            connection.errors.fetch_add(crc_errors, Ordering::Relaxed);
+        }
+    }
+
+    pub fn snapshot(&self) -> MetricsSnapshot {
+        let mut channels: Vec<_> = self
+            .channels
+            .read()
+            .unwrap_or_else(|e| e.into_inner())
+            .iter()
+            .map(|(&channel_id, channel)| ChannelSnapshot {
+                channel_id,
+                frames: channel.frames.load(Ordering::Relaxed),
+                bytes: channel.bytes.load(Ordering::Relaxed),
+                errors: channel.errors.load(Ordering::Relaxed),
+                parse_time_ns: channel.parse_time.snapshot(),
+                inter_arrival_us: channel.inter_arrival.snapshot(),
+            })
+            .collect();
+        channels.sort_by_key(|channel| channel.channel_id);
+
+        let connections = {
+            let mut connections = self.connections.lock().unwrap_or_else(|e| e.into_inner());
+            connections.retain(|c| c.strong_count() > 0);
+            connections
+                .iter()
+                .filter_map(Weak::upgrade)
+                .filter(|c| !c.closed.load(Ordering::Relaxed))
+                .map(|c| ConnectionSnapshot {
+                    peer: c.peer,
+                    uptime_s: c.connected_at.elapsed().as_secs(),
+                    bytes: c.bytes.load(Ordering::Relaxed),
+                    frames: c.frames.load(Ordering::Relaxed),
+                    errors: c.errors.load(Ordering::Relaxed),
+                })
+                .collect()
+        };
+
+        MetricsSnapshot {
+            connections_total: self.connections_total.load(Ordering::Relaxed),
+            bytes_total: self.bytes_total.load(Ordering::Relaxed),
+            skipped_bytes: self.skipped_bytes.load(Ordering::Relaxed),
+            crc_errors: self.crc_errors.load(Ordering::Relaxed),
+            errors: ErrorKind::ALL
+                .iter()
+                .map(|&kind| (kind, self.errors[kind as usize].load(Ordering::Relaxed)))
+                .collect(),
+            channels,
+            connections,
+        }
+    }
+
+    pub fn render_prometheus(&self) -> String {
+        self.snapshot().to_prometheus()
+    }
+}
+
+#[derive(Debug, Clone)]
+pub struct ChannelSnapshot {
+    pub channel_id: u32,
+    pub frames: u64,
+    pub bytes: u64,
+    pub errors: u64,
+    pub parse_time_ns: HistogramSnapshot,
+    pub inter_arrival_us: HistogramSnapshot,
+}
+
+#[derive(Debug, Clone)]
+pub struct ConnectionSnapshot {
+    pub peer: Option<SocketAddr>,
+    pub uptime_s: u64,
+    pub bytes: u64,
+    pub frames: u64,
+    pub errors: u64,
+}
+
+#[derive(Debug, Clone)]
+pub struct MetricsSnapshot {
+    pub connections_total: u64,
+    pub bytes_total: u64,
+    pub skipped_bytes: u64,
+    pub crc_errors: u64,
+    pub errors: Vec<(ErrorKind, u64)>,
+    pub channels: Vec<ChannelSnapshot>,
+    pub connections: Vec<ConnectionSnapshot>,
+}
+
+fn write_histogram(
+    out: &mut String,
+    name: &str,
+    labels: &str,
+    histogram: &HistogramSnapshot,
+    scale: f64,
+) {
+    let mut buckets = histogram.buckets.iter().peekable();
+    let mut cumulative = 0;
+
+    // Fixed bounds so that every series exists from the first scrape, the
+    // histogram buckets never straddle a power of two.
+    for exp in 0..=PROMETHEUS_BUCKETS_EXP_MAX {
+        let le = (1u64 << exp) - 1;
+
+        while let Some((_, count)) = buckets.next_if(|&&(upper, _)| upper <= le) {
+            cumulative += count;
+        }
+
+        let _ = writeln!(
+            out,
+            "{}_bucket{{{},le=\"{}\"}} {}",
+            name,
+            labels,
+            le as f64 * scale,
+            cumulative
+        );
+    }
+
+    let _ = writeln!(
+        out,
+        "{}_bucket{{{},le=\"+Inf\"}} {}",
+        name, labels, histogram.count
+    );
+    let _ = writeln!(
+        out,
+        "{}_sum{{{}}} {}",
+        name,
+        labels,
+        histogram.sum as f64 * scale
+    );
+    let _ = writeln!(out, "{}_count{{{}}} {}", name, labels, histogram.count);
+}
+
+impl MetricsSnapshot {
+    pub fn to_prometheus(&self) -> String {
+        let mut out = String::new();
+
+        let _ = writeln!(out, "# TYPE ble_copro_connections_total counter");
+        let _ = writeln!(
+            out,
+            "ble_copro_connections_total {}",
+            self.connections_total
+        );
+        let _ = writeln!(out, "# TYPE ble_copro_connections_active gauge");
+        let _ = writeln!(
+            out,
+            "ble_copro_connections_active {}",
+            self.connections.len()
+        );
+        let _ = writeln!(out, "# TYPE ble_copro_bytes_total counter");
+        let _ = writeln!(out, "ble_copro_bytes_total {}", self.bytes_total);
+
+        let _ = writeln!(out, "# TYPE ble_copro_skipped_bytes_total counter");
+        let _ = writeln!(out, "ble_copro_skipped_bytes_total {}", self.skipped_bytes);
+        let _ = writeln!(out, "# TYPE ble_copro_crc_errors_total counter");
+        let _ = writeln!(out, "ble_copro_crc_errors_total {}", self.crc_errors);
+
+        let _ = writeln!(out, "# TYPE ble_copro_errors_total counter");
+        for (kind, count) in &self.errors {
+            let _ = writeln!(
+                out,
+                "ble_copro_errors_total{{kind=\"{}\"}} {}",
+                kind.label(),
+                count
+            );
+        }
+
+        let _ = writeln!(out, "# TYPE ble_copro_channel_frames_total counter");
+        for c in &self.channels {
+            let _ = writeln!(
+                out,
+                "ble_copro_channel_frames_total{{channel=\"0x{:08x}\"}} {}",
+                c.channel_id, c.frames
+            );
+        }
+
+        let _ = writeln!(out, "# TYPE ble_copro_channel_bytes_total counter");
+        for c in &self.channels {
+            let _ = writeln!(
+                out,
+                "ble_copro_channel_bytes_total{{channel=\"0x{:08x}\"}} {}",
+                c.channel_id, c.bytes
+            );
+        }
+
+        let _ = writeln!(out, "# TYPE ble_copro_channel_errors_total counter");
+        for c in &self.channels {
+            let _ = writeln!(
+                out,
+                "ble_copro_channel_errors_total{{channel=\"0x{:08x}\"}} {}",
+                c.channel_id, c.errors
+            );
+        }
+
+        let _ = writeln!(out, "# TYPE ble_copro_parse_time_seconds histogram");
+        for c in &self.channels {
+            let labels = format!("channel=\"0x{:08x}\"", c.channel_id);
+            write_histogram(
+                &mut out,
+                "ble_copro_parse_time_seconds",
+                &labels,
+                &c.parse_time_ns,
+                1e-9,
+            );
+        }
+
+        let _ = writeln!(out, "# TYPE ble_copro_inter_arrival_seconds histogram");
+        for c in &self.channels {
+            let labels = format!("channel=\"0x{:08x}\"", c.channel_id);
+            write_histogram(
+                &mut out,
+                "ble_copro_inter_arrival_seconds",
+                &labels,
+                &c.inter_arrival_us,
+                1e-6,
+            );
+        }
+
+        let _ = writeln!(out, "# TYPE ble_copro_connection_bytes_total counter");
+        for c in &self.connections {
+            let peer = c.peer.map(|p| p.to_string()).unwrap_or_default();
+            let _ = writeln!(
+                out,
+                "ble_copro_connection_bytes_total{{peer=\"{}\"}} {}",
+                peer, c.bytes
+            );
+        }
+
+        let _ = writeln!(out, "# TYPE ble_copro_connection_frames_total counter");
+        for c in &self.connections {
+            let peer = c.peer.map(|p| p.to_string()).unwrap_or_default();
+            let _ = writeln!(
+                out,
+                "ble_copro_connection_frames_total{{peer=\"{}\"}} {}",
+                peer, c.frames
+            );
+        }
+
+        out
+    }
+}
+
+/// Serve the registry in the Prometheus text format on `127.0.0.1:port`, any
+/// request gets the current metrics. Runs until an accept error occurs.
+#[cfg(feature = "prometheus")]
+pub async fn serve_prometheus(registry: Arc<MetricsRegistry>, port: u16) -> std::io::Result<()> {
+    use tokio::io::{AsyncReadExt, AsyncWriteExt};
+
+    let listener = tokio::net::TcpListener::bind(("127.0.0.1", port)).await?;
+
+    loop {
+        let (mut stream, _addr) = listener.accept().await?;
+        let registry = registry.clone();
+
+        tokio::spawn(async move {
+            // The request itself is not interpreted
+            let mut request = [0; 1024];
+            let _ = stream.read(&mut request).await;
+
+            let body = registry.render_prometheus();
+            let response = format!(
+                "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: {}\r\nConnection: close\r\n\r\n{}",
+                body.len(),
+                body
+            );
+            let _ = stream.write_all(response.as_bytes()).await;
+        });
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// (le, cumulative count) of the `name` histogram buckets in `text`
+    fn buckets(text: &str, name: &str) -> Vec<(f64, u64)> {
+        let prefix = format!("{}_bucket{{", name);
+
+        text.lines()
+            .filter_map(|line| line.strip_prefix(&prefix))
+            .map(|line| {
+                let (labels, count) = line.split_once("} ").unwrap();
+                let le = labels.split("le=\"").nth(1).unwrap().trim_end_matches('"');
+                let le = if le == "+Inf" {
+                    f64::INFINITY
+                } else {
+                    le.parse().unwrap()
+                };
+                (le, count.parse().unwrap())
+            })
+            .collect()
+    }
+
+    #[test]
+    fn bucket_bounds_round_trip() {
+        assert_eq!(bucket_lower_bound(0), 0);
+        assert_eq!(bucket_upper_bound(HISTOGRAM_BUCKETS - 1), u64::MAX);
+        assert_eq!(bucket_index(u64::MAX), HISTOGRAM_BUCKETS - 1);
+
+        for index in 0..HISTOGRAM_BUCKETS {
+            let lower = bucket_lower_bound(index);
+            let upper = bucket_upper_bound(index);
+
+            assert!(lower <= upper);
+            assert_eq!(bucket_index(lower), index);
+            assert_eq!(bucket_index(upper), index);
+            if index + 1 < HISTOGRAM_BUCKETS {
+                assert_eq!(upper + 1, bucket_lower_bound(index + 1));
+            }
+        }
+
+        // Exact below SUB_BUCKETS, then within 12.5 %
+        for value in 0..SUB_BUCKETS as u64 {
+            assert_eq!(bucket_upper_bound(bucket_index(value)), value);
+        }
+        for value in [9, 100, 1000, 123_456, 1 << 40, u64::MAX / 3] {
+            let index = bucket_index(value);
+            let width = bucket_upper_bound(index) - bucket_lower_bound(index) + 1;
+            assert!(width <= bucket_lower_bound(index) / SUB_BUCKETS as u64);
+        }
+
+        // Powers of two start a bucket, as the Prometheus bounds expect
+        for exp in 1..64 {
+            assert_eq!(bucket_lower_bound(bucket_index(1 << exp)), 1 << exp);
+        }
+    }
+
+    #[test]
+    fn histogram_snapshot() {
+        let histogram = Histogram::new();
+
+        let empty = histogram.snapshot();
+        assert!(empty.buckets.is_empty());
+        assert_eq!((empty.count, empty.sum, empty.max), (0, 0, 0));
+        assert_eq!(empty.mean(), 0.0);
+
+        for value in [0, 3, 3, 100, 101, 5000] {
+            histogram.record(value);
+        }
+
+        let snapshot = histogram.snapshot();
+        assert_eq!(snapshot.count, 6);
+        assert_eq!(snapshot.sum, 5207);
+        assert_eq!(snapshot.max, 5000);
+        assert_eq!(
+            snapshot.buckets,
+            vec![
+                (0, 1),
+                (3, 2),
+                (bucket_upper_bound(bucket_index(100)), 2),
+                (bucket_upper_bound(bucket_index(5000)), 1),
+            ]
+        );
+        assert_eq!(snapshot.quantile(0.5), 3);
+        assert_eq!(
+            snapshot.quantile(0.6),
+            bucket_upper_bound(bucket_index(100))
+        );
+        assert_eq!(snapshot.quantile(1.0), 5000);
+    }
+
+    #[test]
+    fn raw_frames_skip_parse_time() {
+        let registry = MetricsRegistry::new();
+
+        registry.record_frame(None, 1, 30, Instant::now(), None);
+        registry.record_frame(None, 1, 30, Instant::now(), Some(2000));
+
+        let snapshot = registry.snapshot();
+        let channel = &snapshot.channels[0];
+        assert_eq!(channel.frames, 2);
+        assert_eq!(channel.bytes, 60);
+        assert_eq!(channel.parse_time_ns.count, 1);
+        assert_eq!(channel.parse_time_ns.sum, 2000);
+        assert_eq!(channel.inter_arrival_us.count, 1);
+        assert_eq!(snapshot.bytes_total, 60);
+    }
+
+    #[test]
+    fn prometheus_fixed_buckets() {
+        let registry = MetricsRegistry::new();
+        let connection = registry.connection(None);
+        let name = "ble_copro_parse_time_seconds";
+
+        registry.record_frame(Some(&connection), 0xfa30fa42, 30, Instant::now(), None);
+        let before = buckets(&registry.render_prometheus(), name);
+
+        for parse_ns in [1, 1500, 1500, 3_000_000] {
+            registry.record_frame(
+                Some(&connection),
+                0xfa30fa42,
+                30,
+                Instant::now(),
+                Some(parse_ns),
+            );
+        }
+        registry.record_error(
+            Some(&connection),
+            Some(0xfa30fa42),
+            &StreamChannelError::InvalidMessageData,
+        );
+        let text = registry.render_prometheus();
+        let after = buckets(&text, name);
+
+        // Same series, empty buckets included
+        assert_eq!(after.len(), PROMETHEUS_BUCKETS_EXP_MAX as usize + 2);
+        assert_eq!(
+            before.iter().map(|b| b.0).collect::<Vec<_>>(),
+            after.iter().map(|b| b.0).collect::<Vec<_>>()
+        );
+        assert!(before.iter().all(|&(_, count)| count == 0));
+
+        // Cumulative counts, at the first bound above each value
+        assert!(after
+            .windows(2)
+            .all(|w| w[0].0 < w[1].0 && w[0].1 <= w[1].1));
+        let count_at = |le: u64| {
+            after
+                .iter()
+                .find(|b| b.0 >= le as f64 * 1e-9 * 0.999)
+                .unwrap()
+                .1
+        };
+        assert_eq!(count_at(0), 0);
+        assert_eq!(count_at(1), 1);
+        assert_eq!(count_at(1023), 1);
+        assert_eq!(count_at(2047), 3);
+        assert_eq!(count_at((1 << 22) - 1), 4);
+        assert_eq!(after.last(), Some(&(f64::INFINITY, 4)));
+
+        assert!(text.contains("ble_copro_parse_time_seconds_count{channel=\"0xfa30fa42\"} 4\n"));
+        assert!(text.contains("ble_copro_channel_frames_total{channel=\"0xfa30fa42\"} 5\n"));
+        assert!(text.contains("ble_copro_channel_errors_total{channel=\"0xfa30fa42\"} 1\n"));
+        assert!(text.contains("ble_copro_errors_total{kind=\"invalid_message_data\"} 1\n"));
+        assert!(text.contains("ble_copro_connection_frames_total{peer=\"\"} 5\n"));
+        assert!(text.contains("ble_copro_connections_active 1\n"));
+    }
+}
@@ -0,0 +1,554 @@
+//! [`SinkWriter`] publishing the records to an MQTT 3.1.1 broker (`sink`
+//! feature).
+//!
+//! Every record is published as a JSON object on
+//! `<prefix>/<mac>/<xiaomi|linky_tic|device_health>`, e.g.
+//! `ble-copro/a4c138010203/xiaomi`:
+//!
+//! ```text
+//! {"time_ms":1700000000000,"temperature":21.5,"humidity":45,"battery_mv":2950,"battery_percent":85,"rssi":-67}
+//! ```
+//!
+//! The publishes of a batch are pipelined on a single connection. With QoS 1
+//! the batch succeeds once the broker acknowledged all of them, a batch failing
+//! midway is published again from the start (at least once delivery). The
+//! batches of a writer are published one at a time on its connection.
+
+use std::collections::HashSet;
+use std::fmt::Write;
+use std::time::Duration;
+
+use tokio::io::{AsyncReadExt, AsyncWriteExt};
+use tokio::net::TcpStream;
+use tokio::sync::Mutex;
+use tokio::time::Instant;
+
+use crate::sink::{SinkError, SinkRecord, SinkWriter};
+use crate::stream_message::ChannelMessage;
+
+pub const DEFAULT_TOPIC_PREFIX: &str = "ble-copro";
+pub const DEFAULT_MQTT_TIMEOUT: Duration = Duration::from_secs(10);
+
+/// Announced in CONNECT, the broker drops the connection after 1.5 times this
+/// period without packet. Connections idle for longer are replaced instead of
+/// sending PINGREQ.
+const KEEP_ALIVE: Duration = Duration::from_secs(60);
+
+/// Publishes awaiting their PUBACK
+const PUBLISH_WINDOW: usize = 256;
+
+const PACKET_CONNECT: u8 = 0x10;
+const PACKET_CONNACK: u8 = 0x20;
+const PACKET_PUBLISH: u8 = 0x30;
+const PACKET_PUBACK: u8 = 0x40;
+
+const CONNECT_CLEAN_SESSION: u8 = 0x02;
+const CONNECT_PASSWORD: u8 = 0x40;
+const CONNECT_USERNAME: u8 = 0x80;
+
+const PUBLISH_RETAIN: u8 = 0x01;
+
+/// Remaining length of the fixed header, 7 bits per byte
+fn put_remaining_length(mut len: usize, out: &mut Vec<u8>) {
+    loop {
+        let byte = (len % 128) as u8;
+        len /= 128;
+        if len > 0 {
+            out.push(byte | 0x80);
+        } else {
+            out.push(byte);
+            break;
+        }
+    }
+}
+
+fn put_string(s: &[u8], out: &mut Vec<u8>) {
+    out.extend_from_slice(&(s.len() as u16).to_be_bytes());
+    out.extend_from_slice(s);
+}
+
+fn put_packet(packet_type: u8, body: &[u8], out: &mut Vec<u8>) {
+    out.push(packet_type);
+    put_remaining_length(body.len(), out);
+    out.extend_from_slice(body);
+}
+
+/// Topic suffix and JSON payload of `record`, None for records without MQTT
+/// representation
+pub fn encode_payload(record: &SinkRecord) -> Option<(&'static str, String)> {
+    let time_ms = record.time_ns() / 1_000_000;
+    let mut payload = String::with_capacity(128);
+
+    let kind = match &record.message {
+        ChannelMessage::Xiaomi(r) => {
+            let m = &r.measurement;
+            let _ = write!(
+                payload,
+                "{{\"time_ms\":{},\"temperature\":{},\"humidity\":{},\"battery_mv\":{},\"battery_percent\":{},\"rssi\":{}}}",
+                time_ms, m.temperature, m.humidity, m.battery_mv, m.battery_percent, m.rssi
+            );
+            "xiaomi"
+        }
+        ChannelMessage::LinkyTic(r) => {
+            let m = &r.measurement;
+            let _ = write!(
+                payload,
+                "{{\"time_ms\":{},\"base\":{},\"papp\":{},\"iinst\":{},\"ptec\":{},\"rssi\":{}}}",
+                time_ms, m.base, m.papp, m.iinst, m.ptec, r.rssi
+            );
+            "linky_tic"
+        }
+        ChannelMessage::DeviceHealth(r) => {
+            let _ = write!(
+                payload,
+                "{{\"time_ms\":{},\"event\":\"{:?}\",\"adv_count\":{},\"measurements\":{},\"missed\":{},\"suppressed\":{},\"rssi_avg\":{},\"rssi_last\":{}}}",
+                time_ms,
+                r.event,
+                r.adv_count,
+                r.measurements,
+                r.missed,
+                r.suppressed,
+                r.rssi_avg,
+                r.rssi_last
+            );
+            "device_health"
+        }
+        _ => return None,
+    };
+
+    Some((kind, payload))
+}
+
+fn record_address(record: &SinkRecord) -> Option<String> {
+    match &record.message {
+        ChannelMessage::Xiaomi(r) => Some(r.ble_addr.to_slug()),
+        ChannelMessage::LinkyTic(r) => Some(r.ble_addr.to_slug()),
+        ChannelMessage::DeviceHealth(r) => Some(r.ble_addr.to_slug()),
+        _ => None,
+    }
+}
+
+struct Connection {
+    stream: TcpStream,
+    last_used: Instant,
+    /// Last packet identifier used, 0 is reserved
+    packet_id: u16,
+}
+
+impl Connection {
+    fn next_packet_id(&mut self) -> u16 {
+        self.packet_id = self.packet_id.checked_add(1).unwrap_or(1);
+        self.packet_id
+    }
+
+    /// Read a packet, returns its first byte and body
+    async fn read_packet(&mut self) -> Result<(u8, Vec<u8>), SinkError> {
+        let header = self.stream.read_u8().await?;
+
+        let mut len = 0usize;
+        for shift in (0..28).step_by(7) {
+            let byte = self.stream.read_u8().await?;
+            len |= ((byte & 0x7f) as usize) << shift;
+            if byte & 0x80 == 0 {
+                let mut body = vec![0; len];
+                self.stream.read_exact(&mut body).await?;
+                return Ok((header, body));
+            }
+        }
+
+        Err(SinkError::InvalidResponse)
+    }
+}
+
+pub struct MqttWriter {
+    addr: String,
+    client_id: String,
+    credentials: Option<(String, String)>,
+    topic_prefix: String,
+    qos: u8,
+    retain: bool,
+    timeout: Duration,
+    connection: Mutex<Option<Connection>>,
+}
+
+impl MqttWriter {
+    /// Broker at `addr` (`host:port`), QoS 1 and no retain by default
+    pub fn new(addr: &str) -> MqttWriter {
+        MqttWriter {
+            addr: addr.to_string(),
+            client_id: format!("ble-copro-{}", std::process::id()),
+            credentials: None,
+            topic_prefix: DEFAULT_TOPIC_PREFIX.to_string(),
+            qos: 1,
+            retain: false,
+            timeout: DEFAULT_MQTT_TIMEOUT,
+            connection: Mutex::new(None),
+        }
+    }
+
+    pub fn set_client_id(&mut self, client_id: &str) {
+        self.client_id = client_id.to_string();
+    }
+
+    pub fn set_credentials(&mut self, username: &str, password: &str) {
+        self.credentials = Some((username.to_string(), password.to_string()));
+    }
+
+    pub fn set_topic_prefix(&mut self, prefix: &str) {
+        self.topic_prefix = prefix.trim_end_matches('/').to_string();
+    }
+
+    /// 0 (fire and forget) or 1 (acknowledged), higher values are capped to 1
+    pub fn set_qos(&mut self, qos: u8) {
+        self.qos = qos.min(1);
+    }
+
+    /// Retained messages give new subscribers the last value of every device
+    pub fn set_retain(&mut self, retain: bool) {
+        self.retain = retain;
+    }
+
+    /// Timeout of a whole batch, connection included
+    pub fn set_timeout(&mut self, timeout: Duration) {
+        self.timeout = timeout;
+    }
+
+    async fn connect(&self) -> Result<Connection, SinkError> {
+        let mut stream = TcpStream::connect(&self.addr).await?;
+        stream.set_nodelay(true)?;
+
+        let mut flags = CONNECT_CLEAN_SESSION;
+        if self.credentials.is_some() {
+            flags |= CONNECT_USERNAME | CONNECT_PASSWORD;
+        }
+
+        let mut body = Vec::with_capacity(64);
+        put_string(b"MQTT", &mut body);
+        body.push(4); // Protocol level 3.1.1
+        body.push(flags);
+        body.extend_from_slice(&(KEEP_ALIVE.as_secs() as u16).to_be_bytes());
+        put_string(self.client_id.as_bytes(), &mut body);
+        if let Some((username, password)) = &self.credentials {
+            put_string(username.as_bytes(), &mut body);
+            put_string(password.as_bytes(), &mut body);
+        }
+
+        let mut packet = Vec::with_capacity(body.len() + 4);
+        put_packet(PACKET_CONNECT, &body, &mut packet);
+        stream.write_all(&packet).await?;
+
+        let mut connection = Connection {
+            stream,
+            last_used: Instant::now(),
+            packet_id: 0,
+        };
+
+        let (header, body) = connection.read_packet().await?;
+        if header != PACKET_CONNACK || body.len() != 2 {
+            return Err(SinkError::InvalidResponse);
+        }
+        if body[1] != 0 {
+            return Err(SinkError::MqttRefused(body[1]));
+        }
+
+        Ok(connection)
+    }
+
+    /// Publish `records`, waiting for their acknowledgement with QoS 1
+    async fn publish(
+        &self,
+        connection: &mut Connection,
+        records: &[SinkRecord],
+    ) -> Result<(), SinkError> {
+        let mut packets = Vec::with_capacity(records.len() * 192);
+        let mut body = Vec::with_capacity(192);
+        let mut pending = HashSet::new();
+
+        for record in records {
+            let (Some((kind, payload)), Some(addr)) =
+                (encode_payload(record), record_address(record))
+            else {
+                continue;
+            };
+
+            let topic = format!("{}/{}/{}", self.topic_prefix, addr, kind);
+
+            body.clear();
+            put_string(topic.as_bytes(), &mut body);
+            if self.qos > 0 {
+                let packet_id = connection.next_packet_id();
+                body.extend_from_slice(&packet_id.to_be_bytes());
+                pending.insert(packet_id);
+            }
+            body.extend_from_slice(payload.as_bytes());
+
+            let mut header = PACKET_PUBLISH | (self.qos << 1);
+            if self.retain {
+                header |= PUBLISH_RETAIN;
+            }
+            put_packet(header, &body, &mut packets);
+        }
+
+        connection.stream.write_all(&packets).await?;
+
+        // Packet identifiers are unique within the window, a PUBACK only
+        // acknowledges the publish of its identifier
+        while !pending.is_empty() {
+            let (header, body) = connection.read_packet().await?;
+            if header & 0xf0 != PACKET_PUBACK {
+                continue;
+            }
+            if body.len() != 2 {
+                return Err(SinkError::InvalidResponse);
+            }
+
+            pending.remove(&u16::from_be_bytes([body[0], body[1]]));
+        }
+
+        connection.last_used = Instant::now();
+
+        Ok(())
+    }
+
+    async fn publish_batch(&self, batch: &[SinkRecord]) -> Result<(), SinkError> {
+        let mut guard = self.connection.lock().await;
+
+        // Taken until the batch succeeds: a failed or timed out batch leaves
+        // the connection in an unknown state, it is replaced on the next one
+        let mut connection = match guard
+            .take()
+            .filter(|connection| connection.last_used.elapsed() < KEEP_ALIVE)
+        {
+            Some(connection) => connection,
+            None => self.connect().await?,
+        };
+
+        for window in batch.chunks(PUBLISH_WINDOW) {
+            self.publish(&mut connection, window).await?;
+        }
+
+        *guard = Some(connection);
+
+        Ok(())
+    }
+}
+
+impl SinkWriter for MqttWriter {
+    async fn write(&self, batch: &[SinkRecord]) -> Result<(), SinkError> {
+        tokio::time::timeout(self.timeout, self.publish_batch(batch))
+            .await
+            .map_err(|_| SinkError::Timeout)?
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::sync::Arc;
+
+    use tokio::net::TcpListener;
+
+    use crate::sink::tests::xiaomi_record;
+
+    #[derive(Debug, Clone, Copy, PartialEq, Eq)]
+    enum Ack {
+        None,
+        Reversed,
+        /// The first publish twice instead of the last one
+        Duplicate,
+    }
+
+    #[derive(Debug, Clone)]
+    struct Publish {
+        header: u8,
+        topic: String,
+        packet_id: Option<u16>,
+        payload: String,
+    }
+
+    #[derive(Default)]
+    struct Broker {
+        /// Body of the CONNECT packet
+        connect: Vec<u8>,
+        publishes: Vec<Publish>,
+    }
+
+    async fn read_packet(stream: &mut TcpStream) -> Option<(u8, Vec<u8>)> {
+        let header = stream.read_u8().await.ok()?;
+        let mut len = 0usize;
+        for shift in (0..28).step_by(7) {
+            let byte = stream.read_u8().await.ok()?;
+            len |= ((byte & 0x7f) as usize) << shift;
+            if byte & 0x80 == 0 {
+                break;
+            }
+        }
+
+        let mut body = vec![0; len];
+        stream.read_exact(&mut body).await.ok()?;
+        Some((header, body))
+    }
+
+    /// Broker stand-in answering CONNECT with `return_code`, then acknowledging
+    /// the publishes by groups of `batch` as set by `ack`
+    async fn broker(return_code: u8, batch: usize, ack: Ack) -> (String, Arc<Mutex<Broker>>) {
+        let listener = TcpListener::bind("127.0.0.1:0").await.unwrap();
+        let addr = listener.local_addr().unwrap().to_string();
+        let state = Arc::new(Mutex::new(Broker::default()));
+
+        let broker = state.clone();
+        tokio::spawn(async move {
+            let (mut stream, _) = listener.accept().await.unwrap();
+
+            let (header, body) = read_packet(&mut stream).await.unwrap();
+            assert_eq!(header, PACKET_CONNECT);
+            broker.lock().await.connect = body;
+            stream
+                .write_all(&[PACKET_CONNACK, 2, 0, return_code])
+                .await
+                .unwrap();
+
+            loop {
+                let mut ids = Vec::new();
+                for _ in 0..batch {
+                    let Some((header, body)) = read_packet(&mut stream).await else {
+                        return;
+                    };
+                    assert_eq!(header & 0xf0, PACKET_PUBLISH);
+
+                    let topic_len = u16::from_be_bytes([body[0], body[1]]) as usize;
+                    let mut rest = &body[2 + topic_len..];
+                    let packet_id = (header & 0x06 != 0).then(|| {
+                        let id = u16::from_be_bytes([rest[0], rest[1]]);
+                        rest = &rest[2..];
+                        id
+                    });
+                    ids.extend(packet_id);
+
+                    broker.lock().await.publishes.push(Publish {
+                        header,
+                        topic: String::from_utf8(body[2..2 + topic_len].to_vec()).unwrap(),
+                        packet_id,
+                        payload: String::from_utf8(rest.to_vec()).unwrap(),
+                    });
+                }
+
+                match ack {
+                    Ack::None => continue,
+                    Ack::Reversed => ids.reverse(),
+                    Ack::Duplicate => *ids.last_mut().unwrap() = ids[0],
+                }
+                for id in ids {
+                    let [hi, lo] = id.to_be_bytes();
+                    stream.write_all(&[PACKET_PUBACK, 2, hi, lo]).await.unwrap();
+                }
+            }
+        });
+
+        (addr, state)
+    }
+
+    #[test]
+    fn payload() {
+        let (kind, payload) = encode_payload(&xiaomi_record(1)).unwrap();
+
+        assert_eq!(kind, "xiaomi");
+        assert_eq!(
+            payload,
+            "{\"time_ms\":1700000000000,\"temperature\":21.5,\"humidity\":45,\"battery_mv\":2950,\"battery_percent\":85,\"rssi\":-67}"
+        );
+    }
+
+    #[test]
+    fn remaining_length() {
+        for (len, encoded) in [
+            (0, vec![0x00]),
+            (127, vec![0x7f]),
+            (128, vec![0x80, 0x01]),
+            (16_383, vec![0xff, 0x7f]),
+            (2_097_152, vec![0x80, 0x80, 0x80, 0x01]),
+        ] {
+            let mut out = Vec::new();
+            put_remaining_length(len, &mut out);
+            assert_eq!(out, encoded, "{}", len);
+        }
+    }
+
+    #[tokio::test]
+    async fn publish_qos1() {
+        let (addr, broker) = broker(0, 3, Ack::Reversed).await;
+        let mut writer = MqttWriter::new(&addr);
+        writer.set_client_id("test");
+        writer.set_credentials("user", "pass");
+        writer.set_topic_prefix("home/ble/");
+        writer.set_retain(true);
+
+        let batch = [xiaomi_record(1), xiaomi_record(2), xiaomi_record(3)];
+        writer.write(&batch).await.unwrap();
+        // Same connection, the packet identifiers go on
+        writer.write(&batch).await.unwrap();
+
+        let broker = broker.lock().await;
+        let mut connect = Vec::new();
+        put_string(b"MQTT", &mut connect);
+        connect.extend_from_slice(&[4, 0xc2, 0, 60]);
+        put_string(b"test", &mut connect);
+        put_string(b"user", &mut connect);
+        put_string(b"pass", &mut connect);
+        assert_eq!(broker.connect, connect);
+
+        assert_eq!(broker.publishes.len(), 6);
+        let ids: Vec<_> = broker.publishes.iter().map(|p| p.packet_id).collect();
+        assert_eq!(ids, (1..=6).map(Some).collect::<Vec<_>>());
+
+        let publish = &broker.publishes[1];
+        assert_eq!(publish.header, PACKET_PUBLISH | 0x02 | PUBLISH_RETAIN);
+        assert_eq!(publish.topic, "home/ble/a4c138000002/xiaomi");
+        assert_eq!(publish.payload, encode_payload(&batch[1]).unwrap().1);
+    }
+
+    #[tokio::test]
+    async fn publish_qos0() {
+        let (addr, broker) = broker(0, 2, Ack::None).await;
+        let mut writer = MqttWriter::new(&addr);
+        writer.set_qos(0);
+
+        writer
+            .write(&[xiaomi_record(1), xiaomi_record(2)])
+            .await
+            .unwrap();
+
+        // Not acknowledged, wait for the broker to read them
+        tokio::time::sleep(Duration::from_millis(50)).await;
+        let broker = broker.lock().await;
+        assert_eq!(broker.publishes.len(), 2);
+        assert!(broker.publishes.iter().all(|p| p.packet_id.is_none()));
+        assert_eq!(broker.publishes[0].header, PACKET_PUBLISH);
+    }
+
+    #[tokio::test]
+    async fn puback_mismatch() {
+        let (addr, _broker) = broker(0, 3, Ack::Duplicate).await;
+        let mut writer = MqttWriter::new(&addr);
+        writer.set_timeout(Duration::from_millis(100));
+
+        // 3 PUBACKs, but one publish never acknowledged
+        assert!(matches!(
+            writer
+                .write(&[xiaomi_record(1), xiaomi_record(2), xiaomi_record(3)])
+                .await,
+            Err(SinkError::Timeout)
+        ));
+    }
+
+    #[tokio::test]
+    async fn connection_refused() {
+        let (addr, _broker) = broker(5, 1, Ack::Reversed).await;
+        let writer = MqttWriter::new(&addr);
+
+        match writer.write(&[xiaomi_record(1)]).await {
+            Err(e @ SinkError::MqttRefused(5)) => assert!(!e.is_retryable()),
+            other => panic!("unexpected result: {:?}", other),
+        }
+    }
+}
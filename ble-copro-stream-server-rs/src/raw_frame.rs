@@ -0,0 +1,296 @@
+//! Undecoded frames, for relays which forward frames without looking at them.
+//!
+//! [`RawFrame`] borrows the channel receive buffer, payloads are only decoded
+//! on demand with [`RawFrame::decode`]. [`RawFrameWriter`] re-emits frames byte
+//! for byte when the output format matches the input one.
+
+use tokio::io::{AsyncWrite, AsyncWriteExt, BufWriter};
+
+use crate::control_channel::ControlHandler;
+use crate::device_health::DeviceHealthHandler;
+use crate::frame::{encode_v2, FrameFormat};
+use crate::latency::LatencyHandler;
+use crate::linky::LinkyTicHandler;
+use crate::snapshot::SnapshotHandler;
+use crate::stream_message::ChannelMessage;
+use crate::xiaomi::XiaomiHandler;
+use crate::{StreamChannelError, StreamChannelHandler};
+
+#[derive(Debug, Clone, Copy)]
+pub struct RawFrame<'a> {
+    channel_id: u32,
+    format: FrameFormat,
+    payload: &'a [u8],
+    bytes: &'a [u8],
+}
+
+impl<'a> RawFrame<'a> {
+    pub(crate) fn new(
+        channel_id: u32,
+        format: FrameFormat,
+        payload: &'a [u8],
+        bytes: &'a [u8],
+    ) -> RawFrame<'a> {
+        RawFrame {
+            channel_id,
+            format,
+            payload,
+            bytes,
+        }
+    }
+
+    pub fn channel_id(&self) -> u32 {
+        self.channel_id
+    }
+
+    pub fn format(&self) -> FrameFormat {
+        self.format
+    }
+
+    pub fn payload(&self) -> &'a [u8] {
+        self.payload
+    }
+
+    /// Complete frame as received (header, payload and CRC for v2)
+    pub fn as_bytes(&self) -> &'a [u8] {
+        self.bytes
+    }
+
+    pub fn is<H: StreamChannelHandler>(&self) -> bool {
+        self.channel_id == H::CHANNEL_ID
+    }
+
+    /// Decode the payload with `H`, e.g. `frame.decode::<XiaomiHandler>()`
+    pub fn decode<H: StreamChannelHandler>(&self) -> Result<H::Message, StreamChannelError> {
+        if !self.is::<H>() {
+            return Err(StreamChannelError::UnhandledChannelId);
+        }
+
+        H::parse_message(self.payload)
+    }
+
+    /// Decode the payload with the handler of its channel
+    pub fn to_message(&self) -> Result<ChannelMessage, StreamChannelError> {
+        match self.channel_id {
+            XiaomiHandler::CHANNEL_ID => self.decode::<XiaomiHandler>().map(ChannelMessage::Xiaomi),
+            LinkyTicHandler::CHANNEL_ID => self
+                .decode::<LinkyTicHandler>()
+                .map(ChannelMessage::LinkyTic),
+            DeviceHealthHandler::CHANNEL_ID => self
+                .decode::<DeviceHealthHandler>()
+                .map(ChannelMessage::DeviceHealth),
+            LatencyHandler::CHANNEL_ID => {
+                self.decode::<LatencyHandler>().map(ChannelMessage::Latency)
+            }
+            SnapshotHandler::CHANNEL_ID => self
+                .decode::<SnapshotHandler>()
+                .map(ChannelMessage::SnapshotPart),
+            ControlHandler::CHANNEL_ID => {
+                self.decode::<ControlHandler>().map(ChannelMessage::Control)
+            }
+            _ => Err(StreamChannelError::UnhandledChannelId),
+        }
+    }
+}
+
+/// Buffered frame writer, frames are copied as is when their format matches
+/// the writer one and re-framed otherwise. Call `flush()` to push buffered
+/// frames out.
+pub struct RawFrameWriter<W: AsyncWrite + Unpin> {
+    inner: BufWriter<W>,
+    format: FrameFormat,
+    scratch: Vec<u8>,
+    frames: u64,
+    bytes: u64,
+}
+
+impl<W: AsyncWrite + Unpin> RawFrameWriter<W> {
+    pub fn new(inner: W, format: FrameFormat) -> RawFrameWriter<W> {
+        RawFrameWriter {
+            inner: BufWriter::new(inner),
+            format,
+            scratch: Vec::new(),
+            frames: 0,
+            bytes: 0,
+        }
+    }
+
+    pub async fn write(&mut self, frame: &RawFrame<'_>) -> std::io::Result<()> {
+        let bytes = if frame.format == self.format {
+            frame.as_bytes()
+        } else {
+            self.scratch.clear();
+            match self.format {
+                FrameFormat::V1 => {
+                    self.scratch
+                        .extend_from_slice(&frame.channel_id.to_le_bytes());
+                    self.scratch
+                        .extend_from_slice(&(frame.payload.len() as u16).to_le_bytes());
+                    self.scratch.extend_from_slice(frame.payload);
+                }
+                FrameFormat::V2 => encode_v2(frame.channel_id, frame.payload, &mut self.scratch),
+            }
+            &self.scratch
+        };
+
+        self.inner.write_all(bytes).await?;
+        self.frames += 1;
+        self.bytes += bytes.len() as u64;
+
+        Ok(())
+    }
+
+    pub async fn flush(&mut self) -> std::io::Result<()> {
+        self.inner.flush().await
+    }
+
+    /// (frames, bytes) written so far
+    pub fn stats(&self) -> (u64, u64) {
+        (self.frames, self.bytes)
+    }
+
+    pub fn into_inner(self) -> W {
+        self.inner.into_inner()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::frame::{parse_v2, FRAME_V1_HEADER_SIZE, FRAME_V2_CRC_SIZE, FRAME_V2_HEADER_SIZE};
+
+    fn xiaomi_payload() -> [u8; 24] {
+        let mut data = [0u8; 24];
+        data[0..6].copy_from_slice(&[0xa4, 0xc1, 0x38, 0x00, 0x00, 0x01]);
+        data[17..19].copy_from_slice(&2150i16.to_le_bytes());
+        data
+    }
+
+    /// Frame bytes of `payload` in `format`
+    fn encode(format: FrameFormat, channel_id: u32, payload: &[u8]) -> Vec<u8> {
+        let mut bytes = Vec::new();
+        match format {
+            FrameFormat::V1 => {
+                bytes.extend_from_slice(&channel_id.to_le_bytes());
+                bytes.extend_from_slice(&(payload.len() as u16).to_le_bytes());
+                bytes.extend_from_slice(payload);
+            }
+            FrameFormat::V2 => encode_v2(channel_id, payload, &mut bytes),
+        }
+        bytes
+    }
+
+    fn raw(format: FrameFormat, bytes: &[u8]) -> RawFrame<'_> {
+        let (channel_id, payload) = match format {
+            FrameFormat::V1 => (
+                u32::from_le_bytes(bytes[0..4].try_into().unwrap()),
+                &bytes[FRAME_V1_HEADER_SIZE..],
+            ),
+            FrameFormat::V2 => {
+                let (header, payload) = parse_v2(bytes).unwrap();
+                (header.channel_id, &bytes[payload])
+            }
+        };
+
+        RawFrame::new(channel_id, format, payload, bytes)
+    }
+
+    /// Write `frames` (channel id, payload) received as `input` to a writer
+    /// of `output` format
+    async fn rewrite(input: FrameFormat, output: FrameFormat, frames: &[(u32, &[u8])]) -> Vec<u8> {
+        let mut writer = RawFrameWriter::new(Vec::new(), output);
+        let mut bytes = 0;
+
+        for &(channel_id, payload) in frames {
+            let encoded = encode(input, channel_id, payload);
+            writer.write(&raw(input, &encoded)).await.unwrap();
+            bytes += encode(output, channel_id, payload).len() as u64;
+        }
+
+        writer.flush().await.unwrap();
+        assert_eq!(writer.stats(), (frames.len() as u64, bytes));
+        writer.into_inner()
+    }
+
+    #[tokio::test]
+    async fn copy_on_format_match() {
+        let payload = xiaomi_payload();
+        let frames: [(u32, &[u8]); 3] = [
+            (XiaomiHandler::CHANNEL_ID, &payload),
+            (0x12345678, &[]),
+            (ControlHandler::CHANNEL_ID, &[0x01, 0x02, 0x30, 0x00]),
+        ];
+
+        for format in [FrameFormat::V1, FrameFormat::V2] {
+            let expected: Vec<u8> = frames
+                .iter()
+                .flat_map(|&(channel_id, payload)| encode(format, channel_id, payload))
+                .collect();
+
+            assert_eq!(rewrite(format, format, &frames).await, expected);
+        }
+    }
+
+    #[tokio::test]
+    async fn reframe_v1_to_v2() {
+        let payload = xiaomi_payload();
+        let frames: [(u32, &[u8]); 2] = [(XiaomiHandler::CHANNEL_ID, &payload), (0x12345678, &[])];
+
+        let out = rewrite(FrameFormat::V1, FrameFormat::V2, &frames).await;
+
+        // Valid CRC on every frame
+        let mut rest = &out[..];
+        for &(channel_id, payload) in &frames {
+            let len = FRAME_V2_HEADER_SIZE + payload.len() + FRAME_V2_CRC_SIZE;
+            let (header, range) = parse_v2(&rest[..len]).unwrap();
+            assert_eq!(header.channel_id, channel_id);
+            assert_eq!(&rest[range], payload);
+            rest = &rest[len..];
+        }
+        assert!(rest.is_empty());
+
+        let frame = raw(
+            FrameFormat::V2,
+            &out[..FRAME_V2_HEADER_SIZE + 24 + FRAME_V2_CRC_SIZE],
+        );
+        assert!(frame.decode::<XiaomiHandler>().is_ok());
+    }
+
+    #[tokio::test]
+    async fn reframe_v2_to_v1() {
+        let payload = xiaomi_payload();
+        let frames: [(u32, &[u8]); 2] = [(XiaomiHandler::CHANNEL_ID, &payload), (0x12345678, &[])];
+
+        let out = rewrite(FrameFormat::V2, FrameFormat::V1, &frames).await;
+
+        let mut expected = encode(FrameFormat::V1, XiaomiHandler::CHANNEL_ID, &payload);
+        expected.extend_from_slice(&encode(FrameFormat::V1, 0x12345678, &[]));
+        assert_eq!(out, expected);
+    }
+
+    #[test]
+    fn decode_mismatched_channel() {
+        let payload = xiaomi_payload();
+        let bytes = encode(FrameFormat::V1, XiaomiHandler::CHANNEL_ID, &payload);
+        let frame = raw(FrameFormat::V1, &bytes);
+
+        assert!(frame.is::<XiaomiHandler>());
+        assert!(!frame.is::<DeviceHealthHandler>());
+        assert!(matches!(
+            frame.decode::<DeviceHealthHandler>(),
+            Err(StreamChannelError::UnhandledChannelId)
+        ));
+        assert!(matches!(
+            frame.decode::<LinkyTicHandler>(),
+            Err(StreamChannelError::UnhandledChannelId)
+        ));
+        assert!(frame.decode::<XiaomiHandler>().is_ok());
+        assert!(matches!(frame.to_message(), Ok(ChannelMessage::Xiaomi(_))));
+
+        let bytes = encode(FrameFormat::V1, 0x12345678, &payload);
+        assert!(matches!(
+            raw(FrameFormat::V1, &bytes).to_message(),
+            Err(StreamChannelError::UnhandledChannelId)
+        ));
+    }
+}
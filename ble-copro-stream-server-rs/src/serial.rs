@@ -0,0 +1,444 @@
+//! Reader of the serial transport (firmware `CONFIG_COPRO_STREAM_TRANSPORT_SERIAL`),
+//! `serial` feature.
+//!
+//! The dongle exposes a UART or a CDC-ACM port (`/dev/ttyACM*`), or a pseudo
+//! terminal when running on `native_sim`. Every frame is a v2 frame (sync word
+//! and CRC-32, see [`crate::frame`]) COBS encoded and followed by a 0x00
+//! delimiter. A corrupted frame is dropped up to the next delimiter, the link
+//! stays up.
+//!
+//! A CDC-ACM dongle only streams while the port is open (DTR raised).
+
+use std::fs::{File, OpenOptions};
+use std::io::{Read, Write};
+use std::ops::Range;
+use std::os::fd::AsRawFd;
+use std::os::unix::fs::OpenOptionsExt;
+use std::sync::Arc;
+
+use tokio::io::unix::AsyncFd;
+
+use crate::cache::LatestValueCache;
+use crate::control_channel::{ControlHandler, ControlMessage};
+use crate::frame::{
+    encode_v2, parse_v2, FrameDecoderStats, FrameFormat, FRAME_V2_CRC_SIZE, FRAME_V2_HEADER_SIZE,
+    FRAME_V2_PAYLOAD_MAX,
+};
+use crate::raw_frame::RawFrame;
+use crate::snapshot::SnapshotAssembler;
+use crate::stream_message::ChannelMessage;
+use crate::{StreamChannelError, StreamChannelHandler};
+
+const COBS_DELIMITER: u8 = 0x00;
+const COBS_BLOCK_MAX: usize = 254;
+
+/// Longer packets are garbage, e.g. a stream missing its delimiters
+const PACKET_MAX: usize = 2 * (FRAME_V2_HEADER_SIZE + FRAME_V2_PAYLOAD_MAX + FRAME_V2_CRC_SIZE);
+
+/// COBS encode `data` and append it to `out`, followed by the delimiter
+pub fn cobs_encode(data: &[u8], out: &mut Vec<u8>) {
+    let mut i = 0;
+
+    loop {
+        let n = data[i..]
+            .iter()
+            .take(COBS_BLOCK_MAX)
+            .take_while(|&&b| b != COBS_DELIMITER)
+            .count();
+
+        out.push(n as u8 + 1);
+        out.extend_from_slice(&data[i..i + n]);
+        i += n;
+
+        let more = i < data.len();
+        if n < COBS_BLOCK_MAX {
+            // Skip the 0x00 ending the block, a trailing one yields an empty
+            // last block
+            i += 1;
+        }
+        if !more {
+            break;
+        }
+    }
+
+    out.push(COBS_DELIMITER);
+}
+
+/// Decode a COBS packet (without its delimiter) into `out`, None if malformed
+pub fn cobs_decode(packet: &[u8], out: &mut Vec<u8>) -> Option<()> {
+    let mut i = 0;
+
+    while i < packet.len() {
+        let code = packet[i] as usize;
+        if code == 0 || i + code > packet.len() {
+            return None;
+        }
+
+        out.extend_from_slice(&packet[i + 1..i + code]);
+        i += code;
+
+        if code <= COBS_BLOCK_MAX && i < packet.len() {
+            out.push(0);
+        }
+    }
+
+    Some(())
+}
+
+pub struct SerialChannel {
+    port: AsyncFd<File>,
+    cache: Option<Arc<LatestValueCache>>,
+    /// Received bytes, packets are consumed up to `rx_start`
+    rx: Vec<u8>,
+    rx_start: usize,
+    /// Last decoded frame
+    frame: Vec<u8>,
+    stats: FrameDecoderStats,
+    snapshot: SnapshotAssembler,
+    unknown_frames: u64,
+}
+
+impl SerialChannel {
+    /// Open the serial port at `path` in raw mode, must be called from a tokio
+    /// runtime.
+    pub fn open(path: &str) -> Result<SerialChannel, StreamChannelError> {
+        let file = OpenOptions::new()
+            .read(true)
+            .write(true)
+            .custom_flags(libc::O_NOCTTY | libc::O_NONBLOCK)
+            .open(path)?;
+
+        Self::configure_raw(&file)?;
+
+        Ok(SerialChannel {
+            port: AsyncFd::new(file)?,
+            cache: None,
+            rx: Vec::new(),
+            rx_start: 0,
+            frame: Vec::new(),
+            stats: FrameDecoderStats::default(),
+            snapshot: SnapshotAssembler::new(),
+            unknown_frames: 0,
+        })
+    }
+
+    /// No echo nor line discipline, 8N1. The baudrate is irrelevant to CDC-ACM
+    /// ports and pseudo terminals.
+    fn configure_raw(file: &File) -> std::io::Result<()> {
+        let fd = file.as_raw_fd();
+
+        unsafe {
+            let mut tio: libc::termios = std::mem::zeroed();
+            if libc::tcgetattr(fd, &mut tio) < 0 {
+                return Err(std::io::Error::last_os_error());
+            }
+
+            libc::cfmakeraw(&mut tio);
+            libc::cfsetspeed(&mut tio, libc::B115200);
+
+            if libc::tcsetattr(fd, libc::TCSANOW, &tio) < 0 {
+                return Err(std::io::Error::last_os_error());
+            }
+        }
+
+        Ok(())
+    }
+
+    /// Dropped packets, `crc_errors` counts them and `skipped_bytes` their size
+    pub fn frame_stats(&self) -> FrameDecoderStats {
+        self.stats
+    }
+
+    /// Number of frames of unknown channels skipped by `next()`
+    pub fn unknown_frames(&self) -> u64 {
+        self.unknown_frames
+    }
+
+    /// Update `cache` with every message yielded by `next()`
+    pub fn set_cache(&mut self, cache: Arc<LatestValueCache>) {
+        self.cache = Some(cache);
+    }
+
+    async fn read_some(&mut self) -> Result<(), StreamChannelError> {
+        let mut buf = [0; 512];
+
+        let n = loop {
+            let mut guard = self.port.readable().await?;
+            match guard.try_io(|port| port.get_ref().read(&mut buf)) {
+                Ok(result) => break result?,
+                Err(_would_block) => continue,
+            }
+        };
+
+        if n == 0 {
+            return Err(std::io::Error::from(std::io::ErrorKind::UnexpectedEof).into());
+        }
+
+        // Reclaim consumed packets before growing
+        self.rx.drain(..self.rx_start);
+        self.rx_start = 0;
+
+        if self.rx.len() > PACKET_MAX {
+            self.stats.crc_errors += 1;
+            self.stats.skipped_bytes += self.rx.len() as u64;
+            self.rx.clear();
+        }
+
+        self.rx.extend_from_slice(&buf[..n]);
+
+        Ok(())
+    }
+
+    async fn write_all(&mut self, mut data: &[u8]) -> Result<(), StreamChannelError> {
+        while !data.is_empty() {
+            let mut guard = self.port.writable().await?;
+            match guard.try_io(|port| port.get_ref().write(data)) {
+                Ok(result) => data = &data[result?..],
+                Err(_would_block) => continue,
+            }
+        }
+
+        Ok(())
+    }
+
+    /// Decode the next valid frame into `self.frame`, returns its channel id
+    /// and payload range
+    async fn read_frame(&mut self) -> Result<(u32, Range<usize>), StreamChannelError> {
+        loop {
+            while let Some(p) = self.rx[self.rx_start..]
+                .iter()
+                .position(|&b| b == COBS_DELIMITER)
+            {
+                let packet = self.rx_start..self.rx_start + p;
+                self.rx_start += p + 1;
+
+                // Empty packets flush the receiver, they are not errors
+                if packet.is_empty() {
+                    continue;
+                }
+
+                self.frame.clear();
+                let frame = cobs_decode(&self.rx[packet.clone()], &mut self.frame)
+                    .and_then(|_| parse_v2(&self.frame));
+
+                match frame {
+                    Some((header, payload)) => return Ok((header.channel_id, payload)),
+                    None => {
+                        self.stats.crc_errors += 1;
+                        self.stats.skipped_bytes += packet.len() as u64 + 1;
+                    }
+                }
+            }
+
+            self.read_some().await?;
+        }
+    }
+
+    /// Next frame of any channel, without decoding it. The frame borrows the
+    /// channel receive buffer and the cache is not updated.
+    pub async fn next_raw(&mut self) -> Result<RawFrame<'_>, StreamChannelError> {
+        let (channel_id, payload) = self.read_frame().await?;
+
+        Ok(RawFrame::new(
+            channel_id,
+            FrameFormat::V2,
+            &self.frame[payload],
+            &self.frame,
+        ))
+    }
+
+    /// Send a control message to the device, which answers with an
+    /// acknowledgement (`ControlMessage::ack()`) on the control channel.
+    pub async fn send_control(
+        &mut self,
+        message: &ControlMessage,
+    ) -> Result<(), StreamChannelError> {
+        let mut frame = Vec::new();
+        encode_v2(ControlHandler::CHANNEL_ID, &message.encode(), &mut frame);
+
+        // Leading delimiter, discards any garbage received by the device
+        let mut packet = vec![COBS_DELIMITER];
+        cobs_encode(&frame, &mut packet);
+
+        self.write_all(&packet).await
+    }
+
+    /// Frames of unknown channels are skipped, see `unknown_frames()`. Snapshot
+    /// frames are yielded as a single `ChannelMessage::Snapshot`.
+    pub async fn next(&mut self) -> Result<ChannelMessage, StreamChannelError> {
+        loop {
+            let (channel_id, payload) = self.read_frame().await?;
+
+            let raw = RawFrame::new(
+                channel_id,
+                FrameFormat::V2,
+                &self.frame[payload],
+                &self.frame,
+            );
+
+            let message = match raw.to_message() {
+                Err(StreamChannelError::UnhandledChannelId) => {
+                    self.unknown_frames += 1;
+                    continue;
+                }
+                message => message?,
+            };
+
+            let message = match message {
+                ChannelMessage::SnapshotPart(part) => match self.snapshot.push(part) {
+                    Some(snapshot) => ChannelMessage::Snapshot(snapshot),
+                    None => continue,
+                },
+                message => message,
+            };
+
+            if let Some(cache) = &self.cache {
+                cache.update(&message);
+            }
+
+            return Ok(message);
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::os::fd::FromRawFd;
+
+    use crate::xiaomi::XiaomiHandler;
+
+    fn round_trip(data: &[u8]) -> Vec<u8> {
+        let mut packet = Vec::new();
+        cobs_encode(data, &mut packet);
+
+        // A single delimiter, at the end
+        assert_eq!(packet.iter().position(|&b| b == 0), Some(packet.len() - 1));
+
+        let mut decoded = Vec::new();
+        assert_eq!(
+            cobs_decode(&packet[..packet.len() - 1], &mut decoded),
+            Some(())
+        );
+        assert_eq!(decoded, data);
+
+        packet
+    }
+
+    #[test]
+    fn cobs_empty_packet() {
+        assert_eq!(round_trip(&[]), [0x01, 0x00]);
+    }
+
+    #[test]
+    fn cobs_trailing_zero() {
+        assert_eq!(round_trip(&[0x11, 0x00]), [0x02, 0x11, 0x01, 0x00]);
+        assert_eq!(round_trip(&[0x00]), [0x01, 0x01, 0x00]);
+        assert_eq!(
+            round_trip(&[0x11, 0x00, 0x00]),
+            [0x02, 0x11, 0x01, 0x01, 0x00]
+        );
+    }
+
+    #[test]
+    fn cobs_full_block() {
+        let block: Vec<u8> = (1..=254).collect();
+
+        // No zero follows a full block
+        let packet = round_trip(&block);
+        assert_eq!(packet.len(), 256);
+        assert_eq!(packet[0], 0xff);
+
+        // A zero after a full block gets a block of its own
+        let mut data = block.clone();
+        data.push(0);
+        assert_eq!(&round_trip(&data)[255..], [0x01, 0x01, 0x00]);
+
+        let mut data = block.clone();
+        data.extend_from_slice(&[0x42, 0x00, 0x43]);
+        assert_eq!(&round_trip(&data)[255..], [0x02, 0x42, 0x02, 0x43, 0x00]);
+
+        // Frames of any length
+        for len in [253, 255, 508, 509, 1100] {
+            let data: Vec<u8> = (0..len).map(|i| (i % 300) as u8).collect();
+            round_trip(&data);
+        }
+    }
+
+    #[test]
+    fn cobs_malformed() {
+        let mut out = Vec::new();
+
+        // Code byte of 0, or pointing past the packet end
+        assert_eq!(cobs_decode(&[0x00, 0x11], &mut out), None);
+        assert_eq!(cobs_decode(&[0x02, 0x11, 0x00], &mut out), None);
+        assert_eq!(cobs_decode(&[0x03, 0x11], &mut out), None);
+        assert_eq!(cobs_decode(&[0x02, 0x11, 0x05, 0x22], &mut out), None);
+    }
+
+    /// COBS packet of a Xiaomi frame, with a wrong CRC if `corrupt`
+    fn xiaomi_packet(battery_mv: u16, corrupt: bool) -> Vec<u8> {
+        let mut payload = [0u8; 24];
+        payload[0..6].copy_from_slice(&[0xa4, 0xc1, 0x38, 0x00, 0x00, 0x01]);
+        payload[21..23].copy_from_slice(&battery_mv.to_le_bytes());
+
+        let mut frame = Vec::new();
+        encode_v2(XiaomiHandler::CHANNEL_ID, &payload, &mut frame);
+        if corrupt {
+            frame[FRAME_V2_HEADER_SIZE + 3] ^= 0x01;
+        }
+
+        let mut packet = Vec::new();
+        cobs_encode(&frame, &mut packet);
+        packet
+    }
+
+    async fn next_battery_mv(channel: &mut SerialChannel) -> u16 {
+        match channel.next().await.unwrap() {
+            ChannelMessage::Xiaomi(record) => record.measurement.battery_mv,
+            message => panic!("unexpected message {:?}", message),
+        }
+    }
+
+    #[tokio::test]
+    async fn corrupted_packet_on_pty() {
+        let (mut master, mut slave) = (0, 0);
+        let ret = unsafe {
+            libc::openpty(
+                &mut master,
+                &mut slave,
+                std::ptr::null_mut(),
+                std::ptr::null(),
+                std::ptr::null(),
+            )
+        };
+        assert_eq!(ret, 0);
+
+        let mut master = unsafe { File::from_raw_fd(master) };
+        let slave = unsafe { File::from_raw_fd(slave) };
+        let path = std::fs::read_link(format!("/proc/self/fd/{}", slave.as_raw_fd())).unwrap();
+
+        let mut channel = SerialChannel::open(path.to_str().unwrap()).unwrap();
+
+        // Valid, CRC error, COBS error, then valid again
+        let corrupted = xiaomi_packet(2950, true);
+        let mut data = xiaomi_packet(2900, false);
+        data.extend_from_slice(&corrupted);
+        data.extend_from_slice(&[0x05, 0x11, 0x00]);
+        data.extend_from_slice(&xiaomi_packet(2950, false));
+        master.write_all(&data).unwrap();
+
+        assert_eq!(next_battery_mv(&mut channel).await, 2900);
+        assert_eq!(channel.frame_stats().crc_errors, 0);
+
+        assert_eq!(next_battery_mv(&mut channel).await, 2950);
+        let stats = channel.frame_stats();
+        assert_eq!(stats.crc_errors, 2);
+        assert_eq!(stats.skipped_bytes, corrupted.len() as u64 + 3);
+
+        // Still up
+        master.write_all(&xiaomi_packet(3000, false)).unwrap();
+        assert_eq!(next_battery_mv(&mut channel).await, 3000);
+        assert_eq!(channel.unknown_frames(), 0);
+    }
+}
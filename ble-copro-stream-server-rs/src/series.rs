@@ -0,0 +1,757 @@
+//! Compressed in-memory time series, one per device.
+//!
+//! Every series is a ring of fixed-size blocks of `SERIES_BLOCK_SIZE` bytes.
+//! The first sample of a block is kept as is, the following ones are bit packed
+//! (Gorilla style):
+//!  - timestamps, quantized to the store resolution, as delta of delta
+//!  - values, integers in the record units (1e-2 °C, 1e-2 %, mV, Wh, VA, A), as
+//!    delta, or delta of delta for monotonic counters (Linky index)
+//!
+//! Each delta is written with a prefix selecting its width: `0` for 0, then
+//! `10`, `110`, `1110`, `11110` and `11111` followed by 4, 8, 16, 32 and 64
+//! bits. A sensor reporting every few seconds with slowly moving values costs
+//! about 2 bytes per sample.
+//!
+//! Timestamps are provided by the caller (e.g. host time in ms) and are
+//! expected to be non-decreasing, earlier ones are clamped to the last one.
+
+use std::collections::{HashMap, VecDeque};
+use std::time::Duration;
+
+use crate::ble::BleAddress;
+use crate::stream_message::ChannelMessage;
+
+pub const SERIES_COLUMNS: usize = 3;
+pub const SERIES_BLOCK_SIZE: usize = 1024;
+
+pub const DEFAULT_RETENTION: Duration = Duration::from_secs(24 * 3600);
+pub const DEFAULT_RESOLUTION: Duration = Duration::from_secs(1);
+
+/// Upper bound of the blocks of a series, the oldest ones are dropped beyond
+pub const DEFAULT_MAX_BLOCKS: usize = 128;
+
+/// Width prefixes: (prefix, prefix length, payload bits)
+const BUCKETS: [(u64, u32, u32); 5] = [
+    (0b10, 2, 4),
+    (0b110, 3, 8),
+    (0b1110, 4, 16),
+    (0b11110, 5, 32),
+    (0b11111, 5, 64),
+];
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum SeriesKind {
+    Xiaomi,
+    LinkyTic,
+}
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+enum Coding {
+    Delta,
+    DeltaOfDelta,
+}
+
+impl SeriesKind {
+    /// Names of the sample values
+    pub fn columns(&self) -> [&'static str; SERIES_COLUMNS] {
+        match self {
+            SeriesKind::Xiaomi => ["temperature", "humidity", "battery_mv"],
+            SeriesKind::LinkyTic => ["base", "papp", "iinst"],
+        }
+    }
+
+    fn codings(&self) -> [Coding; SERIES_COLUMNS] {
+        match self {
+            SeriesKind::Xiaomi => [Coding::Delta; SERIES_COLUMNS],
+            SeriesKind::LinkyTic => [Coding::DeltaOfDelta, Coding::Delta, Coding::Delta],
+        }
+    }
+}
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct Sample {
+    pub timestamp_ms: u64,
+    /// Integers in the record units, see `SeriesKind::columns()`:
+    ///  - Xiaomi: temperature (1e-2 °C), humidity (1e-2 %), battery (mV)
+    ///  - Linky TIC: index (Wh), apparent power (VA), current (A)
+    pub values: [i64; SERIES_COLUMNS],
+}
+
+impl Sample {
+    /// Sample of a Xiaomi or Linky TIC record, None for other messages
+    pub fn from_message(
+        message: &ChannelMessage,
+        timestamp_ms: u64,
+    ) -> Option<(BleAddress, SeriesKind, Sample)> {
+        match message {
+            ChannelMessage::Xiaomi(record) => {
+                let m = &record.measurement;
+                let values = [
+                    (m.temperature * 100.0).round() as i64,
+                    (m.humidity * 100.0).round() as i64,
+                    m.battery_mv as i64,
+                ];
+                Some((
+                    record.ble_addr,
+                    SeriesKind::Xiaomi,
+                    Sample {
+                        timestamp_ms,
+                        values,
+                    },
+                ))
+            }
+            ChannelMessage::LinkyTic(record) => {
+                let m = &record.measurement;
+                let values = [m.base as i64, m.papp as i64, m.iinst as i64];
+                Some((
+                    record.ble_addr,
+                    SeriesKind::LinkyTic,
+                    Sample {
+                        timestamp_ms,
+                        values,
+                    },
+                ))
+            }
+            _ => None,
+        }
+    }
+}
+
+fn fits(value: i64, bits: u32) -> bool {
+    bits == 64 || (-(1i64 << (bits - 1))..(1i64 << (bits - 1))).contains(&value)
+}
+
+fn encoded_bits(value: i64) -> usize {
+    if value == 0 {
+        return 1;
+    }
+
+    let (_, prefix_len, bits) = BUCKETS
+        .iter()
+        .find(|(_, _, bits)| fits(value, *bits))
+        .unwrap();
+    (prefix_len + bits) as usize
+}
+
+/// MSB first bit writer over a zeroed buffer
+struct BitWriter<'a> {
+    buf: &'a mut [u8],
+    pos: usize,
+}
+
+impl BitWriter<'_> {
+    fn put(&mut self, value: u64, mut n: u32) {
+        while n > 0 {
+            let off = (self.pos % 8) as u32;
+            let take = n.min(8 - off);
+            let bits = (value >> (n - take)) & ((1u64 << take) - 1);
+
+            self.buf[self.pos / 8] |= (bits as u8) << (8 - off - take);
+            self.pos += take as usize;
+            n -= take;
+        }
+    }
+
+    fn put_signed(&mut self, value: i64) {
+        if value == 0 {
+            self.put(0, 1);
+            return;
+        }
+
+        let (prefix, prefix_len, bits) = *BUCKETS
+            .iter()
+            .find(|(_, _, bits)| fits(value, *bits))
+            .unwrap();
+        self.put(prefix, prefix_len);
+        self.put(value as u64 & (u64::MAX >> (64 - bits)), bits);
+    }
+}
+
+struct BitReader<'a> {
+    buf: &'a [u8],
+    pos: usize,
+}
+
+impl BitReader<'_> {
+    fn get(&mut self, mut n: u32) -> u64 {
+        let mut value = 0u64;
+
+        while n > 0 {
+            let off = (self.pos % 8) as u32;
+            let take = n.min(8 - off);
+            let bits = (self.buf[self.pos / 8] >> (8 - off - take)) as u64 & ((1u64 << take) - 1);
+
+            value = (value << take) | bits;
+            self.pos += take as usize;
+            n -= take;
+        }
+
+        value
+    }
+
+    fn get_signed(&mut self) -> i64 {
+        let mut ones = 0;
+        while ones < BUCKETS.len() && self.get(1) == 1 {
+            ones += 1;
+        }
+
+        if ones == 0 {
+            return 0;
+        }
+
+        let bits = BUCKETS[ones - 1].2;
+        let raw = self.get(bits);
+
+        // Sign extension
+        ((raw << (64 - bits)) as i64) >> (64 - bits)
+    }
+}
+
+struct Block {
+    bytes: Box<[u8]>,
+    /// Bits written after the first sample
+    bits: usize,
+    count: usize,
+    /// First sample, timestamp in resolution units
+    first_ts: i64,
+    first: [i64; SERIES_COLUMNS],
+    /// Encoder state
+    last_ts: i64,
+    last_ts_delta: i64,
+    last: [i64; SERIES_COLUMNS],
+    last_delta: [i64; SERIES_COLUMNS],
+}
+
+impl Block {
+    fn new(ts: i64, values: [i64; SERIES_COLUMNS]) -> Block {
+        Block {
+            bytes: vec![0; SERIES_BLOCK_SIZE].into_boxed_slice(),
+            bits: 0,
+            count: 1,
+            first_ts: ts,
+            first: values,
+            last_ts: ts,
+            last_ts_delta: 0,
+            last: values,
+            last_delta: [0; SERIES_COLUMNS],
+        }
+    }
+
+    fn deltas(
+        &self,
+        ts: i64,
+        values: &[i64; SERIES_COLUMNS],
+        codings: &[Coding; SERIES_COLUMNS],
+    ) -> (i64, [i64; SERIES_COLUMNS], [i64; SERIES_COLUMNS]) {
+        let ts_delta = ts.wrapping_sub(self.last_ts);
+        let mut deltas = [0; SERIES_COLUMNS];
+        let mut encoded = [0; SERIES_COLUMNS];
+
+        for i in 0..SERIES_COLUMNS {
+            deltas[i] = values[i].wrapping_sub(self.last[i]);
+            encoded[i] = match codings[i] {
+                Coding::Delta => deltas[i],
+                Coding::DeltaOfDelta => deltas[i].wrapping_sub(self.last_delta[i]),
+            };
+        }
+
+        (ts_delta, deltas, encoded)
+    }
+
+    /// Returns false if the block is full
+    fn append(
+        &mut self,
+        ts: i64,
+        values: [i64; SERIES_COLUMNS],
+        codings: &[Coding; SERIES_COLUMNS],
+    ) -> bool {
+        let (ts_delta, deltas, encoded) = self.deltas(ts, &values, codings);
+        let dod = ts_delta.wrapping_sub(self.last_ts_delta);
+
+        let bits = encoded_bits(dod) + encoded.iter().map(|&v| encoded_bits(v)).sum::<usize>();
+        if self.bits + bits > SERIES_BLOCK_SIZE * 8 {
+            return false;
+        }
+
+        let mut writer = BitWriter {
+            buf: &mut self.bytes,
+            pos: self.bits,
+        };
+        writer.put_signed(dod);
+        for v in encoded {
+            writer.put_signed(v);
+        }
+
+        self.bits = writer.pos;
+        self.count += 1;
+        self.last_ts = ts;
+        self.last_ts_delta = ts_delta;
+        self.last = values;
+        self.last_delta = deltas;
+
+        true
+    }
+
+    /// Decode the samples in order until `f` returns false
+    fn decode(
+        &self,
+        resolution_ms: u64,
+        codings: &[Coding; SERIES_COLUMNS],
+        mut f: impl FnMut(Sample) -> bool,
+    ) {
+        let mut reader = BitReader {
+            buf: &self.bytes,
+            pos: 0,
+        };
+        let mut ts = self.first_ts;
+        let mut ts_delta = 0i64;
+        let mut values = self.first;
+        let mut deltas = [0i64; SERIES_COLUMNS];
+
+        for n in 0..self.count {
+            if n > 0 {
+                ts_delta = ts_delta.wrapping_add(reader.get_signed());
+                ts = ts.wrapping_add(ts_delta);
+
+                for i in 0..SERIES_COLUMNS {
+                    let v = reader.get_signed();
+                    deltas[i] = match codings[i] {
+                        Coding::Delta => v,
+                        Coding::DeltaOfDelta => deltas[i].wrapping_add(v),
+                    };
+                    values[i] = values[i].wrapping_add(deltas[i]);
+                }
+            }
+
+            let sample = Sample {
+                timestamp_ms: ts as u64 * resolution_ms,
+                values,
+            };
+            if !f(sample) {
+                return;
+            }
+        }
+    }
+
+    fn first_ms(&self, resolution_ms: u64) -> u64 {
+        self.first_ts as u64 * resolution_ms
+    }
+
+    fn last_ms(&self, resolution_ms: u64) -> u64 {
+        self.last_ts as u64 * resolution_ms
+    }
+}
+
+struct Series {
+    kind: SeriesKind,
+    blocks: VecDeque<Block>,
+}
+
+#[derive(Debug, Clone, Copy, Default)]
+pub struct SeriesStats {
+    pub series: usize,
+    pub blocks: usize,
+    pub samples: usize,
+    /// Bytes used by the samples, first samples of the blocks included
+    pub encoded_bytes: usize,
+    /// Memory of the blocks
+    pub allocated_bytes: usize,
+}
+
+impl SeriesStats {
+    pub fn bytes_per_sample(&self) -> f32 {
+        if self.samples == 0 {
+            0.0
+        } else {
+            self.encoded_bytes as f32 / self.samples as f32
+        }
+    }
+}
+
+pub struct SeriesStore {
+    retention_ms: u64,
+    resolution_ms: u64,
+    max_blocks: usize,
+    series: HashMap<BleAddress, Series>,
+}
+
+impl Default for SeriesStore {
+    fn default() -> Self {
+        Self::new(DEFAULT_RETENTION, DEFAULT_RESOLUTION)
+    }
+}
+
+impl SeriesStore {
+    /// Samples older than `retention` are dropped block by block, timestamps
+    /// are rounded down to `resolution`.
+    pub fn new(retention: Duration, resolution: Duration) -> SeriesStore {
+        SeriesStore {
+            retention_ms: retention.as_millis() as u64,
+            resolution_ms: (resolution.as_millis() as u64).max(1),
+            max_blocks: DEFAULT_MAX_BLOCKS,
+            series: HashMap::new(),
+        }
+    }
+
+    /// Bound the memory of every series to `max_blocks * SERIES_BLOCK_SIZE`
+    pub fn set_max_blocks(&mut self, max_blocks: usize) {
+        self.max_blocks = max_blocks.max(1);
+    }
+
+    /// Append the sample of a Xiaomi or Linky TIC record received at
+    /// `timestamp_ms`, e.g. each message yielded by `StreamChannel::next()`.
+    /// Returns false if the message carries no sample.
+    pub fn push(&mut self, message: &ChannelMessage, timestamp_ms: u64) -> bool {
+        match Sample::from_message(message, timestamp_ms) {
+            Some((addr, kind, sample)) => self.append(addr, kind, sample),
+            None => false,
+        }
+    }
+
+    /// Returns false if the series of `addr` is of another kind
+    pub fn append(&mut self, addr: BleAddress, kind: SeriesKind, sample: Sample) -> bool {
+        let resolution_ms = self.resolution_ms;
+        let series = self.series.entry(addr).or_insert_with(|| Series {
+            kind,
+            blocks: VecDeque::new(),
+        });
+
+        if series.kind != kind {
+            return false;
+        }
+
+        let mut ts = (sample.timestamp_ms / resolution_ms) as i64;
+        let codings = kind.codings();
+
+        let appended = match series.blocks.back_mut() {
+            Some(block) => {
+                ts = ts.max(block.last_ts);
+                block.append(ts, sample.values, &codings)
+            }
+            None => false,
+        };
+
+        if !appended {
+            series.blocks.push_back(Block::new(ts, sample.values));
+        }
+
+        while series.blocks.len() > self.max_blocks {
+            series.blocks.pop_front();
+        }
+
+        self.expire_series(&addr, sample.timestamp_ms);
+
+        true
+    }
+
+    fn expire_series(&mut self, addr: &BleAddress, now_ms: u64) {
+        let Some(series) = self.series.get_mut(addr) else {
+            return;
+        };
+
+        let oldest = now_ms.saturating_sub(self.retention_ms);
+        while series
+            .blocks
+            .front()
+            .is_some_and(|block| block.last_ms(self.resolution_ms) < oldest)
+        {
+            series.blocks.pop_front();
+        }
+
+        if series.blocks.is_empty() {
+            self.series.remove(addr);
+        }
+    }
+
+    /// Drop the samples older than the retention at `now_ms`, and the series of
+    /// the devices not heard from since
+    pub fn expire(&mut self, now_ms: u64) {
+        let addrs: Vec<BleAddress> = self.series.keys().copied().collect();
+
+        for addr in addrs {
+            self.expire_series(&addr, now_ms);
+        }
+    }
+
+    pub fn kind(&self, addr: &BleAddress) -> Option<SeriesKind> {
+        self.series.get(addr).map(|series| series.kind)
+    }
+
+    pub fn addresses(&self) -> impl Iterator<Item = &BleAddress> {
+        self.series.keys()
+    }
+
+    /// Samples of `addr` with a timestamp in `from_ms..=to_ms`, in order. Only
+    /// the blocks overlapping the range are decoded.
+    pub fn range(&self, addr: &BleAddress, from_ms: u64, to_ms: u64) -> Vec<Sample> {
+        let mut samples = Vec::new();
+
+        let Some(series) = self.series.get(addr) else {
+            return samples;
+        };
+
+        let codings = series.kind.codings();
+
+        for block in &series.blocks {
+            if block.last_ms(self.resolution_ms) < from_ms {
+                continue;
+            }
+            if block.first_ms(self.resolution_ms) > to_ms {
+                break;
+            }
+
+            block.decode(self.resolution_ms, &codings, |sample| {
+                if sample.timestamp_ms > to_ms {
+                    return false;
+                }
+                if sample.timestamp_ms >= from_ms {
+                    samples.push(sample);
+                }
+                true
+            });
+        }
+
+        samples
+    }
+
+    /// Last sample of `addr`
+    pub fn last(&self, addr: &BleAddress) -> Option<Sample> {
+        let block = self.series.get(addr)?.blocks.back()?;
+
+        Some(Sample {
+            timestamp_ms: block.last_ms(self.resolution_ms),
+            values: block.last,
+        })
+    }
+
+    pub fn stats(&self) -> SeriesStats {
+        let mut stats = SeriesStats {
+            series: self.series.len(),
+            ..Default::default()
+        };
+
+        for block in self.series.values().flat_map(|series| series.blocks.iter()) {
+            stats.blocks += 1;
+            stats.samples += block.count;
+            stats.encoded_bytes += (block.bits + 64 * (1 + SERIES_COLUMNS)).div_ceil(8);
+            stats.allocated_bytes += block.bytes.len();
+        }
+
+        stats
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::ble::BleType;
+
+    /// Deterministic xorshift64 generator
+    struct Rng(u64);
+
+    impl Rng {
+        fn next(&mut self) -> u64 {
+            self.0 ^= self.0 << 13;
+            self.0 ^= self.0 >> 7;
+            self.0 ^= self.0 << 17;
+            self.0
+        }
+    }
+
+    fn addr(last: u8) -> BleAddress {
+        BleAddress {
+            mac: [0xa4, 0xc1, 0x38, 0x00, 0x00, last],
+            ble_type: BleType::Public,
+        }
+    }
+
+    fn decode_all(block: &Block, codings: &[Coding; SERIES_COLUMNS]) -> Vec<Sample> {
+        let mut samples = Vec::new();
+        block.decode(1, codings, |sample| {
+            samples.push(sample);
+            true
+        });
+        samples
+    }
+
+    #[test]
+    fn test_bits_round_trip() {
+        let mut rng = Rng(0x9e3779b97f4a7c15);
+        let mut buf = vec![0u8; 4096];
+        let mut fields = Vec::new();
+        let mut writer = BitWriter {
+            buf: &mut buf,
+            pos: 0,
+        };
+
+        // Every width, at every bit offset
+        for n in (1..=64).cycle().take(400) {
+            let value = rng.next() & (u64::MAX >> (64 - n));
+            writer.put(value, n);
+            fields.push((value, n));
+        }
+        let end = writer.pos;
+
+        let mut reader = BitReader { buf: &buf, pos: 0 };
+        for (value, n) in fields {
+            assert_eq!(reader.get(n), value, "{} bits at {}", n, reader.pos);
+        }
+        assert_eq!(reader.pos, end);
+    }
+
+    #[test]
+    fn test_signed_round_trip() {
+        let mut values = vec![0, i64::MIN, i64::MAX];
+        for bits in [4, 8, 16, 32] {
+            let max = (1i64 << (bits - 1)) - 1;
+            values.extend([max, max + 1, -max - 1, -max - 2]);
+        }
+
+        let mut buf = vec![0u8; 256];
+        let mut writer = BitWriter {
+            buf: &mut buf,
+            pos: 1,
+        };
+        let mut ends = Vec::new();
+        for &value in &values {
+            writer.put_signed(value);
+            ends.push(writer.pos);
+        }
+
+        let mut reader = BitReader { buf: &buf, pos: 1 };
+        for (&value, &end) in values.iter().zip(&ends) {
+            let start = reader.pos;
+            assert_eq!(reader.get_signed(), value);
+            assert_eq!(reader.pos, end);
+            assert_eq!(end - start, encoded_bits(value), "width of {}", value);
+        }
+
+        // Smallest bucket holding the value
+        assert_eq!(encoded_bits(0), 1);
+        assert_eq!(encoded_bits(-8), 2 + 4);
+        assert_eq!(encoded_bits(8), 3 + 8);
+        assert_eq!(encoded_bits(-32769), 5 + 32);
+        assert_eq!(encoded_bits(i64::MIN), 5 + 64);
+    }
+
+    #[test]
+    fn test_block_round_trip() {
+        let mut rng = Rng(42);
+
+        for codings in [SeriesKind::Xiaomi.codings(), SeriesKind::LinkyTic.codings()] {
+            let mut samples = vec![Sample {
+                timestamp_ms: 1_700_000_000,
+                values: [2150, 4560, 2950],
+            }];
+            let mut block = Block::new(1_700_000_000, samples[0].values);
+
+            // Regular, jittered and large steps, extreme values wrap
+            for n in 1..100u64 {
+                let last = samples[samples.len() - 1];
+                let step = match n % 50 {
+                    0 => 1 << 40,
+                    _ => 5 + rng.next() % 3,
+                };
+                let values = match n % 67 {
+                    0 => [i64::MIN, i64::MAX, 0],
+                    _ => [
+                        last.values[0].wrapping_add((rng.next() % 21) as i64 - 10),
+                        last.values[1].wrapping_add(n as i64 * 100),
+                        (rng.next() % 20_000) as i64 - 10_000,
+                    ],
+                };
+                let sample = Sample {
+                    timestamp_ms: last.timestamp_ms + step,
+                    values,
+                };
+
+                assert!(block.append(sample.timestamp_ms as i64, values, &codings));
+                samples.push(sample);
+            }
+
+            assert_eq!(block.count, samples.len());
+            assert_eq!(decode_all(&block, &codings), samples);
+        }
+    }
+
+    #[test]
+    fn test_block_full() {
+        let codings = SeriesKind::Xiaomi.codings();
+        let mut rng = Rng(7);
+        let mut block = Block::new(0, [0; SERIES_COLUMNS]);
+        let mut samples = vec![Sample {
+            timestamp_ms: 0,
+            values: [0; SERIES_COLUMNS],
+        }];
+
+        // Random values take 5 + 64 bits each, the block fills up quickly
+        for ts in 1.. {
+            let values = [rng.next() as i64, rng.next() as i64, rng.next() as i64];
+            if !block.append(ts * 1000 + (rng.next() % 1000) as i64, values, &codings) {
+                break;
+            }
+            samples.push(Sample {
+                timestamp_ms: block.last_ts as u64,
+                values,
+            });
+        }
+
+        assert!(block.bits <= SERIES_BLOCK_SIZE * 8);
+        assert!(block.bits + 4 * (5 + 64) > SERIES_BLOCK_SIZE * 8);
+        assert_eq!(decode_all(&block, &codings), samples);
+    }
+
+    #[test]
+    fn test_store_range() {
+        let mut store = SeriesStore::new(Duration::from_secs(3600), Duration::from_millis(10));
+        store.set_max_blocks(1000);
+        let a = addr(1);
+
+        let mut expected = Vec::new();
+        for n in 0..2000u64 {
+            let sample = Sample {
+                timestamp_ms: 1_000_000 + n * 1000 + 3,
+                values: [2000 + (n % 7) as i64, 5000 - n as i64, 3000],
+            };
+            assert!(store.append(a, SeriesKind::Xiaomi, sample));
+            expected.push(Sample {
+                timestamp_ms: sample.timestamp_ms - 3,
+                ..sample
+            });
+        }
+
+        let stats = store.stats();
+        assert!(stats.blocks > 1, "spans several blocks");
+        assert_eq!(stats.samples, expected.len());
+
+        assert_eq!(store.range(&a, 0, u64::MAX), expected);
+        assert_eq!(store.range(&a, 1_500_000, 1_502_000), expected[500..=502]);
+        assert_eq!(store.last(&a), expected.last().copied());
+        assert!(store.range(&addr(2), 0, u64::MAX).is_empty());
+
+        // A series keeps its kind
+        assert!(!store.append(a, SeriesKind::LinkyTic, expected[0]));
+    }
+
+    #[test]
+    fn test_store_clamp_and_expire() {
+        let mut store = SeriesStore::new(Duration::from_secs(10), Duration::from_secs(1));
+        let a = addr(1);
+        let sample = |timestamp_ms| Sample {
+            timestamp_ms,
+            values: [1, 2, 3],
+        };
+
+        store.append(a, SeriesKind::LinkyTic, sample(5000));
+        store.append(a, SeriesKind::LinkyTic, sample(3000));
+        let samples = store.range(&a, 0, u64::MAX);
+        assert_eq!(samples.len(), 2);
+        assert_eq!(samples[1].timestamp_ms, 5000, "earlier timestamp clamped");
+
+        store.expire(15_000);
+        assert_eq!(store.kind(&a), Some(SeriesKind::LinkyTic));
+        store.expire(15_001);
+        assert_eq!(store.kind(&a), None);
+        assert_eq!(store.addresses().count(), 0);
+    }
+}
@@ -0,0 +1,580 @@
+//! Batching sink, forwarding the records to a time series database or a
+//! broker (`sink` feature).
+//!
+//! [`Sink::spawn`] starts a task grouping the records in batches of up to
+//! `batch_size`, a partial batch is written once its first record waited
+//! `linger`. Up to `max_in_flight` batches are written concurrently by a
+//! [`SinkWriter`], a failed write is retried with exponential backoff and the
+//! batch is dropped once the retries are exhausted. Records wait in a bounded
+//! buffer: when the writers fall behind, [`Sink::send`] waits (backpressure) and
+//! [`Sink::try_send`] fails.
+//!
+//! Writers: [`InfluxWriter`](crate::influx::InfluxWriter) (InfluxDB line
+//! protocol over HTTP) and [`MqttWriter`](crate::mqtt::MqttWriter) (MQTT 3.1.1
+//! publish).
+
+use std::future::Future;
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::sync::{Arc, Mutex};
+use std::time::{Duration, SystemTime, UNIX_EPOCH};
+
+use thiserror::Error;
+use tokio::sync::{mpsc, OwnedSemaphorePermit, Semaphore};
+use tokio::task::{JoinHandle, JoinSet};
+use tokio::time::Instant;
+
+use crate::stream_message::ChannelMessage;
+
+pub const DEFAULT_BATCH_SIZE: usize = 500;
+pub const DEFAULT_LINGER: Duration = Duration::from_secs(1);
+pub const DEFAULT_BUFFER: usize = 10_000;
+pub const DEFAULT_MAX_IN_FLIGHT: usize = 4;
+pub const DEFAULT_RETRIES: u32 = 5;
+pub const DEFAULT_BACKOFF: Duration = Duration::from_millis(100);
+pub const DEFAULT_BACKOFF_MAX: Duration = Duration::from_secs(10);
+
+#[derive(Error, Debug)]
+pub enum SinkError {
+    #[error("IO error: {0}")]
+    IoError(#[from] std::io::Error),
+    #[error("Timeout")]
+    Timeout,
+    #[error("Invalid URL")]
+    InvalidUrl,
+    #[error("Invalid response")]
+    InvalidResponse,
+    #[error("HTTP status {0}")]
+    HttpStatus(u16),
+    #[error("MQTT connection refused ({0})")]
+    MqttRefused(u8),
+    #[error("Sink buffer full")]
+    Full,
+    #[error("Sink closed")]
+    Closed,
+}
+
+impl SinkError {
+    /// Client errors (bad request, authentication) fail again on retry
+    pub fn is_retryable(&self) -> bool {
+        match self {
+            SinkError::HttpStatus(status) => *status == 408 || *status == 429 || *status >= 500,
+            // 3: server unavailable
+            SinkError::MqttRefused(code) => *code == 3,
+            SinkError::InvalidUrl | SinkError::Full | SinkError::Closed => false,
+            _ => true,
+        }
+    }
+}
+
+/// Record queued in the sink
+#[derive(Debug)]
+pub struct SinkRecord {
+    /// Host time the record was sent to the sink, the records carry the device
+    /// uptime only
+    pub time: SystemTime,
+    /// Xiaomi, Linky TIC or device health record
+    pub message: ChannelMessage,
+}
+
+impl SinkRecord {
+    /// Nanoseconds since the Unix epoch
+    pub fn time_ns(&self) -> u64 {
+        self.time
+            .duration_since(UNIX_EPOCH)
+            .map_or(0, |elapsed| elapsed.as_nanos() as u64)
+    }
+}
+
+/// Destination of the batches
+pub trait SinkWriter: Send + Sync + 'static {
+    /// Write a whole batch, called concurrently for up to `max_in_flight`
+    /// batches. An error fails the whole batch, which is retried.
+    fn write(&self, batch: &[SinkRecord]) -> impl Future<Output = Result<(), SinkError>> + Send;
+}
+
+#[derive(Debug, Clone)]
+pub struct SinkConfig {
+    /// Records per batch
+    pub batch_size: usize,
+    /// Longest wait of a record before its partial batch is written
+    pub linger: Duration,
+    /// Records buffered before `send()` waits
+    pub buffer: usize,
+    /// Batches written concurrently
+    pub max_in_flight: usize,
+    /// Retries of a failed batch before it is dropped
+    pub retries: u32,
+    /// Delay before the first retry, doubled on every retry up to `backoff_max`
+    pub backoff: Duration,
+    pub backoff_max: Duration,
+}
+
+impl Default for SinkConfig {
+    fn default() -> Self {
+        SinkConfig {
+            batch_size: DEFAULT_BATCH_SIZE,
+            linger: DEFAULT_LINGER,
+            buffer: DEFAULT_BUFFER,
+            max_in_flight: DEFAULT_MAX_IN_FLIGHT,
+            retries: DEFAULT_RETRIES,
+            backoff: DEFAULT_BACKOFF,
+            backoff_max: DEFAULT_BACKOFF_MAX,
+        }
+    }
+}
+
+#[derive(Debug, Clone, Default)]
+pub struct SinkStats {
+    /// Records accepted by `send()`
+    pub received: u64,
+    /// Records written
+    pub written: u64,
+    /// Records of the batches dropped after their last retry
+    pub dropped: u64,
+    /// Batches written
+    pub batches: u64,
+    /// Batches dropped
+    pub failed_batches: u64,
+    /// Write attempts retried
+    pub retries: u64,
+    /// Batches being written
+    pub in_flight: u64,
+    pub last_error: Option<String>,
+}
+
+#[derive(Default)]
+struct SinkCounters {
+    received: AtomicU64,
+    written: AtomicU64,
+    dropped: AtomicU64,
+    batches: AtomicU64,
+    failed_batches: AtomicU64,
+    retries: AtomicU64,
+    in_flight: AtomicU64,
+    last_error: Mutex<Option<String>>,
+}
+
+impl SinkCounters {
+    fn snapshot(&self) -> SinkStats {
+        SinkStats {
+            received: self.received.load(Ordering::Relaxed),
+            written: self.written.load(Ordering::Relaxed),
+            dropped: self.dropped.load(Ordering::Relaxed),
+            batches: self.batches.load(Ordering::Relaxed),
+            failed_batches: self.failed_batches.load(Ordering::Relaxed),
+            retries: self.retries.load(Ordering::Relaxed),
+            in_flight: self.in_flight.load(Ordering::Relaxed),
+            last_error: self.last_error.lock().unwrap().clone(),
+        }
+    }
+}
+
+pub struct Sink {
+    tx: mpsc::Sender<SinkRecord>,
+    counters: Arc<SinkCounters>,
+    task: JoinHandle<()>,
+}
+
+impl Sink {
+    /// Start the batching task, must be called from a tokio runtime
+    pub fn spawn<W: SinkWriter>(writer: W, config: SinkConfig) -> Sink {
+        let (tx, rx) = mpsc::channel(config.buffer.max(1));
+        let counters = Arc::new(SinkCounters::default());
+        let task = tokio::spawn(run(Arc::new(writer), config, rx, counters.clone()));
+
+        Sink { tx, counters, task }
+    }
+
+    fn record(message: ChannelMessage) -> Option<SinkRecord> {
+        match message {
+            ChannelMessage::Xiaomi(_)
+            | ChannelMessage::LinkyTic(_)
+            | ChannelMessage::DeviceHealth(_) => Some(SinkRecord {
+                time: SystemTime::now(),
+                message,
+            }),
+            // Snapshots replay old values, which are already in the sink
+            _ => None,
+        }
+    }
+
+    /// Queue a message, waits while the buffer is full. Messages other than
+    /// Xiaomi, Linky TIC and device health records are ignored.
+    pub async fn send(&self, message: ChannelMessage) -> Result<(), SinkError> {
+        let Some(record) = Self::record(message) else {
+            return Ok(());
+        };
+
+        self.tx.send(record).await.map_err(|_| SinkError::Closed)?;
+        self.counters.received.fetch_add(1, Ordering::Relaxed);
+
+        Ok(())
+    }
+
+    /// Queue a message, fails with `SinkError::Full` rather than waiting
+    pub fn try_send(&self, message: ChannelMessage) -> Result<(), SinkError> {
+        let Some(record) = Self::record(message) else {
+            return Ok(());
+        };
+
+        self.tx.try_send(record).map_err(|e| match e {
+            mpsc::error::TrySendError::Full(_) => SinkError::Full,
+            mpsc::error::TrySendError::Closed(_) => SinkError::Closed,
+        })?;
+        self.counters.received.fetch_add(1, Ordering::Relaxed);
+
+        Ok(())
+    }
+
+    pub fn stats(&self) -> SinkStats {
+        self.counters.snapshot()
+    }
+
+    /// Write the buffered records and wait for the batches in flight
+    pub async fn close(self) -> SinkStats {
+        drop(self.tx);
+        let _ = self.task.await;
+
+        self.counters.snapshot()
+    }
+}
+
+async fn run<W: SinkWriter>(
+    writer: Arc<W>,
+    config: SinkConfig,
+    mut rx: mpsc::Receiver<SinkRecord>,
+    counters: Arc<SinkCounters>,
+) {
+    let batch_size = config.batch_size.max(1);
+    let permits = Arc::new(Semaphore::new(config.max_in_flight.max(1)));
+    let mut tasks = JoinSet::new();
+    let mut batch = Vec::with_capacity(batch_size);
+    let mut deadline: Option<Instant> = None;
+
+    loop {
+        let received = match deadline {
+            Some(deadline) => tokio::time::timeout_at(deadline, rx.recv()).await.ok(),
+            None => Some(rx.recv().await),
+        };
+
+        let closed = match received {
+            Some(Some(record)) => {
+                if batch.is_empty() {
+                    deadline = Some(Instant::now() + config.linger);
+                }
+
+                batch.push(record);
+                if batch.len() < batch_size {
+                    continue;
+                }
+
+                false
+            }
+            Some(None) => true,
+            // Linger elapsed
+            None => false,
+        };
+
+        if !batch.is_empty() {
+            // Waiting for a permit stops the receive loop, the buffer fills up
+            // and the senders wait in turn
+            let permit = permits
+                .clone()
+                .acquire_owned()
+                .await
+                .expect("Semaphore never closed");
+            let batch = std::mem::replace(&mut batch, Vec::with_capacity(batch_size));
+
+            tasks.spawn(write_batch(
+                writer.clone(),
+                batch,
+                config.clone(),
+                counters.clone(),
+                permit,
+            ));
+        }
+        deadline = None;
+
+        while tasks.try_join_next().is_some() {}
+
+        if closed {
+            break;
+        }
+    }
+
+    while tasks.join_next().await.is_some() {}
+}
+
+/// Spread the retries of concurrent batches: `delay` / 2 plus up to `delay` / 2
+fn jitter(delay: Duration) -> Duration {
+    let nanos = SystemTime::now()
+        .duration_since(UNIX_EPOCH)
+        .map_or(0, |elapsed| elapsed.subsec_nanos() as u64);
+    let half = delay / 2;
+
+    half + Duration::from_nanos(nanos % (half.as_nanos() as u64 + 1))
+}
+
+async fn write_batch<W: SinkWriter>(
+    writer: Arc<W>,
+    batch: Vec<SinkRecord>,
+    config: SinkConfig,
+    counters: Arc<SinkCounters>,
+    _permit: OwnedSemaphorePermit,
+) {
+    let len = batch.len() as u64;
+    let mut backoff = config.backoff;
+    let mut attempt = 0;
+
+    counters.in_flight.fetch_add(1, Ordering::Relaxed);
+
+    loop {
+        match writer.write(&batch).await {
+            Ok(()) => {
+                counters.written.fetch_add(len, Ordering::Relaxed);
+                counters.batches.fetch_add(1, Ordering::Relaxed);
+                break;
+            }
+            Err(e) => {
+                *counters.last_error.lock().unwrap() = Some(e.to_string());
+
+                if attempt >= config.retries || !e.is_retryable() {
+                    counters.dropped.fetch_add(len, Ordering::Relaxed);
+                    counters.failed_batches.fetch_add(1, Ordering::Relaxed);
+                    break;
+                }
+
+                attempt += 1;
+                counters.retries.fetch_add(1, Ordering::Relaxed);
+
+                tokio::time::sleep(jitter(backoff)).await;
+                backoff = (backoff * 2).min(config.backoff_max);
+            }
+        }
+    }
+
+    counters.in_flight.fetch_sub(1, Ordering::Relaxed);
+}
+
+#[cfg(test)]
+pub(crate) mod tests {
+    use super::*;
+    use std::sync::atomic::AtomicU32;
+
+    use byteorder::{ByteOrder, LittleEndian};
+
+    use crate::xiaomi::XiaomiHandler;
+    use crate::StreamChannelHandler;
+
+    /// Record of device `a4:c1:38:00:00:<device>` at 1700000000 s, 21.5 °C
+    pub(crate) fn xiaomi_record(device: u8) -> SinkRecord {
+        let mut data = [0u8; 24];
+        data[0..6].copy_from_slice(&[0xa4, 0xc1, 0x38, 0x00, 0x00, device]);
+        data[7] = -67i8 as u8;
+        LittleEndian::write_i16(&mut data[17..19], 2150);
+        LittleEndian::write_u16(&mut data[19..21], 4500);
+        LittleEndian::write_u16(&mut data[21..23], 2950);
+        data[23] = 85;
+
+        SinkRecord {
+            time: UNIX_EPOCH + Duration::from_secs(1_700_000_000),
+            message: ChannelMessage::Xiaomi(XiaomiHandler::parse_message(&data).unwrap()),
+        }
+    }
+
+    fn config(batch_size: usize) -> SinkConfig {
+        SinkConfig {
+            batch_size,
+            linger: Duration::from_secs(60),
+            backoff: Duration::from_millis(1),
+            backoff_max: Duration::from_millis(4),
+            ..Default::default()
+        }
+    }
+
+    /// Writer recording the batch lengths, failing the first `failures` writes
+    /// with `error`
+    #[derive(Default)]
+    struct TestWriter {
+        batches: Arc<Mutex<Vec<usize>>>,
+        failures: AtomicU32,
+        error: Option<fn() -> SinkError>,
+    }
+
+    impl SinkWriter for TestWriter {
+        async fn write(&self, batch: &[SinkRecord]) -> Result<(), SinkError> {
+            if let Some(error) = self.error {
+                if self.failures.load(Ordering::SeqCst) > 0 {
+                    self.failures.fetch_sub(1, Ordering::SeqCst);
+                    return Err(error());
+                }
+            }
+
+            self.batches.lock().unwrap().push(batch.len());
+            Ok(())
+        }
+    }
+
+    #[tokio::test]
+    async fn batch_size() {
+        let writer = TestWriter::default();
+        let batches = writer.batches.clone();
+        let sink = Sink::spawn(writer, config(3));
+
+        for device in 0..7 {
+            sink.send(xiaomi_record(device).message).await.unwrap();
+        }
+        let stats = sink.close().await;
+
+        let mut batches = batches.lock().unwrap().clone();
+        batches.sort();
+        assert_eq!(batches, [1, 3, 3]);
+        assert_eq!(stats.received, 7);
+        assert_eq!(stats.written, 7);
+        assert_eq!(stats.batches, 3);
+        assert_eq!(stats.in_flight, 0);
+    }
+
+    #[tokio::test]
+    async fn linger() {
+        let writer = TestWriter::default();
+        let batches = writer.batches.clone();
+        let sink = Sink::spawn(
+            writer,
+            SinkConfig {
+                linger: Duration::from_millis(20),
+                ..config(100)
+            },
+        );
+
+        sink.send(xiaomi_record(1).message).await.unwrap();
+        sink.send(xiaomi_record(2).message).await.unwrap();
+        tokio::time::sleep(Duration::from_millis(200)).await;
+
+        // Written before the sink is closed
+        assert_eq!(*batches.lock().unwrap(), [2]);
+        assert_eq!(sink.close().await.batches, 1);
+    }
+
+    #[tokio::test]
+    async fn retry() {
+        let writer = TestWriter {
+            failures: AtomicU32::new(2),
+            error: Some(|| SinkError::HttpStatus(503)),
+            ..Default::default()
+        };
+        let batches = writer.batches.clone();
+        let sink = Sink::spawn(writer, config(2));
+
+        sink.send(xiaomi_record(1).message).await.unwrap();
+        sink.send(xiaomi_record(2).message).await.unwrap();
+        let stats = sink.close().await;
+
+        assert_eq!(*batches.lock().unwrap(), [2]);
+        assert_eq!(stats.retries, 2);
+        assert_eq!(stats.written, 2);
+        assert_eq!(stats.dropped, 0);
+        assert_eq!(stats.last_error.as_deref(), Some("HTTP status 503"));
+    }
+
+    #[tokio::test]
+    async fn retries_exhausted() {
+        let writer = TestWriter {
+            failures: AtomicU32::new(u32::MAX),
+            error: Some(|| SinkError::Timeout),
+            ..Default::default()
+        };
+        let sink = Sink::spawn(
+            writer,
+            SinkConfig {
+                retries: 3,
+                ..config(1)
+            },
+        );
+
+        sink.send(xiaomi_record(1).message).await.unwrap();
+        let stats = sink.close().await;
+
+        assert_eq!(stats.retries, 3);
+        assert_eq!(stats.written, 0);
+        assert_eq!(stats.dropped, 1);
+        assert_eq!(stats.failed_batches, 1);
+    }
+
+    #[tokio::test]
+    async fn not_retryable() {
+        let writer = TestWriter {
+            failures: AtomicU32::new(1),
+            error: Some(|| SinkError::HttpStatus(400)),
+            ..Default::default()
+        };
+        let sink = Sink::spawn(writer, config(1));
+
+        sink.send(xiaomi_record(1).message).await.unwrap();
+        let stats = sink.close().await;
+
+        assert_eq!(stats.retries, 0);
+        assert_eq!(stats.dropped, 1);
+    }
+
+    /// Writer never completing
+    struct StalledWriter;
+
+    impl SinkWriter for StalledWriter {
+        async fn write(&self, _batch: &[SinkRecord]) -> Result<(), SinkError> {
+            std::future::pending().await
+        }
+    }
+
+    #[tokio::test]
+    async fn backpressure() {
+        let sink = Sink::spawn(
+            StalledWriter,
+            SinkConfig {
+                buffer: 1,
+                max_in_flight: 1,
+                ..config(1)
+            },
+        );
+
+        // Written, then waiting for a permit, then buffered
+        for device in 0..3 {
+            sink.try_send(xiaomi_record(device).message).unwrap();
+            tokio::time::sleep(Duration::from_millis(20)).await;
+        }
+
+        assert!(matches!(
+            sink.try_send(xiaomi_record(3).message),
+            Err(SinkError::Full)
+        ));
+        assert!(tokio::time::timeout(
+            Duration::from_millis(50),
+            sink.send(xiaomi_record(3).message)
+        )
+        .await
+        .is_err());
+        assert_eq!(sink.stats().received, 3);
+        assert_eq!(sink.stats().in_flight, 1);
+    }
+
+    #[test]
+    fn retryable() {
+        assert!(SinkError::HttpStatus(429).is_retryable());
+        assert!(SinkError::HttpStatus(500).is_retryable());
+        assert!(!SinkError::HttpStatus(401).is_retryable());
+        assert!(SinkError::MqttRefused(3).is_retryable());
+        assert!(!SinkError::MqttRefused(5).is_retryable());
+        assert!(SinkError::Timeout.is_retryable());
+        assert!(!SinkError::InvalidUrl.is_retryable());
+    }
+
+    #[test]
+    fn jitter_bounds() {
+        let delay = Duration::from_millis(100);
+
+        for _ in 0..100 {
+            let d = jitter(delay);
+            assert!(d >= delay / 2 && d <= delay, "{:?}", d);
+        }
+    }
+}
@@ -0,0 +1,330 @@
+//! Warm-start snapshots of the firmware device registry
+//! (`CONFIG_COPRO_DEVICE_REGISTRY_SNAPSHOT`).
+//!
+//! On every new connection, or when requested with
+//! [`ControlMessage::snapshot_request()`](crate::control_channel::ControlMessage::snapshot_request),
+//! the firmware replays the last record of every device it knows in a burst of
+//! snapshot frames, closed by an end frame. The channels assemble the burst and
+//! yield it as a single [`ChannelMessage::Snapshot`].
+
+use std::fmt::Display;
+
+use byteorder::{ByteOrder, LittleEndian};
+
+use crate::linky::LinkyTicHandler;
+use crate::stream_message::ChannelMessage;
+use crate::xiaomi::XiaomiHandler;
+use crate::{StreamChannelError, StreamChannelHandler, Timestamp};
+
+const SNAPSHOT_HEADER_SIZE: usize = 20;
+const SNAPSHOT_FLAG_END: u8 = 0x01;
+
+/// Frame of a snapshot burst
+#[derive(Debug)]
+pub enum SnapshotPart {
+    /// Last record of a device
+    Record {
+        seq: u16,
+        index: u16,
+        message: Box<ChannelMessage>,
+    },
+    /// End of the snapshot, `count` records were sent
+    End {
+        seq: u16,
+        timestamp: Timestamp,
+        count: u16,
+    },
+}
+
+/// Last known record of every device, replayed by the firmware
+#[derive(Debug)]
+pub struct Snapshot {
+    /// Sequence number, incremented on every snapshot
+    pub seq: u16,
+    /// Device uptime (ms) of the snapshot request
+    pub timestamp: Timestamp,
+    /// Xiaomi and Linky TIC records, with the timestamps of the advertisements
+    /// they were decoded from
+    pub records: Vec<ChannelMessage>,
+    /// Records sent by the firmware, more than `records.len()` if some were lost
+    pub count: u16,
+}
+
+impl Snapshot {
+    pub fn is_complete(&self) -> bool {
+        self.records.len() == self.count as usize
+    }
+}
+
+impl Display for Snapshot {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        write!(
+            f,
+            "seq: {} timestamp: {} records: {}/{}",
+            self.seq,
+            self.timestamp,
+            self.records.len(),
+            self.count
+        )
+    }
+}
+
+/// Collects the frames of a snapshot burst, records of a snapshot interrupted
+/// by a newer one are dropped.
+#[derive(Debug, Default)]
+pub struct SnapshotAssembler {
+    seq: Option<u16>,
+    records: Vec<ChannelMessage>,
+}
+
+impl SnapshotAssembler {
+    pub fn new() -> SnapshotAssembler {
+        Self::default()
+    }
+
+    /// Returns the snapshot once its end frame is received
+    pub fn push(&mut self, part: SnapshotPart) -> Option<Snapshot> {
+        match part {
+            SnapshotPart::Record { seq, message, .. } => {
+                if self.seq != Some(seq) {
+                    self.seq = Some(seq);
+                    self.records.clear();
+                }
+
+                self.records.push(*message);
+
+                None
+            }
+            SnapshotPart::End {
+                seq,
+                timestamp,
+                count,
+            } => {
+                // The end of an interrupted snapshot leaves the newer one
+                // being assembled
+                let records = if self.seq == Some(seq) {
+                    self.seq = None;
+                    std::mem::take(&mut self.records)
+                } else {
+                    Vec::new()
+                };
+
+                Some(Snapshot {
+                    seq,
+                    timestamp,
+                    records,
+                    count,
+                })
+            }
+        }
+    }
+}
+
+pub struct SnapshotHandler;
+
+impl StreamChannelHandler for SnapshotHandler {
+    const CHANNEL_ID: u32 = 0x9b2e41d7;
+    type Message = SnapshotPart;
+
+    fn parse_message(data: &[u8]) -> Result<Self::Message, StreamChannelError> {
+        if data.len() < SNAPSHOT_HEADER_SIZE {
+            return Err(StreamChannelError::InvalidMessageLength);
+        }
+
+        let flags = data[1];
+        let seq = LittleEndian::read_u16(&data[2..4]);
+        let index = LittleEndian::read_u16(&data[4..6]);
+
+        if flags & SNAPSHOT_FLAG_END != 0 {
+            return Ok(SnapshotPart::End {
+                seq,
+                timestamp: Timestamp::Uptime(LittleEndian::read_i64(&data[6..14]) as u64),
+                count: index,
+            });
+        }
+
+        let channel_id = LittleEndian::read_u32(&data[14..18]);
+        let len = LittleEndian::read_u16(&data[18..20]) as usize;
+        let record = data
+            .get(SNAPSHOT_HEADER_SIZE..SNAPSHOT_HEADER_SIZE + len)
+            .ok_or(StreamChannelError::InvalidMessageLength)?;
+
+        let message = match channel_id {
+            XiaomiHandler::CHANNEL_ID => {
+                ChannelMessage::Xiaomi(XiaomiHandler::parse_message(record)?)
+            }
+            LinkyTicHandler::CHANNEL_ID => {
+                ChannelMessage::LinkyTic(LinkyTicHandler::parse_message(record)?)
+            }
+            _ => return Err(StreamChannelError::InvalidMessageData),
+        };
+
+        Ok(SnapshotPart::Record {
+            seq,
+            index,
+            message: Box::new(message),
+        })
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn xiaomi(device: u8) -> [u8; 24] {
+        let mut data = [0u8; 24];
+        data[0..6].copy_from_slice(&[0xa4, 0xc1, 0x38, 0x00, 0x00, device]);
+        LittleEndian::write_i16(&mut data[17..19], 2150);
+        data
+    }
+
+    /// Snapshot frame payload replaying `record` of `channel_id`
+    fn frame(seq: u16, index: u16, channel_id: u32, record: &[u8]) -> Vec<u8> {
+        let mut data = vec![0u8; SNAPSHOT_HEADER_SIZE];
+        data[0] = 1;
+        LittleEndian::write_u16(&mut data[2..4], seq);
+        LittleEndian::write_u16(&mut data[4..6], index);
+        LittleEndian::write_i64(&mut data[6..14], 42_000);
+        LittleEndian::write_u32(&mut data[14..18], channel_id);
+        LittleEndian::write_u16(&mut data[18..20], record.len() as u16);
+        data.extend_from_slice(record);
+        data
+    }
+
+    fn end_frame(seq: u16, count: u16) -> Vec<u8> {
+        let mut data = frame(seq, count, 0, &[]);
+        data[1] = SNAPSHOT_FLAG_END;
+        data
+    }
+
+    fn part(data: &[u8]) -> SnapshotPart {
+        SnapshotHandler::parse_message(data).unwrap()
+    }
+
+    fn device(message: &ChannelMessage) -> u8 {
+        match message {
+            ChannelMessage::Xiaomi(record) => record.ble_addr.mac[5],
+            message => panic!("unexpected message {:?}", message),
+        }
+    }
+
+    #[test]
+    fn parse_record_and_end() {
+        match part(&frame(7, 3, XiaomiHandler::CHANNEL_ID, &xiaomi(5))) {
+            SnapshotPart::Record {
+                seq,
+                index,
+                message,
+            } => {
+                assert_eq!((seq, index), (7, 3));
+                assert_eq!(device(&message), 5);
+            }
+            part => panic!("unexpected part {:?}", part),
+        }
+
+        match part(&end_frame(7, 4)) {
+            SnapshotPart::End {
+                seq,
+                timestamp,
+                count,
+            } => {
+                assert_eq!((seq, count), (7, 4));
+                assert_eq!(timestamp, Timestamp::Uptime(42_000));
+            }
+            part => panic!("unexpected part {:?}", part),
+        }
+    }
+
+    #[test]
+    fn parse_invalid() {
+        let record = frame(1, 0, XiaomiHandler::CHANNEL_ID, &xiaomi(1));
+
+        // Header, record length beyond the payload, unknown channel
+        assert!(matches!(
+            SnapshotHandler::parse_message(&record[..SNAPSHOT_HEADER_SIZE - 1]),
+            Err(StreamChannelError::InvalidMessageLength)
+        ));
+        assert!(matches!(
+            SnapshotHandler::parse_message(&record[..record.len() - 1]),
+            Err(StreamChannelError::InvalidMessageLength)
+        ));
+        assert!(matches!(
+            SnapshotHandler::parse_message(&frame(1, 0, 0x12345678, &xiaomi(1))),
+            Err(StreamChannelError::InvalidMessageData)
+        ));
+    }
+
+    #[test]
+    fn assemble() {
+        let mut assembler = SnapshotAssembler::new();
+
+        for index in 0..3 {
+            let data = frame(1, index, XiaomiHandler::CHANNEL_ID, &xiaomi(index as u8));
+            assert!(assembler.push(part(&data)).is_none());
+        }
+
+        let snapshot = assembler.push(part(&end_frame(1, 3))).unwrap();
+        assert_eq!(snapshot.seq, 1);
+        assert_eq!(snapshot.timestamp, Timestamp::Uptime(42_000));
+        assert_eq!(snapshot.count, 3);
+        assert!(snapshot.is_complete());
+        assert_eq!(
+            snapshot.records.iter().map(device).collect::<Vec<_>>(),
+            [0, 1, 2]
+        );
+    }
+
+    #[test]
+    fn interrupted_by_newer_seq() {
+        let mut assembler = SnapshotAssembler::new();
+
+        // Snapshot 1 interrupted by snapshot 2, then the late end of 1
+        assembler.push(part(&frame(1, 0, XiaomiHandler::CHANNEL_ID, &xiaomi(1))));
+        assembler.push(part(&frame(1, 1, XiaomiHandler::CHANNEL_ID, &xiaomi(2))));
+        assembler.push(part(&frame(2, 0, XiaomiHandler::CHANNEL_ID, &xiaomi(3))));
+
+        let snapshot = assembler.push(part(&end_frame(1, 2))).unwrap();
+        assert_eq!(snapshot.seq, 1);
+        assert!(snapshot.records.is_empty());
+        assert!(!snapshot.is_complete());
+
+        // Snapshot 2 is still being assembled
+        assembler.push(part(&frame(2, 1, XiaomiHandler::CHANNEL_ID, &xiaomi(4))));
+        let snapshot = assembler.push(part(&end_frame(2, 2))).unwrap();
+        assert_eq!(snapshot.seq, 2);
+        assert_eq!(
+            snapshot.records.iter().map(device).collect::<Vec<_>>(),
+            [3, 4]
+        );
+        assert!(snapshot.is_complete());
+
+        // A newer snapshot drops the records of the interrupted one
+        assembler.push(part(&frame(3, 0, XiaomiHandler::CHANNEL_ID, &xiaomi(4))));
+        assembler.push(part(&frame(4, 0, XiaomiHandler::CHANNEL_ID, &xiaomi(5))));
+        let snapshot = assembler.push(part(&end_frame(4, 1))).unwrap();
+        assert_eq!(snapshot.seq, 4);
+        assert_eq!(snapshot.records.iter().map(device).collect::<Vec<_>>(), [5]);
+        assert!(snapshot.is_complete());
+    }
+
+    #[test]
+    fn end_without_records() {
+        let mut assembler = SnapshotAssembler::new();
+
+        // Empty registry
+        let snapshot = assembler.push(part(&end_frame(1, 0))).unwrap();
+        assert!(snapshot.records.is_empty());
+        assert!(snapshot.is_complete());
+
+        // All records lost
+        let snapshot = assembler.push(part(&end_frame(2, 2))).unwrap();
+        assert_eq!(snapshot.count, 2);
+        assert!(!snapshot.is_complete());
+
+        // The assembler is reset by an end frame
+        assembler.push(part(&frame(3, 0, XiaomiHandler::CHANNEL_ID, &xiaomi(1))));
+        assembler.push(part(&end_frame(3, 1)));
+        let snapshot = assembler.push(part(&end_frame(3, 1))).unwrap();
+        assert!(snapshot.records.is_empty());
+    }
+}
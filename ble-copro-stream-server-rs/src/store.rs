@@ -0,0 +1,716 @@
+//! Append-only record store.
+//!
+//! Frames are appended as fixed-size entries into memory-mapped segment files
+//! (`segment-XXXXXXXX.dat`). Appending is a copy into the mapping, durability is
+//! left to the kernel page cache until [`RecordStore::flush`] or
+//! [`RecordStore::sync`] is called. Queries hand out [`StoredEntry`] views
+//! borrowing the mapping, no record is deserialized while scanning.
+//!
+//! Entry layout (little endian, `ENTRY_SIZE` bytes):
+//!  - 8 bytes: timestamp (ms, provided by the caller)
+//!  - 4 bytes: channel id
+//!  - 2 bytes: payload length
+//!  - 6 bytes: BLE address
+//!  - 1 byte: BLE address type
+//!  - 1 byte: commit marker, written last
+//!  - 1 byte: flags
+//!  - 1 byte: reserved
+//!  - N bytes: payload (up to `ENTRY_PAYLOAD_MAX`)
+//!
+//! The time and device indexes binary search on the timestamps, which must be
+//! non-decreasing. A timestamp older than the last appended one (host clock
+//! step, merged sources) is clamped to it and the entry is flagged, see
+//! [`StoredEntry::is_clamped`].
+
+use std::collections::HashMap;
+use std::fs::{File, OpenOptions};
+use std::os::fd::AsRawFd;
+use std::path::{Path, PathBuf};
+
+use byteorder::{ByteOrder, LittleEndian};
+use thiserror::Error;
+
+use crate::{ble::BleAddress, linky::LinkyTicHandler, xiaomi::XiaomiHandler, StreamChannelHandler};
+
+pub const ENTRY_SIZE: usize = 128;
+pub const ENTRY_HEADER_SIZE: usize = 24;
+pub const ENTRY_PAYLOAD_MAX: usize = ENTRY_SIZE - ENTRY_HEADER_SIZE;
+pub const DEFAULT_SEGMENT_ENTRIES: usize = 65536;
+
+const ENTRY_COMMIT_MARKER: u8 = 0xa5;
+const ENTRY_FLAG_HAS_ADDR: u8 = 0x01;
+const ENTRY_FLAG_CLAMPED: u8 = 0x02;
+
+/// One time index sample every `TIME_INDEX_STRIDE` entries
+const TIME_INDEX_STRIDE: u64 = 256;
+
+#[derive(Error, Debug)]
+pub enum StoreError {
+    #[error("IO error: {0}")]
+    IoError(#[from] std::io::Error),
+    #[error("Payload too large")]
+    PayloadTooLarge,
+    #[error("Invalid segment size")]
+    InvalidSegmentSize,
+}
+
+/// Position of an entry, segment index in the upper 32 bits, slot in the lower
+/// 32 bits.
+type EntryPos = u64;
+
+fn pos(segment: usize, slot: usize) -> EntryPos {
+    ((segment as u64) << 32) | slot as u64
+}
+
+fn pos_split(pos: EntryPos) -> (usize, usize) {
+    ((pos >> 32) as usize, (pos & 0xffff_ffff) as usize)
+}
+
+struct Segment {
+    _file: File,
+    ptr: *mut u8,
+    len: usize,
+    count: usize,
+}
+
+// The mapping is owned by the segment and only mutated through &mut self
+unsafe impl Send for Segment {}
+unsafe impl Sync for Segment {}
+
+impl Segment {
+    fn open(path: &Path, entries: usize) -> Result<Segment, StoreError> {
+        let file = OpenOptions::new()
+            .read(true)
+            .write(true)
+            .create(true)
+            .truncate(false)
+            .open(path)?;
+
+        // Existing segments keep the capacity they were created with
+        let mut len = file.metadata()?.len() as usize;
+        if len == 0 {
+            len = entries * ENTRY_SIZE;
+            file.set_len(len as u64)?;
+        }
+
+        if len == 0 || len % ENTRY_SIZE != 0 {
+            return Err(StoreError::InvalidSegmentSize);
+        }
+
+        let ptr = unsafe {
+            libc::mmap(
+                std::ptr::null_mut(),
+                len,
+                libc::PROT_READ | libc::PROT_WRITE,
+                libc::MAP_SHARED,
+                file.as_raw_fd(),
+                0,
+            )
+        };
+
+        if ptr == libc::MAP_FAILED {
+            return Err(StoreError::IoError(std::io::Error::last_os_error()));
+        }
+
+        let mut segment = Segment {
+            _file: file,
+            ptr: ptr as *mut u8,
+            len,
+            count: 0,
+        };
+
+        // Recover the number of committed entries
+        while segment.count < segment.capacity()
+            && segment.entry(segment.count)[21] == ENTRY_COMMIT_MARKER
+        {
+            segment.count += 1;
+        }
+
+        // Entries committed after a torn one would be resurrected once appends
+        // fill the gap, they are discarded
+        for slot in segment.count + 1..segment.capacity() {
+            if segment.entry(slot)[21] == ENTRY_COMMIT_MARKER {
+                segment.bytes_mut()[slot * ENTRY_SIZE + 21] = 0;
+            }
+        }
+
+        Ok(segment)
+    }
+
+    fn capacity(&self) -> usize {
+        self.len / ENTRY_SIZE
+    }
+
+    fn is_full(&self) -> bool {
+        self.count == self.capacity()
+    }
+
+    fn bytes(&self) -> &[u8] {
+        unsafe { std::slice::from_raw_parts(self.ptr, self.len) }
+    }
+
+    fn bytes_mut(&mut self) -> &mut [u8] {
+        unsafe { std::slice::from_raw_parts_mut(self.ptr, self.len) }
+    }
+
+    fn entry(&self, slot: usize) -> &[u8] {
+        &self.bytes()[slot * ENTRY_SIZE..(slot + 1) * ENTRY_SIZE]
+    }
+
+    fn msync(&self, flags: libc::c_int) -> Result<(), StoreError> {
+        let ret = unsafe { libc::msync(self.ptr as *mut libc::c_void, self.len, flags) };
+        if ret < 0 {
+            return Err(StoreError::IoError(std::io::Error::last_os_error()));
+        }
+
+        Ok(())
+    }
+}
+
+impl Drop for Segment {
+    fn drop(&mut self) {
+        unsafe {
+            libc::munmap(self.ptr as *mut libc::c_void, self.len);
+        }
+    }
+}
+
+/// Zero-copy view of a stored entry
+#[derive(Clone, Copy)]
+pub struct StoredEntry<'a> {
+    raw: &'a [u8],
+}
+
+impl<'a> StoredEntry<'a> {
+    pub fn timestamp_ms(&self) -> u64 {
+        LittleEndian::read_u64(&self.raw[0..8])
+    }
+
+    pub fn channel_id(&self) -> u32 {
+        LittleEndian::read_u32(&self.raw[8..12])
+    }
+
+    pub fn ble_addr(&self) -> Option<BleAddress> {
+        if self.raw[22] & ENTRY_FLAG_HAS_ADDR == 0 {
+            return None;
+        }
+
+        let mut mac = [0; 6];
+        mac.copy_from_slice(&self.raw[14..20]);
+        Some(BleAddress::new(mac, self.raw[20]))
+    }
+
+    /// The timestamp given to [`RecordStore::append`] was older than the
+    /// previous entry and has been raised to the timestamp of that entry
+    pub fn is_clamped(&self) -> bool {
+        self.raw[22] & ENTRY_FLAG_CLAMPED != 0
+    }
+
+    /// Original frame payload, can be given to `StreamChannelHandler::parse_message`.
+    /// A corrupted length is clamped to the entry.
+    pub fn payload(&self) -> &'a [u8] {
+        let len = (LittleEndian::read_u16(&self.raw[12..14]) as usize).min(ENTRY_PAYLOAD_MAX);
+        &self.raw[ENTRY_HEADER_SIZE..ENTRY_HEADER_SIZE + len]
+    }
+
+    pub fn raw(&self) -> &'a [u8] {
+        self.raw
+    }
+}
+
+pub struct RecordStore {
+    dir: PathBuf,
+    segment_entries: usize,
+    segments: Vec<Segment>,
+    time_index: Vec<(u64, EntryPos)>,
+    device_index: HashMap<BleAddress, Vec<EntryPos>>,
+    total: u64,
+    /// Timestamp of the last entry, lower bound of the next one
+    last_timestamp: u64,
+    clamped: u64,
+}
+
+impl RecordStore {
+    pub fn open<P: AsRef<Path>>(dir: P) -> Result<RecordStore, StoreError> {
+        Self::open_with_capacity(dir, DEFAULT_SEGMENT_ENTRIES)
+    }
+
+    /// Open (or create) a store, new segments are created with room for
+    /// `segment_entries` entries. Indexes are rebuilt from the segment headers.
+    pub fn open_with_capacity<P: AsRef<Path>>(
+        dir: P,
+        segment_entries: usize,
+    ) -> Result<RecordStore, StoreError> {
+        if segment_entries == 0 || segment_entries > u32::MAX as usize {
+            return Err(StoreError::InvalidSegmentSize);
+        }
+
+        let dir = dir.as_ref().to_path_buf();
+        std::fs::create_dir_all(&dir)?;
+
+        let mut store = RecordStore {
+            dir,
+            segment_entries,
+            segments: Vec::new(),
+            time_index: Vec::new(),
+            device_index: HashMap::new(),
+            total: 0,
+            last_timestamp: 0,
+            clamped: 0,
+        };
+
+        loop {
+            let path = store.segment_path(store.segments.len());
+            if !path.exists() {
+                break;
+            }
+
+            let segment = Segment::open(&path, segment_entries)?;
+            let index = store.segments.len();
+            let count = segment.count;
+            store.segments.push(segment);
+
+            for slot in 0..count {
+                store.index_entry(pos(index, slot));
+            }
+
+            if count < store.segments[index].capacity() {
+                // Entries after a partially written segment are not reachable,
+                // their segments are removed: reopened once the partial one
+                // fills up, they would resurrect their stale entries
+                let mut next = index + 1;
+                while store.segment_path(next).exists() {
+                    std::fs::remove_file(store.segment_path(next))?;
+                    next += 1;
+                }
+                break;
+            }
+        }
+
+        Ok(store)
+    }
+
+    fn segment_path(&self, index: usize) -> PathBuf {
+        self.dir.join(format!("segment-{:08}.dat", index))
+    }
+
+    fn entry_at(&self, pos: EntryPos) -> StoredEntry<'_> {
+        let (segment, slot) = pos_split(pos);
+        StoredEntry {
+            raw: self.segments[segment].entry(slot),
+        }
+    }
+
+    fn index_entry(&mut self, pos: EntryPos) {
+        let entry = self.entry_at(pos);
+        let timestamp = entry.timestamp_ms();
+        let addr = entry.ble_addr();
+
+        if self.total % TIME_INDEX_STRIDE == 0 {
+            self.time_index.push((timestamp, pos));
+        }
+
+        if let Some(addr) = addr {
+            self.device_index.entry(addr).or_default().push(pos);
+        }
+
+        self.last_timestamp = timestamp;
+        self.total += 1;
+    }
+
+    fn writable_segment(&mut self) -> Result<usize, StoreError> {
+        match self.segments.last() {
+            Some(segment) if !segment.is_full() => Ok(self.segments.len() - 1),
+            last => {
+                if let Some(segment) = last {
+                    // Let the kernel start writing back the full segment
+                    segment.msync(libc::MS_ASYNC)?;
+                }
+
+                let path = self.segment_path(self.segments.len());
+                let segment = Segment::open(&path, self.segment_entries)?;
+                self.segments.push(segment);
+                Ok(self.segments.len() - 1)
+            }
+        }
+    }
+
+    /// Append a frame, the BLE address is extracted from the payload of the
+    /// channels known to start with one (Xiaomi, Linky).
+    pub fn append_frame(
+        &mut self,
+        timestamp_ms: u64,
+        channel_id: u32,
+        payload: &[u8],
+    ) -> Result<(), StoreError> {
+        let addr = match channel_id {
+            XiaomiHandler::CHANNEL_ID | LinkyTicHandler::CHANNEL_ID if payload.len() >= 7 => {
+                let mut mac = [0; 6];
+                mac.copy_from_slice(&payload[0..6]);
+                Some(BleAddress::new(mac, payload[6]))
+            }
+            _ => None,
+        };
+
+        self.append(timestamp_ms, channel_id, addr, payload)
+    }
+
+    /// Append an entry, a timestamp older than the last entry is clamped to it
+    pub fn append(
+        &mut self,
+        timestamp_ms: u64,
+        channel_id: u32,
+        addr: Option<BleAddress>,
+        payload: &[u8],
+    ) -> Result<(), StoreError> {
+        if payload.len() > ENTRY_PAYLOAD_MAX {
+            return Err(StoreError::PayloadTooLarge);
+        }
+
+        let mut flags = 0;
+        let mut timestamp_ms = timestamp_ms;
+        if timestamp_ms < self.last_timestamp {
+            timestamp_ms = self.last_timestamp;
+            flags |= ENTRY_FLAG_CLAMPED;
+            self.clamped += 1;
+        }
+
+        let index = self.writable_segment()?;
+        let segment = &mut self.segments[index];
+        let slot = segment.count;
+
+        let raw = &mut segment.bytes_mut()[slot * ENTRY_SIZE..(slot + 1) * ENTRY_SIZE];
+        LittleEndian::write_u64(&mut raw[0..8], timestamp_ms);
+        LittleEndian::write_u32(&mut raw[8..12], channel_id);
+        LittleEndian::write_u16(&mut raw[12..14], payload.len() as u16);
+        match addr {
+            Some(addr) => {
+                raw[14..20].copy_from_slice(&addr.mac);
+                raw[20] = addr.ble_type as u8;
+                raw[22] = flags | ENTRY_FLAG_HAS_ADDR;
+            }
+            None => {
+                raw[14..21].fill(0);
+                raw[22] = flags;
+            }
+        }
+        raw[23] = 0;
+        raw[ENTRY_HEADER_SIZE..ENTRY_HEADER_SIZE + payload.len()].copy_from_slice(payload);
+        raw[ENTRY_HEADER_SIZE + payload.len()..].fill(0);
+        raw[21] = ENTRY_COMMIT_MARKER;
+
+        segment.count += 1;
+        self.index_entry(pos(index, slot));
+
+        Ok(())
+    }
+
+    /// Schedule write back of the current segment without waiting for it
+    pub fn flush(&self) -> Result<(), StoreError> {
+        match self.segments.last() {
+            Some(segment) => segment.msync(libc::MS_ASYNC),
+            None => Ok(()),
+        }
+    }
+
+    /// Write back all segments and wait for completion
+    pub fn sync(&self) -> Result<(), StoreError> {
+        for segment in &self.segments {
+            segment.msync(libc::MS_SYNC)?;
+        }
+
+        Ok(())
+    }
+
+    pub fn len(&self) -> u64 {
+        self.total
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.total == 0
+    }
+
+    /// Entries appended with a timestamp older than the previous entry since
+    /// the store was opened
+    pub fn clamped(&self) -> u64 {
+        self.clamped
+    }
+
+    pub fn devices(&self) -> impl Iterator<Item = &BleAddress> {
+        self.device_index.keys()
+    }
+
+    fn next_pos(&self, pos: EntryPos) -> Option<EntryPos> {
+        let (segment, slot) = pos_split(pos);
+
+        if slot + 1 < self.segments[segment].count {
+            Some(self::pos(segment, slot + 1))
+        } else if segment + 1 < self.segments.len() && self.segments[segment + 1].count > 0 {
+            Some(self::pos(segment + 1, 0))
+        } else {
+            None
+        }
+    }
+
+    /// All entries with `t1 <= timestamp <= t2`
+    pub fn range(&self, t1: u64, t2: u64) -> impl Iterator<Item = StoredEntry<'_>> {
+        // Start from the last sample strictly before t1, entries between two
+        // samples are not indexed.
+        let i = self.time_index.partition_point(|&(ts, _)| ts < t1);
+        let start = match i {
+            0 => self.time_index.first().map(|&(_, pos)| pos),
+            i => Some(self.time_index[i - 1].1),
+        };
+
+        let mut cursor = start;
+        std::iter::from_fn(move || {
+            let pos = cursor?;
+            cursor = self.next_pos(pos);
+            Some(self.entry_at(pos))
+        })
+        .skip_while(move |entry| entry.timestamp_ms() < t1)
+        .take_while(move |entry| entry.timestamp_ms() <= t2)
+    }
+
+    /// Entries of device `addr` with `t1 <= timestamp <= t2`
+    pub fn device_range(
+        &self,
+        addr: &BleAddress,
+        t1: u64,
+        t2: u64,
+    ) -> impl Iterator<Item = StoredEntry<'_>> {
+        let positions = self
+            .device_index
+            .get(addr)
+            .map(|v| v.as_slice())
+            .unwrap_or(&[]);
+
+        let start = positions.partition_point(|&pos| self.entry_at(pos).timestamp_ms() < t1);
+        let end = positions.partition_point(|&pos| self.entry_at(pos).timestamp_ms() <= t2);
+
+        positions[start..end.max(start)]
+            .iter()
+            .map(move |&pos| self.entry_at(pos))
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn test_dir(name: &str) -> PathBuf {
+        let dir =
+            std::env::temp_dir().join(format!("ble-copro-store-{}-{}", name, std::process::id()));
+        let _ = std::fs::remove_dir_all(&dir);
+        dir
+    }
+
+    fn addr(i: u8) -> BleAddress {
+        BleAddress::new([i, 0, 0, 0, 0, 0], 0)
+    }
+
+    fn timestamps<'a>(entries: impl Iterator<Item = StoredEntry<'a>>) -> Vec<u64> {
+        entries.map(|entry| entry.timestamp_ms()).collect()
+    }
+
+    #[test]
+    fn rollover_and_reopen() {
+        let dir = test_dir("rollover");
+
+        {
+            let mut store = RecordStore::open_with_capacity(&dir, 4).unwrap();
+            for ts in 0..10u64 {
+                let payload = [ts as u8; 10];
+                store
+                    .append(ts, 1, Some(addr(ts as u8 % 2)), &payload)
+                    .unwrap();
+            }
+
+            assert_eq!(store.len(), 10);
+            assert_eq!(store.segments.len(), 3);
+            assert_eq!(timestamps(store.range(3, 7)), vec![3, 4, 5, 6, 7]);
+            assert_eq!(
+                timestamps(store.device_range(&addr(1), 2, 8)),
+                vec![3, 5, 7]
+            );
+            store.sync().unwrap();
+        }
+
+        let mut store = RecordStore::open_with_capacity(&dir, 4).unwrap();
+        assert_eq!(store.len(), 10);
+        assert_eq!(
+            timestamps(store.range(0, u64::MAX)),
+            (0..10).collect::<Vec<_>>()
+        );
+        assert_eq!(
+            timestamps(store.device_range(&addr(0), 0, 9)),
+            vec![0, 2, 4, 6, 8]
+        );
+
+        let entry = store.range(9, 9).next().unwrap();
+        assert_eq!(entry.channel_id(), 1);
+        assert_eq!(entry.ble_addr(), Some(addr(1)));
+        assert_eq!(entry.payload(), &[9; 10]);
+
+        // Appending resumes in the partially filled segment
+        store.append(10, 1, None, &[]).unwrap();
+        assert_eq!(store.segments.len(), 3);
+        assert_eq!(timestamps(store.range(9, 10)), vec![9, 10]);
+
+        std::fs::remove_dir_all(&dir).unwrap();
+    }
+
+    #[test]
+    fn truncated_tail() {
+        let dir = test_dir("truncated");
+
+        {
+            let mut store = RecordStore::open_with_capacity(&dir, 4).unwrap();
+            for ts in 0..3u64 {
+                store.append(ts, 1, None, &[1, 2, 3]).unwrap();
+            }
+        }
+
+        // Entry 1 lost its commit marker (crash while writing it): it and the
+        // entries after it are dropped
+        let path = dir.join("segment-00000000.dat");
+        let mut bytes = std::fs::read(&path).unwrap();
+        bytes[ENTRY_SIZE + 21] = 0;
+        std::fs::write(&path, &bytes).unwrap();
+
+        let mut store = RecordStore::open_with_capacity(&dir, 4).unwrap();
+        assert_eq!(store.len(), 1);
+        assert_eq!(timestamps(store.range(0, u64::MAX)), vec![0]);
+
+        // The slot is overwritten by the next append, entry 2 is not resurrected
+        store.append(5, 1, None, &[4]).unwrap();
+        assert_eq!(timestamps(store.range(0, u64::MAX)), vec![0, 5]);
+        drop(store);
+
+        let store = RecordStore::open_with_capacity(&dir, 4).unwrap();
+        assert_eq!(timestamps(store.range(0, u64::MAX)), vec![0, 5]);
+        drop(store);
+
+        // A segment which is not a whole number of entries is rejected
+        std::fs::OpenOptions::new()
+            .write(true)
+            .open(&path)
+            .unwrap()
+            .set_len((ENTRY_SIZE * 4 - 1) as u64)
+            .unwrap();
+        assert!(matches!(
+            RecordStore::open_with_capacity(&dir, 4),
+            Err(StoreError::InvalidSegmentSize)
+        ));
+
+        std::fs::remove_dir_all(&dir).unwrap();
+    }
+
+    #[test]
+    fn torn_entry_in_earlier_segment() {
+        let dir = test_dir("torn-segment");
+
+        {
+            let mut store = RecordStore::open_with_capacity(&dir, 4).unwrap();
+            for ts in 0..10u64 {
+                store.append(ts, 1, Some(addr(1)), &[ts as u8]).unwrap();
+            }
+        }
+
+        // Entry 2 of the first segment is torn, segments 1 and 2 are stale
+        let path = dir.join("segment-00000000.dat");
+        let mut bytes = std::fs::read(&path).unwrap();
+        bytes[2 * ENTRY_SIZE + 21] = 0;
+        std::fs::write(&path, &bytes).unwrap();
+
+        let mut store = RecordStore::open_with_capacity(&dir, 4).unwrap();
+        assert_eq!(store.len(), 2);
+        assert!(!dir.join("segment-00000001.dat").exists());
+        assert!(!dir.join("segment-00000002.dat").exists());
+
+        // Filling the first segment again creates a fresh second one
+        for ts in 20..25u64 {
+            store.append(ts, 1, Some(addr(1)), &[ts as u8]).unwrap();
+        }
+        let expected = vec![0, 1, 20, 21, 22, 23, 24];
+        assert_eq!(timestamps(store.range(0, u64::MAX)), expected);
+        assert_eq!(
+            timestamps(store.device_range(&addr(1), 0, u64::MAX)),
+            expected
+        );
+        drop(store);
+
+        let store = RecordStore::open_with_capacity(&dir, 4).unwrap();
+        assert_eq!(store.len(), 7);
+        assert_eq!(timestamps(store.range(0, u64::MAX)), expected);
+
+        std::fs::remove_dir_all(&dir).unwrap();
+    }
+
+    #[test]
+    fn corrupted_payload_length() {
+        let dir = test_dir("length");
+
+        {
+            let mut store = RecordStore::open_with_capacity(&dir, 4).unwrap();
+            store.append(0, 1, None, &[7; 10]).unwrap();
+        }
+
+        // Committed entry with a length beyond the entry
+        let path = dir.join("segment-00000000.dat");
+        let mut bytes = std::fs::read(&path).unwrap();
+        bytes[12..14].copy_from_slice(&u16::MAX.to_le_bytes());
+        std::fs::write(&path, &bytes).unwrap();
+
+        let store = RecordStore::open_with_capacity(&dir, 4).unwrap();
+        let entry = store.range(0, 0).next().unwrap();
+        assert_eq!(entry.payload().len(), ENTRY_PAYLOAD_MAX);
+        assert_eq!(entry.payload()[..10], [7; 10]);
+
+        std::fs::remove_dir_all(&dir).unwrap();
+    }
+
+    #[test]
+    fn out_of_order_timestamps_are_clamped() {
+        let dir = test_dir("clamp");
+        let mut store = RecordStore::open_with_capacity(&dir, 4).unwrap();
+
+        store.append(100, 1, Some(addr(1)), &[]).unwrap();
+        store.append(50, 1, Some(addr(1)), &[]).unwrap();
+        store.append(120, 1, Some(addr(1)), &[]).unwrap();
+
+        assert_eq!(store.clamped(), 1);
+        assert_eq!(timestamps(store.range(0, u64::MAX)), vec![100, 100, 120]);
+        assert_eq!(timestamps(store.range(100, 100)), vec![100, 100]);
+        assert_eq!(
+            timestamps(store.device_range(&addr(1), 101, 200)),
+            vec![120]
+        );
+
+        let clamped: Vec<bool> = store.range(0, u64::MAX).map(|e| e.is_clamped()).collect();
+        assert_eq!(clamped, vec![false, true, false]);
+
+        // The lower bound survives a reopen
+        drop(store);
+        let mut store = RecordStore::open_with_capacity(&dir, 4).unwrap();
+        store.append(10, 1, None, &[]).unwrap();
+        assert_eq!(store.range(120, 120).count(), 2);
+
+        std::fs::remove_dir_all(&dir).unwrap();
+    }
+
+    #[test]
+    fn payload_too_large() {
+        let dir = test_dir("large");
+        let mut store = RecordStore::open_with_capacity(&dir, 4).unwrap();
+
+        assert!(matches!(
+            store.append(0, 1, None, &[0; ENTRY_PAYLOAD_MAX + 1]),
+            Err(StoreError::PayloadTooLarge)
+        ));
+        store.append(0, 1, None, &[0; ENTRY_PAYLOAD_MAX]).unwrap();
+        assert_eq!(store.len(), 1);
+
+        std::fs::remove_dir_all(&dir).unwrap();
+    }
+}
@@ -1,15 +1,44 @@
+use std::ops::Range;
+use std::sync::Arc;
+use std::time::Instant;
+
 use thiserror::Error;
-use tokio::io::AsyncReadExt;
+use tokio::io::{AsyncReadExt, AsyncWriteExt};
 use tokio::net::TcpStream;
 
-use crate::control_channel::ControlHandler;
-use crate::linky::LinkyTicHandler;
+use crate::cache::LatestValueCache;
+#[cfg(feature = "capture")]
+use crate::capture::CaptureWriter;
+use crate::control_channel::{ControlHandler, ControlMessage};
+use crate::frame::{
+    encode_v2, FrameDecoder, FrameDecoderStats, FrameFormat, FRAME_V1_HEADER_SIZE,
+    FRAME_V2_CRC_SIZE, FRAME_V2_HEADER_SIZE,
+};
+use crate::metrics::{ConnectionMetrics, MetricsRegistry};
+use crate::raw_frame::RawFrame;
+use crate::snapshot::SnapshotAssembler;
 use crate::stream_message::{ChannelMessage, MessageHeader};
-use crate::xiaomi::XiaomiHandler;
 use crate::StreamChannelHandler;
 
 pub struct StreamChannel {
     stream: TcpStream,
+    cache: Option<Arc<LatestValueCache>>,
+    metrics: Option<(Arc<MetricsRegistry>, Arc<ConnectionMetrics>)>,
+    format: FrameFormat,
+    decoder: FrameDecoder,
+    /// v1 receive buffer, reused for every frame
+    rx_buf: Vec<u8>,
+    snapshot: SnapshotAssembler,
+    unknown_frames: u64,
+    #[cfg(feature = "capture")]
+    capture: Option<CaptureWriter>,
+}
+
+/// Location of the last received frame in `StreamChannel::frame_buffer()`
+struct FrameRange {
+    channel_id: u32,
+    payload: Range<usize>,
+    bytes: Range<usize>,
 }
 
 #[derive(Error, Debug)]
@@ -28,10 +57,74 @@ pub enum StreamChannelError {
 
 impl StreamChannel {
     pub(crate) fn from(stream: TcpStream) -> StreamChannel {
-        StreamChannel { stream }
+        StreamChannel {
+            stream,
+            cache: None,
+            metrics: None,
+            format: FrameFormat::V1,
+            decoder: FrameDecoder::new(),
+            rx_buf: Vec::new(),
+            snapshot: SnapshotAssembler::new(),
+            unknown_frames: 0,
+            #[cfg(feature = "capture")]
+            capture: None,
+        }
+    }
+
+    /// Must match the firmware `CONFIG_COPRO_STREAM_FRAME_V2` setting
+    pub fn set_frame_format(&mut self, format: FrameFormat) {
+        self.format = format;
+    }
+
+    fn frame_overhead(&self) -> usize {
+        match self.format {
+            FrameFormat::V1 => FRAME_V1_HEADER_SIZE,
+            FrameFormat::V2 => FRAME_V2_HEADER_SIZE + FRAME_V2_CRC_SIZE,
+        }
+    }
+
+    /// Resynchronisation statistics, only relevant to the v2 frame format
+    pub fn frame_stats(&self) -> FrameDecoderStats {
+        self.decoder.stats()
+    }
+
+    /// Number of frames of unknown channels skipped by `next()`
+    pub fn unknown_frames(&self) -> u64 {
+        self.unknown_frames
+    }
+
+    /// Account frames, bytes, parse time and errors of this channel in `registry`
+    pub fn set_metrics(&mut self, registry: Arc<MetricsRegistry>) {
+        let connection = registry.connection(self.stream.peer_addr().ok());
+        self.metrics = Some((registry, connection));
+    }
+
+    /// Update `cache` with every message yielded by `next()`, the same cache can
+    /// be shared among several channels.
+    pub fn set_cache(&mut self, cache: Arc<LatestValueCache>) {
+        self.cache = Some(cache);
+    }
+
+    /// Tee the received bytes into a capture file at `path`, see
+    /// [`crate::capture`]. The frame format must be set beforehand. The capture
+    /// stops on the first write error, the channel keeps running.
+    #[cfg(feature = "capture")]
+    pub fn set_capture(&mut self, path: &std::path::Path) -> std::io::Result<()> {
+        self.capture = Some(CaptureWriter::create(path, self.format)?);
+
+        Ok(())
     }
 
-    fn parse_message_header(&mut self, data: &[u8]) -> Result<MessageHeader, StreamChannelError> {
+    #[cfg(feature = "capture")]
+    fn capture(capture: &mut Option<CaptureWriter>, data: &[u8]) {
+        if let Some(writer) = capture {
+            if writer.write(data).is_err() {
+                *capture = None;
+            }
+        }
+    }
+
+    fn parse_message_header(&self, data: &[u8]) -> Result<MessageHeader, StreamChannelError> {
         if data.len() < 6 {
             return Err(StreamChannelError::InvalidMessageHeader);
         }
@@ -42,34 +135,199 @@ impl StreamChannel {
         Ok(MessageHeader::new(channel_id, message_len))
     }
 
-    async fn read_next_message(&mut self) -> Result<(MessageHeader, Vec<u8>), StreamChannelError> {
-        let mut header_buf = [0; 6];
-        self.stream.read_exact(&mut header_buf).await?;
+    fn frame_buffer(&self) -> &[u8] {
+        match self.format {
+            FrameFormat::V1 => &self.rx_buf,
+            FrameFormat::V2 => self.decoder.buffer(),
+        }
+    }
 
-        let header = self.parse_message_header(&header_buf)?;
+    async fn read_frame(&mut self) -> Result<FrameRange, StreamChannelError> {
+        let frame = match self.format {
+            FrameFormat::V1 => self.read_frame_v1().await,
+            FrameFormat::V2 => self.read_frame_v2().await,
+        };
 
-        let mut data = vec![0; header.message_len as usize];
-        self.stream.read_exact(&mut data).await?;
+        if let (Err(e), Some((registry, connection))) = (&frame, &self.metrics) {
+            registry.record_error(Some(connection), None, e);
+        }
 
-        Ok((header, data))
+        frame
     }
 
-    pub async fn next(&mut self) -> Result<ChannelMessage, StreamChannelError> {
-        let (header, data) = self.read_next_message().await?;
+    async fn read_frame_v2(&mut self) -> Result<FrameRange, StreamChannelError> {
+        loop {
+            let before = self.decoder.stats();
+            let frame = self.decoder.decode_range();
+            let after = self.decoder.stats();
 
-        let data = data.as_slice();
+            if let Some((registry, connection)) = &self.metrics {
+                registry.record_resync(
+                    Some(connection),
+                    after.skipped_bytes - before.skipped_bytes,
+                    after.crc_errors - before.crc_errors,
+                );
+            }
 
-        match header.channel_id {
-            XiaomiHandler::CHANNEL_ID => {
-                XiaomiHandler::parse_message(data).map(ChannelMessage::Xiaomi)
+            if let Some((header, payload)) = frame {
+                return Ok(FrameRange {
+                    channel_id: header.channel_id,
+                    bytes: payload.start - FRAME_V2_HEADER_SIZE..payload.end + FRAME_V2_CRC_SIZE,
+                    payload,
+                });
             }
-            LinkyTicHandler::CHANNEL_ID => {
-                LinkyTicHandler::parse_message(data).map(ChannelMessage::LinkyTic)
+
+            let mut buf = [0; 512];
+            let n = self.stream.read(&mut buf).await?;
+            if n == 0 {
+                return Err(std::io::Error::from(std::io::ErrorKind::UnexpectedEof).into());
             }
-            ControlHandler::CHANNEL_ID => {
-                ControlHandler::parse_message(data).map(ChannelMessage::Control)
+
+            if let Some((_, connection)) = &self.metrics {
+                connection.add_bytes(n as u64);
             }
-            _ => Err(StreamChannelError::UnhandledChannelId),
+
+            #[cfg(feature = "capture")]
+            Self::capture(&mut self.capture, &buf[..n]);
+
+            self.decoder.extend(&buf[..n]);
+        }
+    }
+
+    async fn read_frame_v1(&mut self) -> Result<FrameRange, StreamChannelError> {
+        self.rx_buf.resize(FRAME_V1_HEADER_SIZE, 0);
+        self.stream.read_exact(&mut self.rx_buf).await?;
+
+        let header = self.parse_message_header(&self.rx_buf)?;
+        let total = FRAME_V1_HEADER_SIZE + header.message_len as usize;
+
+        self.rx_buf.resize(total, 0);
+        self.stream
+            .read_exact(&mut self.rx_buf[FRAME_V1_HEADER_SIZE..])
+            .await?;
+
+        if let Some((_, connection)) = &self.metrics {
+            connection.add_bytes(total as u64);
+        }
+
+        #[cfg(feature = "capture")]
+        Self::capture(&mut self.capture, &self.rx_buf);
+
+        Ok(FrameRange {
+            channel_id: header.channel_id,
+            payload: FRAME_V1_HEADER_SIZE..total,
+            bytes: 0..total,
+        })
+    }
+
+    /// Next frame of any channel, without decoding it. The frame borrows the
+    /// channel receive buffer and the cache is not updated.
+    pub async fn next_raw(&mut self) -> Result<RawFrame<'_>, StreamChannelError> {
+        let frame = self.read_frame().await?;
+
+        if let Some((registry, connection)) = &self.metrics {
+            registry.record_frame(
+                Some(connection),
+                frame.channel_id,
+                frame.bytes.len(),
+                Instant::now(),
+                None,
+            );
+        }
+
+        let buf = self.frame_buffer();
+
+        Ok(RawFrame::new(
+            frame.channel_id,
+            self.format,
+            &buf[frame.payload],
+            &buf[frame.bytes],
+        ))
+    }
+
+    /// Send a control message to the device, which answers with an
+    /// acknowledgement (`ControlMessage::ack()`) on the control channel.
+    pub async fn send_control(
+        &mut self,
+        message: &ControlMessage,
+    ) -> Result<(), StreamChannelError> {
+        let payload = message.encode();
+        let mut frame = Vec::with_capacity(payload.len() + self.frame_overhead());
+
+        match self.format {
+            FrameFormat::V1 => {
+                frame.extend_from_slice(&ControlHandler::CHANNEL_ID.to_le_bytes());
+                frame.extend_from_slice(&(payload.len() as u16).to_le_bytes());
+                frame.extend_from_slice(&payload);
+            }
+            FrameFormat::V2 => encode_v2(ControlHandler::CHANNEL_ID, &payload, &mut frame),
+        }
+
+        self.stream.write_all(&frame).await?;
+
+        Ok(())
+    }
+
+    /// Frames of unknown channels are skipped (their length is still honoured),
+    /// see `unknown_frames()`. Snapshot frames are yielded as a single
+    /// `ChannelMessage::Snapshot` once the burst is complete.
+    pub async fn next(&mut self) -> Result<ChannelMessage, StreamChannelError> {
+        loop {
+            let frame = self.read_frame().await?;
+
+            let arrival = Instant::now();
+            let buf = self.frame_buffer();
+            let raw = RawFrame::new(
+                frame.channel_id,
+                self.format,
+                &buf[frame.payload],
+                &buf[frame.bytes.clone()],
+            );
+
+            let message = raw.to_message();
+
+            if let Some((registry, connection)) = &self.metrics {
+                match &message {
+                    Ok(_) => registry.record_frame(
+                        Some(connection),
+                        frame.channel_id,
+                        frame.bytes.len(),
+                        arrival,
+                        Some(arrival.elapsed().as_nanos() as u64),
+                    ),
+                    Err(e) => registry.record_error(Some(connection), Some(frame.channel_id), e),
+                }
+            }
+
+            let message = match message {
+                Err(StreamChannelError::UnhandledChannelId) => {
+                    self.unknown_frames += 1;
+                    continue;
+                }
+                message => message?,
+            };
+
+            let message = match message {
+                ChannelMessage::SnapshotPart(part) => match self.snapshot.push(part) {
+                    Some(snapshot) => ChannelMessage::Snapshot(snapshot),
+                    None => continue,
+                },
+                message => message,
+            };
+
+            if let Some(cache) = &self.cache {
+                cache.update(&message);
+            }
+
+            return Ok(message);
+        }
+    }
+}
+
+impl Drop for StreamChannel {
+    fn drop(&mut self) {
+        if let Some((_, connection)) = &self.metrics {
+            connection.close();
         }
     }
 }
@@ -1,4 +1,11 @@
-use crate::{control_channel::ControlMessage, linky::LinkyTicRecord, xiaomi::XiaomiRecord};
+use crate::{
+    control_channel::ControlMessage,
+    device_health::DeviceHealthRecord,
+    latency::LatencyHistogram,
+    linky::LinkyTicRecord,
+    snapshot::{Snapshot, SnapshotPart},
+    xiaomi::XiaomiRecord,
+};
 
 #[derive(Debug)]
 pub struct MessageHeader {
@@ -20,4 +27,10 @@ pub enum ChannelMessage {
     Xiaomi(XiaomiRecord),
     LinkyTic(LinkyTicRecord),
     Control(ControlMessage),
+    DeviceHealth(DeviceHealthRecord),
+    Latency(LatencyHistogram),
+    /// Frame of a snapshot burst, only yielded by `RawFrame::to_message()`: the
+    /// channels assemble them into a `Snapshot`
+    SnapshotPart(SnapshotPart),
+    Snapshot(Snapshot),
 }
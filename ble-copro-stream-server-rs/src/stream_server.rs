@@ -1,5 +1,8 @@
+use crate::frame::FrameFormat;
+use crate::metrics::MetricsRegistry;
 use crate::stream_channel::StreamChannel;
 use std::net::SocketAddrV4;
+use std::sync::Arc;
 #[cfg(feature = "tcp-keep-alive")]
 use std::{ffi::c_int, ffi::c_void, os::fd::AsRawFd};
 use thiserror::Error;
@@ -25,6 +28,10 @@ pub enum ServerError {
 
 pub struct StreamServer {
     listener: TcpListener,
+    metrics: Option<Arc<MetricsRegistry>>,
+    frame_format: FrameFormat,
+    #[cfg(feature = "capture")]
+    capture_dir: Option<std::path::PathBuf>,
 }
 
 impl StreamServer {
@@ -33,7 +40,31 @@ impl StreamServer {
         let addr = SocketAddrV4::new(ip, port);
         let listener = TcpListener::bind(addr).await?;
 
-        Ok(StreamServer { listener })
+        Ok(StreamServer {
+            listener,
+            metrics: None,
+            frame_format: FrameFormat::V1,
+            #[cfg(feature = "capture")]
+            capture_dir: None,
+        })
+    }
+
+    /// Frame format of the channels accepted from now on, must match the
+    /// firmware `CONFIG_COPRO_STREAM_FRAME_V2` setting
+    pub fn set_frame_format(&mut self, format: FrameFormat) {
+        self.frame_format = format;
+    }
+
+    /// Attach `registry` to every channel accepted from now on
+    pub fn set_metrics(&mut self, registry: Arc<MetricsRegistry>) {
+        self.metrics = Some(registry);
+    }
+
+    /// Capture the traffic of every channel accepted from now on, into
+    /// `capture-<unix time>-<peer>.bcap` files in `dir`
+    #[cfg(feature = "capture")]
+    pub fn set_capture_dir(&mut self, dir: &std::path::Path) {
+        self.capture_dir = Some(dir.to_path_buf());
     }
 
     #[cfg(feature = "tcp-keep-alive")]
@@ -75,6 +106,21 @@ impl StreamServer {
         #[cfg(feature = "tcp-keep-alive")]
         Self::configure_keep_alive(stream.as_raw_fd())?;
 
-        Ok(StreamChannel::from(stream))
+        let mut channel = StreamChannel::from(stream);
+        channel.set_frame_format(self.frame_format);
+        if let Some(registry) = &self.metrics {
+            channel.set_metrics(registry.clone());
+        }
+
+        #[cfg(feature = "capture")]
+        if let Some(dir) = &self.capture_dir {
+            let now = std::time::SystemTime::now()
+                .duration_since(std::time::UNIX_EPOCH)
+                .map_or(0, |elapsed| elapsed.as_secs());
+            let peer = _addr.to_string().replace([':', '.'], "_");
+            channel.set_capture(&dir.join(format!("capture-{}-{}.bcap", now, peer)))?;
+        }
+
+        Ok(channel)
     }
 }
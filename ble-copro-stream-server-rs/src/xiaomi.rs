@@ -7,7 +7,7 @@ use crate::{
 };
 
 //  xiaomi: [XIAOMI] mac: A4:C1:38:EC:1C:6D rssi: -33 bat: 3016 mV temp: 16 °C hum: 42 %
-#[derive(Debug)]
+#[derive(Debug, Clone)]
 pub struct XiaomiMeasurement {
     pub rssi: i8,
     pub temperature: f32,
@@ -26,7 +26,7 @@ impl Display for XiaomiMeasurement {
     }
 }
 
-#[derive(Debug)]
+#[derive(Debug, Clone)]
 pub struct XiaomiRecord {
     pub version: u8,
     pub ble_addr: BleAddress,
@@ -1,78 +1,198 @@
-// gcc -Wall -O2 -o server server.c
+// make && ./server [addr] [port]
 
-#include <arpa/inet.h>
-#include <netinet/in.h>
-#include <netinet/tcp.h>
-#include <sys/socket.h>
-#include <unistd.h>
+#include "copro.h"
+
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <errno.h>
 #include <string.h>
 
 #define ADDR "192.0.3.1"
-#define PORT 4000
-#define KEEP_ALIVE_IDLE  5   /* seconds before first probe  */
-#define KEEP_ALIVE_INTVL 1   /* seconds between probes      */
-#define KEEP_ALIVE_CNT   1   /* probes before giving up     */
+#define MAX_CONNS 8u
+
+static struct copro_server *srv;
+
+static void on_signal(int sig)
+{
+	(void)sig;
+	copro_server_stop(srv);
+}
+
+static void on_conn(struct copro_conn *conn, bool connected, void *user_data)
+{
+	(void)user_data;
+
+	if (connected) {
+		printf("[%s] connected\n", copro_conn_peer(conn));
+	} else {
+		const struct copro_parser_stats *stats = copro_conn_stats(conn);
+		printf("[%s] disconnected (frames: %llu skipped: %llu crc errors: %llu)\n",
+			   copro_conn_peer(conn),
+			   (unsigned long long)stats->frames,
+			   (unsigned long long)stats->skipped_bytes,
+			   (unsigned long long)stats->crc_errors);
+	}
+}
+
+static void on_xiaomi(struct copro_conn *conn,
+					  const struct copro_frame *frame,
+					  void *user_data)
+{
+	struct copro_xiaomi_record rec;
+	(void)user_data;
+
+	if (copro_xiaomi_decode(frame->payload, frame->len, &rec) < 0) {
+		return;
+	}
+
+	printf("[%s] xiaomi %02X:%02X:%02X:%02X:%02X:%02X rssi: %d temp: %d.%02d °C hum: "
+		   "%u.%02u %% bat: %u mV t: %lld ms\n",
+		   copro_conn_peer(conn),
+		   rec.mac[0],
+		   rec.mac[1],
+		   rec.mac[2],
+		   rec.mac[3],
+		   rec.mac[4],
+		   rec.mac[5],
+		   rec.rssi,
+		   rec.temperature / 100,
+		   abs(rec.temperature % 100),
+		   rec.humidity / 100u,
+		   rec.humidity % 100u,
+		   rec.battery_mv,
+		   (long long)rec.timestamp);
+}
+
+static void on_linky(struct copro_conn *conn,
+					 const struct copro_frame *frame,
+					 void *user_data)
+{
+	struct copro_linky_tic_record rec;
+	(void)user_data;
+
+	if (copro_linky_tic_decode(frame->payload, frame->len, &rec) < 0) {
+		return;
+	}
+
+	printf("[%s] linky rssi: %d t: %lld ms %.*s\n",
+		   copro_conn_peer(conn),
+		   rec.rssi,
+		   (long long)rec.timestamp,
+		   (int)rec.raw_len,
+		   rec.raw);
+}
 
-static void set_keepalive(int fd)
+static void on_device_health(struct copro_conn *conn,
+							 const struct copro_frame *frame,
+							 void *user_data)
 {
-    int optval = 1;
-    setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &optval, sizeof optval);
-    optval = KEEP_ALIVE_IDLE;
-    setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE,  &optval,  sizeof(int));
-    optval = KEEP_ALIVE_INTVL;
-    setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &optval, sizeof(int));
-    optval = KEEP_ALIVE_CNT;
-    setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT,   &optval,   sizeof(int));
+	static const char *const events[] = {"?", "appear", "disappear", "health"};
+	struct copro_device_health_record rec;
+	(void)user_data;
+
+	if (copro_device_health_decode(frame->payload, frame->len, &rec) < 0) {
+		return;
+	}
+
+	printf("[%s] device %02X:%02X:%02X:%02X:%02X:%02X %s adv: %u meas: %u missed: %u "
+		   "suppressed: %u rssi: %.1f\n",
+		   copro_conn_peer(conn),
+		   rec.mac[0],
+		   rec.mac[1],
+		   rec.mac[2],
+		   rec.mac[3],
+		   rec.mac[4],
+		   rec.mac[5],
+		   events[rec.event <= COPRO_DEVICE_EVENT_HEALTH ? rec.event : 0],
+		   rec.adv_count,
+		   rec.measurements,
+		   rec.missed,
+		   rec.suppressed,
+		   rec.rssi_ewma / 16.0);
+}
+
+static void on_snapshot(struct copro_conn *conn,
+						const struct copro_frame *frame,
+						void *user_data)
+{
+	struct copro_snapshot_record rec;
+
+	if (copro_snapshot_decode(frame->payload, frame->len, &rec) < 0) {
+		return;
+	}
+
+	if (rec.flags & COPRO_SNAPSHOT_FLAG_END) {
+		printf("[%s] snapshot %u: %u records\n",
+			   copro_conn_peer(conn),
+			   rec.seq,
+			   rec.index);
+	} else if (rec.record.channel_id == COPRO_CHANNEL_ID_XIAOMI) {
+		on_xiaomi(conn, &rec.record, user_data);
+	} else if (rec.record.channel_id == COPRO_CHANNEL_ID_LINKY_TIC) {
+		on_linky(conn, &rec.record, user_data);
+	}
 }
 
-int main(void)
+static void on_control(struct copro_conn *conn,
+					   const struct copro_frame *frame,
+					   void *user_data)
 {
-    /* create listening socket */
-    int lsock = socket(AF_INET, SOCK_STREAM, 0);
-    if (lsock < 0) { perror("socket"); exit(EXIT_FAILURE); }
-
-    int optval = 1;
-    setsockopt(lsock, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof optval);
-
-    struct sockaddr_in addr = {
-        .sin_family      = AF_INET,
-        .sin_port        = htons(PORT),
-        .sin_addr.s_addr = inet_addr(ADDR)
-    };
-    if (bind(lsock, (struct sockaddr *)&addr, sizeof addr) < 0) {
-        perror("bind"); exit(EXIT_FAILURE);
-    }
-    if (listen(lsock, 1) < 0) {
-        perror("listen"); exit(EXIT_FAILURE);
-    }
-
-    printf("Server listening on %s:%d\n", ADDR, PORT);
-
-    for (;;) {
-        int csock = accept(lsock, NULL, NULL);
-        if (csock < 0) {
-            perror("accept");
-            continue;
-        }
-        printf("Client connected\n");
-
-        set_keepalive(csock);
-
-        char buf[512];
-        ssize_t n;
-        while ((n = read(csock, buf, sizeof buf)) > 0) {
-            printf("Received %zd bytes\n", n);
-        }
-
-        if (n == 0) {
-            printf("Client closed the connection\n");
-        } else {
-            fprintf(stderr, "read error: %s\n", strerror(errno));
-        }
-
-        close(csock);
-    }
+	struct copro_control_msg msg;
+	(void)user_data;
+
+	if (copro_control_decode(frame->payload, frame->len, &msg) < 0) {
+		return;
+	}
+
+	if (msg.type == COPRO_CONTROL_ACK && msg.len >= 2u) {
+		printf("[%s] control ack type: 0x%02x status: 0x%02x\n",
+			   copro_conn_peer(conn),
+			   msg.data[0],
+			   msg.data[1]);
+	} else {
+		printf("[%s] control type: 0x%02x len: %u\n",
+			   copro_conn_peer(conn),
+			   msg.type,
+			   msg.len);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	struct copro_server_config config = {
+		.addr	   = argc > 1 ? argv[1] : ADDR,
+		.port	   = argc > 2 ? (uint16_t)atoi(argv[2]) : COPRO_DEFAULT_PORT,
+		.format	   = getenv("COPRO_FRAME_V2") ? COPRO_FRAME_V2 : COPRO_FRAME_V1,
+		.max_conns = MAX_CONNS,
+		.keepalive = true,
+		.on_conn   = on_conn,
+	};
+	int ret;
+
+	srv = copro_server_create(&config);
+	if (!srv) {
+		perror("copro_server_create");
+		return EXIT_FAILURE;
+	}
+
+	copro_server_channel_register(srv, COPRO_CHANNEL_ID_XIAOMI, on_xiaomi, NULL);
+	copro_server_channel_register(srv, COPRO_CHANNEL_ID_LINKY_TIC, on_linky, NULL);
+	copro_server_channel_register(
+		srv, COPRO_CHANNEL_ID_DEVICE_HEALTH, on_device_health, NULL);
+	copro_server_channel_register(srv, COPRO_CHANNEL_ID_SNAPSHOT, on_snapshot, NULL);
+	copro_server_channel_register(srv, COPRO_CHANNEL_ID_CONTROL, on_control, NULL);
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+
+	printf("Server listening on %s:%u\n", config.addr, config.port);
+
+	ret = copro_server_run(srv);
+	if (ret < 0) {
+		fprintf(stderr, "copro_server_run: %s\n", strerror(-ret));
+	}
+
+	copro_server_destroy(srv);
+
+	return ret < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
 }
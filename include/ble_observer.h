@@ -11,6 +11,16 @@
 
 #include <zephyr/bluetooth/addr.h>
 
+/* Scan interval and window bounds, in 0.625 ms units */
+#define BLE_OBSERVER_SCAN_UNITS_MIN 0x0004u
+#define BLE_OBSERVER_SCAN_UNITS_MAX 0x4000u
+
 int ble_observer_start(void);
 
+/* Apply new scan parameters, restarting the scanner if it is running. window
+ * must not exceed interval. */
+int ble_observer_scan_params_set(uint16_t interval, uint16_t window);
+
+void ble_observer_scan_params_get(uint16_t *interval, uint16_t *window);
+
 #endif /* _BLE_OBSERVER_H */
\ No newline at end of file
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2025 Lucas Dietrich <ld.adecy@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _CONFIG_SERVER_H
+#define _CONFIG_SERVER_H
+
+#include <stdint.h>
+
+/* Request layout is as follows:
+ *  - 1 byte: operation (enum cfg_op)
+ *  - 2 bytes: key (enum cfg_key)
+ *  - 4 bytes: argument, the channel id for the CFG_KEY_CHANNEL_* keys, 0 otherwise
+ *  - 4 bytes: value, ignored by CFG_OP_GET and CFG_OP_RESET
+ *
+ * Every request gets a response:
+ *  - 1 byte: operation
+ *  - 2 bytes: key
+ *  - 4 bytes: argument
+ *  - 1 byte: status (enum stream_control_status)
+ *  - 4 bytes: value of the key after the operation
+ *
+ * All integers are little endian.
+ */
+#define CFG_REQUEST_SIZE  11u
+#define CFG_RESPONSE_SIZE 12u
+
+enum cfg_op {
+	CFG_OP_GET = 0x01,
+	/* Apply and persist */
+	CFG_OP_SET = 0x02,
+	/* Apply only, lost on reboot. Handy to try values out */
+	CFG_OP_SET_VOLATILE = 0x03,
+	/* Forget the persisted value and apply the build time default */
+	CFG_OP_RESET = 0x04,
+};
+
+enum cfg_key {
+	/* BLE scan interval and window, in 0.625 ms units. The window cannot exceed
+	 * the interval, change them in the appropriate order. */
+	CFG_KEY_SCAN_INTERVAL = 0x0001,
+	CFG_KEY_SCAN_WINDOW	  = 0x0002,
+	/* Runtime log level of all modules (0: none to 4: debug), capped by the
+	 * level modules are built with. Requires CONFIG_LOG_RUNTIME_FILTERING. */
+	CFG_KEY_LOG_LEVEL = 0x0010,
+	/* Stream channel tuning, see struct stream_channel_config */
+	CFG_KEY_CHANNEL_ENABLE	 = 0x0100,
+	CFG_KEY_CHANNEL_PRIORITY = 0x0101,
+	CFG_KEY_CHANNEL_WEIGHT	 = 0x0102,
+	/* Deadbands of the change-only reporting, see enum deadband_param for the
+	 * units. Requires CONFIG_COPRO_DEADBAND. */
+	CFG_KEY_DEADBAND_XIAOMI_TEMPERATURE = 0x0200,
+	CFG_KEY_DEADBAND_XIAOMI_HUMIDITY	= 0x0201,
+	CFG_KEY_DEADBAND_XIAOMI_BATTERY		= 0x0202,
+	CFG_KEY_DEADBAND_LINKY_PAPP			= 0x0203,
+	CFG_KEY_DEADBAND_LINKY_BASE			= 0x0204,
+	CFG_KEY_DEADBAND_HEARTBEAT			= 0x0205,
+	/* Records suppressed by the deadband since boot, read only */
+	CFG_KEY_DEADBAND_SUPPRESSED = 0x0210,
+};
+
+/* Load the persisted settings, apply them and start the server. Must be called
+ * once the BLE observer and the stream client are started.
+ */
+int config_server_init(void);
+
+#endif /* _CONFIG_SERVER_H */
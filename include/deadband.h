@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2025 Lucas Dietrich <ld.adecy@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _DEADBAND_H
+#define _DEADBAND_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <linky.h>
+#include <xiaomi.h>
+
+/* Change-only reporting: a decoded record is only streamed if one of its values
+ * moved by at least the deadband since the last record reported for the device,
+ * or if the heartbeat interval elapsed. A deadband of 0 reports every record.
+ */
+enum deadband_param {
+	DEADBAND_XIAOMI_TEMPERATURE = 0, // 1e-2 °C
+	DEADBAND_XIAOMI_HUMIDITY,		 // 1e-2 %
+	DEADBAND_XIAOMI_BATTERY,		 // mV
+	DEADBAND_LINKY_PAPP,			 // VA
+	DEADBAND_LINKY_BASE,			 // Wh
+	DEADBAND_HEARTBEAT,				 // ms
+	DEADBAND_PARAMS_COUNT,
+};
+
+struct deadband_stats {
+	uint32_t reported;	 // records reported
+	uint32_t suppressed; // records suppressed
+	uint32_t heartbeats; // records reported only because of the heartbeat
+};
+
+#if CONFIG_COPRO_DEADBAND
+
+/* Return true if the record must be reported */
+bool deadband_xiaomi_report(const xiaomi_record_t *rec);
+
+bool deadband_linky_report(const linky_tic_record_t *rec);
+
+int deadband_param_set(enum deadband_param param, uint32_t value);
+
+int deadband_param_get(enum deadband_param param, uint32_t *value);
+
+/* Build time value of a parameter */
+uint32_t deadband_param_default(enum deadband_param param);
+
+void deadband_stats_get(struct deadband_stats *stats);
+
+#else
+
+static inline bool deadband_xiaomi_report(const xiaomi_record_t *rec)
+{
+	return true;
+}
+
+static inline bool deadband_linky_report(const linky_tic_record_t *rec)
+{
+	return true;
+}
+
+#endif /* CONFIG_COPRO_DEADBAND */
+
+#endif /* _DEADBAND_H */
@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2025 Lucas Dietrich <ld.adecy@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _DEVICE_REGISTRY_H
+#define _DEVICE_REGISTRY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <zephyr/bluetooth/bluetooth.h>
+
+#define STREAM_CHANNEL_NAME_DEVICE_HEALTH "device-registry-health"
+#define STREAM_CHANNEL_ID_DEVICE_HEALTH	  0x3D5E1A70lu
+
+enum device_type {
+	DEVICE_TYPE_XIAOMI	  = 0x01,
+	DEVICE_TYPE_LINKY_TIC = 0x02,
+};
+
+/* Devices appear on their first advertisement (or the first one after a
+ * disappearance) and disappear after CONFIG_COPRO_DEVICE_REGISTRY_TIMEOUT ms
+ * without advertisement. Present devices are reported periodically. */
+enum device_event {
+	DEVICE_EVENT_APPEAR	   = 0x01,
+	DEVICE_EVENT_DISAPPEAR = 0x02,
+	DEVICE_EVENT_HEALTH	   = 0x03,
+};
+
+/* No measurement counter in the advertisement */
+#define DEVICE_COUNTER_NONE (-1)
+
+/* RSSI EWMA fixed point scale */
+#define DEVICE_RSSI_EWMA_SCALE 16
+
+#define DEVICE_RECORD_BUF_SIZE		   53u
+#define DEVICE_RECORD_HEADER_VERSION   0x02
+#define DEVICE_RECORD_TIMESTAMP_OFFSET 10
+
+/* Buffer layout is as follows:
+ *  - 6 bytes: BLE address
+ *  - 1 byte: BLE address type
+ *  - 1 byte: event (enum device_event)
+ *  - 1 byte: header version
+ *  - 1 byte: device type (enum device_type)
+ *  - 8 bytes: timestamp of the event
+ *  - 8 bytes: first seen (uptime ms)
+ *  - 8 bytes: last seen (uptime ms)
+ *  - 4 bytes: advertisements count
+ *  - 4 bytes: measurements received (counter increments)
+ *  - 4 bytes: measurements missed (counter gaps)
+ *  - 2 bytes: RSSI EWMA (int16, 1/DEVICE_RSSI_EWMA_SCALE dBm)
+ *  - 1 byte: last RSSI
+ *  - 4 bytes: measurements suppressed by the deadband (version >= 2)
+ */
+
+extern struct k_msgq device_registry_msgq;
+
+int device_registry_init(void);
+
+/* Account an advertisement carrying a measurement, counter is the 8 bits
+ * measurement counter of the device or DEVICE_COUNTER_NONE. suppressed is true
+ * if the measurement was not reported because of the deadband.
+ *
+ * record is the serialized record of the measurement (channel of the device
+ * type), kept as the device last known value for the snapshots.
+ */
+void device_registry_update(const bt_addr_le_t *addr,
+							enum device_type type,
+							int8_t rssi,
+							int counter,
+							bool suppressed,
+							const uint8_t *record,
+							size_t record_len);
+
+#if CONFIG_COPRO_DEVICE_REGISTRY_SNAPSHOT
+
+#define STREAM_CHANNEL_NAME_DEVICE_SNAPSHOT "device-registry-snapshot"
+#define STREAM_CHANNEL_ID_DEVICE_SNAPSHOT	0x9B2E41D7lu
+
+/* Largest record kept for a device (Linky TIC) */
+#define DEVICE_SNAPSHOT_RECORD_MAX_SIZE 85u
+
+#define DEVICE_SNAPSHOT_HEADER_SIZE		 20u
+#define DEVICE_SNAPSHOT_HEADER_VERSION	 0x01
+#define DEVICE_SNAPSHOT_TIMESTAMP_OFFSET 6
+
+#define DEVICE_SNAPSHOT_BUF_SIZE                                                         \
+	(DEVICE_SNAPSHOT_HEADER_SIZE + DEVICE_SNAPSHOT_RECORD_MAX_SIZE)
+
+/* Last message of a snapshot, carrying no record */
+#define DEVICE_SNAPSHOT_FLAG_END 0x01
+
+/* A snapshot is a burst of one message per known device, replaying its last
+ * record, followed by an end message. Buffer layout is as follows:
+ *  - 1 byte: header version
+ *  - 1 byte: flags (DEVICE_SNAPSHOT_FLAG_*)
+ *  - 2 bytes: snapshot sequence number
+ *  - 2 bytes: index of the record in the snapshot (records count if END)
+ *  - 8 bytes: timestamp of the snapshot request (uptime ms)
+ *  - 4 bytes: channel id of the record (0 if END)
+ *  - 2 bytes: record length
+ *  - N bytes: record, as sent on its channel, zero padded
+ */
+
+extern struct k_msgq device_snapshot_msgq;
+
+/* Start a snapshot of all known devices, a snapshot in progress is restarted.
+ * Called on every new stream connection.
+ */
+int device_registry_snapshot_request(void);
+
+/* Control channel handler (STREAM_CONTROL_SNAPSHOT), no data */
+int device_registry_control_snapshot(uint8_t type, const uint8_t *data, size_t len);
+
+#endif /* CONFIG_COPRO_DEVICE_REGISTRY_SNAPSHOT */
+
+#endif /* _DEVICE_REGISTRY_H */
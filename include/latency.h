@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2025 Lucas Dietrich <ld.adecy@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _LATENCY_H
+#define _LATENCY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <zephyr/kernel.h>
+#if CONFIG_COPRO_LATENCY_PROBES
+#include <zephyr/timing/timing.h>
+#endif
+
+/* Stages of the advertisement to socket pipeline. DECODE, SERIALIZE, ENQUEUE
+ * and SEND measure the time spent in the stage by the running thread, QUEUE is
+ * the time a record waits in its msgq (stream thread wakeup and scheduling)
+ * and TOTAL the time from device_found() to the end of the socket send.
+ * SEND_CPU is the CPU time of the stream thread during SEND, the difference
+ * being the time it was blocked (socket or UART) or preempted.
+ */
+enum latency_stage {
+	LATENCY_STAGE_DECODE = 0,
+	LATENCY_STAGE_SERIALIZE,
+	LATENCY_STAGE_ENQUEUE,
+	LATENCY_STAGE_QUEUE,
+	LATENCY_STAGE_SEND,
+	LATENCY_STAGE_TOTAL,
+	LATENCY_STAGE_SEND_CPU,
+	LATENCY_STAGES_COUNT,
+};
+
+/* Bucket 0 counts durations < 1 us, bucket i durations in [2^(i-1), 2^i) us,
+ * the last bucket is open ended. */
+#define LATENCY_BUCKETS 24u
+
+#define STREAM_CHANNEL_NAME_LATENCY "latency-histograms"
+#define STREAM_CHANNEL_ID_LATENCY	0x6C7A0E51lu
+
+#define LATENCY_RECORD_HEADER_VERSION 0x01
+#define LATENCY_RECORD_BUF_SIZE		  (19u + 4u * LATENCY_BUCKETS)
+
+/* Buffer layout is as follows:
+ *  - 1 byte: stage (enum latency_stage)
+ *  - 1 byte: header version
+ *  - 1 byte: buckets count
+ *  - 4 bytes: samples count
+ *  - 8 bytes: sum (us)
+ *  - 4 bytes: max (us)
+ *  - 4 bytes per bucket: samples count
+ */
+
+/* STREAM_CONTROL_LATENCY_EXPORT request data, optional */
+#define LATENCY_EXPORT_FLAG_RESET 0x01u
+
+#if CONFIG_COPRO_LATENCY_PROBES
+
+/* The stages within a thread last a few microseconds, they are timed with the
+ * timing functions (DWT cycle counter on Cortex-M). The stages spanning threads
+ * (QUEUE, TOTAL) are timed with the system clock, whose resolution (30.5 us with
+ * the nRF RTC) is enough for them and which can be carried in the messages.
+ */
+
+/* System clock stamps carried at the end of every stream msgq message, they are
+ * not sent to the host. A zeroed stamp is ignored. */
+struct latency_stamp {
+	uint32_t found;	   // device_found() entry
+	uint32_t enqueued; // just before k_msgq_put()
+};
+
+#define LATENCY_STAMP_SIZE sizeof(struct latency_stamp)
+
+extern struct k_msgq latency_msgq;
+
+/* Duration in system clock cycles (k_cycle_get_32()) */
+void latency_record(enum latency_stage stage, uint32_t cycles);
+
+/* Duration between two timing_counter_get() */
+void latency_record_timing(enum latency_stage stage, timing_t start, timing_t end);
+
+/* Record stage durations from the stamp of a dequeued message, msg_end points
+ * after the message payload */
+void latency_stamp_dequeued(const uint8_t *msg_end);
+
+/* Start of the SEND stage of the current thread */
+struct latency_send {
+	timing_t start;
+	uint64_t cpu_start; // thread execution cycles (timing functions)
+};
+
+void latency_send_start(struct latency_send *send);
+
+void latency_stamp_sent(const uint8_t *msg_end, const struct latency_send *send);
+
+/* STREAM_CONTROL_LATENCY_EXPORT handler, queues one message per stage on the
+ * latency channel */
+int latency_control_export(uint8_t type, const uint8_t *data, size_t len);
+
+/* _name is the system clock stamp, _name##_timing the timing counter */
+#define LATENCY_PROBE_START(_name)                                                       \
+	const uint32_t _name __maybe_unused = k_cycle_get_32();                              \
+	const timing_t _name##_timing		= timing_counter_get()
+
+/* Record the duration of _stage since _start and start the next stage */
+#define LATENCY_PROBE_STAGE(_stage, _start, _name)                                       \
+	LATENCY_PROBE_START(_name);                                                          \
+	latency_record_timing(_stage, _start##_timing, _name##_timing)
+
+#define LATENCY_PROBE_END(_stage, _start)                                                \
+	latency_record_timing(_stage, _start##_timing, timing_counter_get())
+
+#define LATENCY_STAMP_WRITE(_buf, _found, _enqueued)                                     \
+	memcpy(_buf,                                                                         \
+		   &(struct latency_stamp){.found = (_found), .enqueued = (_enqueued)},          \
+		   LATENCY_STAMP_SIZE)
+
+#else
+
+#define LATENCY_STAMP_SIZE 0u
+
+#define LATENCY_PROBE_START(_name)
+#define LATENCY_PROBE_STAGE(_stage, _start, _name)
+#define LATENCY_PROBE_END(_stage, _start)
+#define LATENCY_STAMP_WRITE(_buf, _found, _enqueued)
+
+#endif /* CONFIG_COPRO_LATENCY_PROBES */
+
+#endif /* _LATENCY_H */
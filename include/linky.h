@@ -16,6 +16,12 @@
 
 #define LINKY_TIC_RAW_BUFFER_SIZE 64u
 
+/* Little endian measurements in the raw TIC data */
+#define LINKY_TIC_RAW_BASE_OFFSET  1u // index (Wh), 4 bytes
+#define LINKY_TIC_RAW_IINST_OFFSET 5u // instantaneous current (A), 2 bytes
+#define LINKY_TIC_RAW_PTEC_OFFSET  7u // tariff period, 2 bytes
+#define LINKY_TIC_RAW_PAPP_OFFSET  9u // apparent power (VA), 4 bytes
+
 #define STREAM_CHANNEL_NAME_LINKY_TIC "linky-tic-measurements"
 #define STREAM_CHANNEL_ID_LINKY_TIC	  0xCD1F14BDlu
 
@@ -35,8 +41,9 @@ bool linky_adv_data_recognize_cb(struct bt_data *data, void *user_data);
 
 bool linky_adv_data_parse_measurements_cb(struct bt_data *data, void *user_data);
 
-#define LINKY_RECORD_BUF_SIZE		(21u + LINKY_TIC_RAW_BUFFER_SIZE)
-#define LINKY_RECORD_HEADER_VERSION 0x01
+#define LINKY_RECORD_BUF_SIZE		  (21u + LINKY_TIC_RAW_BUFFER_SIZE)
+#define LINKY_RECORD_HEADER_VERSION	  0x01
+#define LINKY_RECORD_TIMESTAMP_OFFSET 13
 
 int linky_record_serialize(const linky_tic_record_t *lc, uint8_t *buf, size_t len);
 
@@ -7,15 +7,138 @@
 #ifndef _STREAM_CLIENT_H
 #define _STREAM_CLIENT_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
 #include <zephyr/kernel.h>
 
+#define STREAM_CHANNEL_NO_TIMESTAMP (-1)
+
+struct stream_channel_config {
+	/* Scheduling class, 0 is the highest priority. A channel is only served when
+	 * no channel of a higher priority has pending messages.
+	 */
+	uint8_t priority;
+	/* Deficit round-robin weight among channels of the same priority. The
+	 * quantum granted per round is weight times the largest frame size and every
+	 * message is charged its frame size: the bandwidth in bytes is shared in
+	 * proportion to the weights.
+	 */
+	uint8_t weight;
+	/* Offset of the little-endian 64 bits uptime timestamp (ms) in a message,
+	 * used to measure queueing delay. STREAM_CHANNEL_NO_TIMESTAMP if none.
+	 */
+	int16_t timestamp_offset;
+};
+
+struct stream_channel_stats {
+	uint32_t sent;			// messages sent
+	uint32_t delay_last_ms; // queueing delay of the last message sent
+	uint32_t delay_max_ms;	// maximum queueing delay
+	uint64_t delay_sum_ms;	// sum of queueing delays, for averaging
+	uint32_t queue_peak;	// highest number of queued messages seen
+};
+
+/* Control channel (id 0) messages, in both directions, are:
+ *  - 1 byte: type
+ *  - 1 byte: data length
+ *  - N bytes: data
+ *
+ * Every message received from the host is acknowledged with a STREAM_CONTROL_ACK
+ * message carrying the type of the request and the handler status (enum
+ * stream_control_status).
+ */
+enum stream_control_type {
+	STREAM_CONTROL_ACK				 = 0x01,
+	STREAM_CONTROL_XIAOMI_KEY_SET	 = 0x10,
+	STREAM_CONTROL_XIAOMI_KEY_REMOVE = 0x11,
+	STREAM_CONTROL_LATENCY_EXPORT	 = 0x20,
+	STREAM_CONTROL_SNAPSHOT			 = 0x30,
+};
+
+/* Status sent to the host for a request. errno values are not portable (newlib
+ * and the host libc differ) and some do not fit in a byte, negative error codes
+ * are mapped with stream_control_status().
+ */
+enum stream_control_status {
+	STREAM_CONTROL_STATUS_OK		  = 0x00,
+	STREAM_CONTROL_STATUS_INVALID	  = 0x01, // -EINVAL, -EMSGSIZE, -ERANGE, -EDOM
+	STREAM_CONTROL_STATUS_UNSUPPORTED = 0x02, // -ENOTSUP, -ENOSYS
+	STREAM_CONTROL_STATUS_NOT_FOUND	  = 0x03, // -ENOENT, -ENODEV
+	STREAM_CONTROL_STATUS_NO_SPACE	  = 0x04, // -ENOMEM, -ENOSPC, -ENOBUFS
+	STREAM_CONTROL_STATUS_BUSY		  = 0x05, // -EBUSY, -EAGAIN, -EALREADY
+	STREAM_CONTROL_STATUS_IO		  = 0x06, // -EIO, e.g. a flash write failure
+	STREAM_CONTROL_STATUS_ERROR		  = 0xFF, // any other error
+};
+
+/* Map 0 or a negative error code to an enum stream_control_status */
+uint8_t stream_control_status(int ret);
+
+#define STREAM_CONTROL_HANDLERS_MAX 8u
+
+/* Called from the stream RX thread, returns 0 or a negative error code */
+typedef int (*stream_control_handler_t)(uint8_t type, const uint8_t *data, size_t len);
+
+#define STREAM_CONNECT_HANDLERS_MAX 2u
+
+/* Called from the stream client thread on every new connection, before the
+ * queues are served. Returns 0 or a negative error code, which is only logged.
+ */
+typedef int (*stream_connect_handler_t)(void);
+
 int stream_client_start(void);
 
-int stream_client_channel_add(uint32_t channel_id, const char *name, struct k_msgq *msgq);
+/* cfg may be NULL, in which case the channel gets the lowest priority and a
+ * weight of 1.
+ */
+int stream_client_channel_add(uint32_t channel_id,
+							  const char *name,
+							  struct k_msgq *msgq,
+							  const struct stream_channel_config *cfg);
+
+int stream_client_control_register(uint8_t type, stream_control_handler_t handler);
+
+int stream_client_control_send(uint8_t type, const void *data, size_t len);
+
+int stream_client_connect_register(stream_connect_handler_t handler);
+
+int stream_client_channel_stats_get(uint32_t channel_id, struct stream_channel_stats *stats);
+
+typedef void (*stream_channel_foreach_cb_t)(uint32_t channel_id,
+											const char *name,
+											struct k_msgq *msgq,
+											const struct stream_channel_stats *stats,
+											void *user_data);
+
+/* Calls cb for every registered channel, control channel included. Meant for
+ * diagnostics, the statistics are read without synchronisation.
+ */
+void stream_client_channel_foreach(stream_channel_foreach_cb_t cb, void *user_data);
+
+/* Runtime tuning, may be called while the client is running. Only the priority
+ * and weight of cfg are applied, the timestamp offset is fixed by the record
+ * layout.
+ */
+int stream_client_channel_config_set(uint32_t channel_id,
+									 const struct stream_channel_config *cfg);
+
+int stream_client_channel_config_get(uint32_t channel_id,
+									 struct stream_channel_config *cfg);
+
+/* Messages of a disabled channel are dropped instead of sent. The control
+ * channel cannot be disabled.
+ */
+int stream_client_channel_enable(uint32_t channel_id, bool enable);
+
+/* Returns 1 if enabled, 0 if disabled or a negative error code */
+int stream_client_channel_is_enabled(uint32_t channel_id);
 
 int stream_try_connect(void);
 
-#endif /* _STREAM_CLIENT_H */
\ No newline at end of file
+/* True while a host is connected, without synchronisation (a hint for
+ * producers which would otherwise wait for the queues to be drained).
+ */
+bool stream_client_is_connected(void);
+
+#endif /* _STREAM_CLIENT_H */
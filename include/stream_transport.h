@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) 2025 Lucas Dietrich <ld.adecy@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _STREAM_TRANSPORT_H
+#define _STREAM_TRANSPORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Link carrying the stream frames between the device and the host, selected at
+ * build time (CONFIG_COPRO_STREAM_TRANSPORT_*).
+ *
+ * send() is only called from the stream client thread, recv() only from the
+ * stream RX thread. disconnect() must make a pending recv() fail.
+ */
+struct stream_transport {
+	const char *name;
+	/* Returns 0 once the host is reachable, a negative error code otherwise */
+	int (*connect)(void);
+	void (*disconnect)(void);
+	/* Send one complete frame */
+	int (*send)(const uint8_t *frame, size_t len);
+	/* Receive exactly len bytes of the frame stream, blocking */
+	int (*recv)(uint8_t *buf, size_t len);
+	/* Optional, for links delimiting the frames: drop the rest of the frame
+	 * being received, the next recv() starts a new frame. recv() returns
+	 * -EBADMSG when the frame is cut short by the link. Without it, a bad
+	 * frame closes the connection.
+	 */
+	void (*resync)(void);
+};
+
+/* TCP connection to CONFIG_COPRO_STREAM_HOST:CONFIG_COPRO_STREAM_PORT */
+extern const struct stream_transport stream_transport_tcp;
+
+/* COBS framed serial link over the UART chosen as "copro,stream-uart" in the
+ * devicetree (UART or CDC-ACM). Every frame is COBS encoded and followed by a
+ * 0x00 delimiter, frames always use the v2 layout (sync word and CRC-32).
+ */
+extern const struct stream_transport stream_transport_serial;
+
+#endif /* _STREAM_TRANSPORT_H */
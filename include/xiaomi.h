@@ -22,13 +22,15 @@ typedef struct {
 	uint8_t battery_level; // Device measured battery level, base unit:  %, valid if > 0
 } xiaomi_measurements_t;
 
-#define XIAOMI_RECORD_FLAG_VALID 0x01
+#define XIAOMI_RECORD_FLAG_VALID	0x01
+#define XIAOMI_RECORD_FLAG_COUNTER 0x02
 
 typedef struct {
 	bt_addr_le_t addr;					// Record device address
 	xiaomi_measurements_t measurements; // Record measurements
 	int64_t timestamp;					// Time of record (uptime since boot)
 	uint32_t flags;						// flags
+	uint8_t counter; // Measurement counter, valid with XIAOMI_RECORD_FLAG_COUNTER
 } xiaomi_record_t;
 
 #define STREAM_CHANNEL_NAME_XIAOMI	  "xiaomi-lywsd03mmc-measurements"
@@ -40,8 +42,9 @@ bool xiaomi_bt_data_parse(const bt_addr_le_t *addr,
 						  struct net_buf_simple *ad,
 						  xiaomi_record_t *xc);
 
-#define XIAOMI_RECORD_BUF_SIZE		 24
-#define XIAOMI_RECORD_HEADER_VERSION 0x01
+#define XIAOMI_RECORD_BUF_SIZE		   24
+#define XIAOMI_RECORD_HEADER_VERSION   0x01
+#define XIAOMI_RECORD_TIMESTAMP_OFFSET 9
 
 /* Buffer layout is as follows:
  *  - 6 bytes: BLE address
@@ -58,4 +61,38 @@ int xiaomi_record_serialize(const xiaomi_record_t *xc, uint8_t *buf, size_t len)
 
 extern struct k_msgq xiaomi_msgq;
 
+#if CONFIG_COPRO_XIAOMI_ENCRYPTED
+
+#define XIAOMI_BIND_KEY_SIZE 16u
+
+#define XIAOMI_MIBEACON_UUID 0xFE95
+#define XIAOMI_BTHOME_UUID	 0xFCD2
+
+int xiaomi_encrypted_init(void);
+
+int xiaomi_key_set(const bt_addr_t *addr, const uint8_t key[XIAOMI_BIND_KEY_SIZE]);
+
+int xiaomi_key_remove(const bt_addr_t *addr);
+
+bool xiaomi_key_known(const bt_addr_t *addr);
+
+/* Decode a MiBeacon (0xFE95) or BTHome v2 (0xFCD2) service data element (UUID
+ * included), decrypting it with the bind key of xc->addr when needed.
+ *
+ * Advertisements usually carry a single measurement, the other fields of
+ * xc->measurements are filled from the last values received from the device.
+ * Returns true if a measurement was decoded.
+ */
+bool xiaomi_encrypted_parse(const uint8_t *svc_data, size_t len, xiaomi_record_t *xc);
+
+/* Control channel handlers (STREAM_CONTROL_XIAOMI_KEY_SET/REMOVE), the data is:
+ *  - 6 bytes: BLE address (most significant byte first)
+ *  - 16 bytes: bind key (KEY_SET only)
+ */
+int xiaomi_control_key_set(uint8_t type, const uint8_t *data, size_t len);
+
+int xiaomi_control_key_remove(uint8_t type, const uint8_t *data, size_t len);
+
+#endif /* CONFIG_COPRO_XIAOMI_ENCRYPTED */
+
 #endif /* _XIAOMI_LYWSD03MMC_H */
\ No newline at end of file
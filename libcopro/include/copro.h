@@ -0,0 +1,330 @@
+/*
+ * Copyright (c) 2025 Lucas Dietrich <ld.adecy@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* Host side library for the BLE coprocessor stream protocol.
+ *
+ * - copro_parser: incremental frame parser (v1 and v2 framing), frames are
+ *   handed out as pointers into the parser receive buffer (no copy).
+ * - copro_*_decode: decoders for the record layouts of the firmware channels,
+ *   variable length fields point into the frame payload.
+ * - copro_server: epoll loop accepting many dongle connections and dispatching
+ *   frames to per channel callbacks.
+ *
+ * Functions returning int return 0 (or a positive value) on success and a
+ * negative errno value on error.
+ */
+
+#ifndef _COPRO_H
+#define _COPRO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define COPRO_DEFAULT_PORT 4000u
+
+#define COPRO_CHANNEL_ID_CONTROL	   0x00000000u
+#define COPRO_CHANNEL_ID_XIAOMI		   0xFA30FA42u
+#define COPRO_CHANNEL_ID_LINKY_TIC	   0xCD1F14BDu
+#define COPRO_CHANNEL_ID_DEVICE_HEALTH 0x3D5E1A70u
+#define COPRO_CHANNEL_ID_LATENCY	   0x6C7A0E51u
+#define COPRO_CHANNEL_ID_SNAPSHOT	   0x9B2E41D7u
+
+/* v1: channel_id (4) | len (2) | payload
+ * v2: sync (2) | channel_id (4) | len (2) | payload | crc32 (4)
+ *
+ * All integers are little endian, the v2 CRC-32 (IEEE) covers channel id,
+ * length and payload.
+ */
+enum copro_frame_format {
+	COPRO_FRAME_V1 = 0,
+	COPRO_FRAME_V2,
+};
+
+#define COPRO_FRAME_V1_HEADER_SIZE 6u
+#define COPRO_FRAME_V2_SYNC		   0xB1C0u
+#define COPRO_FRAME_V2_HEADER_SIZE 8u
+#define COPRO_FRAME_V2_CRC_SIZE	   4u
+
+/* Larger payloads are considered corrupted (firmware
+ * CONFIG_COPRO_STREAM_CHANNEL_MSG_MAX_SIZE is much lower) */
+#define COPRO_FRAME_PAYLOAD_MAX 1024u
+
+#define COPRO_FRAME_SIZE_MAX                                                             \
+	(COPRO_FRAME_V2_HEADER_SIZE + COPRO_FRAME_PAYLOAD_MAX + COPRO_FRAME_V2_CRC_SIZE)
+
+#define COPRO_PARSER_BUF_SIZE (2u * COPRO_FRAME_SIZE_MAX)
+
+struct copro_frame {
+	uint32_t channel_id;
+	uint16_t len;
+	const uint8_t *payload; // Points into the parser buffer
+};
+
+struct copro_parser_stats {
+	uint64_t frames;
+	uint64_t skipped_bytes; // v2: bytes dropped while resynchronizing
+	uint64_t crc_errors;	// v2: candidate frames rejected (CRC or length)
+};
+
+struct copro_parser {
+	enum copro_frame_format format;
+	size_t head; // First unparsed byte
+	size_t tail; // End of received data
+	struct copro_parser_stats stats;
+	uint8_t buf[COPRO_PARSER_BUF_SIZE];
+};
+
+void copro_parser_init(struct copro_parser *p, enum copro_frame_format format);
+
+/* Free space to receive into, previously returned frames are invalidated as
+ * the parsed bytes are reclaimed. Returns NULL if the buffer is full.
+ */
+uint8_t *copro_parser_rx_buf(struct copro_parser *p, size_t *avail);
+
+void copro_parser_rx_commit(struct copro_parser *p, size_t len);
+
+/* Returns 1 if a frame was parsed, 0 if more data is needed, -EBADMSG if a v1
+ * stream is out of sync (unrecoverable, the connection should be closed).
+ * frame->payload is valid until the next copro_parser_rx_buf() call.
+ */
+int copro_parser_next(struct copro_parser *p, struct copro_frame *frame);
+
+uint32_t copro_crc32_ieee(const uint8_t *data, size_t len);
+
+/* Encode a frame, returns its length or -ENOMEM if buf is too small */
+int copro_frame_encode(enum copro_frame_format format,
+					   uint32_t channel_id,
+					   const uint8_t *payload,
+					   size_t len,
+					   uint8_t *buf,
+					   size_t size);
+
+/* Records */
+
+#define COPRO_MAC_SIZE 6u
+
+#define COPRO_XIAOMI_RECORD_SIZE 24u
+
+struct copro_xiaomi_record {
+	uint8_t mac[COPRO_MAC_SIZE]; // Most significant byte first
+	uint8_t addr_type;
+	int8_t rssi;
+	uint8_t version;
+	int64_t timestamp;	   // Device uptime (ms)
+	int16_t temperature;   // 1e-2 °C
+	uint16_t humidity;	   // 1e-2 %
+	uint16_t battery_mv;   // mV
+	uint8_t battery_level; // %, valid if > 0
+};
+
+#define COPRO_LINKY_TIC_RAW_SIZE	64u
+#define COPRO_LINKY_TIC_RECORD_SIZE (21u + COPRO_LINKY_TIC_RAW_SIZE)
+
+struct copro_linky_tic_record {
+	uint8_t mac[COPRO_MAC_SIZE]; // Most significant byte first
+	uint8_t addr_type;
+	int8_t rssi;
+	uint8_t version;
+	uint32_t flags;
+	int64_t timestamp; // Device uptime (ms)
+	const char *raw;   // Points into the payload, not NUL terminated
+	size_t raw_len;
+};
+
+#define COPRO_DEVICE_HEALTH_RECORD_SIZE	   49u
+#define COPRO_DEVICE_HEALTH_RECORD_V2_SIZE 53u
+
+enum copro_device_event {
+	COPRO_DEVICE_EVENT_APPEAR	 = 0x01,
+	COPRO_DEVICE_EVENT_DISAPPEAR = 0x02,
+	COPRO_DEVICE_EVENT_HEALTH	 = 0x03,
+};
+
+enum copro_device_type {
+	COPRO_DEVICE_TYPE_XIAOMI	= 0x01,
+	COPRO_DEVICE_TYPE_LINKY_TIC = 0x02,
+};
+
+/* Device registry presence event or health snapshot */
+struct copro_device_health_record {
+	uint8_t mac[COPRO_MAC_SIZE]; // Most significant byte first
+	uint8_t addr_type;
+	uint8_t event; // enum copro_device_event
+	uint8_t version;
+	uint8_t device_type; // enum copro_device_type
+	int64_t timestamp;	 // Device uptime (ms) of the event
+	int64_t first_seen;	 // Device uptime (ms)
+	int64_t last_seen;	 // Device uptime (ms)
+	uint32_t adv_count;
+	uint32_t measurements;
+	uint32_t missed;   // Measurements missed, from counter gaps
+	int16_t rssi_ewma; // 1/16 dBm
+	int8_t rssi_last;
+	uint32_t suppressed; // Measurements suppressed by the deadband, 0 before v2
+};
+
+#define COPRO_LATENCY_RECORD_HEADER_SIZE 19u
+
+enum copro_latency_stage {
+	COPRO_LATENCY_STAGE_DECODE = 0,
+	COPRO_LATENCY_STAGE_SERIALIZE,
+	COPRO_LATENCY_STAGE_ENQUEUE,
+	COPRO_LATENCY_STAGE_QUEUE,
+	COPRO_LATENCY_STAGE_SEND,
+	COPRO_LATENCY_STAGE_TOTAL,
+	COPRO_LATENCY_STAGE_SEND_CPU, // CPU time of the stream thread during SEND
+};
+
+/* Log2 histogram of a firmware pipeline stage (CONFIG_COPRO_LATENCY_PROBES),
+ * bucket 0 counts durations < 1 us and bucket i durations in [2^(i-1), 2^i) us */
+struct copro_latency_record {
+	uint8_t stage; // enum copro_latency_stage
+	uint8_t version;
+	uint8_t buckets_count;
+	uint32_t count;
+	uint64_t sum_us;
+	uint32_t max_us;
+	const uint8_t *buckets; // Points into the payload, 4 bytes LE per bucket
+};
+
+#define COPRO_SNAPSHOT_RECORD_HEADER_SIZE 20u
+
+/* Last message of a snapshot, carrying no record */
+#define COPRO_SNAPSHOT_FLAG_END 0x01u
+
+/* Device registry snapshot (CONFIG_COPRO_DEVICE_REGISTRY_SNAPSHOT): on every
+ * connection, or on COPRO_CONTROL_SNAPSHOT request, the last record of every
+ * known device is replayed, then an end message is sent */
+struct copro_snapshot_record {
+	uint8_t version;
+	uint8_t flags;			   // COPRO_SNAPSHOT_FLAG_*
+	uint16_t seq;			   // Incremented on every snapshot
+	uint16_t index;			   // Index of the record, records count if END
+	int64_t timestamp;		   // Device uptime (ms) of the snapshot request
+	struct copro_frame record; // Replayed record (Xiaomi or Linky TIC channel)
+};
+
+/* Control channel message: type (1) | len (1) | data */
+struct copro_control_msg {
+	uint8_t type;
+	uint8_t len;
+	const uint8_t *data; // Points into the payload
+};
+
+#define COPRO_CONTROL_ACK				0x01u
+#define COPRO_CONTROL_XIAOMI_KEY_SET	0x10u
+#define COPRO_CONTROL_XIAOMI_KEY_REMOVE 0x11u
+#define COPRO_CONTROL_LATENCY_EXPORT	0x20u
+#define COPRO_CONTROL_SNAPSHOT			0x30u
+
+/* COPRO_CONTROL_ACK data: request type (1) | status (1) */
+#define COPRO_CONTROL_STATUS_OK			 0x00u
+#define COPRO_CONTROL_STATUS_INVALID	 0x01u
+#define COPRO_CONTROL_STATUS_UNSUPPORTED 0x02u
+#define COPRO_CONTROL_STATUS_NOT_FOUND	 0x03u
+#define COPRO_CONTROL_STATUS_NO_SPACE	 0x04u
+#define COPRO_CONTROL_STATUS_BUSY		 0x05u
+#define COPRO_CONTROL_STATUS_IO			 0x06u
+#define COPRO_CONTROL_STATUS_ERROR		 0xFFu
+
+#define COPRO_XIAOMI_BIND_KEY_SIZE 16u
+
+/* Decoders return -EBADMSG if the payload is too short */
+int copro_xiaomi_decode(const uint8_t *payload,
+						size_t len,
+						struct copro_xiaomi_record *rec);
+
+int copro_linky_tic_decode(const uint8_t *payload,
+						   size_t len,
+						   struct copro_linky_tic_record *rec);
+
+int copro_device_health_decode(const uint8_t *payload,
+								size_t len,
+								struct copro_device_health_record *rec);
+
+int copro_latency_decode(const uint8_t *payload,
+						 size_t len,
+						 struct copro_latency_record *rec);
+
+uint32_t copro_latency_bucket(const struct copro_latency_record *rec, uint8_t index);
+
+/* rec->record points into the payload, it can be given to the decoder of its
+ * channel */
+int copro_snapshot_decode(const uint8_t *payload,
+						  size_t len,
+						  struct copro_snapshot_record *rec);
+
+int copro_control_decode(const uint8_t *payload,
+						 size_t len,
+						 struct copro_control_msg *msg);
+
+/* Server */
+
+struct copro_server;
+struct copro_conn;
+
+typedef void (*copro_channel_cb_t)(struct copro_conn *conn,
+								   const struct copro_frame *frame,
+								   void *user_data);
+
+typedef void (*copro_conn_cb_t)(struct copro_conn *conn, bool connected, void *user_data);
+
+struct copro_server_config {
+	const char *addr; // Listen address, NULL for any
+	uint16_t port;
+	enum copro_frame_format format;
+	unsigned int max_conns;
+	bool keepalive;			 // TCP keep-alive on accepted connections
+	copro_conn_cb_t on_conn; // Optional connect/disconnect callback
+	void *user_data;
+};
+
+#define COPRO_SERVER_CHANNELS_MAX 8u
+
+struct copro_server *copro_server_create(const struct copro_server_config *config);
+
+void copro_server_destroy(struct copro_server *srv);
+
+/* Frames of channels without callback are dropped, registering a channel
+ * again replaces its callback */
+int copro_server_channel_register(struct copro_server *srv,
+								  uint32_t channel_id,
+								  copro_channel_cb_t cb,
+								  void *user_data);
+
+/* Process events for at most timeout_ms (-1 blocks), returns the number of
+ * events handled */
+int copro_server_poll(struct copro_server *srv, int timeout_ms);
+
+/* Loop until copro_server_stop() is called (from a callback or a signal
+ * handler) */
+int copro_server_run(struct copro_server *srv);
+
+void copro_server_stop(struct copro_server *srv);
+
+/* Peer address as "a.b.c.d:port" */
+const char *copro_conn_peer(const struct copro_conn *conn);
+
+const struct copro_parser_stats *copro_conn_stats(const struct copro_conn *conn);
+
+/* Send a control message to the dongle, waits up to 1 s for the socket to
+ * accept the whole frame (-ETIMEDOUT). A connection left with a partial frame
+ * is shut down and closed by the next copro_server_poll(). */
+int copro_conn_control_send(struct copro_conn *conn,
+							uint8_t type,
+							const uint8_t *data,
+							size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _COPRO_H */
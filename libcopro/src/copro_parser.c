@@ -0,0 +1,218 @@
+/*
+ * Copyright (c) 2025 Lucas Dietrich <ld.adecy@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "copro.h"
+#include "copro_priv.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include <pthread.h>
+
+static uint32_t crc32_table[256];
+static pthread_once_t crc32_table_once = PTHREAD_ONCE_INIT;
+
+static void crc32_table_init(void)
+{
+	for (uint32_t i = 0u; i < 256u; i++) {
+		uint32_t crc = i;
+		for (int j = 0; j < 8; j++) {
+			crc = (crc & 1u) ? (crc >> 1) ^ 0xEDB88320u : crc >> 1;
+		}
+		crc32_table[i] = crc;
+	}
+}
+
+uint32_t copro_crc32_ieee(const uint8_t *data, size_t len)
+{
+	uint32_t crc = 0xFFFFFFFFu;
+
+	pthread_once(&crc32_table_once, crc32_table_init);
+
+	while (len--) {
+		crc = crc32_table[(crc ^ *data++) & 0xFFu] ^ (crc >> 8);
+	}
+
+	return ~crc;
+}
+
+int copro_frame_encode(enum copro_frame_format format,
+					   uint32_t channel_id,
+					   const uint8_t *payload,
+					   size_t len,
+					   uint8_t *buf,
+					   size_t size)
+{
+	size_t total;
+
+	if (len > COPRO_FRAME_PAYLOAD_MAX) {
+		return -EMSGSIZE;
+	}
+
+	if (format == COPRO_FRAME_V2) {
+		total = COPRO_FRAME_V2_HEADER_SIZE + len + COPRO_FRAME_V2_CRC_SIZE;
+		if (size < total) {
+			return -ENOMEM;
+		}
+
+		put_le16(COPRO_FRAME_V2_SYNC, &buf[0u]);
+		put_le32(channel_id, &buf[2u]);
+		put_le16((uint16_t)len, &buf[6u]);
+		memcpy(&buf[COPRO_FRAME_V2_HEADER_SIZE], payload, len);
+		put_le32(copro_crc32_ieee(&buf[2u], COPRO_FRAME_V2_HEADER_SIZE - 2u + len),
+				 &buf[COPRO_FRAME_V2_HEADER_SIZE + len]);
+	} else {
+		total = COPRO_FRAME_V1_HEADER_SIZE + len;
+		if (size < total) {
+			return -ENOMEM;
+		}
+
+		put_le32(channel_id, &buf[0u]);
+		put_le16((uint16_t)len, &buf[4u]);
+		memcpy(&buf[COPRO_FRAME_V1_HEADER_SIZE], payload, len);
+	}
+
+	return (int)total;
+}
+
+void copro_parser_init(struct copro_parser *p, enum copro_frame_format format)
+{
+	memset(p, 0, sizeof(*p));
+	p->format = format;
+}
+
+uint8_t *copro_parser_rx_buf(struct copro_parser *p, size_t *avail)
+{
+	/* Reclaim parsed bytes, the buffer holds two maximum size frames so there
+	 * is always room for a complete frame once compacted. */
+	if (p->head == p->tail) {
+		p->head = p->tail = 0u;
+	} else if (p->head > 0u) {
+		memmove(p->buf, &p->buf[p->head], p->tail - p->head);
+		p->tail -= p->head;
+		p->head = 0u;
+	}
+
+	*avail = sizeof(p->buf) - p->tail;
+
+	return *avail ? &p->buf[p->tail] : NULL;
+}
+
+void copro_parser_rx_commit(struct copro_parser *p, size_t len)
+{
+	p->tail += len;
+}
+
+static void parser_skip(struct copro_parser *p, size_t n)
+{
+	p->head += n;
+	p->stats.skipped_bytes += n;
+}
+
+static int parser_next_v1(struct copro_parser *p, struct copro_frame *frame)
+{
+	const uint8_t *avail = &p->buf[p->head];
+	size_t avail_len	 = p->tail - p->head;
+	uint16_t len;
+
+	if (avail_len < COPRO_FRAME_V1_HEADER_SIZE) {
+		return 0;
+	}
+
+	/* v1 has no way to resynchronize */
+	len = get_le16(&avail[4u]);
+	if (len > COPRO_FRAME_PAYLOAD_MAX) {
+		return -EBADMSG;
+	}
+
+	if (avail_len < COPRO_FRAME_V1_HEADER_SIZE + len) {
+		return 0;
+	}
+
+	frame->channel_id = get_le32(&avail[0u]);
+	frame->len		  = len;
+	frame->payload	  = &avail[COPRO_FRAME_V1_HEADER_SIZE];
+
+	p->head += COPRO_FRAME_V1_HEADER_SIZE + len;
+
+	return 1;
+}
+
+static int parser_next_v2(struct copro_parser *p, struct copro_frame *frame)
+{
+	const uint8_t sync_lo = COPRO_FRAME_V2_SYNC & 0xFFu;
+	const uint8_t sync_hi = COPRO_FRAME_V2_SYNC >> 8;
+
+	for (;;) {
+		const uint8_t *avail = &p->buf[p->head];
+		size_t avail_len	 = p->tail - p->head;
+		size_t i, total;
+		uint16_t len;
+
+		/* Look for the sync word */
+		for (i = 0u; i + 1u < avail_len; i++) {
+			if (avail[i] == sync_lo && avail[i + 1u] == sync_hi) break;
+		}
+
+		if (i + 1u >= avail_len) {
+			/* Keep a trailing byte which may be the start of a sync word */
+			size_t keep = (avail_len && avail[avail_len - 1u] == sync_lo) ? 1u : 0u;
+			parser_skip(p, avail_len - keep);
+			return 0;
+		} else if (i > 0u) {
+			parser_skip(p, i);
+			continue;
+		}
+
+		if (avail_len < COPRO_FRAME_V2_HEADER_SIZE) {
+			return 0;
+		}
+
+		len = get_le16(&avail[6u]);
+		if (len > COPRO_FRAME_PAYLOAD_MAX) {
+			p->stats.crc_errors++;
+			parser_skip(p, 1u);
+			continue;
+		}
+
+		total = COPRO_FRAME_V2_HEADER_SIZE + len + COPRO_FRAME_V2_CRC_SIZE;
+		if (avail_len < total) {
+			return 0;
+		}
+
+		if (copro_crc32_ieee(&avail[2u], COPRO_FRAME_V2_HEADER_SIZE - 2u + len) !=
+			get_le32(&avail[COPRO_FRAME_V2_HEADER_SIZE + len])) {
+			p->stats.crc_errors++;
+			parser_skip(p, 1u);
+			continue;
+		}
+
+		frame->channel_id = get_le32(&avail[2u]);
+		frame->len		  = len;
+		frame->payload	  = &avail[COPRO_FRAME_V2_HEADER_SIZE];
+
+		p->head += total;
+
+		return 1;
+	}
+}
+
+int copro_parser_next(struct copro_parser *p, struct copro_frame *frame)
+{
+	int ret;
+
+	if (p->format == COPRO_FRAME_V2) {
+		ret = parser_next_v2(p, frame);
+	} else {
+		ret = parser_next_v1(p, frame);
+	}
+
+	if (ret == 1) {
+		p->stats.frames++;
+	}
+
+	return ret;
+}
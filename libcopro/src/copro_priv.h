@@ -0,0 +1,39 @@
+/*
+ * Copyright (c) 2025 Lucas Dietrich <ld.adecy@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _COPRO_PRIV_H
+#define _COPRO_PRIV_H
+
+#include <stdint.h>
+
+static inline uint16_t get_le16(const uint8_t *src)
+{
+	return (uint16_t)(src[0] | (src[1] << 8));
+}
+
+static inline uint32_t get_le32(const uint8_t *src)
+{
+	return (uint32_t)get_le16(src) | ((uint32_t)get_le16(&src[2]) << 16);
+}
+
+static inline uint64_t get_le64(const uint8_t *src)
+{
+	return (uint64_t)get_le32(src) | ((uint64_t)get_le32(&src[4]) << 32);
+}
+
+static inline void put_le16(uint16_t val, uint8_t *dst)
+{
+	dst[0] = val & 0xFFu;
+	dst[1] = val >> 8;
+}
+
+static inline void put_le32(uint32_t val, uint8_t *dst)
+{
+	put_le16(val & 0xFFFFu, dst);
+	put_le16(val >> 16, &dst[2]);
+}
+
+#endif /* _COPRO_PRIV_H */
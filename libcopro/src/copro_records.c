@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) 2025 Lucas Dietrich <ld.adecy@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "copro.h"
+#include "copro_priv.h"
+
+#include <errno.h>
+#include <string.h>
+
+/* Layouts are defined by xiaomi_record_serialize() and linky_record_serialize()
+ * in the firmware:
+ *  - 6 bytes: BLE address (most significant byte first)
+ *  - 1 byte: BLE address type
+ *  - 1 byte: RSSI
+ *  - 1 byte: header version
+ *  - record specific fields
+ */
+
+int copro_xiaomi_decode(const uint8_t *payload,
+						size_t len,
+						struct copro_xiaomi_record *rec)
+{
+	if (len < COPRO_XIAOMI_RECORD_SIZE) {
+		return -EBADMSG;
+	}
+
+	memcpy(rec->mac, &payload[0u], COPRO_MAC_SIZE);
+	rec->addr_type	   = payload[6u];
+	rec->rssi		   = (int8_t)payload[7u];
+	rec->version	   = payload[8u];
+	rec->timestamp	   = (int64_t)get_le64(&payload[9u]);
+	rec->temperature   = (int16_t)get_le16(&payload[17u]);
+	rec->humidity	   = get_le16(&payload[19u]);
+	rec->battery_mv	   = get_le16(&payload[21u]);
+	rec->battery_level = payload[23u];
+
+	return 0;
+}
+
+int copro_linky_tic_decode(const uint8_t *payload,
+						   size_t len,
+						   struct copro_linky_tic_record *rec)
+{
+	if (len < COPRO_LINKY_TIC_RECORD_SIZE) {
+		return -EBADMSG;
+	}
+
+	memcpy(rec->mac, &payload[0u], COPRO_MAC_SIZE);
+	rec->addr_type = payload[6u];
+	rec->rssi	   = (int8_t)payload[7u];
+	rec->version   = payload[8u];
+	rec->flags	   = get_le32(&payload[9u]);
+	rec->timestamp = (int64_t)get_le64(&payload[13u]);
+	rec->raw	   = (const char *)&payload[21u];
+	rec->raw_len   = strnlen(rec->raw, COPRO_LINKY_TIC_RAW_SIZE);
+
+	return 0;
+}
+
+int copro_device_health_decode(const uint8_t *payload,
+								size_t len,
+								struct copro_device_health_record *rec)
+{
+	if (len < COPRO_DEVICE_HEALTH_RECORD_SIZE) {
+		return -EBADMSG;
+	}
+
+	memcpy(rec->mac, &payload[0u], COPRO_MAC_SIZE);
+	rec->addr_type	  = payload[6u];
+	rec->event		  = payload[7u];
+	rec->version	  = payload[8u];
+	rec->device_type  = payload[9u];
+	rec->timestamp	  = (int64_t)get_le64(&payload[10u]);
+	rec->first_seen	  = (int64_t)get_le64(&payload[18u]);
+	rec->last_seen	  = (int64_t)get_le64(&payload[26u]);
+	rec->adv_count	  = get_le32(&payload[34u]);
+	rec->measurements = get_le32(&payload[38u]);
+	rec->missed		  = get_le32(&payload[42u]);
+	rec->rssi_ewma	  = (int16_t)get_le16(&payload[46u]);
+	rec->rssi_last	  = (int8_t)payload[48u];
+	rec->suppressed	  = (len >= COPRO_DEVICE_HEALTH_RECORD_V2_SIZE)
+							? get_le32(&payload[49u])
+							: 0u;
+
+	return 0;
+}
+
+int copro_latency_decode(const uint8_t *payload,
+						 size_t len,
+						 struct copro_latency_record *rec)
+{
+	if (len < COPRO_LATENCY_RECORD_HEADER_SIZE ||
+		payload[2u] > (len - COPRO_LATENCY_RECORD_HEADER_SIZE) / 4u) {
+		return -EBADMSG;
+	}
+
+	rec->stage		   = payload[0u];
+	rec->version	   = payload[1u];
+	rec->buckets_count = payload[2u];
+	rec->count		   = get_le32(&payload[3u]);
+	rec->sum_us		   = get_le64(&payload[7u]);
+	rec->max_us		   = get_le32(&payload[15u]);
+	rec->buckets	   = &payload[COPRO_LATENCY_RECORD_HEADER_SIZE];
+
+	return 0;
+}
+
+uint32_t copro_latency_bucket(const struct copro_latency_record *rec, uint8_t index)
+{
+	return index < rec->buckets_count ? get_le32(&rec->buckets[4u * index]) : 0u;
+}
+
+int copro_snapshot_decode(const uint8_t *payload,
+						  size_t len,
+						  struct copro_snapshot_record *rec)
+{
+	if (len < COPRO_SNAPSHOT_RECORD_HEADER_SIZE ||
+		get_le16(&payload[18u]) > len - COPRO_SNAPSHOT_RECORD_HEADER_SIZE) {
+		return -EBADMSG;
+	}
+
+	rec->version		   = payload[0u];
+	rec->flags			   = payload[1u];
+	rec->seq			   = get_le16(&payload[2u]);
+	rec->index			   = get_le16(&payload[4u]);
+	rec->timestamp		   = (int64_t)get_le64(&payload[6u]);
+	rec->record.channel_id = get_le32(&payload[14u]);
+	rec->record.len		   = get_le16(&payload[18u]);
+	rec->record.payload	   = &payload[COPRO_SNAPSHOT_RECORD_HEADER_SIZE];
+
+	return 0;
+}
+
+int copro_control_decode(const uint8_t *payload,
+						 size_t len,
+						 struct copro_control_msg *msg)
+{
+	if (len < 2u || payload[1u] > len - 2u) {
+		return -EBADMSG;
+	}
+
+	msg->type = payload[0u];
+	msg->len  = payload[1u];
+	msg->data = &payload[2u];
+
+	return 0;
+}
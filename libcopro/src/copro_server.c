@@ -0,0 +1,418 @@
+/*
+ * Copyright (c) 2025 Lucas Dietrich <ld.adecy@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#define _GNU_SOURCE /* accept4() */
+
+#include "copro.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define KEEP_ALIVE_IDLE	 5 /* seconds before first probe  */
+#define KEEP_ALIVE_INTVL 1 /* seconds between probes      */
+#define KEEP_ALIVE_CNT	 1 /* probes before giving up     */
+
+#define EPOLL_EVENTS_MAX 16
+
+/* Longest wait for the socket to accept the rest of a control frame */
+#define CONTROL_SEND_TIMEOUT_MS 1000
+
+struct copro_conn {
+	struct copro_server *srv;
+	int fd; // -1 if the slot is free
+	char peer[INET_ADDRSTRLEN + 6];
+	struct copro_parser parser;
+};
+
+struct channel_handler {
+	uint32_t channel_id;
+	copro_channel_cb_t cb;
+	void *user_data;
+};
+
+struct copro_server {
+	struct copro_server_config config;
+	int lsock;
+	int epfd;
+	volatile sig_atomic_t stop;
+
+	struct channel_handler channels[COPRO_SERVER_CHANNELS_MAX];
+	size_t channels_count;
+
+	/* Allocated once, receive buffers live in the connection parsers */
+	struct copro_conn *conns;
+};
+
+static void set_keepalive(int fd)
+{
+	int optval = 1;
+	setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &optval, sizeof(optval));
+	optval = KEEP_ALIVE_IDLE;
+	setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &optval, sizeof(optval));
+	optval = KEEP_ALIVE_INTVL;
+	setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &optval, sizeof(optval));
+	optval = KEEP_ALIVE_CNT;
+	setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &optval, sizeof(optval));
+}
+
+static int listen_socket(const struct copro_server_config *config)
+{
+	struct sockaddr_in addr = {
+		.sin_family		 = AF_INET,
+		.sin_port		 = htons(config->port),
+		.sin_addr.s_addr = htonl(INADDR_ANY),
+	};
+	int optval = 1;
+	int ret, sock;
+
+	if (config->addr && inet_pton(AF_INET, config->addr, &addr.sin_addr) != 1) {
+		return -EINVAL;
+	}
+
+	sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (sock < 0) {
+		return -errno;
+	}
+
+	setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
+
+	if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+		listen(sock, (int)config->max_conns) < 0) {
+		ret = -errno;
+		close(sock);
+		return ret;
+	}
+
+	return sock;
+}
+
+struct copro_server *copro_server_create(const struct copro_server_config *config)
+{
+	struct copro_server *srv;
+	struct epoll_event ev = {.events = EPOLLIN, .data.ptr = NULL};
+
+	if (!config || config->max_conns == 0u) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	srv = calloc(1u, sizeof(*srv));
+	if (!srv) {
+		return NULL;
+	}
+
+	srv->config = *config;
+	srv->lsock	= -1;
+	srv->epfd	= -1;
+
+	srv->conns = calloc(config->max_conns, sizeof(*srv->conns));
+	if (!srv->conns) {
+		goto error;
+	}
+
+	for (unsigned int i = 0u; i < config->max_conns; i++) {
+		srv->conns[i].srv = srv;
+		srv->conns[i].fd  = -1;
+	}
+
+	srv->lsock = listen_socket(config);
+	if (srv->lsock < 0) {
+		errno = -srv->lsock;
+		goto error;
+	}
+
+	srv->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (srv->epfd < 0 || epoll_ctl(srv->epfd, EPOLL_CTL_ADD, srv->lsock, &ev) < 0) {
+		goto error;
+	}
+
+	return srv;
+
+error:
+	copro_server_destroy(srv);
+	return NULL;
+}
+
+static void conn_close(struct copro_conn *conn)
+{
+	struct copro_server *srv = conn->srv;
+
+	epoll_ctl(srv->epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+	close(conn->fd);
+	conn->fd = -1;
+
+	if (srv->config.on_conn) {
+		srv->config.on_conn(conn, false, srv->config.user_data);
+	}
+}
+
+void copro_server_destroy(struct copro_server *srv)
+{
+	if (!srv) return;
+
+	if (srv->conns) {
+		for (unsigned int i = 0u; i < srv->config.max_conns; i++) {
+			if (srv->conns[i].fd >= 0) conn_close(&srv->conns[i]);
+		}
+		free(srv->conns);
+	}
+
+	if (srv->epfd >= 0) close(srv->epfd);
+	if (srv->lsock >= 0) close(srv->lsock);
+
+	free(srv);
+}
+
+int copro_server_channel_register(struct copro_server *srv,
+								  uint32_t channel_id,
+								  copro_channel_cb_t cb,
+								  void *user_data)
+{
+	struct channel_handler *handler = NULL;
+
+	for (size_t i = 0u; i < srv->channels_count; i++) {
+		if (srv->channels[i].channel_id == channel_id) {
+			handler = &srv->channels[i];
+		}
+	}
+
+	if (!handler) {
+		if (srv->channels_count >= COPRO_SERVER_CHANNELS_MAX) {
+			return -ENOMEM;
+		}
+		handler = &srv->channels[srv->channels_count++];
+	}
+
+	handler->channel_id = channel_id;
+	handler->cb			= cb;
+	handler->user_data	= user_data;
+
+	return 0;
+}
+
+static void server_accept(struct copro_server *srv)
+{
+	struct sockaddr_in addr;
+	socklen_t addrlen = sizeof(addr);
+	struct copro_conn *conn = NULL;
+	struct epoll_event ev;
+	char ip[INET_ADDRSTRLEN];
+	int fd;
+
+	fd = accept4(
+		srv->lsock, (struct sockaddr *)&addr, &addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (fd < 0) {
+		return;
+	}
+
+	for (unsigned int i = 0u; i < srv->config.max_conns; i++) {
+		if (srv->conns[i].fd < 0) {
+			conn = &srv->conns[i];
+			break;
+		}
+	}
+
+	if (!conn) {
+		close(fd);
+		return;
+	}
+
+	if (srv->config.keepalive) {
+		set_keepalive(fd);
+	}
+
+	ev.events	= EPOLLIN | EPOLLRDHUP;
+	ev.data.ptr = conn;
+	if (epoll_ctl(srv->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		close(fd);
+		return;
+	}
+
+	conn->fd = fd;
+	copro_parser_init(&conn->parser, srv->config.format);
+	inet_ntop(AF_INET, &addr.sin_addr, ip, sizeof(ip));
+	snprintf(conn->peer, sizeof(conn->peer), "%s:%u", ip, ntohs(addr.sin_port));
+
+	if (srv->config.on_conn) {
+		srv->config.on_conn(conn, true, srv->config.user_data);
+	}
+}
+
+static void frame_dispatch(struct copro_conn *conn, const struct copro_frame *frame)
+{
+	struct copro_server *srv = conn->srv;
+
+	for (size_t i = 0u; i < srv->channels_count; i++) {
+		if (srv->channels[i].channel_id == frame->channel_id) {
+			srv->channels[i].cb(conn, frame, srv->channels[i].user_data);
+			return;
+		}
+	}
+}
+
+static void conn_read(struct copro_conn *conn)
+{
+	struct copro_frame frame;
+	uint8_t *buf;
+	size_t avail;
+	ssize_t n;
+	int ret;
+
+	buf = copro_parser_rx_buf(&conn->parser, &avail);
+	if (!buf) {
+		conn_close(conn);
+		return;
+	}
+
+	n = recv(conn->fd, buf, avail, 0);
+	if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+		return;
+	} else if (n <= 0) {
+		conn_close(conn);
+		return;
+	}
+
+	copro_parser_rx_commit(&conn->parser, (size_t)n);
+
+	while ((ret = copro_parser_next(&conn->parser, &frame)) == 1) {
+		frame_dispatch(conn, &frame);
+	}
+
+	if (ret < 0) {
+		conn_close(conn);
+	}
+}
+
+int copro_server_poll(struct copro_server *srv, int timeout_ms)
+{
+	struct epoll_event events[EPOLL_EVENTS_MAX];
+	int n;
+
+	n = epoll_wait(srv->epfd, events, EPOLL_EVENTS_MAX, timeout_ms);
+	if (n < 0) {
+		return errno == EINTR ? 0 : -errno;
+	}
+
+	for (int i = 0; i < n; i++) {
+		struct copro_conn *conn = events[i].data.ptr;
+
+		if (!conn) {
+			server_accept(srv);
+		} else if (conn->fd >= 0 && (events[i].events & EPOLLIN)) {
+			conn_read(conn);
+		} else if (conn->fd >= 0) {
+			conn_close(conn);
+		}
+	}
+
+	return n;
+}
+
+int copro_server_run(struct copro_server *srv)
+{
+	int ret = 0;
+
+	srv->stop = 0;
+	while (!srv->stop && ret >= 0) {
+		ret = copro_server_poll(srv, -1);
+	}
+
+	return ret < 0 ? ret : 0;
+}
+
+void copro_server_stop(struct copro_server *srv)
+{
+	srv->stop = 1;
+}
+
+const char *copro_conn_peer(const struct copro_conn *conn)
+{
+	return conn->peer;
+}
+
+const struct copro_parser_stats *copro_conn_stats(const struct copro_conn *conn)
+{
+	return &conn->parser.stats;
+}
+
+int copro_conn_control_send(struct copro_conn *conn,
+							uint8_t type,
+							const uint8_t *data,
+							size_t len)
+{
+	uint8_t payload[2u + UINT8_MAX];
+	uint8_t frame[COPRO_FRAME_V2_HEADER_SIZE + sizeof(payload) + COPRO_FRAME_V2_CRC_SIZE];
+	size_t sent = 0u;
+	size_t total;
+	int ret;
+
+	if (conn->fd < 0) {
+		return -ENOTCONN;
+	} else if (len > UINT8_MAX) {
+		return -EMSGSIZE;
+	}
+
+	payload[0u] = type;
+	payload[1u] = (uint8_t)len;
+	if (len) memcpy(&payload[2u], data, len);
+
+	ret = copro_frame_encode(conn->parser.format,
+							 COPRO_CHANNEL_ID_CONTROL,
+							 payload,
+							 2u + len,
+							 frame,
+							 sizeof(frame));
+	if (ret < 0) {
+		return ret;
+	}
+
+	/* The socket is non-blocking: wait for room until the whole frame is sent,
+	 * a partial frame would desynchronize the stream for good */
+	total = (size_t)ret;
+	ret	  = 0;
+	while (sent < total) {
+		struct pollfd pfd = {.fd = conn->fd, .events = POLLOUT};
+		ssize_t n		  = send(conn->fd, &frame[sent], total - sent, MSG_NOSIGNAL);
+
+		if (n >= 0) {
+			sent += (size_t)n;
+			continue;
+		} else if (errno == EINTR) {
+			continue;
+		} else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+			ret = -errno;
+			break;
+		}
+
+		n = poll(&pfd, 1u, CONTROL_SEND_TIMEOUT_MS);
+		if (n == 0) {
+			ret = -ETIMEDOUT;
+			break;
+		} else if (n < 0 && errno != EINTR) {
+			ret = -errno;
+			break;
+		}
+	}
+
+	if (ret < 0 && sent > 0u) {
+		/* Part of the frame is on the wire, the connection is closed by the
+		 * next copro_server_poll() */
+		shutdown(conn->fd, SHUT_RDWR);
+	}
+
+	return ret;
+}
@@ -0,0 +1,463 @@
+/*
+ * Copyright (c) 2025 Lucas Dietrich <ld.adecy@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* Unit tests of the parser and the record decoders, no framework: a failed
+ * check prints its location and the run exits with a non-zero status.
+ */
+
+#include "copro.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int failures;
+
+#define CHECK(cond)                                                                  \
+	do {                                                                             \
+		if (!(cond)) {                                                               \
+			fprintf(stderr, "%s:%d: %s: check failed: %s\n", __FILE__, __LINE__,    \
+					__func__, #cond);                                                \
+			failures++;                                                              \
+		}                                                                            \
+	} while (0)
+
+#define CHECK_EQ(a, b) CHECK((a) == (b))
+
+/* Deterministic xorshift32 generator */
+static uint32_t rng_state = 0x12345678u;
+
+static uint32_t rng(void)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return rng_state;
+}
+
+#define STREAM_FRAMES 64u
+
+struct stream {
+	uint8_t bytes[STREAM_FRAMES * (COPRO_FRAME_SIZE_MAX + 16u)];
+	size_t len;
+	uint32_t channel_ids[STREAM_FRAMES];
+	uint16_t lens[STREAM_FRAMES];
+	size_t count;
+};
+
+static void stream_garbage(struct stream *s, size_t len)
+{
+	for (size_t i = 0u; i < len; i++) {
+		s->bytes[s->len++] = (uint8_t)rng();
+	}
+}
+
+/* Payload byte i of frame n, to check the frames parsed */
+static uint8_t payload_byte(size_t n, size_t i)
+{
+	return (uint8_t)(n * 31u + i);
+}
+
+static void stream_frame(struct stream *s, enum copro_frame_format format, uint16_t len)
+{
+	uint8_t payload[COPRO_FRAME_PAYLOAD_MAX];
+	size_t n = s->count;
+	int ret;
+
+	for (size_t i = 0u; i < len; i++) {
+		payload[i] = payload_byte(n, i);
+	}
+
+	ret = copro_frame_encode(format,
+							 0x1000u + (uint32_t)n,
+							 payload,
+							 len,
+							 &s->bytes[s->len],
+							 sizeof(s->bytes) - s->len);
+	CHECK(ret > 0);
+	s->len += (size_t)ret;
+	s->channel_ids[n] = 0x1000u + (uint32_t)n;
+	s->lens[n]		  = len;
+	s->count++;
+}
+
+/* Feed the stream in chunks of 1 to max_chunk bytes, returns the number of
+ * frames matching the stream ones, in order */
+static size_t stream_parse(const struct stream *s,
+						   struct copro_parser *p,
+						   size_t max_chunk,
+						   size_t *frame_index)
+{
+	struct copro_frame frame;
+	size_t off	   = 0u;
+	size_t matched = 0u;
+
+	while (off < s->len) {
+		size_t avail;
+		uint8_t *buf = copro_parser_rx_buf(p, &avail);
+		size_t n	 = 1u + rng() % max_chunk;
+
+		CHECK(buf != NULL);
+		if (!buf) break;
+
+		n = n < avail ? n : avail;
+		n = n < s->len - off ? n : s->len - off;
+		memcpy(buf, &s->bytes[off], n);
+		copro_parser_rx_commit(p, n);
+		off += n;
+
+		while (copro_parser_next(p, &frame) == 1) {
+			size_t i;
+			bool ok;
+
+			CHECK(matched < STREAM_FRAMES);
+			if (matched >= STREAM_FRAMES) return matched;
+
+			i  = frame_index[matched];
+			ok = frame.channel_id == s->channel_ids[i] && frame.len == s->lens[i];
+
+			for (size_t j = 0u; ok && j < frame.len; j++) {
+				ok = frame.payload[j] == payload_byte(i, j);
+			}
+
+			CHECK(ok);
+			matched++;
+		}
+	}
+
+	return matched;
+}
+
+static void test_crc32(void)
+{
+	CHECK_EQ(copro_crc32_ieee((const uint8_t *)"123456789", 9u), 0xCBF43926u);
+	CHECK_EQ(copro_crc32_ieee(NULL, 0u), 0u);
+}
+
+static void test_frame_encode(void)
+{
+	uint8_t payload[COPRO_FRAME_PAYLOAD_MAX + 1u] = {0};
+	uint8_t buf[COPRO_FRAME_SIZE_MAX + 1u];
+
+	CHECK_EQ(copro_frame_encode(COPRO_FRAME_V1, 1u, payload, 3u, buf, sizeof(buf)), 9);
+	CHECK_EQ(copro_frame_encode(COPRO_FRAME_V2, 1u, payload, 3u, buf, sizeof(buf)), 15);
+	CHECK_EQ(buf[0], 0xC0u);
+	CHECK_EQ(buf[1], 0xB1u);
+
+	CHECK_EQ(copro_frame_encode(COPRO_FRAME_V2, 1u, payload, 3u, buf, 14u), -ENOMEM);
+	CHECK_EQ(copro_frame_encode(COPRO_FRAME_V1, 1u, payload, 3u, buf, 8u), -ENOMEM);
+	CHECK_EQ(copro_frame_encode(
+				 COPRO_FRAME_V2, 1u, payload, sizeof(payload), buf, sizeof(buf)),
+			 -EMSGSIZE);
+}
+
+static void test_parser_chunks(enum copro_frame_format format)
+{
+	static struct stream s;
+	static struct copro_parser p;
+	size_t index[STREAM_FRAMES];
+
+	memset(&s, 0, sizeof(s));
+	for (size_t n = 0u; n < STREAM_FRAMES; n++) {
+		/* Empty, small and maximum size frames */
+		uint16_t len = n % 8u == 0u ? 0u
+					 : n % 8u == 1u ? COPRO_FRAME_PAYLOAD_MAX
+									: (uint16_t)(rng() % 300u);
+		stream_frame(&s, format, len);
+		index[n] = n;
+	}
+
+	for (size_t max_chunk = 1u; max_chunk <= 2u * COPRO_FRAME_SIZE_MAX; max_chunk *= 3u) {
+		copro_parser_init(&p, format);
+		CHECK_EQ(stream_parse(&s, &p, max_chunk, index), STREAM_FRAMES);
+		CHECK_EQ(p.stats.frames, STREAM_FRAMES);
+		CHECK_EQ(p.stats.skipped_bytes, 0u);
+		CHECK_EQ(p.stats.crc_errors, 0u);
+	}
+}
+
+static void test_parser_v1_out_of_sync(void)
+{
+	static struct copro_parser p;
+	struct copro_frame frame;
+	uint8_t header[COPRO_FRAME_V1_HEADER_SIZE] = {1, 2, 3, 4, 0x01, 0x04}; /* 1025 */
+	size_t avail;
+	uint8_t *buf;
+
+	copro_parser_init(&p, COPRO_FRAME_V1);
+	buf = copro_parser_rx_buf(&p, &avail);
+	memcpy(buf, header, sizeof(header));
+	copro_parser_rx_commit(&p, sizeof(header));
+
+	CHECK_EQ(copro_parser_next(&p, &frame), -EBADMSG);
+}
+
+static void test_parser_v2_resync(void)
+{
+	static struct stream s;
+	static struct copro_parser p;
+	size_t index[STREAM_FRAMES];
+	size_t expected = 0u;
+	size_t corrupted;
+
+	memset(&s, 0, sizeof(s));
+	for (size_t n = 0u; n < 16u; n++) {
+		size_t start;
+
+		/* Garbage, sync words included */
+		stream_garbage(&s, rng() % 40u);
+		if (n % 4u == 1u) {
+			s.bytes[s.len++] = 0xC0u;
+			s.bytes[s.len++] = 0xB1u;
+		}
+
+		start = s.len;
+		stream_frame(&s, COPRO_FRAME_V2, (uint16_t)(rng() % 200u));
+
+		switch (n % 4u) {
+		case 2u:
+			/* Bad CRC */
+			s.bytes[s.len - 1u] ^= 0x01u;
+			break;
+		case 3u:
+			/* Length beyond the maximum */
+			s.bytes[start + 7u] = 0xFFu;
+			break;
+		default:
+			index[expected++] = n;
+			break;
+		}
+	}
+	corrupted = 16u - expected;
+
+	for (size_t max_chunk = 1u; max_chunk <= 4096u; max_chunk *= 4u) {
+		copro_parser_init(&p, COPRO_FRAME_V2);
+		CHECK_EQ(stream_parse(&s, &p, max_chunk, index), expected);
+		CHECK(p.stats.crc_errors >= corrupted);
+		CHECK(p.stats.skipped_bytes > 0u);
+	}
+}
+
+static void test_parser_v2_trailing_sync(void)
+{
+	static struct copro_parser p;
+	struct copro_frame frame = {0};
+	uint8_t payload[3] = {7, 8, 9};
+	uint8_t bytes[32] = {0x11, 0x22, 0x33};
+	size_t avail;
+	uint8_t *buf;
+	int len;
+
+	/* Garbage, then a frame whose first byte ends the first chunk */
+	len = copro_frame_encode(
+		COPRO_FRAME_V2, 42u, payload, sizeof(payload), &bytes[3], sizeof(bytes) - 3u);
+	CHECK(len > 0);
+
+	copro_parser_init(&p, COPRO_FRAME_V2);
+	buf = copro_parser_rx_buf(&p, &avail);
+	memcpy(buf, bytes, 4u);
+	copro_parser_rx_commit(&p, 4u);
+	CHECK_EQ(copro_parser_next(&p, &frame), 0);
+	CHECK_EQ(p.stats.skipped_bytes, 3u);
+
+	buf = copro_parser_rx_buf(&p, &avail);
+	memcpy(buf, &bytes[4], (size_t)len - 1u);
+	copro_parser_rx_commit(&p, (size_t)len - 1u);
+	CHECK_EQ(copro_parser_next(&p, &frame), 1);
+	CHECK_EQ(frame.channel_id, 42u);
+	CHECK_EQ(frame.len, sizeof(payload));
+	CHECK(frame.payload && memcmp(frame.payload, payload, sizeof(payload)) == 0);
+	CHECK_EQ(p.stats.skipped_bytes, 3u);
+}
+
+static void test_parser_rx_buf(void)
+{
+	static struct copro_parser p;
+	struct copro_frame frame;
+	uint8_t payload[100];
+	size_t avail;
+	uint8_t *buf;
+	int len;
+
+	copro_parser_init(&p, COPRO_FRAME_V1);
+	buf = copro_parser_rx_buf(&p, &avail);
+	CHECK(buf == p.buf);
+	CHECK_EQ(avail, COPRO_PARSER_BUF_SIZE);
+
+	/* A whole frame and the first 10 bytes of the next one */
+	memset(payload, 0xAB, sizeof(payload));
+	len = copro_frame_encode(COPRO_FRAME_V1, 1u, payload, sizeof(payload), buf, avail);
+	memcpy(&buf[len], buf, 10u);
+	copro_parser_rx_commit(&p, (size_t)len + 10u);
+
+	CHECK_EQ(copro_parser_next(&p, &frame), 1);
+	CHECK_EQ(copro_parser_next(&p, &frame), 0);
+	CHECK_EQ(p.head, (size_t)len);
+
+	/* The partial frame is moved to the start of the buffer */
+	buf = copro_parser_rx_buf(&p, &avail);
+	CHECK_EQ(p.head, 0u);
+	CHECK_EQ(p.tail, 10u);
+	CHECK(buf == &p.buf[10]);
+	CHECK_EQ(avail, COPRO_PARSER_BUF_SIZE - 10u);
+
+	memset(buf, 0xAB, 100u - 4u);
+	copro_parser_rx_commit(&p, 100u - 4u);
+	CHECK_EQ(copro_parser_next(&p, &frame), 1);
+	CHECK(frame.payload == &p.buf[COPRO_FRAME_V1_HEADER_SIZE]);
+	CHECK_EQ(frame.len, 100u);
+
+	/* Everything parsed: the buffer is reset */
+	buf = copro_parser_rx_buf(&p, &avail);
+	CHECK(buf == p.buf);
+	CHECK_EQ(avail, COPRO_PARSER_BUF_SIZE);
+
+	/* Full of unparsed bytes */
+	copro_parser_rx_commit(&p, avail);
+	CHECK(copro_parser_rx_buf(&p, &avail) == NULL);
+	CHECK_EQ(avail, 0u);
+}
+
+/* Record sizes of the firmware serializers: xiaomi_record_serialize(),
+ * linky_record_serialize(), the device registry (v1 and v2 records, snapshot
+ * header) and the latency histograms.
+ */
+static void test_decode_lengths(void)
+{
+	static uint8_t payload[256];
+	struct copro_xiaomi_record xiaomi;
+	struct copro_linky_tic_record linky;
+	struct copro_device_health_record health;
+	struct copro_latency_record latency;
+	struct copro_snapshot_record snapshot;
+	struct copro_control_msg control;
+
+	memset(payload, 0, sizeof(payload));
+
+	CHECK_EQ(COPRO_XIAOMI_RECORD_SIZE, 24u);
+	CHECK_EQ(copro_xiaomi_decode(payload, 23u, &xiaomi), -EBADMSG);
+	CHECK_EQ(copro_xiaomi_decode(payload, 24u, &xiaomi), 0);
+
+	CHECK_EQ(COPRO_LINKY_TIC_RECORD_SIZE, 85u);
+	CHECK_EQ(copro_linky_tic_decode(payload, 84u, &linky), -EBADMSG);
+	CHECK_EQ(copro_linky_tic_decode(payload, 85u, &linky), 0);
+
+	CHECK_EQ(COPRO_DEVICE_HEALTH_RECORD_SIZE, 49u);
+	CHECK_EQ(COPRO_DEVICE_HEALTH_RECORD_V2_SIZE, 53u);
+	CHECK_EQ(copro_device_health_decode(payload, 48u, &health), -EBADMSG);
+	CHECK_EQ(copro_device_health_decode(payload, 49u, &health), 0);
+	CHECK_EQ(copro_device_health_decode(payload, 53u, &health), 0);
+
+	/* 19 bytes header, then 4 bytes per bucket */
+	CHECK_EQ(COPRO_LATENCY_RECORD_HEADER_SIZE, 19u);
+	payload[2] = 2u;
+	CHECK_EQ(copro_latency_decode(payload, 18u, &latency), -EBADMSG);
+	CHECK_EQ(copro_latency_decode(payload, 19u + 7u, &latency), -EBADMSG);
+	CHECK_EQ(copro_latency_decode(payload, 19u + 8u, &latency), 0);
+	payload[2] = 0u;
+	CHECK_EQ(copro_latency_decode(payload, 19u, &latency), 0);
+
+	/* 20 bytes header, then the replayed record */
+	CHECK_EQ(COPRO_SNAPSHOT_RECORD_HEADER_SIZE, 20u);
+	payload[18] = 24u;
+	CHECK_EQ(copro_snapshot_decode(payload, 19u, &snapshot), -EBADMSG);
+	CHECK_EQ(copro_snapshot_decode(payload, 20u + 23u, &snapshot), -EBADMSG);
+	CHECK_EQ(copro_snapshot_decode(payload, 20u + 24u, &snapshot), 0);
+	payload[18] = 0u;
+
+	/* type, length, data */
+	payload[1] = 3u;
+	CHECK_EQ(copro_control_decode(payload, 1u, &control), -EBADMSG);
+	CHECK_EQ(copro_control_decode(payload, 4u, &control), -EBADMSG);
+	CHECK_EQ(copro_control_decode(payload, 5u, &control), 0);
+}
+
+static void test_decode_fields(void)
+{
+	static const uint8_t xiaomi_payload[24] = {
+		0xA4, 0xC1, 0x38, 0x01, 0x02, 0x03, /* MAC */
+		0x00,								/* public */
+		0xBD,								/* -67 dBm */
+		0x01,								/* version */
+		0x10, 0x27, 0, 0, 0, 0, 0, 0,		/* 10000 ms */
+		0x66, 0x08,							/* 21.50 °C */
+		0x94, 0x11,							/* 45.00 % */
+		0x86, 0x0B,							/* 2950 mV */
+		85,
+	};
+	static const uint8_t health_payload[53] = {
+		[6] = 1, [7] = COPRO_DEVICE_EVENT_HEALTH, [8] = 2, [9] = COPRO_DEVICE_TYPE_XIAOMI,
+		[34] = 120, [38] = 30, [42] = 1, [46] = 0xBC, [47] = 0xFB, /* -68.25 dBm */
+		[48] = 0xBA, [49] = 12,
+	};
+	uint8_t snapshot_payload[20 + 24] = {1, COPRO_SNAPSHOT_FLAG_END, 7, 0, 3, 0};
+	uint8_t latency_payload[19 + 8] = {COPRO_LATENCY_STAGE_SEND, 1, 2, 5};
+	struct copro_xiaomi_record xiaomi;
+	struct copro_device_health_record health;
+	struct copro_snapshot_record snapshot;
+	struct copro_latency_record latency;
+
+	CHECK_EQ(copro_xiaomi_decode(xiaomi_payload, sizeof(xiaomi_payload), &xiaomi), 0);
+	CHECK(memcmp(xiaomi.mac, xiaomi_payload, COPRO_MAC_SIZE) == 0);
+	CHECK_EQ(xiaomi.rssi, -67);
+	CHECK_EQ(xiaomi.timestamp, 10000);
+	CHECK_EQ(xiaomi.temperature, 2150);
+	CHECK_EQ(xiaomi.humidity, 4500u);
+	CHECK_EQ(xiaomi.battery_mv, 2950u);
+	CHECK_EQ(xiaomi.battery_level, 85u);
+
+	/* v1 records carry no suppressed counter */
+	CHECK_EQ(copro_device_health_decode(health_payload, 49u, &health), 0);
+	CHECK_EQ(health.suppressed, 0u);
+	CHECK_EQ(copro_device_health_decode(health_payload, 53u, &health), 0);
+	CHECK_EQ(health.event, COPRO_DEVICE_EVENT_HEALTH);
+	CHECK_EQ(health.device_type, COPRO_DEVICE_TYPE_XIAOMI);
+	CHECK_EQ(health.adv_count, 120u);
+	CHECK_EQ(health.rssi_ewma, -1092);
+	CHECK_EQ(health.rssi_last, -70);
+	CHECK_EQ(health.suppressed, 12u);
+
+	latency_payload[19 + 4] = 9u;
+	CHECK_EQ(copro_latency_decode(latency_payload, sizeof(latency_payload), &latency), 0);
+	CHECK_EQ(latency.stage, COPRO_LATENCY_STAGE_SEND);
+	CHECK_EQ(latency.count, 5u);
+	CHECK_EQ(copro_latency_bucket(&latency, 1u), 9u);
+	CHECK_EQ(copro_latency_bucket(&latency, 2u), 0u);
+
+	snapshot_payload[14] = 0x42;
+	snapshot_payload[18] = 24u;
+	CHECK_EQ(copro_snapshot_decode(snapshot_payload, sizeof(snapshot_payload), &snapshot),
+			 0);
+	CHECK_EQ(snapshot.flags, COPRO_SNAPSHOT_FLAG_END);
+	CHECK_EQ(snapshot.seq, 7u);
+	CHECK_EQ(snapshot.index, 3u);
+	CHECK_EQ(snapshot.record.channel_id, 0x42u);
+	CHECK_EQ(snapshot.record.len, 24u);
+	CHECK(snapshot.record.payload == &snapshot_payload[20]);
+}
+
+int main(void)
+{
+	test_crc32();
+	test_frame_encode();
+	test_parser_chunks(COPRO_FRAME_V1);
+	test_parser_chunks(COPRO_FRAME_V2);
+	test_parser_v1_out_of_sync();
+	test_parser_v2_resync();
+	test_parser_v2_trailing_sync();
+	test_parser_rx_buf();
+	test_decode_lengths();
+	test_decode_fields();
+
+	if (failures) {
+		fprintf(stderr, "%d check(s) failed\n", failures);
+		return EXIT_FAILURE;
+	}
+
+	printf("All tests passed\n");
+	return EXIT_SUCCESS;
+}
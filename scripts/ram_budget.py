@@ -0,0 +1,220 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2025 Lucas Dietrich <ld.adecy@gmail.com>
+#
+# SPDX-License-Identifier: Apache-2.0
+
+"""Static RAM budget per subsystem, from the GNU ld map of a Zephyr build.
+
+Every input section placed in a writable memory region is accounted to the
+library it comes from (bluetooth/controller, net/ip, kernel, app/xiaomi.c...),
+split into initialized data, bss and noinit (thread stacks, net_buf pools). The
+largest sections are listed afterwards to tell where the RAM of a subsystem
+goes.
+
+    west build -t ram_budget
+    scripts/ram_budget.py build/zephyr/ble-copro.map --depth 1 --top 40
+"""
+
+import argparse
+import os
+import re
+import sys
+from collections import defaultdict
+
+# Regions of the map which are not actual memory
+IGNORED_REGIONS = ("*default*", "IDT_LIST")
+
+HEX = r"0x([0-9a-fA-F]+)"
+
+# " .bss.name  0x20001000  0x40 path/lib.a(file.c.obj)", the name is alone on its
+# line when too long and the rest follows on the next one
+SECTION_RE = re.compile(r"^ (\S+)\s+" + HEX + r"\s+" + HEX + r"(?:\s+(.*))?$")
+SECTION_NAME_RE = re.compile(r"^ (\S+)$")
+SECTION_REST_RE = re.compile(r"^\s+" + HEX + r"\s+" + HEX + r"(?:\s+(.*))?$")
+REGION_RE = re.compile(r"^(\S+)\s+" + HEX + r"\s+" + HEX + r"(?:\s+(\S+))?")
+
+# "zephyr/subsys/bluetooth/host/libsubsys__bluetooth__host.a(hci_core.c.obj)"
+ARCHIVE_RE = re.compile(r"^(.*?)([^/]+)\.a\(([^)]+)\)$")
+
+
+def parse_regions(lines):
+    """Writable regions of the "Memory Configuration" table, as (name, origin,
+    length) tuples"""
+    regions = []
+    in_table = False
+
+    for line in lines:
+        if line.startswith("Memory Configuration"):
+            in_table = True
+            continue
+        if not in_table:
+            continue
+        if line.startswith("Linker script and memory map"):
+            break
+
+        m = REGION_RE.match(line)
+        if m is None:
+            continue
+
+        name, attrs = m.group(1), m.group(4) or ""
+        if name in IGNORED_REGIONS or "w" not in attrs.lower():
+            continue
+
+        regions.append((name, int(m.group(2), 16), int(m.group(3), 16)))
+
+    return regions
+
+
+def parse_sections(lines):
+    """Input sections of the memory map, as (name, address, size, object) tuples"""
+    pending = None
+
+    for line in lines:
+        if pending is not None:
+            m = SECTION_REST_RE.match(line)
+            name, pending = pending, None
+            if m is not None:
+                addr, size, obj = m.group(1), m.group(2), m.group(3) or ""
+                yield name, int(addr, 16), int(size, 16), obj.strip()
+                continue
+
+        m = SECTION_RE.match(line)
+        if m is not None:
+            name, addr, size, obj = m.group(1), m.group(2), m.group(3), m.group(4) or ""
+            yield name, int(addr, 16), int(size, 16), obj.strip()
+            continue
+
+        m = SECTION_NAME_RE.match(line)
+        if m is not None:
+            pending = m.group(1)
+
+
+def section_kind(name):
+    if "noinit" in name:
+        return "noinit"
+    if name.startswith((".bss", ".sbss", "COMMON")):
+        return "bss"
+    return "data"
+
+
+def section_group(name, obj, depth):
+    """Subsystem a section is accounted to"""
+    if name == "*fill*":
+        return "(alignment)"
+    if "net_buf" in name:
+        return "net_buf pools"
+    if not obj:
+        return "(linker)"
+
+    m = ARCHIVE_RE.match(obj)
+    if m is None:
+        # Objects linked directly, e.g. the generated offsets or isr tables
+        return os.path.basename(obj)
+
+    path, lib, member = m.group(1), m.group(2), m.group(3)
+    if lib == "libapp":
+        return "app/" + re.sub(r"\.obj$", "", member)
+    if os.path.isabs(path):
+        # Toolchain libraries (libc, libgcc)
+        return lib
+
+    lib = re.sub(r"^lib", "", lib)
+    parts = [p for p in lib.split("__") if p]
+    if parts and parts[0] == "subsys":
+        parts = parts[1:]
+
+    return "/".join(parts[:depth]) or lib
+
+
+def short_name(name):
+    return re.sub(r"^\.(bss|sbss|data|sdata|noinit)\.", "", name)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("map", help="linker map, e.g. build/zephyr/zephyr.map")
+    parser.add_argument(
+        "--depth", type=int, default=2, help="library path components per subsystem (default 2)"
+    )
+    parser.add_argument(
+        "--top", type=int, default=20, help="largest sections listed (default 20)"
+    )
+    parser.add_argument(
+        "--region",
+        action="append",
+        help="memory region to account, repeatable (default: the writable ones)",
+    )
+    args = parser.parse_args()
+
+    try:
+        with open(args.map) as f:
+            lines = f.read().splitlines()
+    except OSError as e:
+        sys.exit("Failed to read {}: {}".format(args.map, e))
+
+    regions = parse_regions(lines)
+    if args.region:
+        regions = [r for r in regions if r[0] in args.region]
+    if not regions:
+        sys.exit("No RAM region found in {}".format(args.map))
+
+    ram_size = sum(length for _, _, length in regions)
+
+    def in_ram(addr):
+        return any(origin <= addr < origin + length for _, origin, length in regions)
+
+    groups = defaultdict(lambda: {"data": 0, "bss": 0, "noinit": 0})
+    items = []
+    seen = set()
+
+    for name, addr, size, obj in parse_sections(lines):
+        if size == 0 or not in_ram(addr):
+            continue
+        # Sections listed twice, e.g. by a KEEP() and a wildcard, are counted once
+        if (addr, size, name) in seen:
+            continue
+        seen.add((addr, size, name))
+
+        group = section_group(name, obj, args.depth)
+        kind = section_kind(name)
+        groups[group][kind] += size
+        if name != "*fill*":
+            items.append((size, kind, group, short_name(name)))
+
+    data = sum(g["data"] for g in groups.values())
+    bss = sum(g["bss"] for g in groups.values())
+    noinit = sum(g["noinit"] for g in groups.values())
+    used = data + bss + noinit
+
+    def row(label, data, bss, noinit, total):
+        print(
+            "{:<36} {:>8} {:>8} {:>8} {:>8} {:>6.1f}".format(
+                label, data, bss, noinit, total, 100.0 * total / ram_size
+            )
+        )
+
+    print("RAM: {} bytes in {}".format(ram_size, ", ".join(r[0] for r in regions)))
+    print()
+    print(
+        "{:<36} {:>8} {:>8} {:>8} {:>8} {:>6}".format(
+            "subsystem", "data", "bss", "noinit", "total", "%"
+        )
+    )
+
+    rows = sorted(groups.items(), key=lambda kv: sum(kv[1].values()), reverse=True)
+    for group, sizes in rows:
+        row(group, sizes["data"], sizes["bss"], sizes["noinit"], sum(sizes.values()))
+
+    row("used", data, bss, noinit, used)
+    row("free", "", "", "", ram_size - used)
+
+    if args.top > 0:
+        print()
+        print("{:<48} {:>8} {:>7}  {}".format("largest sections", "size", "kind", "subsystem"))
+        for size, kind, group, name in sorted(items, reverse=True)[: args.top]:
+            print("{:<48} {:>8} {:>7}  {}".format(name[:48], size, kind, group))
+
+
+if __name__ == "__main__":
+    main()
@@ -15,6 +15,9 @@
 #include <zephyr/logging/log.h>
 
 #include <ble_observer.h>
+#include <deadband.h>
+#include <device_registry.h>
+#include <latency.h>
 #include <stream_client.h>
 #include <xiaomi.h>
 
@@ -35,22 +38,54 @@ static void device_found(const bt_addr_le_t *addr,
 {
 	int ret;
 
+	LATENCY_PROBE_START(t_found);
+
 #if CONFIG_COPRO_XIAOMI_LYWSD03MMC
-	if (bt_addr_manufacturer_match(XIAOMI_MANUFACTURER_ADDR_STR, &addr->a) == true) {
+	bool is_xiaomi = bt_addr_manufacturer_match(XIAOMI_MANUFACTURER_ADDR_STR, &addr->a);
+#if CONFIG_COPRO_XIAOMI_ENCRYPTED
+	/* Provisioned devices may use any address */
+	is_xiaomi = is_xiaomi || xiaomi_key_known(&addr->a);
+#endif
+
+	if (is_xiaomi == true) {
 		xiaomi_record_t xc = {0};
 		if (xiaomi_bt_data_parse(addr, rssi, ad, &xc) == true) {
+			LATENCY_PROBE_STAGE(LATENCY_STAGE_DECODE, t_found, t_decoded);
 
-			char buf_record[XIAOMI_RECORD_BUF_SIZE];
+			/* Serialized even if suppressed, the registry keeps the last record */
+			char buf_record[XIAOMI_RECORD_BUF_SIZE + LATENCY_STAMP_SIZE];
 			ret = xiaomi_record_serialize(&xc, buf_record, XIAOMI_RECORD_BUF_SIZE);
 			if (ret < 0) {
 				LOG_ERR("Failed to serialize xiaomi record: %d", ret);
 				return;
 			}
 
-			ret = k_msgq_put(&xiaomi_msgq, buf_record, K_NO_WAIT);
-			if (ret < 0) {
-				LOG_ERR("Failed to put xiaomi record in msgq: %d", ret);
+			LATENCY_PROBE_STAGE(LATENCY_STAGE_SERIALIZE, t_decoded, t_serialized);
+
+			const bool report = deadband_xiaomi_report(&xc);
+			if (report) {
+				LATENCY_STAMP_WRITE(
+					&buf_record[XIAOMI_RECORD_BUF_SIZE], t_found, t_serialized);
+
+				ret = k_msgq_put(&xiaomi_msgq, buf_record, K_NO_WAIT);
+				if (ret < 0) {
+					LOG_ERR("Failed to put xiaomi record in msgq: %d", ret);
+				}
+
+				LATENCY_PROBE_END(LATENCY_STAGE_ENQUEUE, t_serialized);
 			}
+
+#if CONFIG_COPRO_DEVICE_REGISTRY
+			device_registry_update(addr,
+								   DEVICE_TYPE_XIAOMI,
+								   rssi,
+								   (xc.flags & XIAOMI_RECORD_FLAG_COUNTER) != 0
+									   ? xc.counter
+									   : DEVICE_COUNTER_NONE,
+								   !report,
+								   (const uint8_t *)buf_record,
+								   XIAOMI_RECORD_BUF_SIZE);
+#endif
 		}
 		return;
 	}
@@ -74,39 +109,105 @@ static void device_found(const bt_addr_le_t *addr,
 		LOG_INF("Linky found: %s (RSSI %d)", addr_str, (int)rssi);
 		bt_data_parse(ad, linky_adv_data_parse_measurements_cb, (void *)&record);
 
-		char buf_record[LINKY_RECORD_BUF_SIZE];
-		ret = linky_record_serialize(&record, buf_record, sizeof(buf_record));
+		LATENCY_PROBE_STAGE(LATENCY_STAGE_DECODE, t_found, t_decoded);
+
+		if ((record.flags & LINKY_RECORD_FLAG_VALID) == 0) {
+			return;
+		}
+
+		char buf_record[LINKY_RECORD_BUF_SIZE + LATENCY_STAMP_SIZE];
+		ret = linky_record_serialize(&record, buf_record, LINKY_RECORD_BUF_SIZE);
 		if (ret < 0) {
 			LOG_ERR("Failed to serialize linky record: %d", ret);
 			return;
 		}
 
-		if ((record.flags & LINKY_RECORD_FLAG_VALID) != 0) {
+		LATENCY_PROBE_STAGE(LATENCY_STAGE_SERIALIZE, t_decoded, t_serialized);
+
+		const bool report = deadband_linky_report(&record);
+		if (report) {
+			LATENCY_STAMP_WRITE(
+				&buf_record[LINKY_RECORD_BUF_SIZE], t_found, t_serialized);
+
 			ret = k_msgq_put(&linky_msgq, buf_record, K_NO_WAIT);
 			if (ret < 0) {
 				LOG_ERR("Failed to put linky record in msgq: %d", ret);
 			}
+
+			LATENCY_PROBE_END(LATENCY_STAGE_ENQUEUE, t_serialized);
 		}
 
+#if CONFIG_COPRO_DEVICE_REGISTRY
+		device_registry_update(addr,
+							   DEVICE_TYPE_LINKY_TIC,
+							   rssi,
+							   DEVICE_COUNTER_NONE,
+							   !report,
+							   (const uint8_t *)buf_record,
+							   LINKY_RECORD_BUF_SIZE);
+#endif
+
 		return;
 	}
 #endif
 }
 
+static struct bt_le_scan_param scan_param = {
+	.type	  = BT_LE_SCAN_TYPE_PASSIVE,
+	.options  = BT_LE_SCAN_OPT_NONE, /* don't filter duplicates */
+	.interval = BT_GAP_SCAN_FAST_INTERVAL,
+	.window	  = BT_GAP_SCAN_FAST_WINDOW,
+};
+
+static bool scanning;
+
 int ble_observer_start(void)
 {
-	struct bt_le_scan_param scan_param = {
-		.type	  = BT_LE_SCAN_TYPE_PASSIVE,
-		.options  = BT_LE_SCAN_OPT_NONE, /* don't filter duplicates */
-		.interval = BT_GAP_SCAN_FAST_INTERVAL,
-		.window	  = BT_GAP_SCAN_FAST_WINDOW,
-	};
-
 	int ret = bt_le_scan_start(&scan_param, device_found);
 	if (ret) {
 		LOG_ERR("Starting scanning failed (ret %d)", ret);
 		return ret;
 	}
 
+	scanning = true;
+
 	return ret;
+}
+
+int ble_observer_scan_params_set(uint16_t interval, uint16_t window)
+{
+	int ret;
+
+	if (interval < BLE_OBSERVER_SCAN_UNITS_MIN ||
+		interval > BLE_OBSERVER_SCAN_UNITS_MAX || window < BLE_OBSERVER_SCAN_UNITS_MIN ||
+		window > interval) {
+		return -EINVAL;
+	}
+
+	scan_param.interval = interval;
+	scan_param.window	= window;
+
+	if (!scanning) {
+		/* Applied by ble_observer_start() */
+		return 0;
+	}
+
+	/* Scan parameters can only be changed while the scanner is stopped */
+	ret = bt_le_scan_stop();
+	if (ret) {
+		LOG_ERR("Stopping scanning failed (ret %d)", ret);
+		return ret;
+	}
+
+	scanning = false;
+
+	LOG_INF("Scan interval: %u window: %u (0.625 ms units)", interval, window);
+
+	return ble_observer_start();
+}
+
+void ble_observer_scan_params_get(uint16_t *interval, uint16_t *window)
+{
+	*interval = scan_param.interval;
+	*window	  = scan_param.window;
 }
\ No newline at end of file
@@ -0,0 +1,635 @@
+/*
+ * Copyright (c) 2025 Lucas Dietrich <ld.adecy@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/bluetooth/gap.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/logging/log_ctrl.h>
+#include <zephyr/net/net_ip.h>
+#include <zephyr/net/socket.h>
+#include <zephyr/settings/settings.h>
+#include <zephyr/sys/byteorder.h>
+
+#include <ble_observer.h>
+#include <config_server.h>
+#include <deadband.h>
+#include <stream_client.h>
+
+LOG_MODULE_REGISTER(config_server, LOG_LEVEL_INF);
+
+#define SETTINGS_ROOT "copro"
+
+/* Delay before retrying to open the listening socket */
+#define SERVER_RETRY_INTERVAL_MS 1000u
+
+/* Settings layout is as follows:
+ *  - copro/scan: interval (2) | window (2)
+ *  - copro/log: level (1)
+ *  - copro/ch/<channel id, 8 hex digits>: enabled (1) | priority (1) | weight (1)
+ *  - copro/db/<key, 4 hex digits>: deadband (4)
+ */
+#define SETTINGS_SCAN_SIZE	   4u
+#define SETTINGS_LOG_SIZE	   1u
+#define SETTINGS_CHANNEL_SIZE  3u
+#define SETTINGS_DEADBAND_SIZE 4u
+
+#define SETTINGS_NAME_MAX_LEN sizeof(SETTINGS_ROOT "/ch/00000000")
+
+/* Channels whose build time configuration has been saved, every channel but
+ * the control one may be tuned */
+#define CHANNEL_DEFAULTS_MAX (CONFIG_COPRO_STREAM_CHANNELS_COUNT + 1)
+
+/* Log level meaning "no runtime restriction" */
+#define LOG_LEVEL_UNRESTRICTED LOG_LEVEL_DBG
+
+struct channel_default {
+	uint32_t channel_id;
+	struct stream_channel_config cfg;
+};
+
+static struct channel_default channel_defaults[CHANNEL_DEFAULTS_MAX];
+static size_t channel_defaults_count;
+
+static uint8_t log_level = LOG_LEVEL_UNRESTRICTED;
+
+static void config_thread(void *arg0, void *arg1, void *arg2);
+
+K_THREAD_DEFINE(config_tid,
+				CONFIG_COPRO_CONFIG_STACK_SIZE,
+				config_thread,
+				NULL,
+				NULL,
+				NULL,
+				K_PRIO_PREEMPT(11),
+				0,
+				SYS_FOREVER_MS);
+
+/* Save the build time configuration of a channel before its first change, for
+ * CFG_OP_RESET */
+static int channel_default_save(uint32_t channel_id)
+{
+	struct stream_channel_config cfg;
+	int ret;
+
+	for (size_t i = 0u; i < channel_defaults_count; i++) {
+		if (channel_defaults[i].channel_id == channel_id) {
+			return 0;
+		}
+	}
+
+	ret = stream_client_channel_config_get(channel_id, &cfg);
+	if (ret < 0) {
+		return ret;
+	}
+
+	if (channel_defaults_count >= ARRAY_SIZE(channel_defaults)) {
+		return -ENOMEM;
+	}
+
+	channel_defaults[channel_defaults_count].channel_id = channel_id;
+	channel_defaults[channel_defaults_count].cfg		= cfg;
+	channel_defaults_count++;
+
+	return 0;
+}
+
+static const struct stream_channel_config *channel_default_get(uint32_t channel_id)
+{
+	for (size_t i = 0u; i < channel_defaults_count; i++) {
+		if (channel_defaults[i].channel_id == channel_id) {
+			return &channel_defaults[i].cfg;
+		}
+	}
+
+	return NULL;
+}
+
+static int log_level_apply(uint8_t level)
+{
+#if CONFIG_LOG_RUNTIME_FILTERING
+	const uint32_t sources = log_src_cnt_get(Z_LOG_LOCAL_DOMAIN_ID);
+
+	if (level > LOG_LEVEL_DBG) {
+		return -EINVAL;
+	}
+
+	for (uint32_t i = 0u; i < sources; i++) {
+		(void)log_filter_set(NULL, Z_LOG_LOCAL_DOMAIN_ID, (int16_t)i, level);
+	}
+
+	log_level = level;
+
+	return 0;
+#else
+	ARG_UNUSED(level);
+
+	return -ENOTSUP;
+#endif
+}
+
+#if CONFIG_COPRO_DEADBAND
+#define CFG_KEY_DEADBAND_CASES                                                           \
+	case CFG_KEY_DEADBAND_XIAOMI_TEMPERATURE:                                            \
+	case CFG_KEY_DEADBAND_XIAOMI_HUMIDITY:                                               \
+	case CFG_KEY_DEADBAND_XIAOMI_BATTERY:                                                \
+	case CFG_KEY_DEADBAND_LINKY_PAPP:                                                    \
+	case CFG_KEY_DEADBAND_LINKY_BASE:                                                    \
+	case CFG_KEY_DEADBAND_HEARTBEAT
+
+static enum deadband_param deadband_param_of(uint16_t key)
+{
+	return (enum deadband_param)(key - CFG_KEY_DEADBAND_XIAOMI_TEMPERATURE);
+}
+
+static void deadband_settings_name(uint16_t key, char *name)
+{
+	snprintf(name, SETTINGS_NAME_MAX_LEN, SETTINGS_ROOT "/db/%04x", key);
+}
+#endif
+
+static int cfg_get(uint16_t key, uint32_t arg, uint32_t *value)
+{
+#if CONFIG_COPRO_DEADBAND
+	struct deadband_stats stats;
+#endif
+	struct stream_channel_config cfg;
+	uint16_t interval, window;
+	int ret;
+
+	switch (key) {
+	case CFG_KEY_SCAN_INTERVAL:
+	case CFG_KEY_SCAN_WINDOW:
+		ble_observer_scan_params_get(&interval, &window);
+		*value = (key == CFG_KEY_SCAN_INTERVAL) ? interval : window;
+		return 0;
+	case CFG_KEY_LOG_LEVEL:
+		*value = log_level;
+		return 0;
+	case CFG_KEY_CHANNEL_ENABLE:
+		ret = stream_client_channel_is_enabled(arg);
+		if (ret < 0) {
+			return ret;
+		}
+		*value = (uint32_t)ret;
+		return 0;
+	case CFG_KEY_CHANNEL_PRIORITY:
+	case CFG_KEY_CHANNEL_WEIGHT:
+		ret = stream_client_channel_config_get(arg, &cfg);
+		if (ret < 0) {
+			return ret;
+		}
+		*value = (key == CFG_KEY_CHANNEL_PRIORITY) ? cfg.priority : cfg.weight;
+		return 0;
+#if CONFIG_COPRO_DEADBAND
+	CFG_KEY_DEADBAND_CASES:
+		return deadband_param_get(deadband_param_of(key), value);
+	case CFG_KEY_DEADBAND_SUPPRESSED:
+		deadband_stats_get(&stats);
+		*value = stats.suppressed;
+		return 0;
+#endif
+	default:
+		return -ENOENT;
+	}
+}
+
+static int cfg_apply(uint16_t key, uint32_t arg, uint32_t value)
+{
+	struct stream_channel_config cfg;
+	uint16_t interval, window;
+	int ret;
+
+	switch (key) {
+	case CFG_KEY_SCAN_INTERVAL:
+	case CFG_KEY_SCAN_WINDOW:
+		if (value > UINT16_MAX) {
+			return -EINVAL;
+		}
+		ble_observer_scan_params_get(&interval, &window);
+		if (key == CFG_KEY_SCAN_INTERVAL) {
+			interval = (uint16_t)value;
+		} else {
+			window = (uint16_t)value;
+		}
+		return ble_observer_scan_params_set(interval, window);
+	case CFG_KEY_LOG_LEVEL:
+		return log_level_apply((uint8_t)MIN(value, UINT8_MAX));
+	case CFG_KEY_CHANNEL_ENABLE:
+		if (value > 1u) {
+			return -EINVAL;
+		}
+		ret = channel_default_save(arg);
+		if (ret < 0) {
+			return ret;
+		}
+		return stream_client_channel_enable(arg, value != 0u);
+	case CFG_KEY_CHANNEL_PRIORITY:
+	case CFG_KEY_CHANNEL_WEIGHT:
+		if (value > UINT8_MAX) {
+			return -EINVAL;
+		}
+		ret = channel_default_save(arg);
+		if (ret < 0) {
+			return ret;
+		}
+		ret = stream_client_channel_config_get(arg, &cfg);
+		if (ret < 0) {
+			return ret;
+		}
+		if (key == CFG_KEY_CHANNEL_PRIORITY) {
+			cfg.priority = (uint8_t)value;
+		} else {
+			cfg.weight = (uint8_t)value;
+		}
+		return stream_client_channel_config_set(arg, &cfg);
+#if CONFIG_COPRO_DEADBAND
+	CFG_KEY_DEADBAND_CASES:
+		return deadband_param_set(deadband_param_of(key), value);
+	case CFG_KEY_DEADBAND_SUPPRESSED:
+		return -EACCES;
+#endif
+	default:
+		return -ENOENT;
+	}
+}
+
+static void channel_settings_name(uint32_t channel_id, char *name)
+{
+	snprintf(name, SETTINGS_NAME_MAX_LEN, SETTINGS_ROOT "/ch/%08x", channel_id);
+}
+
+/* Persist the current value of key, along with the values sharing its setting */
+static int cfg_persist(uint16_t key, uint32_t arg)
+{
+	struct stream_channel_config cfg;
+	char name[SETTINGS_NAME_MAX_LEN];
+	uint8_t buf[SETTINGS_SCAN_SIZE];
+	uint16_t interval, window;
+#if CONFIG_COPRO_DEADBAND
+	uint32_t value;
+#endif
+	int ret;
+
+	switch (key) {
+	case CFG_KEY_SCAN_INTERVAL:
+	case CFG_KEY_SCAN_WINDOW:
+		ble_observer_scan_params_get(&interval, &window);
+		sys_put_le16(interval, &buf[0u]);
+		sys_put_le16(window, &buf[2u]);
+		return settings_save_one(SETTINGS_ROOT "/scan", buf, SETTINGS_SCAN_SIZE);
+	case CFG_KEY_LOG_LEVEL:
+		return settings_save_one(SETTINGS_ROOT "/log", &log_level, SETTINGS_LOG_SIZE);
+	case CFG_KEY_CHANNEL_ENABLE:
+	case CFG_KEY_CHANNEL_PRIORITY:
+	case CFG_KEY_CHANNEL_WEIGHT:
+		ret = stream_client_channel_config_get(arg, &cfg);
+		if (ret < 0) {
+			return ret;
+		}
+		buf[0u] = (uint8_t)(stream_client_channel_is_enabled(arg) == 1);
+		buf[1u] = cfg.priority;
+		buf[2u] = cfg.weight;
+		channel_settings_name(arg, name);
+		return settings_save_one(name, buf, SETTINGS_CHANNEL_SIZE);
+#if CONFIG_COPRO_DEADBAND
+	CFG_KEY_DEADBAND_CASES:
+		ret = deadband_param_get(deadband_param_of(key), &value);
+		if (ret < 0) {
+			return ret;
+		}
+		sys_put_le32(value, buf);
+		deadband_settings_name(key, name);
+		return settings_save_one(name, buf, SETTINGS_DEADBAND_SIZE);
+#endif
+	default:
+		return -ENOENT;
+	}
+}
+
+static int cfg_reset(uint16_t key, uint32_t arg)
+{
+	const struct stream_channel_config *cfg;
+	char name[SETTINGS_NAME_MAX_LEN];
+	int ret;
+
+	switch (key) {
+	case CFG_KEY_SCAN_INTERVAL:
+	case CFG_KEY_SCAN_WINDOW:
+		ret = ble_observer_scan_params_set(BT_GAP_SCAN_FAST_INTERVAL,
+										   BT_GAP_SCAN_FAST_WINDOW);
+		return ret < 0 ? ret : settings_delete(SETTINGS_ROOT "/scan");
+	case CFG_KEY_LOG_LEVEL:
+		ret = log_level_apply(LOG_LEVEL_UNRESTRICTED);
+		return ret < 0 ? ret : settings_delete(SETTINGS_ROOT "/log");
+	case CFG_KEY_CHANNEL_ENABLE:
+	case CFG_KEY_CHANNEL_PRIORITY:
+	case CFG_KEY_CHANNEL_WEIGHT:
+		/* Never changed means already at its default */
+		cfg = channel_default_get(arg);
+		if (cfg != NULL) {
+			ret = stream_client_channel_config_set(arg, cfg);
+			if (ret < 0) {
+				return ret;
+			}
+		}
+		ret = stream_client_channel_enable(arg, true);
+		if (ret < 0 && ret != -EPERM) {
+			return ret;
+		}
+		channel_settings_name(arg, name);
+		return settings_delete(name);
+#if CONFIG_COPRO_DEADBAND
+	CFG_KEY_DEADBAND_CASES:
+		ret = deadband_param_set(deadband_param_of(key),
+								 deadband_param_default(deadband_param_of(key)));
+		if (ret < 0) {
+			return ret;
+		}
+		deadband_settings_name(key, name);
+		return settings_delete(name);
+	case CFG_KEY_DEADBAND_SUPPRESSED:
+		return -EACCES;
+#endif
+	default:
+		return -ENOENT;
+	}
+}
+
+static int settings_set(const char *name,
+						size_t len,
+						settings_read_cb read_cb,
+						void *cb_arg)
+{
+	uint8_t buf[SETTINGS_SCAN_SIZE];
+	const char *next;
+	uint32_t channel_id;
+#if CONFIG_COPRO_DEADBAND
+	uint16_t key;
+#endif
+	ssize_t rlen;
+	int ret;
+
+	if (len > sizeof(buf)) {
+		return -EINVAL;
+	}
+
+	rlen = read_cb(cb_arg, buf, len);
+	if (rlen < 0) {
+		return (int)rlen;
+	}
+
+	if (settings_name_steq(name, "scan", NULL) && rlen == SETTINGS_SCAN_SIZE) {
+		ret = ble_observer_scan_params_set(sys_get_le16(&buf[0u]),
+										   sys_get_le16(&buf[2u]));
+	} else if (settings_name_steq(name, "log", NULL) && rlen == SETTINGS_LOG_SIZE) {
+		ret = log_level_apply(buf[0u]);
+	} else if (settings_name_steq(name, "ch", &next) && next != NULL &&
+			   rlen == SETTINGS_CHANNEL_SIZE) {
+		channel_id = strtoul(next, NULL, 16);
+		ret		   = cfg_apply(CFG_KEY_CHANNEL_ENABLE, channel_id, buf[0u]);
+		if (ret == 0) {
+			ret = cfg_apply(CFG_KEY_CHANNEL_PRIORITY, channel_id, buf[1u]);
+		}
+		if (ret == 0) {
+			ret = cfg_apply(CFG_KEY_CHANNEL_WEIGHT, channel_id, buf[2u]);
+		}
+#if CONFIG_COPRO_DEADBAND
+	} else if (settings_name_steq(name, "db", &next) && next != NULL &&
+			   rlen == SETTINGS_DEADBAND_SIZE) {
+		key = (uint16_t)strtoul(next, NULL, 16);
+		ret = (key >= CFG_KEY_DEADBAND_XIAOMI_TEMPERATURE &&
+			   key <= CFG_KEY_DEADBAND_HEARTBEAT)
+				  ? cfg_apply(key, 0u, sys_get_le32(buf))
+				  : -ENOENT;
+#endif
+	} else {
+		ret = -ENOENT;
+	}
+
+	/* A stale setting must not prevent the others from loading */
+	if (ret < 0) {
+		LOG_WRN("Ignoring setting %s: %d", name, ret);
+	}
+
+	return 0;
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(copro, SETTINGS_ROOT, NULL, settings_set, NULL, NULL);
+
+static int request_handle(const uint8_t *req, uint8_t *rsp)
+{
+	const uint8_t op	 = req[0u];
+	const uint16_t key	 = sys_get_le16(&req[1u]);
+	const uint32_t arg	 = sys_get_le32(&req[3u]);
+	const uint32_t value = sys_get_le32(&req[7u]);
+	uint32_t current	 = 0u;
+	int ret;
+
+	switch (op) {
+	case CFG_OP_GET:
+		ret = 0;
+		break;
+	case CFG_OP_SET:
+		ret = cfg_apply(key, arg, value);
+		if (ret == 0) {
+			ret = cfg_persist(key, arg);
+		}
+		break;
+	case CFG_OP_SET_VOLATILE:
+		ret = cfg_apply(key, arg, value);
+		break;
+	case CFG_OP_RESET:
+		ret = cfg_reset(key, arg);
+		break;
+	default:
+		ret = -ENOTSUP;
+		break;
+	}
+
+	if (ret == 0) {
+		ret = cfg_get(key, arg, &current);
+	} else {
+		(void)cfg_get(key, arg, &current);
+	}
+
+	LOG_INF("op: %u key: 0x%04x arg: %X value: %u -> %d", op, key, arg, current, ret);
+
+	memcpy(rsp, req, 7u);
+	rsp[7u] = stream_control_status(ret);
+	sys_put_le32(current, &rsp[8u]);
+
+	return ret;
+}
+
+static int sock_recv_all(int sock, uint8_t *buf, size_t len)
+{
+	int ret;
+
+	while (len > 0) {
+		ret = recv(sock, buf, len, 0);
+		if (ret < 0) {
+			return ret;
+		} else if (ret == 0) {
+			return -ECONNRESET;
+		}
+
+		buf += ret;
+		len -= ret;
+	}
+
+	return 0;
+}
+
+static int sock_send_all(int sock, const uint8_t *buf, size_t len)
+{
+	int ret;
+
+	while (len > 0) {
+		ret = send(sock, buf, len, 0);
+		if (ret < 0) {
+			return ret;
+		}
+
+		buf += ret;
+		len -= ret;
+	}
+
+	return 0;
+}
+
+/* A client which stops sending requests, or reading the responses, is
+ * disconnected after CONFIG_COPRO_CONFIG_CLIENT_TIMEOUT ms instead of locking
+ * out the other ones.
+ */
+static int client_timeout_set(int client)
+{
+	int ret;
+	const struct timeval tv = {
+		.tv_sec	 = CONFIG_COPRO_CONFIG_CLIENT_TIMEOUT / 1000,
+		.tv_usec = (CONFIG_COPRO_CONFIG_CLIENT_TIMEOUT % 1000) * 1000,
+	};
+
+	ret = setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	if (ret == 0) {
+		ret = setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+	}
+
+	return ret < 0 ? -errno : 0;
+}
+
+static int server_socket(void)
+{
+	int ret, sock;
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_port	= htons(CONFIG_COPRO_CONFIG_PORT),
+		.sin_addr	= INADDR_ANY_INIT,
+	};
+
+	sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (sock < 0) {
+		LOG_ERR("Failed to create socket: %d", sock);
+		return sock;
+	}
+
+	ret = bind(sock, (struct sockaddr *)&addr, sizeof(addr));
+	if (ret == 0) {
+		ret = listen(sock, 1);
+	}
+	if (ret < 0) {
+		LOG_ERR("Failed to listen on port %d: %d", CONFIG_COPRO_CONFIG_PORT, errno);
+		close(sock);
+		return ret;
+	}
+
+	return sock;
+}
+
+/* One client at a time, requests are handled in order */
+static void config_thread(void *arg0, void *arg1, void *arg2)
+{
+	int ret;
+	int sock = -1;
+	int client;
+	uint8_t req[CFG_REQUEST_SIZE];
+	uint8_t rsp[CFG_RESPONSE_SIZE];
+
+	for (;;) {
+		if (sock < 0) {
+			sock = server_socket();
+			if (sock < 0) {
+				k_sleep(K_MSEC(SERVER_RETRY_INTERVAL_MS));
+				continue;
+			}
+		}
+
+		client = accept(sock, NULL, NULL);
+		if (client < 0) {
+			LOG_ERR("Failed to accept: %d", errno);
+			close(sock);
+			sock = -1;
+			continue;
+		}
+
+		ret = client_timeout_set(client);
+		if (ret < 0) {
+			LOG_ERR("Failed to set client timeout: %d", ret);
+			close(client);
+			continue;
+		}
+
+		LOG_INF("Config client connected");
+
+		for (;;) {
+			ret = sock_recv_all(client, req, sizeof(req));
+			if (ret < 0) {
+				if (errno == EAGAIN) {
+					LOG_WRN("Config client timed out");
+				}
+				break;
+			}
+
+			(void)request_handle(req, rsp);
+
+			ret = sock_send_all(client, rsp, sizeof(rsp));
+			if (ret < 0) {
+				break;
+			}
+		}
+
+		LOG_INF("Config client disconnected");
+		close(client);
+	}
+}
+
+int config_server_init(void)
+{
+	int ret;
+
+	ret = settings_subsys_init();
+	if (ret < 0) {
+		LOG_ERR("Failed to initialize settings: %d", ret);
+		return ret;
+	}
+
+	ret = settings_load_subtree(SETTINGS_ROOT);
+	if (ret < 0) {
+		LOG_ERR("Failed to load settings: %d", ret);
+		return ret;
+	}
+
+	k_thread_start(config_tid);
+
+	LOG_INF("Config server listening on port %d", CONFIG_COPRO_CONFIG_PORT);
+
+	return 0;
+}
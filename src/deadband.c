@@ -0,0 +1,185 @@
+/*
+ * Copyright (c) 2025 Lucas Dietrich <ld.adecy@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/byteorder.h>
+
+#include <deadband.h>
+
+/* Values compared per device, the meaning depends on the device type:
+ *  - xiaomi: temperature, humidity, battery
+ *  - linky: papp, base, ptec
+ */
+#define DEADBAND_VALUES 3u
+
+struct deadband_entry {
+	bool in_use;
+	bt_addr_le_t addr;
+	int64_t reported_at; // uptime (ms) of the last report
+	int32_t values[DEADBAND_VALUES];
+};
+
+/* Only accessed from the BT RX thread, parameters and statistics are 32 bits
+ * words read and written atomically from other threads. */
+static struct deadband_entry entries[CONFIG_COPRO_DEADBAND_SIZE];
+
+#define PARAMS_DEFAULT_INIT                                                              \
+	{                                                                                    \
+		[DEADBAND_XIAOMI_TEMPERATURE] = CONFIG_COPRO_DEADBAND_XIAOMI_TEMPERATURE,        \
+		[DEADBAND_XIAOMI_HUMIDITY]	  = CONFIG_COPRO_DEADBAND_XIAOMI_HUMIDITY,           \
+		[DEADBAND_XIAOMI_BATTERY]	  = CONFIG_COPRO_DEADBAND_XIAOMI_BATTERY,            \
+		[DEADBAND_LINKY_PAPP]		  = CONFIG_COPRO_DEADBAND_LINKY_PAPP,                \
+		[DEADBAND_LINKY_BASE]		  = CONFIG_COPRO_DEADBAND_LINKY_BASE,                \
+		[DEADBAND_HEARTBEAT]		  = CONFIG_COPRO_DEADBAND_HEARTBEAT,                 \
+	}
+
+static const uint32_t params_default[DEADBAND_PARAMS_COUNT] = PARAMS_DEFAULT_INIT;
+
+static uint32_t params[DEADBAND_PARAMS_COUNT] = PARAMS_DEFAULT_INIT;
+
+static struct deadband_stats stats;
+
+static struct deadband_entry *entry_get(const bt_addr_le_t *addr, bool *created)
+{
+	struct deadband_entry *oldest = &entries[0];
+
+	*created = false;
+
+	for (size_t i = 0u; i < ARRAY_SIZE(entries); i++) {
+		if (entries[i].in_use && bt_addr_le_eq(&entries[i].addr, addr)) {
+			return &entries[i];
+		}
+	}
+
+	/* Table full, forget the device reported the longest time ago */
+	for (size_t i = 0u; i < ARRAY_SIZE(entries); i++) {
+		if (!entries[i].in_use) {
+			oldest = &entries[i];
+			break;
+		} else if (entries[i].reported_at < oldest->reported_at) {
+			oldest = &entries[i];
+		}
+	}
+
+	oldest->in_use = true;
+	bt_addr_le_copy(&oldest->addr, addr);
+	*created = true;
+
+	return oldest;
+}
+
+static bool exceeds(int32_t last, int32_t value, enum deadband_param param)
+{
+	return (uint32_t)abs(value - last) >= params[param];
+}
+
+/* thresholds[i] is the deadband parameter of values[i], -1 to report any change */
+static bool deadband_report(const bt_addr_le_t *addr,
+							const int32_t values[DEADBAND_VALUES],
+							const int thresholds[DEADBAND_VALUES])
+{
+	const int64_t now = k_uptime_get();
+	struct deadband_entry *entry;
+	bool created;
+	bool report = false;
+
+	entry = entry_get(addr, &created);
+
+	for (size_t i = 0u; i < DEADBAND_VALUES && !report && !created; i++) {
+		if (thresholds[i] < 0) {
+			report = values[i] != entry->values[i];
+		} else {
+			report = exceeds(entry->values[i], values[i], thresholds[i]);
+		}
+	}
+
+	if (!created && !report) {
+		const uint32_t heartbeat = params[DEADBAND_HEARTBEAT];
+
+		if (heartbeat == 0u || now - entry->reported_at < heartbeat) {
+			stats.suppressed++;
+			return false;
+		}
+
+		stats.heartbeats++;
+	}
+
+	entry->reported_at = now;
+	memcpy(entry->values, values, sizeof(entry->values));
+	stats.reported++;
+
+	return true;
+}
+
+bool deadband_xiaomi_report(const xiaomi_record_t *rec)
+{
+	const int32_t values[DEADBAND_VALUES] = {
+		rec->measurements.temperature,
+		rec->measurements.humidity,
+		rec->measurements.battery_mv,
+	};
+	static const int thresholds[DEADBAND_VALUES] = {
+		DEADBAND_XIAOMI_TEMPERATURE,
+		DEADBAND_XIAOMI_HUMIDITY,
+		DEADBAND_XIAOMI_BATTERY,
+	};
+
+	return deadband_report(&rec->addr, values, thresholds);
+}
+
+bool deadband_linky_report(const linky_tic_record_t *rec)
+{
+	const int32_t values[DEADBAND_VALUES] = {
+		(int32_t)sys_get_le32((const uint8_t *)&rec->raw[LINKY_TIC_RAW_PAPP_OFFSET]),
+		(int32_t)sys_get_le32((const uint8_t *)&rec->raw[LINKY_TIC_RAW_BASE_OFFSET]),
+		sys_get_le16((const uint8_t *)&rec->raw[LINKY_TIC_RAW_PTEC_OFFSET]),
+	};
+	static const int thresholds[DEADBAND_VALUES] = {
+		DEADBAND_LINKY_PAPP,
+		DEADBAND_LINKY_BASE,
+		-1, // tariff period changes are always reported
+	};
+
+	return deadband_report(&rec->addr, values, thresholds);
+}
+
+int deadband_param_set(enum deadband_param param, uint32_t value)
+{
+	if (param >= DEADBAND_PARAMS_COUNT) {
+		return -EINVAL;
+	}
+
+	params[param] = value;
+
+	return 0;
+}
+
+int deadband_param_get(enum deadband_param param, uint32_t *value)
+{
+	if (param >= DEADBAND_PARAMS_COUNT) {
+		return -EINVAL;
+	}
+
+	*value = params[param];
+
+	return 0;
+}
+
+uint32_t deadband_param_default(enum deadband_param param)
+{
+	return param < DEADBAND_PARAMS_COUNT ? params_default[param] : 0u;
+}
+
+void deadband_stats_get(struct deadband_stats *st)
+{
+	*st = stats;
+}
@@ -0,0 +1,402 @@
+/*
+ * Copyright (c) 2025 Lucas Dietrich <ld.adecy@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/byteorder.h>
+
+#include <device_registry.h>
+#include <latency.h>
+#include <linky.h>
+#include <xiaomi.h>
+
+#if CONFIG_COPRO_STREAM_CLIENT
+#include <stream_client.h>
+#endif
+
+LOG_MODULE_REGISTER(registry, LOG_LEVEL_INF);
+
+/* Period of the presence and health checks */
+#define REGISTRY_CHECK_PERIOD_MS 1000u
+
+/* Delay before resuming a snapshot which did not fit in the queue, while the
+ * stream client drains it
+ */
+#define SNAPSHOT_RETRY_PERIOD_MS 10u
+
+K_MSGQ_DEFINE(device_registry_msgq,
+			  DEVICE_RECORD_BUF_SIZE + LATENCY_STAMP_SIZE,
+			  CONFIG_COPRO_DEVICE_REGISTRY_QUEUE_SIZE,
+			  4);
+
+BUILD_ASSERT(DEVICE_RECORD_TIMESTAMP_OFFSET + sizeof(int64_t) <= DEVICE_RECORD_BUF_SIZE,
+			 "Device record timestamp out of the record");
+#if CONFIG_COPRO_STREAM_CLIENT
+BUILD_ASSERT(DEVICE_RECORD_BUF_SIZE + LATENCY_STAMP_SIZE <=
+				 CONFIG_COPRO_STREAM_CHANNEL_MSG_MAX_SIZE,
+			 "Device records exceed COPRO_STREAM_CHANNEL_MSG_MAX_SIZE");
+#endif
+
+struct device_entry {
+	bool in_use;
+	bt_addr_le_t addr;
+	uint8_t type;		   // enum device_type
+	int64_t first_seen;	   // uptime (ms)
+	int64_t last_seen;	   // uptime (ms)
+	int64_t next_health;   // uptime (ms) of the next health snapshot
+	uint32_t adv_count;	   // advertisements received
+	uint32_t measurements; // measurements received
+	uint32_t missed;	   // measurements missed, from counter gaps
+	uint32_t suppressed;   // records suppressed by the deadband
+	int16_t rssi_ewma;	   // 1/DEVICE_RSSI_EWMA_SCALE dBm
+	int8_t rssi_last;
+	bool appear_pending; // appear event not queued yet
+	bool counter_valid;
+	uint8_t counter; // last measurement counter
+#if CONFIG_COPRO_DEVICE_REGISTRY_SNAPSHOT
+	uint8_t record_len; // 0 if no record received yet
+	uint8_t record[DEVICE_SNAPSHOT_RECORD_MAX_SIZE]; // last record
+#endif
+};
+
+static struct device_entry devices[CONFIG_COPRO_DEVICE_REGISTRY_SIZE];
+
+K_MUTEX_DEFINE(devices_mutex);
+
+static void registry_work_handler(struct k_work *work);
+
+static K_WORK_DELAYABLE_DEFINE(registry_work, registry_work_handler);
+
+static void device_record_serialize(const struct device_entry *dev,
+									enum device_event event,
+									int64_t now,
+									uint8_t *buf)
+{
+	buf[0] = dev->addr.a.val[5];
+	buf[1] = dev->addr.a.val[4];
+	buf[2] = dev->addr.a.val[3];
+	buf[3] = dev->addr.a.val[2];
+	buf[4] = dev->addr.a.val[1];
+	buf[5] = dev->addr.a.val[0];
+	buf[6] = dev->addr.type;
+	buf[7] = event;
+	buf[8] = DEVICE_RECORD_HEADER_VERSION;
+	buf[9] = dev->type;
+	sys_put_le64(now, &buf[10]);
+	sys_put_le64(dev->first_seen, &buf[18]);
+	sys_put_le64(dev->last_seen, &buf[26]);
+	sys_put_le32(dev->adv_count, &buf[34]);
+	sys_put_le32(dev->measurements, &buf[38]);
+	sys_put_le32(dev->missed, &buf[42]);
+	sys_put_le16(dev->rssi_ewma, &buf[46]);
+	buf[48] = dev->rssi_last;
+	sys_put_le32(dev->suppressed, &buf[49]);
+}
+
+static int device_event_emit(const struct device_entry *dev,
+							 enum device_event event,
+							 int64_t now)
+{
+	/* Not an advertisement, the latency stamp is left zeroed */
+	uint8_t buf[DEVICE_RECORD_BUF_SIZE + LATENCY_STAMP_SIZE] = {0};
+
+	device_record_serialize(dev, event, now, buf);
+
+	return k_msgq_put(&device_registry_msgq, buf, K_NO_WAIT);
+}
+
+static struct device_entry *device_lookup(const bt_addr_le_t *addr)
+{
+	for (size_t i = 0u; i < ARRAY_SIZE(devices); i++) {
+		if (devices[i].in_use && bt_addr_le_eq(&devices[i].addr, addr)) {
+			return &devices[i];
+		}
+	}
+
+	return NULL;
+}
+
+static struct device_entry *device_alloc(int64_t now)
+{
+	struct device_entry *oldest = &devices[0];
+
+	for (size_t i = 0u; i < ARRAY_SIZE(devices); i++) {
+		if (!devices[i].in_use) {
+			return &devices[i];
+		} else if (devices[i].last_seen < oldest->last_seen) {
+			oldest = &devices[i];
+		}
+	}
+
+	/* Registry full, evict the device heard from the longest time ago. The host
+	 * must be told it disappeared, if the queue is full the new device is not
+	 * tracked yet (it will be on one of its next advertisements).
+	 */
+	if (!oldest->appear_pending &&
+		device_event_emit(oldest, DEVICE_EVENT_DISAPPEAR, now) < 0) {
+		return NULL;
+	}
+
+	char addr_str[BT_ADDR_LE_STR_LEN];
+	bt_addr_le_to_str(&oldest->addr, addr_str, sizeof(addr_str));
+	LOG_WRN("Registry full, evicting %s", addr_str);
+
+	return oldest;
+}
+
+void device_registry_update(const bt_addr_le_t *addr,
+							enum device_type type,
+							int8_t rssi,
+							int counter,
+							bool suppressed,
+							const uint8_t *record,
+							size_t record_len)
+{
+	const int64_t now = k_uptime_get();
+	struct device_entry *dev;
+
+	k_mutex_lock(&devices_mutex, K_FOREVER);
+
+	dev = device_lookup(addr);
+	if (dev == NULL) {
+		dev = device_alloc(now);
+		if (dev == NULL) {
+			goto exit;
+		}
+
+		memset(dev, 0, sizeof(*dev));
+		dev->in_use		 = true;
+		dev->type		 = type;
+		dev->first_seen	 = now;
+		dev->next_health = now + CONFIG_COPRO_DEVICE_REGISTRY_HEALTH_INTERVAL;
+		dev->rssi_ewma	 = rssi * DEVICE_RSSI_EWMA_SCALE;
+		bt_addr_le_copy(&dev->addr, addr);
+	} else {
+		dev->rssi_ewma += (rssi * DEVICE_RSSI_EWMA_SCALE - dev->rssi_ewma) /
+						  (1 << CONFIG_COPRO_DEVICE_REGISTRY_RSSI_EWMA_SHIFT);
+	}
+
+	dev->last_seen = now;
+	dev->rssi_last = rssi;
+	dev->adv_count++;
+	dev->suppressed += suppressed ? 1u : 0u;
+
+	if (counter == DEVICE_COUNTER_NONE) {
+		dev->measurements++;
+	} else {
+		if (!dev->counter_valid) {
+			dev->counter_valid = true;
+			dev->measurements++;
+		} else {
+			/* The counter is incremented on every new measurement, which is
+			 * then advertised several times */
+			uint8_t gap = (uint8_t)counter - dev->counter;
+			if (gap != 0u) {
+				dev->measurements++;
+				dev->missed += gap - 1u;
+			}
+		}
+		dev->counter = (uint8_t)counter;
+	}
+
+#if CONFIG_COPRO_DEVICE_REGISTRY_SNAPSHOT
+	if (record != NULL && record_len <= sizeof(dev->record)) {
+		memcpy(dev->record, record, record_len);
+		dev->record_len = (uint8_t)record_len;
+	}
+#else
+	ARG_UNUSED(record);
+	ARG_UNUSED(record_len);
+#endif
+
+	/* Retried by the periodic check if the queue is full */
+	if (dev->adv_count == 1u) {
+		dev->appear_pending = device_event_emit(dev, DEVICE_EVENT_APPEAR, now) < 0;
+	}
+
+exit:
+	k_mutex_unlock(&devices_mutex);
+}
+
+static void registry_work_handler(struct k_work *work)
+{
+	const int64_t now = k_uptime_get();
+
+	k_mutex_lock(&devices_mutex, K_FOREVER);
+
+	for (size_t i = 0u; i < ARRAY_SIZE(devices); i++) {
+		struct device_entry *dev = &devices[i];
+		int ret					 = 0;
+
+		if (!dev->in_use) continue;
+
+		if (now - dev->last_seen >= CONFIG_COPRO_DEVICE_REGISTRY_TIMEOUT) {
+			/* A device never reported to the host disappears silently */
+			if (!dev->appear_pending) {
+				ret = device_event_emit(dev, DEVICE_EVENT_DISAPPEAR, now);
+			}
+			dev->in_use = ret < 0;
+		} else if (dev->appear_pending) {
+			ret					= device_event_emit(dev, DEVICE_EVENT_APPEAR, now);
+			dev->appear_pending = ret < 0;
+		} else if (CONFIG_COPRO_DEVICE_REGISTRY_HEALTH_INTERVAL > 0 &&
+				   now >= dev->next_health) {
+			ret = device_event_emit(dev, DEVICE_EVENT_HEALTH, now);
+			if (ret == 0) {
+				dev->next_health = now + CONFIG_COPRO_DEVICE_REGISTRY_HEALTH_INTERVAL;
+			}
+		}
+
+		/* Events which don't fit in the queue are retried on the next check */
+		if (ret < 0) break;
+	}
+
+	k_mutex_unlock(&devices_mutex);
+
+	k_work_schedule(&registry_work, K_MSEC(REGISTRY_CHECK_PERIOD_MS));
+}
+
+#if CONFIG_COPRO_DEVICE_REGISTRY_SNAPSHOT
+
+BUILD_ASSERT(XIAOMI_RECORD_BUF_SIZE <= DEVICE_SNAPSHOT_RECORD_MAX_SIZE &&
+			 LINKY_RECORD_BUF_SIZE <= DEVICE_SNAPSHOT_RECORD_MAX_SIZE);
+
+K_MSGQ_DEFINE(device_snapshot_msgq,
+			  DEVICE_SNAPSHOT_BUF_SIZE + LATENCY_STAMP_SIZE,
+			  CONFIG_COPRO_DEVICE_REGISTRY_SNAPSHOT_QUEUE_SIZE,
+			  4);
+
+BUILD_ASSERT(DEVICE_SNAPSHOT_TIMESTAMP_OFFSET + sizeof(int64_t) <=
+				 DEVICE_SNAPSHOT_BUF_SIZE,
+			 "Snapshot timestamp out of the record");
+#if CONFIG_COPRO_STREAM_CLIENT
+BUILD_ASSERT(DEVICE_SNAPSHOT_BUF_SIZE + LATENCY_STAMP_SIZE <=
+				 CONFIG_COPRO_STREAM_CHANNEL_MSG_MAX_SIZE,
+			 "Snapshots exceed COPRO_STREAM_CHANNEL_MSG_MAX_SIZE");
+#endif
+
+/* Snapshot in progress, protected by devices_mutex */
+static struct {
+	bool active;
+	uint16_t seq;	   // sequence number of the current snapshot
+	uint16_t index;	   // records sent so far
+	size_t cursor;	   // next device slot to visit
+	int64_t timestamp; // uptime (ms) of the request
+} snapshot;
+
+static void snapshot_work_handler(struct k_work *work);
+
+static K_WORK_DELAYABLE_DEFINE(snapshot_work, snapshot_work_handler);
+
+static uint32_t device_channel_id(uint8_t type)
+{
+	return (type == DEVICE_TYPE_LINKY_TIC) ? STREAM_CHANNEL_ID_LINKY_TIC
+										   : STREAM_CHANNEL_ID_XIAOMI;
+}
+
+static void snapshot_header_serialize(uint8_t flags,
+									  uint32_t channel_id,
+									  size_t record_len,
+									  uint8_t *buf)
+{
+	buf[0] = DEVICE_SNAPSHOT_HEADER_VERSION;
+	buf[1] = flags;
+	sys_put_le16(snapshot.seq, &buf[2]);
+	sys_put_le16(snapshot.index, &buf[4]);
+	sys_put_le64(snapshot.timestamp, &buf[6]);
+	sys_put_le32(channel_id, &buf[14]);
+	sys_put_le16((uint16_t)record_len, &buf[18]);
+}
+
+/* Replay the last record of every device, as many as the queue can hold, then
+ * the end message. The snapshot resumes where it stopped once the stream client
+ * has drained the queue, devices (dis)appearing meanwhile may or may not be part
+ * of it. */
+static void snapshot_work_handler(struct k_work *work)
+{
+	/* Not an advertisement, the latency stamp is left zeroed */
+	uint8_t buf[DEVICE_SNAPSHOT_BUF_SIZE + LATENCY_STAMP_SIZE];
+	bool active;
+
+	k_mutex_lock(&devices_mutex, K_FOREVER);
+
+	while (snapshot.active && k_msgq_num_free_get(&device_snapshot_msgq) > 0u) {
+		memset(buf, 0, sizeof(buf));
+
+		if (snapshot.cursor < ARRAY_SIZE(devices)) {
+			const struct device_entry *dev = &devices[snapshot.cursor++];
+
+			if (!dev->in_use || dev->record_len == 0u) continue;
+
+			snapshot_header_serialize(
+				0u, device_channel_id(dev->type), dev->record_len, buf);
+			memcpy(&buf[DEVICE_SNAPSHOT_HEADER_SIZE], dev->record, dev->record_len);
+			snapshot.index++;
+		} else {
+			snapshot_header_serialize(DEVICE_SNAPSHOT_FLAG_END, 0u, 0u, buf);
+			snapshot.active = false;
+		}
+
+		(void)k_msgq_put(&device_snapshot_msgq, buf, K_NO_WAIT);
+	}
+
+	active = snapshot.active;
+
+	k_mutex_unlock(&devices_mutex);
+
+	/* Without host the queue is not drained, the snapshot is restarted by the
+	 * connect handler instead.
+	 */
+	if (active && stream_client_is_connected()) {
+		k_work_schedule(&snapshot_work, K_MSEC(SNAPSHOT_RETRY_PERIOD_MS));
+	}
+}
+
+int device_registry_snapshot_request(void)
+{
+	int ret;
+
+	k_mutex_lock(&devices_mutex, K_FOREVER);
+
+	/* Records of a previous snapshot are dropped, the host discards the
+	 * incomplete one when the sequence number changes */
+	k_msgq_purge(&device_snapshot_msgq);
+
+	snapshot.seq++;
+	snapshot.active	   = true;
+	snapshot.index	   = 0u;
+	snapshot.cursor	   = 0u;
+	snapshot.timestamp = k_uptime_get();
+
+	k_mutex_unlock(&devices_mutex);
+
+	ret = k_work_reschedule(&snapshot_work, K_NO_WAIT);
+
+	return ret < 0 ? ret : 0;
+}
+
+int device_registry_control_snapshot(uint8_t type, const uint8_t *data, size_t len)
+{
+	ARG_UNUSED(type);
+	ARG_UNUSED(data);
+	ARG_UNUSED(len);
+
+	return device_registry_snapshot_request();
+}
+
+#endif /* CONFIG_COPRO_DEVICE_REGISTRY_SNAPSHOT */
+
+int device_registry_init(void)
+{
+	int ret = k_work_schedule(&registry_work, K_MSEC(REGISTRY_CHECK_PERIOD_MS));
+
+	return ret < 0 ? ret : 0;
+}
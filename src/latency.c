@@ -0,0 +1,169 @@
+/*
+ * Copyright (c) 2025 Lucas Dietrich <ld.adecy@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/byteorder.h>
+
+#include <latency.h>
+
+LOG_MODULE_REGISTER(latency, LOG_LEVEL_INF);
+
+struct latency_histogram {
+	uint32_t count;
+	uint64_t sum_us;
+	uint32_t max_us;
+	uint32_t buckets[LATENCY_BUCKETS];
+};
+
+static struct latency_histogram histograms[LATENCY_STAGES_COUNT];
+
+static struct k_spinlock histograms_lock;
+
+K_MSGQ_DEFINE(latency_msgq,
+			  LATENCY_RECORD_BUF_SIZE + LATENCY_STAMP_SIZE,
+			  LATENCY_STAGES_COUNT,
+			  4);
+
+BUILD_ASSERT(LATENCY_RECORD_BUF_SIZE + LATENCY_STAMP_SIZE <=
+				 CONFIG_COPRO_STREAM_CHANNEL_MSG_MAX_SIZE,
+			 "Latency histograms exceed COPRO_STREAM_CHANNEL_MSG_MAX_SIZE");
+
+static uint32_t bucket_index(uint32_t us)
+{
+	uint32_t idx = (us == 0u) ? 0u : 32u - (uint32_t)__builtin_clz(us);
+
+	return MIN(idx, LATENCY_BUCKETS - 1u);
+}
+
+static void histogram_add(enum latency_stage stage, uint32_t us)
+{
+	struct latency_histogram *h = &histograms[stage];
+	k_spinlock_key_t key;
+
+	key = k_spin_lock(&histograms_lock);
+	h->count++;
+	h->sum_us += us;
+	h->max_us = MAX(h->max_us, us);
+	h->buckets[bucket_index(us)]++;
+	k_spin_unlock(&histograms_lock, key);
+}
+
+static uint32_t timing_cycles_to_us(uint64_t cycles)
+{
+	return (uint32_t)MIN(timing_cycles_to_ns(cycles) / 1000u, UINT32_MAX);
+}
+
+void latency_record(enum latency_stage stage, uint32_t cycles)
+{
+	histogram_add(stage, k_cyc_to_us_floor32(cycles));
+}
+
+void latency_record_timing(enum latency_stage stage, timing_t start, timing_t end)
+{
+	histogram_add(stage, timing_cycles_to_us(timing_cycles_get(&start, &end)));
+}
+
+/* Execution time of the current thread, counted with the timing functions
+ * (THREAD_RUNTIME_STATS_USE_TIMING_FUNCTIONS), the running slice included */
+static uint64_t thread_cpu_cycles(void)
+{
+	k_thread_runtime_stats_t rt;
+
+	if (k_thread_runtime_stats_get(k_current_get(), &rt) < 0) {
+		return 0u;
+	}
+
+	return rt.execution_cycles;
+}
+
+static bool stamp_get(const uint8_t *msg_end, struct latency_stamp *stamp)
+{
+	memcpy(stamp, msg_end - LATENCY_STAMP_SIZE, LATENCY_STAMP_SIZE);
+
+	return stamp->found != 0u || stamp->enqueued != 0u;
+}
+
+void latency_stamp_dequeued(const uint8_t *msg_end)
+{
+	struct latency_stamp stamp;
+
+	if (stamp_get(msg_end, &stamp)) {
+		latency_record(LATENCY_STAGE_QUEUE, k_cycle_get_32() - stamp.enqueued);
+	}
+}
+
+void latency_send_start(struct latency_send *send)
+{
+	send->cpu_start = thread_cpu_cycles();
+	send->start		= timing_counter_get();
+}
+
+void latency_stamp_sent(const uint8_t *msg_end, const struct latency_send *send)
+{
+	struct latency_stamp stamp;
+	const timing_t end = timing_counter_get();
+	const uint64_t cpu = thread_cpu_cycles() - send->cpu_start;
+	const uint32_t now = k_cycle_get_32();
+
+	if (stamp_get(msg_end, &stamp)) {
+		latency_record_timing(LATENCY_STAGE_SEND, send->start, end);
+		histogram_add(LATENCY_STAGE_SEND_CPU, timing_cycles_to_us(cpu));
+		latency_record(LATENCY_STAGE_TOTAL, now - stamp.found);
+	}
+}
+
+static void histogram_serialize(enum latency_stage stage,
+								const struct latency_histogram *h,
+								uint8_t *buf)
+{
+	buf[0] = stage;
+	buf[1] = LATENCY_RECORD_HEADER_VERSION;
+	buf[2] = LATENCY_BUCKETS;
+	sys_put_le32(h->count, &buf[3]);
+	sys_put_le64(h->sum_us, &buf[7]);
+	sys_put_le32(h->max_us, &buf[15]);
+	for (uint32_t i = 0u; i < LATENCY_BUCKETS; i++) {
+		sys_put_le32(h->buckets[i], &buf[19u + 4u * i]);
+	}
+}
+
+int latency_control_export(uint8_t type, const uint8_t *data, size_t len)
+{
+	uint8_t buf[LATENCY_RECORD_BUF_SIZE + LATENCY_STAMP_SIZE] = {0};
+	struct latency_histogram snapshot[LATENCY_STAGES_COUNT];
+	const bool reset = len > 0 && (data[0] & LATENCY_EXPORT_FLAG_RESET) != 0;
+	k_spinlock_key_t key;
+	int ret;
+
+	ARG_UNUSED(type);
+
+	if (k_msgq_num_free_get(&latency_msgq) < LATENCY_STAGES_COUNT) {
+		return -EBUSY;
+	}
+
+	key = k_spin_lock(&histograms_lock);
+	memcpy(snapshot, histograms, sizeof(snapshot));
+	if (reset) {
+		memset(histograms, 0, sizeof(histograms));
+	}
+	k_spin_unlock(&histograms_lock, key);
+
+	for (int stage = 0; stage < LATENCY_STAGES_COUNT; stage++) {
+		histogram_serialize(stage, &snapshot[stage], buf);
+
+		ret = k_msgq_put(&latency_msgq, buf, K_NO_WAIT);
+		if (ret < 0) {
+			LOG_ERR("Failed to put latency histogram in msgq: %d", ret);
+			return ret;
+		}
+	}
+
+	return 0;
+}
@@ -10,11 +10,23 @@
 #include <zephyr/logging/log.h>
 #include <zephyr/sys/byteorder.h>
 
+#include <latency.h>
 #include <linky.h>
 
 LOG_MODULE_REGISTER(linky, LOG_LEVEL_INF);
 
-K_MSGQ_DEFINE(linky_msgq, LINKY_RECORD_BUF_SIZE, CONFIG_COPRO_LINKY_QUEUE_SIZE, 4);
+K_MSGQ_DEFINE(linky_msgq,
+			  LINKY_RECORD_BUF_SIZE + LATENCY_STAMP_SIZE,
+			  CONFIG_COPRO_LINKY_QUEUE_SIZE,
+			  4);
+
+BUILD_ASSERT(LINKY_RECORD_TIMESTAMP_OFFSET + sizeof(int64_t) <= LINKY_RECORD_BUF_SIZE,
+			 "Linky record timestamp out of the record");
+#if CONFIG_COPRO_STREAM_CLIENT
+BUILD_ASSERT(LINKY_RECORD_BUF_SIZE + LATENCY_STAMP_SIZE <=
+				 CONFIG_COPRO_STREAM_CHANNEL_MSG_MAX_SIZE,
+			 "Linky records exceed COPRO_STREAM_CHANNEL_MSG_MAX_SIZE");
+#endif
 
 bool linky_adv_data_recognize_cb(struct bt_data *data, void *user_data)
 {
@@ -12,6 +12,9 @@
 #include <zephyr/usb/usb_device.h>
 
 #include <ble_observer.h>
+#include <config_server.h>
+#include <device_registry.h>
+#include <latency.h>
 #include <led.h>
 #include <linky.h>
 #include <stream_client.h>
@@ -20,6 +23,38 @@
 
 LOG_MODULE_REGISTER(ble, LOG_LEVEL_INF);
 
+#if CONFIG_COPRO_XIAOMI_LYWSD03MMC
+static const struct stream_channel_config xiaomi_channel_config = {
+	.priority		  = CONFIG_COPRO_XIAOMI_STREAM_PRIORITY,
+	.weight			  = CONFIG_COPRO_XIAOMI_STREAM_WEIGHT,
+	.timestamp_offset = XIAOMI_RECORD_TIMESTAMP_OFFSET,
+};
+#endif
+
+#if CONFIG_COPRO_LINKY_TIC
+static const struct stream_channel_config linky_channel_config = {
+	.priority		  = CONFIG_COPRO_LINKY_STREAM_PRIORITY,
+	.weight			  = CONFIG_COPRO_LINKY_STREAM_WEIGHT,
+	.timestamp_offset = LINKY_RECORD_TIMESTAMP_OFFSET,
+};
+#endif
+
+#if CONFIG_COPRO_DEVICE_REGISTRY
+static const struct stream_channel_config device_health_channel_config = {
+	.priority		  = CONFIG_COPRO_DEVICE_REGISTRY_STREAM_PRIORITY,
+	.weight			  = CONFIG_COPRO_DEVICE_REGISTRY_STREAM_WEIGHT,
+	.timestamp_offset = DEVICE_RECORD_TIMESTAMP_OFFSET,
+};
+#endif
+
+#if CONFIG_COPRO_DEVICE_REGISTRY_SNAPSHOT
+static const struct stream_channel_config device_snapshot_channel_config = {
+	.priority		  = CONFIG_COPRO_DEVICE_REGISTRY_SNAPSHOT_STREAM_PRIORITY,
+	.weight			  = 1u,
+	.timestamp_offset = DEVICE_SNAPSHOT_TIMESTAMP_OFFSET,
+};
+#endif
+
 int main(void)
 {
 	int ret;
@@ -38,7 +73,7 @@ int main(void)
 	usb_net_iface_init();
 #endif
 
-#if !CONFIG_USB_DEVICE_INITIALIZE_AT_BOOT
+#if CONFIG_USB_DEVICE_STACK && !CONFIG_USB_DEVICE_INITIALIZE_AT_BOOT
 	/* Initialize the USB Subsystem */
 	ret = usb_enable(NULL);
 	if (ret != 0) {
@@ -58,31 +93,116 @@ int main(void)
 
 	LOG_INF("Bluetooth initialized %d", 0);
 
+#if CONFIG_COPRO_XIAOMI_ENCRYPTED
+	ret = xiaomi_encrypted_init();
+	if (ret < 0) {
+		LOG_ERR("Failed to initialize xiaomi decryption: %d", ret);
+		return ret;
+	}
+#endif /* CONFIG_COPRO_XIAOMI_ENCRYPTED */
+
+#if CONFIG_COPRO_DEVICE_REGISTRY
+	ret = device_registry_init();
+	if (ret < 0) {
+		LOG_ERR("Failed to initialize device registry: %d", ret);
+		return ret;
+	}
+#endif /* CONFIG_COPRO_DEVICE_REGISTRY */
+
 	/* Start the BLE observer thread */
 	ble_observer_start();
 
+	/* A channel which cannot be added (e.g. CONFIG_COPRO_STREAM_CHANNELS_COUNT
+	 * too small) is skipped, the other ones are still streamed.
+	 */
+
 #if CONFIG_COPRO_XIAOMI_LYWSD03MMC
 	/* Configure the stream client */
-	ret = stream_client_channel_add(
-		STREAM_CHANNEL_ID_XIAOMI, STREAM_CHANNEL_NAME_XIAOMI, &xiaomi_msgq);
+	ret = stream_client_channel_add(STREAM_CHANNEL_ID_XIAOMI,
+									STREAM_CHANNEL_NAME_XIAOMI,
+									&xiaomi_msgq,
+									&xiaomi_channel_config);
 	if (ret < 0) {
 		LOG_ERR("Failed to add xiaomi channel to stream client: %d", ret);
-		return ret;
 	}
 #endif /* CONFIG_COPRO_XIAOMI_LYWSD03MMC */
 
+#if CONFIG_COPRO_XIAOMI_ENCRYPTED
+	/* Bind keys provisioning */
+	ret = stream_client_control_register(STREAM_CONTROL_XIAOMI_KEY_SET,
+										 xiaomi_control_key_set);
+	if (ret == 0) {
+		ret = stream_client_control_register(STREAM_CONTROL_XIAOMI_KEY_REMOVE,
+											 xiaomi_control_key_remove);
+	}
+	if (ret < 0) {
+		LOG_ERR("Failed to register xiaomi control handlers: %d", ret);
+		return ret;
+	}
+#endif /* CONFIG_COPRO_XIAOMI_ENCRYPTED */
+
 #if CONFIG_COPRO_LINKY_TIC
 	/* Configure the stream client */
-	ret = stream_client_channel_add(
-		STREAM_CHANNEL_ID_LINKY_TIC, STREAM_CHANNEL_NAME_LINKY_TIC, &linky_msgq);
+	ret = stream_client_channel_add(STREAM_CHANNEL_ID_LINKY_TIC,
+									STREAM_CHANNEL_NAME_LINKY_TIC,
+									&linky_msgq,
+									&linky_channel_config);
 	if (ret < 0) {
 		LOG_ERR("Failed to add linky channel to stream client: %d", ret);
-		return ret;
 	}
 #endif /* CONFIG_COPRO_LINKY_TIC */
 
+#if CONFIG_COPRO_DEVICE_REGISTRY
+	ret = stream_client_channel_add(STREAM_CHANNEL_ID_DEVICE_HEALTH,
+									STREAM_CHANNEL_NAME_DEVICE_HEALTH,
+									&device_registry_msgq,
+									&device_health_channel_config);
+	if (ret < 0) {
+		LOG_ERR("Failed to add device health channel to stream client: %d", ret);
+	}
+#endif /* CONFIG_COPRO_DEVICE_REGISTRY */
+
+#if CONFIG_COPRO_DEVICE_REGISTRY_SNAPSHOT
+	/* Replay the last record of every device on connection and on request */
+	ret = stream_client_channel_add(STREAM_CHANNEL_ID_DEVICE_SNAPSHOT,
+									STREAM_CHANNEL_NAME_DEVICE_SNAPSHOT,
+									&device_snapshot_msgq,
+									&device_snapshot_channel_config);
+	if (ret < 0) {
+		LOG_ERR("Failed to add device snapshot channel to stream client: %d", ret);
+	} else {
+		ret = stream_client_connect_register(device_registry_snapshot_request);
+		if (ret == 0) {
+			ret = stream_client_control_register(STREAM_CONTROL_SNAPSHOT,
+												 device_registry_control_snapshot);
+		}
+		if (ret < 0) {
+			LOG_ERR("Failed to register device snapshot handlers: %d", ret);
+			return ret;
+		}
+	}
+#endif /* CONFIG_COPRO_DEVICE_REGISTRY_SNAPSHOT */
+
+#if CONFIG_COPRO_LATENCY_PROBES
+	ret = stream_client_control_register(STREAM_CONTROL_LATENCY_EXPORT,
+										 latency_control_export);
+	if (ret < 0) {
+		LOG_ERR("Failed to register latency control handler: %d", ret);
+		return ret;
+	}
+#endif /* CONFIG_COPRO_LATENCY_PROBES */
+
 	/* Start the stream client */
 	stream_client_start();
 
+#if CONFIG_COPRO_CONFIG_SERVER
+	/* Apply the persisted settings once every channel is registered */
+	ret = config_server_init();
+	if (ret < 0) {
+		LOG_ERR("Failed to initialize config server: %d", ret);
+		return ret;
+	}
+#endif /* CONFIG_COPRO_CONFIG_SERVER */
+
 	return 0;
 }
\ No newline at end of file
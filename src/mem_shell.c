@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) 2025 Lucas Dietrich <ld.adecy@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/sys_heap.h>
+
+#if CONFIG_COPRO_STREAM_CLIENT
+#include <stream_client.h>
+#endif
+
+#if K_HEAP_MEM_POOL_SIZE > 0
+extern struct k_heap _system_heap;
+#endif
+
+static void stack_print(const struct k_thread *thread, void *user_data)
+{
+	const struct shell *sh = user_data;
+	const char *name	   = k_thread_name_get((k_tid_t)thread);
+	size_t size			   = thread->stack_info.size;
+	size_t unused;
+
+	if (name == NULL || name[0] == '\0') {
+		name = "-";
+	}
+
+	/* Requires INIT_STACKS, the unused part is the one still holding the
+	 * initialization pattern: used is a high-water mark, not the current depth.
+	 */
+	if (k_thread_stack_space_get(thread, &unused) < 0 || size == 0u) {
+		shell_print(sh, "%-24s %6zu %6s %6s", name, size, "?", "?");
+		return;
+	}
+
+	shell_print(sh,
+				"%-24s %6zu %6zu %6zu %3zu %%",
+				name,
+				size,
+				size - unused,
+				unused,
+				(size - unused) * 100u / size);
+}
+
+static int cmd_stacks(const struct shell *sh, size_t argc, char **argv)
+{
+	ARG_UNUSED(argc);
+	ARG_UNUSED(argv);
+
+	shell_print(sh, "%-24s %6s %6s %6s %5s", "thread", "size", "used", "unused", "usage");
+	k_thread_foreach_unlocked(stack_print, (void *)sh);
+
+	return 0;
+}
+
+static int cmd_heap(const struct shell *sh, size_t argc, char **argv)
+{
+	ARG_UNUSED(argc);
+	ARG_UNUSED(argv);
+
+#if K_HEAP_MEM_POOL_SIZE > 0
+	struct sys_memory_stats stats;
+	int ret;
+
+	ret = sys_heap_runtime_stats_get(&_system_heap.heap, &stats);
+	if (ret < 0) {
+		shell_error(sh, "Failed to get heap statistics: %d", ret);
+		return ret;
+	}
+
+	shell_print(sh,
+				"system heap: %u bytes, allocated: %zu free: %zu peak: %zu",
+				(uint32_t)K_HEAP_MEM_POOL_SIZE,
+				stats.allocated_bytes,
+				stats.free_bytes,
+				stats.max_allocated_bytes);
+#else
+	shell_print(sh, "system heap: none");
+#endif
+
+	return 0;
+}
+
+#if CONFIG_COPRO_STREAM_CLIENT
+static void queue_print(uint32_t channel_id,
+						const char *name,
+						struct k_msgq *msgq,
+						const struct stream_channel_stats *stats,
+						void *user_data)
+{
+	const struct shell *sh = user_data;
+
+	ARG_UNUSED(channel_id);
+
+	shell_print(sh,
+				"%-24s %5zu %5u %5u %5u %6zu",
+				name,
+				msgq->msg_size,
+				msgq->max_msgs,
+				k_msgq_num_used_get(msgq),
+				stats->queue_peak,
+				msgq->msg_size * msgq->max_msgs);
+}
+#endif
+
+static int cmd_queues(const struct shell *sh, size_t argc, char **argv)
+{
+	ARG_UNUSED(argc);
+	ARG_UNUSED(argv);
+
+#if CONFIG_COPRO_STREAM_CLIENT
+	/* The peak is sampled by the stream thread when dequeuing, it stays at 0
+	 * until the host connects.
+	 */
+	shell_print(sh,
+				"%-24s %5s %5s %5s %5s %6s",
+				"channel",
+				"msg",
+				"slots",
+				"used",
+				"peak",
+				"bytes");
+	stream_client_channel_foreach(queue_print, (void *)sh);
+#else
+	shell_print(sh, "no stream client");
+#endif
+
+	return 0;
+}
+
+static int cmd_mem(const struct shell *sh, size_t argc, char **argv)
+{
+	cmd_stacks(sh, argc, argv);
+	shell_print(sh, "");
+	cmd_heap(sh, argc, argv);
+	shell_print(sh, "");
+
+	return cmd_queues(sh, argc, argv);
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+	sub_mem,
+	SHELL_CMD(stacks, NULL, "Stack high-water mark of every thread", cmd_stacks),
+	SHELL_CMD(heap, NULL, "System heap usage and peak", cmd_heap),
+	SHELL_CMD(queues, NULL, "Stream channel queues usage and peak", cmd_queues),
+	SHELL_SUBCMD_SET_END);
+
+SHELL_CMD_REGISTER(mem, &sub_mem, "Memory usage (stacks, heap, queues)", cmd_mem);
@@ -1,15 +1,39 @@
 #include <zephyr/kernel.h>
-#include <zephyr/net/net_ip.h>
-#include <zephyr/net/socket.h>
 #include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/crc.h>
 
+#include <latency.h>
 #include <led.h>
 #include <stream_client.h>
+#include <stream_transport.h>
 
 LOG_MODULE_REGISTER(stream_client, LOG_LEVEL_INF);
 
 #define CHANNEL_CONTROL_ID 0x00000000
 
+#define FRAME_V1_HEADER_SIZE 6u
+#define FRAME_V2_SYNC		 0xB1C0u
+#define FRAME_V2_HEADER_SIZE 8u
+#define FRAME_V2_CRC_SIZE	 4u
+
+#if CONFIG_COPRO_STREAM_FRAME_V2
+#define FRAME_OVERHEAD (FRAME_V2_HEADER_SIZE + FRAME_V2_CRC_SIZE)
+#else
+#define FRAME_OVERHEAD FRAME_V1_HEADER_SIZE
+#endif
+
+/* DRR quantum granted per round and unit of weight, the largest frame: a channel
+ * of weight 1 sends at least one message per round.
+ */
+#define DRR_QUANTUM (FRAME_OVERHEAD + CONFIG_COPRO_STREAM_CHANNEL_MSG_MAX_SIZE)
+
+/* Registered channels plus the control and latency channels */
+#define CHANNELS_MAX                                                                     \
+	(CONFIG_COPRO_STREAM_CHANNELS_COUNT + 1 + IS_ENABLED(CONFIG_COPRO_LATENCY_PROBES))
+
+/* Control messages payload is: type (1) | length (1) | data */
+#define CONTROL_MSG_HEADER_SIZE 2u
+
 typedef enum {
 	STREAM_UNINITIALIZED,
 	STREAM_DISCONNECTED,
@@ -20,31 +44,155 @@ typedef struct {
 	char name[32];		 // channel name
 	uint32_t channel_id; // channel id
 	struct k_msgq *msgq;
+	struct stream_channel_config cfg;
+	uint32_t quantum; // DRR quantum in bytes
+	uint32_t deficit; // DRR deficit counter in bytes
+	bool disabled;	  // messages of a disabled channel are dropped
+	struct stream_channel_stats stats;
 } chan_t;
 
 typedef struct {
-	int sock;
+	const struct stream_transport *transport;
 	scli_state_t state;
-	struct k_poll_event poll_events[CONFIG_COPRO_STREAM_CHANNELS_COUNT];
+	uint32_t conn_gen; // incremented on every connection
+	struct k_poll_event poll_events[CHANNELS_MAX + 1u];
 	size_t channels_count;
-	chan_t channels[CONFIG_COPRO_STREAM_CHANNELS_COUNT];
+	chan_t channels[CHANNELS_MAX];
+	size_t drr_cursor; // channel currently visited by the DRR scheduler
+	bool drr_granted;  // quantum already granted to the current channel
+	struct k_poll_signal rx_error; // raised by the RX thread on a receive error
+	uint32_t rx_dropped;		   // bad frames from the host dropped by resynchronising
+	stream_control_handler_t control_handlers[STREAM_CONTROL_HANDLERS_MAX];
+	uint8_t control_types[STREAM_CONTROL_HANDLERS_MAX];
+	stream_connect_handler_t connect_handlers[STREAM_CONNECT_HANDLERS_MAX];
 } scli_t;
 
 // Global stream client instance
 static scli_t scli = {
+#if CONFIG_COPRO_STREAM_TRANSPORT_SERIAL
+	.transport = &stream_transport_serial,
+#else
+	.transport = &stream_transport_tcp,
+#endif
 	.state = STREAM_UNINITIALIZED,
-	.sock  = -1,
 };
 
+K_MSGQ_DEFINE(control_msgq,
+			  CONFIG_COPRO_STREAM_CONTROL_MSG_SIZE + LATENCY_STAMP_SIZE,
+			  CONFIG_COPRO_STREAM_CONTROL_QUEUE_SIZE,
+			  4);
+
+K_SEM_DEFINE(rx_connected_sem, 0, 1);
+
 int thread(void *arg0, void *arg1, void *arg2);
+static void rx_thread(void *arg0, void *arg1, void *arg2);
+
+K_THREAD_DEFINE(stream_tid,
+				CONFIG_COPRO_STREAM_STACK_SIZE,
+				thread,
+				NULL,
+				NULL,
+				NULL,
+				K_PRIO_PREEMPT(10),
+				0,
+				SYS_FOREVER_MS);
+
+K_THREAD_DEFINE(stream_rx_tid,
+				CONFIG_COPRO_STREAM_RX_STACK_SIZE,
+				rx_thread,
+				NULL,
+				NULL,
+				NULL,
+				K_PRIO_PREEMPT(10),
+				0,
+				SYS_FOREVER_MS);
+
+/* The stack buffers of the threads, the message being sent plus its frame for the
+ * stream thread and the received control message for the RX thread, leave at
+ * least half of the stacks to the transport and logging calls.
+ */
+BUILD_ASSERT(2u * CONFIG_COPRO_STREAM_CHANNEL_MSG_MAX_SIZE + FRAME_V2_HEADER_SIZE +
+					 FRAME_V2_CRC_SIZE <=
+				 CONFIG_COPRO_STREAM_STACK_SIZE / 2u,
+			 "COPRO_STREAM_CHANNEL_MSG_MAX_SIZE too large for COPRO_STREAM_STACK_SIZE");
+BUILD_ASSERT(CONFIG_COPRO_STREAM_CONTROL_RX_MAX_SIZE + FRAME_V2_HEADER_SIZE +
+					 FRAME_V2_CRC_SIZE <=
+				 CONFIG_COPRO_STREAM_RX_STACK_SIZE / 2u,
+			 "COPRO_STREAM_CONTROL_RX_MAX_SIZE too large for COPRO_STREAM_RX_STACK_SIZE");
+BUILD_ASSERT(CONFIG_COPRO_STREAM_CONTROL_MSG_SIZE + LATENCY_STAMP_SIZE <=
+				 CONFIG_COPRO_STREAM_CHANNEL_MSG_MAX_SIZE,
+			 "COPRO_STREAM_CONTROL_MSG_SIZE exceeds COPRO_STREAM_CHANNEL_MSG_MAX_SIZE");
+
+static const struct stream_channel_config control_channel_config = {
+	.priority		  = 0u,
+	.weight			  = 1u,
+	.timestamp_offset = STREAM_CHANNEL_NO_TIMESTAMP,
+};
 
-K_THREAD_DEFINE(
-	stream_tid, 2048u, thread, NULL, NULL, NULL, K_PRIO_PREEMPT(10), 0, SYS_FOREVER_MS);
+#if CONFIG_COPRO_LATENCY_PROBES
+static const struct stream_channel_config latency_channel_config = {
+	.priority		  = UINT8_MAX,
+	.weight			  = 1u,
+	.timestamp_offset = STREAM_CHANNEL_NO_TIMESTAMP,
+};
+#endif
+
+static const struct stream_channel_config default_channel_config = {
+	.priority		  = UINT8_MAX,
+	.weight			  = 1u,
+	.timestamp_offset = STREAM_CHANNEL_NO_TIMESTAMP,
+};
 
-int stream_client_channel_add(uint32_t channel_id, const char *name, struct k_msgq *msgq)
+static int channel_register(uint32_t channel_id,
+							const char *name,
+							struct k_msgq *msgq,
+							const struct stream_channel_config *cfg)
 {
 	int i;
 
+	if (msgq == NULL || name == NULL || msgq->msg_size == 0 ||
+		msgq->msg_size > CONFIG_COPRO_STREAM_CHANNEL_MSG_MAX_SIZE) {
+		return -EINVAL;
+	}
+
+	if (cfg->weight == 0 ||
+		(cfg->timestamp_offset != STREAM_CHANNEL_NO_TIMESTAMP &&
+		 (cfg->timestamp_offset < 0 ||
+		  cfg->timestamp_offset + sizeof(int64_t) > msgq->msg_size))) {
+		return -EINVAL;
+	}
+
+	for (i = 0; i < CHANNELS_MAX; i++) {
+		chan_t *chan = &scli.channels[i];
+
+		if (chan->msgq == NULL || chan->channel_id == channel_id) {
+			if (chan->msgq == NULL) {
+				scli.channels_count++;
+			}
+
+			strncpy(chan->name, name, sizeof(chan->name) - 1);
+			chan->channel_id = channel_id;
+			chan->msgq		 = msgq;
+			chan->cfg		 = *cfg;
+			chan->quantum	 = cfg->weight * DRR_QUANTUM;
+			chan->deficit	 = 0u;
+
+			return 0;
+		}
+	}
+
+	return -ENOMEM;
+}
+
+int stream_client_channel_add(uint32_t channel_id,
+							  const char *name,
+							  struct k_msgq *msgq,
+							  const struct stream_channel_config *cfg)
+{
+	if (cfg == NULL) {
+		cfg = &default_channel_config;
+	}
+
 	if (scli.state != STREAM_UNINITIALIZED) {
 		return -EALREADY;
 	}
@@ -54,20 +202,48 @@ int stream_client_channel_add(uint32_t channel_id, const char *name, struct k_ms
 		return -EINVAL;
 	}
 
-	if (channel_id == 0 || msgq == NULL || name == NULL || msgq->msg_size == 0 ||
-		msgq->msg_size > CONFIG_COPRO_STREAM_CHANNEL_MSG_MAX_SIZE) {
+	/* Keep a slot for the control channel */
+	if (scli.channels_count >= CONFIG_COPRO_STREAM_CHANNELS_COUNT) {
+		return -ENOMEM;
+	}
+
+	return channel_register(channel_id, name, msgq, cfg);
+}
+
+int stream_client_control_register(uint8_t type, stream_control_handler_t handler)
+{
+	if (scli.state != STREAM_UNINITIALIZED) {
+		return -EALREADY;
+	}
+
+	if (handler == NULL) {
 		return -EINVAL;
 	}
 
-	for (i = 0; i < CONFIG_COPRO_STREAM_CHANNELS_COUNT; i++) {
-		if (scli.channels[i].channel_id == 0 ||
-			scli.channels[i].channel_id == channel_id) {
-			strncpy(scli.channels[i].name, name, sizeof(scli.channels[i].name));
-			scli.channels[i].channel_id = channel_id;
-			scli.channels[i].msgq		= msgq;
+	for (int i = 0; i < STREAM_CONTROL_HANDLERS_MAX; i++) {
+		if (scli.control_handlers[i] == NULL || scli.control_types[i] == type) {
+			scli.control_handlers[i] = handler;
+			scli.control_types[i]	 = type;
+			return 0;
+		}
+	}
 
-			scli.channels_count++;
+	return -ENOMEM;
+}
+
+int stream_client_connect_register(stream_connect_handler_t handler)
+{
+	if (scli.state != STREAM_UNINITIALIZED) {
+		return -EALREADY;
+	}
+
+	if (handler == NULL) {
+		return -EINVAL;
+	}
 
+	for (int i = 0; i < STREAM_CONNECT_HANDLERS_MAX; i++) {
+		if (scli.connect_handlers[i] == NULL) {
+			scli.connect_handlers[i] = handler;
 			return 0;
 		}
 	}
@@ -75,12 +251,228 @@ int stream_client_channel_add(uint32_t channel_id, const char *name, struct k_ms
 	return -ENOMEM;
 }
 
+int stream_client_control_send(uint8_t type, const void *data, size_t len)
+{
+	uint8_t msg[CONFIG_COPRO_STREAM_CONTROL_MSG_SIZE + LATENCY_STAMP_SIZE] = {0};
+
+	if (len > CONFIG_COPRO_STREAM_CONTROL_MSG_SIZE - CONTROL_MSG_HEADER_SIZE ||
+		(len > 0 && data == NULL)) {
+		return -EINVAL;
+	}
+
+	msg[0] = type;
+	msg[1] = (uint8_t)len;
+	if (len > 0) {
+		memcpy(&msg[CONTROL_MSG_HEADER_SIZE], data, len);
+	}
+
+	return k_msgq_put(&control_msgq, msg, K_NO_WAIT);
+}
+
+uint8_t stream_control_status(int ret)
+{
+	switch (ret) {
+	case 0:
+		return STREAM_CONTROL_STATUS_OK;
+	case -EINVAL:
+	case -EMSGSIZE:
+	case -ERANGE:
+	case -EDOM:
+		return STREAM_CONTROL_STATUS_INVALID;
+	case -ENOTSUP:
+	case -ENOSYS:
+		return STREAM_CONTROL_STATUS_UNSUPPORTED;
+	case -ENOENT:
+	case -ENODEV:
+		return STREAM_CONTROL_STATUS_NOT_FOUND;
+	case -ENOMEM:
+	case -ENOSPC:
+	case -ENOBUFS:
+		return STREAM_CONTROL_STATUS_NO_SPACE;
+	case -EBUSY:
+	case -EAGAIN:
+	case -EALREADY:
+		return STREAM_CONTROL_STATUS_BUSY;
+	case -EIO:
+		return STREAM_CONTROL_STATUS_IO;
+	default:
+		return STREAM_CONTROL_STATUS_ERROR;
+	}
+}
+
+static void control_ack(uint8_t type, int status)
+{
+	uint8_t ack[2u] = {type, stream_control_status(status)};
+
+	(void)stream_client_control_send(STREAM_CONTROL_ACK, ack, sizeof(ack));
+}
+
+static void control_dispatch(const uint8_t *msg, size_t len)
+{
+	uint8_t type;
+	size_t data_len;
+
+	if (len < CONTROL_MSG_HEADER_SIZE) {
+		LOG_WRN("Control message too short: %zu", len);
+		return;
+	}
+
+	type	 = msg[0];
+	data_len = MIN(msg[1], len - CONTROL_MSG_HEADER_SIZE);
+
+	for (int i = 0; i < STREAM_CONTROL_HANDLERS_MAX; i++) {
+		if (scli.control_handlers[i] != NULL && scli.control_types[i] == type) {
+			control_ack(
+				type,
+				scli.control_handlers[i](type, &msg[CONTROL_MSG_HEADER_SIZE], data_len));
+			return;
+		}
+	}
+
+	LOG_WRN("Unhandled control message type: 0x%02x", type);
+	control_ack(type, -ENOTSUP);
+}
+
+static chan_t *channel_lookup(uint32_t channel_id)
+{
+	for (int i = 0; i < scli.channels_count; i++) {
+		if (scli.channels[i].channel_id == channel_id) {
+			return &scli.channels[i];
+		}
+	}
+
+	return NULL;
+}
+
+int stream_client_channel_stats_get(uint32_t channel_id, struct stream_channel_stats *stats)
+{
+	chan_t *chan;
+
+	if (stats == NULL) {
+		return -EINVAL;
+	}
+
+	chan = channel_lookup(channel_id);
+	if (chan == NULL) {
+		return -ENOENT;
+	}
+
+	*stats = chan->stats;
+
+	return 0;
+}
+
+void stream_client_channel_foreach(stream_channel_foreach_cb_t cb, void *user_data)
+{
+	for (int i = 0; i < scli.channels_count; i++) {
+		chan_t *chan = &scli.channels[i];
+
+		cb(chan->channel_id, chan->name, chan->msgq, &chan->stats, user_data);
+	}
+}
+
+int stream_client_channel_config_set(uint32_t channel_id,
+									 const struct stream_channel_config *cfg)
+{
+	chan_t *chan;
+
+	if (cfg == NULL || cfg->weight == 0) {
+		return -EINVAL;
+	}
+
+	chan = channel_lookup(channel_id);
+	if (chan == NULL) {
+		return -ENOENT;
+	}
+
+	/* The stream thread must not see a half updated channel */
+	k_sched_lock();
+	chan->cfg.priority = cfg->priority;
+	chan->cfg.weight   = cfg->weight;
+	chan->quantum	   = cfg->weight * DRR_QUANTUM;
+	k_sched_unlock();
+
+	return 0;
+}
+
+int stream_client_channel_config_get(uint32_t channel_id,
+									 struct stream_channel_config *cfg)
+{
+	chan_t *chan;
+
+	if (cfg == NULL) {
+		return -EINVAL;
+	}
+
+	chan = channel_lookup(channel_id);
+	if (chan == NULL) {
+		return -ENOENT;
+	}
+
+	*cfg = chan->cfg;
+
+	return 0;
+}
+
+int stream_client_channel_enable(uint32_t channel_id, bool enable)
+{
+	chan_t *chan;
+
+	if (channel_id == CHANNEL_CONTROL_ID) {
+		/* Acks and control replies must always flow */
+		return -EPERM;
+	}
+
+	chan = channel_lookup(channel_id);
+	if (chan == NULL) {
+		return -ENOENT;
+	}
+
+	chan->disabled = !enable;
+
+	return 0;
+}
+
+int stream_client_channel_is_enabled(uint32_t channel_id)
+{
+	chan_t *chan = channel_lookup(channel_id);
+
+	if (chan == NULL) {
+		return -ENOENT;
+	}
+
+	return chan->disabled ? 0 : 1;
+}
+
+bool stream_client_is_connected(void)
+{
+	return scli.state == STREAM_CONNECTED;
+}
+
 int stream_client_start(void)
 {
+	int ret;
+
 	if (scli.state != STREAM_UNINITIALIZED) {
 		return -EALREADY;
 	}
 
+	ret = channel_register(
+		CHANNEL_CONTROL_ID, "control", &control_msgq, &control_channel_config);
+	if (ret < 0) {
+		return ret;
+	}
+
+#if CONFIG_COPRO_LATENCY_PROBES
+	ret = channel_register(STREAM_CHANNEL_ID_LATENCY,
+						   STREAM_CHANNEL_NAME_LATENCY,
+						   &latency_msgq,
+						   &latency_channel_config);
+	if (ret < 0) {
+		return ret;
+	}
+#endif
+
 	for (int i = 0; i < scli.channels_count; i++) {
 		k_poll_event_init(&scli.poll_events[i],
 						  K_POLL_TYPE_MSGQ_DATA_AVAILABLE,
@@ -88,7 +480,14 @@ int stream_client_start(void)
 						  scli.channels[i].msgq);
 	}
 
+	k_poll_signal_init(&scli.rx_error);
+	k_poll_event_init(&scli.poll_events[scli.channels_count],
+					  K_POLL_TYPE_SIGNAL,
+					  K_POLL_MODE_NOTIFY_ONLY,
+					  &scli.rx_error);
+
 	k_thread_start(stream_tid);
+	k_thread_start(stream_rx_tid);
 
 	scli.state = STREAM_DISCONNECTED;
 
@@ -97,37 +496,30 @@ int stream_client_start(void)
 
 static int try_connect(scli_t *s)
 {
-	int ret, sock;
-	struct sockaddr_in addr;
+	int ret;
 
 	__ASSERT_NO_MSG(s);
 
-	ret = net_addr_pton(AF_INET, CONFIG_COPRO_STREAM_HOST, &addr.sin_addr);
-	if (ret < 0) {
-		return ret;
-	}
-
-	addr.sin_family = AF_INET;
-	addr.sin_port	= htons(CONFIG_COPRO_STREAM_PORT);
-
-	sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-	if (sock < 0) {
-		LOG_ERR("Failed to create socket: %d", sock);
-		return sock;
-	}
-
-	ret = connect(sock, (struct sockaddr *)&addr, sizeof(addr));
+	ret = s->transport->connect();
 	if (ret < 0) {
-		LOG_ERR("Failed to connect: %d", ret);
-		close(sock);
 		return ret;
 	}
 
-	s->sock	 = sock;
 	s->state = STREAM_CONNECTED;
+	s->conn_gen++;
 	LED_ON();
 
-	LOG_INF("Connected to %s:%d", CONFIG_COPRO_STREAM_HOST, CONFIG_COPRO_STREAM_PORT);
+	for (int i = 0; i < STREAM_CONNECT_HANDLERS_MAX; i++) {
+		if (s->connect_handlers[i] != NULL) {
+			ret = s->connect_handlers[i]();
+			if (ret < 0) {
+				LOG_WRN("Connect handler %d failed: %d", i, ret);
+			}
+		}
+	}
+
+	/* Let the RX thread read from the new connection */
+	k_sem_give(&rx_connected_sem);
 
 	return 0;
 }
@@ -136,10 +528,7 @@ static int disconnect(scli_t *s)
 {
 	__ASSERT_NO_MSG(s);
 
-	if (s->sock >= 0) {
-		close(s->sock);
-		s->sock = -1;
-	}
+	s->transport->disconnect();
 
 	s->state = STREAM_DISCONNECTED;
 	LED_OFF();
@@ -147,6 +536,44 @@ static int disconnect(scli_t *s)
 	return 0;
 }
 
+#if CONFIG_COPRO_STREAM_FRAME_V2
+
+/* Channel data layout (v2) is as follows:
+ *  - 2 bytes: sync word (0xB1C0)
+ *  - 4 bytes: channel id
+ *  - 2 bytes: data length
+ *  - N bytes: data
+ *  - 4 bytes: CRC-32 (IEEE) of channel id, data length and data
+ *
+ * The sync word and CRC allow the receiver to scan forward to the next valid
+ * frame after a corruption instead of dropping the connection.
+ */
+
+static int channel_send_data(scli_t *s, uint32_t channel_id, void *data, size_t len)
+{
+	uint8_t frame[FRAME_V2_HEADER_SIZE + CONFIG_COPRO_STREAM_CHANNEL_MSG_MAX_SIZE +
+				  FRAME_V2_CRC_SIZE];
+
+	if (s->state != STREAM_CONNECTED) {
+		return -ENOTCONN;
+	}
+
+	if (len > CONFIG_COPRO_STREAM_CHANNEL_MSG_MAX_SIZE) {
+		return -EMSGSIZE;
+	}
+
+	sys_put_le16(FRAME_V2_SYNC, &frame[0u]);
+	sys_put_le32(channel_id, &frame[2u]);
+	sys_put_le16((uint16_t)len, &frame[6u]);
+	memcpy(&frame[FRAME_V2_HEADER_SIZE], data, len);
+	sys_put_le32(crc32_ieee(&frame[2u], FRAME_V2_HEADER_SIZE - 2u + len),
+				 &frame[FRAME_V2_HEADER_SIZE + len]);
+
+	return s->transport->send(frame, FRAME_V2_HEADER_SIZE + len + FRAME_V2_CRC_SIZE);
+}
+
+#else
+
 /* Channel data layout is as follows:
  *  - 4 bytes: channel id
  *  - 2 bytes: data length
@@ -155,39 +582,296 @@ static int disconnect(scli_t *s)
 
 static int channel_send_data(scli_t *s, uint32_t channel_id, void *data, size_t len)
 {
-	int ret;
+	uint8_t frame[FRAME_V1_HEADER_SIZE + CONFIG_COPRO_STREAM_CHANNEL_MSG_MAX_SIZE];
 
 	if (s->state != STREAM_CONNECTED) {
 		return -ENOTCONN;
 	}
 
-	// Prepare the header
-	char buf_hdr[6u];
+	if (len > CONFIG_COPRO_STREAM_CHANNEL_MSG_MAX_SIZE) {
+		return -EMSGSIZE;
+	}
 
-	sys_put_le32(channel_id, buf_hdr);
-	sys_put_le16((uint16_t)len, &buf_hdr[4u]);
+	sys_put_le32(channel_id, &frame[0u]);
+	sys_put_le16((uint16_t)len, &frame[4u]);
+	memcpy(&frame[FRAME_V1_HEADER_SIZE], data, len);
+
+	return s->transport->send(frame, FRAME_V1_HEADER_SIZE + len);
+}
 
-	// Write the header
-	ret = send(s->sock, buf_hdr, sizeof(buf_hdr), 0);
+#endif /* CONFIG_COPRO_STREAM_FRAME_V2 */
+
+/* Receive a frame sent by the host, using the same layout as channel_send_data().
+ * A bad frame (-EBADMSG or -EMSGSIZE) closes the connection, unless the
+ * transport can resynchronise on the next frame.
+ */
+static int channel_recv_data(scli_t *s, uint32_t *channel_id, uint8_t *buf, size_t *len)
+{
+	int ret;
+	uint16_t data_len;
+
+#if CONFIG_COPRO_STREAM_FRAME_V2
+	uint8_t hdr[FRAME_V2_HEADER_SIZE];
+	uint8_t crc[FRAME_V2_CRC_SIZE];
+
+	ret = s->transport->recv(hdr, sizeof(hdr));
 	if (ret < 0) {
-		LOG_ERR("Failed to send header: %d errno: %d", ret, errno);
 		return ret;
 	}
 
-	// Write the data
-	ret = send(s->sock, data, len, 0);
+	if (sys_get_le16(&hdr[0u]) != FRAME_V2_SYNC) {
+		return -EBADMSG;
+	}
+
+	*channel_id = sys_get_le32(&hdr[2u]);
+	data_len	= sys_get_le16(&hdr[6u]);
+#else
+	uint8_t hdr[FRAME_V1_HEADER_SIZE];
+
+	ret = s->transport->recv(hdr, sizeof(hdr));
 	if (ret < 0) {
-		LOG_ERR("Failed to send data: %d errno: %d", ret, errno);
 		return ret;
 	}
 
+	*channel_id = sys_get_le32(&hdr[0u]);
+	data_len	= sys_get_le16(&hdr[4u]);
+#endif
+
+	if (data_len > *len) {
+		return -EMSGSIZE;
+	}
+
+	ret = s->transport->recv(buf, data_len);
+	if (ret < 0) {
+		return ret;
+	}
+
+#if CONFIG_COPRO_STREAM_FRAME_V2
+	ret = s->transport->recv(crc, sizeof(crc));
+	if (ret < 0) {
+		return ret;
+	}
+
+	uint32_t crc_calc = crc32_ieee_update(crc32_ieee(&hdr[2u], 6u), buf, data_len);
+	if (crc_calc != sys_get_le32(crc)) {
+		return -EBADMSG;
+	}
+#endif
+
+	*len = data_len;
+
 	return 0;
 }
 
+static void rx_thread(void *arg0, void *arg1, void *arg2)
+{
+	int ret;
+	uint32_t gen;
+	uint32_t channel_id;
+	uint8_t buf[CONFIG_COPRO_STREAM_CONTROL_RX_MAX_SIZE];
+	size_t len;
+
+	for (;;) {
+		k_sem_take(&rx_connected_sem, K_FOREVER);
+
+		gen = scli.conn_gen;
+
+		for (;;) {
+			len = sizeof(buf);
+			ret = channel_recv_data(&scli, &channel_id, buf, &len);
+			if ((ret == -EBADMSG || ret == -EMSGSIZE) &&
+				scli.transport->resync != NULL) {
+				scli.transport->resync();
+				scli.rx_dropped++;
+				LOG_WRN("Dropped bad frame from host: %d (%u)", ret, scli.rx_dropped);
+				continue;
+			} else if (ret < 0) {
+				/* Only report errors of the current connection */
+				if (scli.state == STREAM_CONNECTED && scli.conn_gen == gen) {
+					LOG_ERR("Failed to receive data: %d", ret);
+					k_poll_signal_raise(&scli.rx_error, ret);
+				}
+				break;
+			}
+
+			if (channel_id != CHANNEL_CONTROL_ID) {
+				LOG_WRN("Ignoring data from host on channel %X", channel_id);
+				continue;
+			}
+
+			control_dispatch(buf, len);
+		}
+	}
+}
+
+static void channel_stats_update(chan_t *chan, const uint8_t *msg)
+{
+	struct stream_channel_stats *st = &chan->stats;
+
+	st->sent++;
+
+	if (chan->cfg.timestamp_offset != STREAM_CHANNEL_NO_TIMESTAMP) {
+		int64_t ts	  = (int64_t)sys_get_le64(&msg[chan->cfg.timestamp_offset]);
+		int64_t delay = k_uptime_get() - ts;
+
+		if (delay < 0) {
+			delay = 0;
+		}
+
+		st->delay_last_ms = (uint32_t)MIN(delay, UINT32_MAX);
+		st->delay_max_ms  = MAX(st->delay_max_ms, st->delay_last_ms);
+		st->delay_sum_ms += st->delay_last_ms;
+	}
+}
+
+/* Returns the highest priority (lowest value) among the channels having pending
+ * messages, or -1 if all queues are empty. The queues of disabled channels are
+ * drained on the way.
+ */
+static int sched_top_priority(scli_t *s)
+{
+	int prio = -1;
+
+	for (int i = 0; i < s->channels_count; i++) {
+		chan_t *chan = &s->channels[i];
+
+		if (chan->disabled) {
+			k_msgq_purge(chan->msgq);
+			continue;
+		}
+
+		if (k_msgq_num_used_get(chan->msgq) > 0 &&
+			(prio < 0 || chan->cfg.priority < prio)) {
+			prio = chan->cfg.priority;
+		}
+	}
+
+	return prio;
+}
+
+/* Bytes written to the transport for a message of the channel, the latency stamp
+ * is not sent
+ */
+static uint32_t channel_frame_size(const chan_t *chan)
+{
+	return FRAME_OVERHEAD + chan->msgq->msg_size - LATENCY_STAMP_SIZE;
+}
+
+static void sched_advance(scli_t *s)
+{
+	s->drr_cursor  = (s->drr_cursor + 1) % s->channels_count;
+	s->drr_granted = false;
+}
+
+/* Drain all queues using strict priority between classes and deficit round-robin
+ * among channels of the same class. The top priority is re-evaluated after every
+ * message so a latency-critical channel waits for at most one message from a
+ * lower class, whatever the volume of bulk channels.
+ *
+ * Messages are charged the size of their frame, channels of the same class share
+ * the link bandwidth in bytes in proportion to their weight, whatever the size of
+ * their messages.
+ */
+static int sched_run(scli_t *s, uint8_t *buf)
+{
+	int ret;
+	int prio;
+
+	while ((prio = sched_top_priority(s)) >= 0) {
+		chan_t *chan = &s->channels[s->drr_cursor];
+
+		if (chan->disabled || k_msgq_num_used_get(chan->msgq) == 0) {
+			/* Idle channels do not accumulate credit */
+			chan->deficit = 0u;
+			sched_advance(s);
+			continue;
+		}
+
+		if (chan->cfg.priority != prio) {
+			sched_advance(s);
+			continue;
+		}
+
+		if (!s->drr_granted) {
+			chan->deficit += chan->quantum;
+			s->drr_granted = true;
+		}
+
+		if (chan->deficit < channel_frame_size(chan)) {
+			sched_advance(s);
+			continue;
+		}
+
+		chan->stats.queue_peak =
+			MAX(chan->stats.queue_peak, k_msgq_num_used_get(chan->msgq));
+
+		if (k_msgq_get(chan->msgq, (void *)buf, K_NO_WAIT) != 0) {
+			continue;
+		}
+
+		chan->deficit -= channel_frame_size(chan);
+		channel_stats_update(chan, buf);
+
+#if CONFIG_COPRO_LATENCY_PROBES
+		struct latency_send send;
+
+		latency_stamp_dequeued(&buf[chan->msgq->msg_size]);
+		latency_send_start(&send);
+#endif
+
+		/* The latency stamp, if any, is not sent */
+		ret = channel_send_data(
+			s, chan->channel_id, buf, chan->msgq->msg_size - LATENCY_STAMP_SIZE);
+		if (ret < 0) {
+			LOG_ERR("[channel %s:%X] Failed to send data: %d",
+					chan->name,
+					chan->channel_id,
+					ret);
+			return ret;
+		}
+
+#if CONFIG_COPRO_LATENCY_PROBES
+		latency_stamp_sent(&buf[chan->msgq->msg_size], &send);
+#endif
+	}
+
+	return 0;
+}
+
+#if CONFIG_COPRO_STREAM_STATS_INTERVAL > 0
+static void stats_log(scli_t *s)
+{
+	for (int i = 0; i < s->channels_count; i++) {
+		struct stream_channel_stats *st = &s->channels[i].stats;
+
+		LOG_INF("[channel %s] prio: %u weight: %u sent: %u delay last: %u ms max: %u "
+				"ms avg: %u ms queue peak: %u/%u",
+				s->channels[i].name,
+				s->channels[i].cfg.priority,
+				s->channels[i].cfg.weight,
+				st->sent,
+				st->delay_last_ms,
+				st->delay_max_ms,
+				st->sent ? (uint32_t)(st->delay_sum_ms / st->sent) : 0u,
+				st->queue_peak,
+				s->channels[i].msgq->max_msgs);
+	}
+	if (s->transport->resync != NULL) {
+		LOG_INF("rx frames dropped: %u", s->rx_dropped);
+	}
+}
+#endif
+
 int thread(void *arg0, void *arg1, void *arg2)
 {
 	int ret;
-	char buf[CONFIG_COPRO_STREAM_CHANNEL_MSG_MAX_SIZE];
+	uint8_t buf[CONFIG_COPRO_STREAM_CHANNEL_MSG_MAX_SIZE];
+#if CONFIG_COPRO_STREAM_STATS_INTERVAL > 0
+	int64_t stats_next = k_uptime_get() + CONFIG_COPRO_STREAM_STATS_INTERVAL;
+	const k_timeout_t poll_timeout = K_MSEC(CONFIG_COPRO_STREAM_STATS_INTERVAL);
+#else
+	const k_timeout_t poll_timeout = K_FOREVER;
+#endif
 
 	for (;;) {
 		switch (scli.state) {
@@ -197,34 +881,35 @@ int thread(void *arg0, void *arg1, void *arg2)
 			}
 			break;
 		case STREAM_CONNECTED:
-			ret = k_poll(scli.poll_events, scli.channels_count, K_FOREVER);
-			if (ret < 0) {
-				if (ret == -EAGAIN) {
-					// Timeout, should not happen
-					continue;
-				} else {
-					LOG_ERR("Failed to poll: %d", ret);
-					disconnect(&scli);
-				}
+			ret = k_poll(scli.poll_events, scli.channels_count + 1u, poll_timeout);
+			if (ret < 0 && ret != -EAGAIN) {
+				LOG_ERR("Failed to poll: %d", ret);
+				disconnect(&scli);
+				break;
 			}
 
 			for (int i = 0; i < scli.channels_count; i++) {
-				if (scli.poll_events[i].state == K_POLL_STATE_MSGQ_DATA_AVAILABLE) {
-					chan_t *chan = &scli.channels[i];
-
-					if (k_msgq_get(chan->msgq, (void *)buf, K_NO_WAIT) == 0) {
-						ret = channel_send_data(
-							&scli, chan->channel_id, buf, chan->msgq->msg_size);
-						if (ret < 0) {
-							LOG_ERR("[channel %s:%X] Failed to send data: %d",
-									chan->name,
-									chan->channel_id,
-									ret);
-							disconnect(&scli);
-						}
-					}
-				}
+				scli.poll_events[i].state = K_POLL_STATE_NOT_READY;
+			}
+
+			if (scli.poll_events[scli.channels_count].state == K_POLL_STATE_SIGNALED) {
+				scli.poll_events[scli.channels_count].state = K_POLL_STATE_NOT_READY;
+				k_poll_signal_reset(&scli.rx_error);
+				disconnect(&scli);
+				break;
+			}
+
+			ret = sched_run(&scli, buf);
+			if (ret < 0) {
+				disconnect(&scli);
+			}
+
+#if CONFIG_COPRO_STREAM_STATS_INTERVAL > 0
+			if (k_uptime_get() >= stats_next) {
+				stats_log(&scli);
+				stats_next = k_uptime_get() + CONFIG_COPRO_STREAM_STATS_INTERVAL;
 			}
+#endif
 			break;
 		case STREAM_UNINITIALIZED:
 		default:
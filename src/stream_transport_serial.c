@@ -0,0 +1,352 @@
+/*
+ * Copyright (c) 2025 Lucas Dietrich <ld.adecy@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <zephyr/device.h>
+#include <zephyr/drivers/uart.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/ring_buffer.h>
+
+#include <stream_transport.h>
+
+LOG_MODULE_REGISTER(stream_serial, LOG_LEVEL_INF);
+
+/* COBS (Consistent Overhead Byte Stuffing): the frame is split into blocks at
+ * every 0x00 byte, each block is prefixed with its length + 1 and the 0x00 is
+ * dropped. A block of 254 non-zero bytes (code 0xFF) is not followed by an
+ * implicit 0x00. The encoded frame contains no 0x00, which is used as delimiter.
+ *
+ * Empty packets are ignored, the host may send a delimiter to flush garbage.
+ */
+#define COBS_DELIMITER 0x00u
+#define COBS_BLOCK_MAX 254u
+
+/* Largest v2 frame and its encoding: one code byte per block of 254 bytes, plus
+ * the trailing block and the delimiter */
+#define FRAME_MAX_SIZE	 (8u + CONFIG_COPRO_STREAM_CHANNEL_MSG_MAX_SIZE + 4u)
+#define ENCODED_MAX_SIZE (FRAME_MAX_SIZE + FRAME_MAX_SIZE / COBS_BLOCK_MAX + 2u)
+
+/* Delay before a stalled host is considered gone */
+#define TX_TIMEOUT_MS 1000u
+
+/* Receive polling period when the UART is not interrupt driven */
+#define RX_POLL_INTERVAL_MS 1u
+
+static const struct device *const uart = DEVICE_DT_GET(DT_CHOSEN(copro_stream_uart));
+
+static volatile bool connected;
+
+/* COBS decoder state, only accessed from the RX thread */
+static struct {
+	bool zero_pending; // the current block ends with an implicit 0x00
+	uint8_t remaining; // data bytes left in the current block
+	bool in_packet;	   // bytes of the current packet were consumed
+	bool skip;		   // drop the bytes up to the next delimiter
+} rx;
+
+#if CONFIG_UART_INTERRUPT_DRIVEN
+
+RING_BUF_DECLARE(rx_ring, CONFIG_COPRO_STREAM_SERIAL_RX_BUF_SIZE);
+RING_BUF_DECLARE(tx_ring, CONFIG_COPRO_STREAM_SERIAL_TX_BUF_SIZE);
+
+static K_SEM_DEFINE(rx_sem, 0, 1);
+static K_SEM_DEFINE(tx_sem, 0, 1);
+
+static uint32_t rx_overruns;
+
+static void uart_isr(const struct device *dev, void *user_data)
+{
+	uint8_t *data;
+	uint8_t discard[16u];
+	uint32_t size;
+	int len;
+
+	ARG_UNUSED(user_data);
+
+	while (uart_irq_update(dev) && uart_irq_is_pending(dev)) {
+		if (uart_irq_rx_ready(dev)) {
+			size = ring_buf_put_claim(&rx_ring, &data, rx_ring.size);
+			if (size == 0u) {
+				/* The frame being received is lost, its CRC check fails */
+				len = uart_fifo_read(dev, discard, sizeof(discard));
+				rx_overruns += (len > 0) ? (uint32_t)len : 0u;
+			} else {
+				len = uart_fifo_read(dev, data, size);
+				ring_buf_put_finish(&rx_ring, (len > 0) ? (uint32_t)len : 0u);
+			}
+			k_sem_give(&rx_sem);
+		}
+
+		if (uart_irq_tx_ready(dev)) {
+			size = ring_buf_get_claim(&tx_ring, &data, tx_ring.size);
+			if (size == 0u) {
+				uart_irq_tx_disable(dev);
+			} else {
+				len = uart_fifo_fill(dev, data, size);
+				ring_buf_get_finish(&tx_ring, (len > 0) ? (uint32_t)len : 0u);
+			}
+			k_sem_give(&tx_sem);
+		}
+	}
+}
+
+static int uart_setup(void)
+{
+	return uart_irq_callback_user_data_set(uart, uart_isr, NULL);
+}
+
+static void uart_start(void)
+{
+	uart_irq_rx_disable(uart);
+	uart_irq_tx_disable(uart);
+	ring_buf_reset(&rx_ring);
+	ring_buf_reset(&tx_ring);
+	k_sem_reset(&rx_sem);
+	uart_irq_rx_enable(uart);
+}
+
+static void uart_stop(void)
+{
+	uart_irq_rx_disable(uart);
+	/* Wake up the RX thread */
+	k_sem_give(&rx_sem);
+}
+
+static int uart_write(const uint8_t *buf, size_t len)
+{
+	uint32_t put;
+
+	while (len > 0u) {
+		put = ring_buf_put(&tx_ring, buf, len);
+		uart_irq_tx_enable(uart);
+
+		buf += put;
+		len -= put;
+
+		if (len > 0u && k_sem_take(&tx_sem, K_MSEC(TX_TIMEOUT_MS)) < 0) {
+			return -ETIMEDOUT;
+		}
+	}
+
+	return 0;
+}
+
+static int uart_getc(uint8_t *c)
+{
+	while (ring_buf_get(&rx_ring, c, 1u) == 0u) {
+		if (!connected) {
+			return -ENOTCONN;
+		}
+
+		if (rx_overruns > 0u) {
+			LOG_WRN("RX overrun, %u bytes lost", rx_overruns);
+			rx_overruns = 0u;
+		}
+
+		(void)k_sem_take(&rx_sem, K_FOREVER);
+	}
+
+	return 0;
+}
+
+#else
+
+static int uart_setup(void)
+{
+	return 0;
+}
+
+static void uart_start(void)
+{
+	uint8_t c;
+
+	/* Drop the bytes received while disconnected */
+	while (uart_poll_in(uart, &c) == 0) {
+	}
+}
+
+static void uart_stop(void)
+{
+}
+
+static int uart_write(const uint8_t *buf, size_t len)
+{
+	for (size_t i = 0u; i < len; i++) {
+		uart_poll_out(uart, buf[i]);
+	}
+
+	return 0;
+}
+
+static int uart_getc(uint8_t *c)
+{
+	while (uart_poll_in(uart, c) != 0) {
+		if (!connected) {
+			return -ENOTCONN;
+		}
+
+		k_sleep(K_MSEC(RX_POLL_INTERVAL_MS));
+	}
+
+	return 0;
+}
+
+#endif /* CONFIG_UART_INTERRUPT_DRIVEN */
+
+/* A CDC-ACM host raises DTR when it opens the port, plain UARTs have no
+ * notion of it and are considered always connected */
+static bool host_ready(void)
+{
+#if CONFIG_UART_LINE_CTRL
+	uint32_t dtr;
+
+	if (uart_line_ctrl_get(uart, UART_LINE_CTRL_DTR, &dtr) == 0) {
+		return dtr != 0u;
+	}
+#endif
+
+	return true;
+}
+
+static int serial_connect(void)
+{
+	static bool setup_done;
+	int ret;
+
+	if (!device_is_ready(uart)) {
+		LOG_ERR("UART %s not ready", uart->name);
+		return -ENODEV;
+	}
+
+	if (!setup_done) {
+		ret = uart_setup();
+		if (ret < 0) {
+			LOG_ERR("Failed to set up UART %s: %d", uart->name, ret);
+			return ret;
+		}
+		setup_done = true;
+	}
+
+	if (!host_ready()) {
+		return -ENOTCONN;
+	}
+
+	memset(&rx, 0, sizeof(rx));
+
+	uart_start();
+	connected = true;
+
+	LOG_INF("Connected on %s", uart->name);
+
+	return 0;
+}
+
+static void serial_disconnect(void)
+{
+	connected = false;
+	uart_stop();
+}
+
+static int serial_send(const uint8_t *frame, size_t len)
+{
+	static uint8_t encoded[ENCODED_MAX_SIZE];
+	size_t i = 0u, o = 0u;
+	size_t n;
+	bool more = true;
+
+	if (!host_ready()) {
+		return -ENOTCONN;
+	}
+
+	if (len > FRAME_MAX_SIZE) {
+		return -EMSGSIZE;
+	}
+
+	while (more) {
+		for (n = 0u; i + n < len && frame[i + n] != 0u && n < COBS_BLOCK_MAX; n++) {
+		}
+
+		encoded[o++] = (uint8_t)(n + 1u);
+		memcpy(&encoded[o], &frame[i], n);
+		o += n;
+		i += n;
+
+		more = i < len;
+		if (n < COBS_BLOCK_MAX) {
+			/* Skip the 0x00 ending the block, a trailing one yields an empty
+			 * last block */
+			i++;
+		}
+	}
+
+	encoded[o++] = COBS_DELIMITER;
+
+	return uart_write(encoded, o);
+}
+
+static int serial_recv(uint8_t *buf, size_t len)
+{
+	size_t got = 0u;
+	uint8_t c;
+	int ret;
+
+	while (got < len) {
+		ret = uart_getc(&c);
+		if (ret < 0) {
+			return ret;
+		}
+
+		if (c == COBS_DELIMITER) {
+			rx.zero_pending = false;
+			rx.remaining	= 0u;
+			rx.in_packet	= false;
+			rx.skip			= false;
+
+			/* Packet shorter than announced by the frame header (bytes lost),
+			 * the frame is dropped and the next one starts after the delimiter
+			 */
+			if (got > 0u) {
+				return -EBADMSG;
+			}
+		} else if (rx.skip) {
+			continue;
+		} else if (rx.remaining == 0u) {
+			/* Code byte, starting a new block */
+			if (rx.zero_pending) {
+				buf[got++] = 0u;
+			}
+			rx.remaining	= c - 1u;
+			rx.zero_pending = (c != COBS_BLOCK_MAX + 1u);
+			rx.in_packet	= true;
+		} else {
+			buf[got++] = c;
+			rx.remaining--;
+		}
+	}
+
+	return 0;
+}
+
+/* The client found the frame bad (sync word, length or CRC), its remaining
+ * bytes are dropped. Nothing to do if the delimiter was already consumed.
+ */
+static void serial_resync(void)
+{
+	rx.skip = rx.in_packet;
+}
+
+const struct stream_transport stream_transport_serial = {
+	.name		= "serial",
+	.connect	= serial_connect,
+	.disconnect = serial_disconnect,
+	.send		= serial_send,
+	.recv		= serial_recv,
+	.resync		= serial_resync,
+};
@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2025 Lucas Dietrich <ld.adecy@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <errno.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/net/net_ip.h>
+#include <zephyr/net/socket.h>
+
+#include <stream_transport.h>
+
+LOG_MODULE_REGISTER(stream_tcp, LOG_LEVEL_INF);
+
+static int sock = -1;
+
+static int tcp_connect(void)
+{
+	int ret;
+	struct sockaddr_in addr;
+
+	ret = net_addr_pton(AF_INET, CONFIG_COPRO_STREAM_HOST, &addr.sin_addr);
+	if (ret < 0) {
+		return ret;
+	}
+
+	addr.sin_family = AF_INET;
+	addr.sin_port	= htons(CONFIG_COPRO_STREAM_PORT);
+
+	ret = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (ret < 0) {
+		LOG_ERR("Failed to create socket: %d", ret);
+		return ret;
+	}
+
+	sock = ret;
+
+	ret = connect(sock, (struct sockaddr *)&addr, sizeof(addr));
+	if (ret < 0) {
+		LOG_ERR("Failed to connect: %d", ret);
+		close(sock);
+		sock = -1;
+		return ret;
+	}
+
+	LOG_INF("Connected to %s:%d", CONFIG_COPRO_STREAM_HOST, CONFIG_COPRO_STREAM_PORT);
+
+	return 0;
+}
+
+static void tcp_disconnect(void)
+{
+	if (sock >= 0) {
+		close(sock);
+		sock = -1;
+	}
+}
+
+static int tcp_send(const uint8_t *buf, size_t len)
+{
+	int ret;
+
+	while (len > 0) {
+		ret = send(sock, buf, len, 0);
+		if (ret < 0) {
+			LOG_ERR("Failed to send: %d errno: %d", ret, errno);
+			return ret;
+		}
+
+		buf += ret;
+		len -= ret;
+	}
+
+	return 0;
+}
+
+static int tcp_recv(uint8_t *buf, size_t len)
+{
+	int ret;
+
+	while (len > 0) {
+		ret = recv(sock, buf, len, 0);
+		if (ret < 0) {
+			return ret;
+		} else if (ret == 0) {
+			return -ECONNRESET;
+		}
+
+		buf += ret;
+		len -= ret;
+	}
+
+	return 0;
+}
+
+const struct stream_transport stream_transport_tcp = {
+	.name		= "tcp",
+	.connect	= tcp_connect,
+	.disconnect = tcp_disconnect,
+	.send		= tcp_send,
+	.recv		= tcp_recv,
+};
@@ -8,6 +8,7 @@
 #include <zephyr/logging/log.h>
 #include <zephyr/sys/byteorder.h>
 
+#include <latency.h>
 #include <xiaomi.h>
 
 LOG_MODULE_REGISTER(xiaomi, LOG_LEVEL_INF);
@@ -18,7 +19,18 @@ LOG_MODULE_REGISTER(xiaomi, LOG_LEVEL_INF);
 
 #define XIAOMI_CUSTOM_ATC_ADV_PAYLOAD_SIZE sizeof(struct xiaomi_atc_custom_adv_payload)
 
-K_MSGQ_DEFINE(xiaomi_msgq, XIAOMI_RECORD_BUF_SIZE, CONFIG_COPRO_XIAOMI_QUEUE_SIZE, 4);
+K_MSGQ_DEFINE(xiaomi_msgq,
+			  XIAOMI_RECORD_BUF_SIZE + LATENCY_STAMP_SIZE,
+			  CONFIG_COPRO_XIAOMI_QUEUE_SIZE,
+			  4);
+
+BUILD_ASSERT(XIAOMI_RECORD_TIMESTAMP_OFFSET + sizeof(int64_t) <= XIAOMI_RECORD_BUF_SIZE,
+			 "Xiaomi record timestamp out of the record");
+#if CONFIG_COPRO_STREAM_CLIENT
+BUILD_ASSERT(XIAOMI_RECORD_BUF_SIZE + LATENCY_STAMP_SIZE <=
+				 CONFIG_COPRO_STREAM_CHANNEL_MSG_MAX_SIZE,
+			 "Xiaomi records exceed COPRO_STREAM_CHANNEL_MSG_MAX_SIZE");
+#endif
 
 /* https://github.com/pvvx/ATC_MiThermometer#custom-format-all-data-little-endian
  */
@@ -54,8 +66,8 @@ static bool adv_data_cb(struct bt_data *data, void *user_data)
 					XIAOMI_CUSTOM_ATC_NAME_STARTS_WITH,
 					XIAOMI_CUSTOM_ATC_NAME_STARTS_WITH_SIZE) == 0)) {
 
-			/* copy device name */
-			char name[128u];
+			/* copy device name, at most the payload of a legacy AD structure */
+			char name[BT_GAP_ADV_MAX_ADV_DATA_LEN - 2u + 1u];
 			size_t copy_len = MIN(data->data_len, sizeof(name) - 1);
 			memcpy(name, data->data, copy_len);
 			name[copy_len] = '\0';
@@ -71,8 +83,9 @@ static bool adv_data_cb(struct bt_data *data, void *user_data)
 			xiaomi_record_t *const xc = (xiaomi_record_t *)user_data;
 
 			if (payload->UUID == BT_UUID_ESS_VAL) {
-				xc->flags					   = XIAOMI_RECORD_FLAG_VALID;
+				xc->flags = XIAOMI_RECORD_FLAG_VALID | XIAOMI_RECORD_FLAG_COUNTER;
 				xc->timestamp				   = k_uptime_get();
+				xc->counter					   = payload->counter;
 				xc->measurements.battery_level = payload->battery_level;
 				xc->measurements.battery_mv	   = payload->battery_mv;
 				xc->measurements.humidity	   = payload->humidity;
@@ -82,6 +95,24 @@ static bool adv_data_cb(struct bt_data *data, void *user_data)
 				return false;
 			}
 		}
+
+#if CONFIG_COPRO_XIAOMI_ENCRYPTED
+		if (data->data_len >= sizeof(uint16_t)) {
+			uint16_t uuid = sys_get_le16(data->data);
+
+			if (uuid == XIAOMI_MIBEACON_UUID || uuid == XIAOMI_BTHOME_UUID) {
+				xiaomi_record_t *const xc = (xiaomi_record_t *)user_data;
+
+				if (xiaomi_encrypted_parse(data->data, data->data_len, xc)) {
+					xc->flags	  = XIAOMI_RECORD_FLAG_VALID;
+					xc->timestamp = k_uptime_get();
+
+					/* Fully parsed */
+					return false;
+				}
+			}
+		}
+#endif
 	} break;
 	default:
 		break;
@@ -99,10 +130,12 @@ bool xiaomi_bt_data_parse(const bt_addr_le_t *addr,
 
 	memset(xc, 0, sizeof(xiaomi_record_t));
 
+	/* Address is needed to look up the bind key of encrypted advertisements */
+	bt_addr_le_copy(&xc->addr, addr);
+
 	bt_data_parse(ad, adv_data_cb, xc);
 
 	if ((xc->flags & XIAOMI_RECORD_FLAG_VALID) != 0) {
-		bt_addr_le_copy(&xc->addr, addr);
 		xc->measurements.rssi = rssi;
 
 		char mac_str[BT_ADDR_STR_LEN];
@@ -0,0 +1,622 @@
+/*
+ * Copyright (c) 2025 Lucas Dietrich <ld.adecy@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/byteorder.h>
+
+#include <psa/crypto.h>
+#include <xiaomi.h>
+
+LOG_MODULE_REGISTER(xiaomi_enc, LOG_LEVEL_INF);
+
+/* Both MiBeacon v4/v5 and BTHome v2 use AES-128-CCM with a 4 bytes tag */
+#define CCM_ALG		 PSA_ALG_AEAD_WITH_SHORTENED_TAG(PSA_ALG_CCM, 4u)
+#define CCM_TAG_SIZE 4u
+
+/* Largest decrypted object payload we accept */
+#define PLAINTEXT_MAX_SIZE 32u
+
+/* MiBeacon frame control bits */
+#define MIBEACON_FCTRL_ENCRYPTED  BIT(3)
+#define MIBEACON_FCTRL_MAC		  BIT(4)
+#define MIBEACON_FCTRL_CAPABILITY BIT(5)
+#define MIBEACON_FCTRL_OBJECT	  BIT(6)
+#define MIBEACON_FCTRL_VERSION(_fctrl) (((_fctrl) >> 12u) & 0x0Fu)
+#define MIBEACON_CAPABILITY_IO	  BIT(5)
+#define MIBEACON_EXT_COUNTER_SIZE 3u
+#define MIBEACON_NONCE_SIZE		  12u
+
+/* MiBeacon object types */
+#define MIBEACON_OBJ_TEMPERATURE 0x1004 /* int16, 0.1 °C */
+#define MIBEACON_OBJ_HUMIDITY	 0x1006 /* uint16, 0.1 % */
+#define MIBEACON_OBJ_BATTERY	 0x100A /* uint8, % */
+#define MIBEACON_OBJ_TEMP_HUM	 0x100D /* int16 0.1 °C, uint16 0.1 % */
+
+/* BTHome v2 device information byte */
+#define BTHOME_INFO_ENCRYPTED	 BIT(0)
+#define BTHOME_INFO_VERSION(_info) (((_info) >> 5u) & 0x07u)
+#define BTHOME_COUNTER_SIZE		 4u
+#define BTHOME_NONCE_SIZE		 13u
+
+/* BTHome v2 object ids */
+#define BTHOME_OBJ_PACKET_ID	 0x00
+#define BTHOME_OBJ_BATTERY		 0x01 /* uint8, % */
+#define BTHOME_OBJ_TEMPERATURE	 0x02 /* int16, 0.01 °C */
+#define BTHOME_OBJ_HUMIDITY		 0x03 /* uint16, 0.01 % */
+#define BTHOME_OBJ_VOLTAGE		 0x0C /* uint16, 1 mV */
+#define BTHOME_OBJ_HUMIDITY_1	 0x2E /* uint8, 1 % */
+#define BTHOME_OBJ_TEMPERATURE_1 0x45 /* int16, 0.1 °C */
+
+#define MEAS_TEMPERATURE BIT(0)
+#define MEAS_HUMIDITY	 BIT(1)
+#define MEAS_BATTERY_MV	 BIT(2)
+#define MEAS_BATTERY_LVL BIT(3)
+
+struct xiaomi_key_entry {
+	bool in_use;
+	bt_addr_t addr;
+	psa_key_id_t key_id;
+	bool counter_valid;
+	uint32_t counter;			  // last advertisement counter, duplicates are skipped
+	xiaomi_measurements_t last;	  // last known measurements
+	uint8_t last_valid;			  // MEAS_* flags of valid fields in last
+};
+
+static struct xiaomi_key_entry keys[CONFIG_COPRO_XIAOMI_KEYS_MAX];
+
+K_MUTEX_DEFINE(keys_mutex);
+
+/* Object sizes of the BTHome ids we know, 0 if unknown */
+static uint8_t bthome_object_size(uint8_t id)
+{
+	switch (id) {
+	case BTHOME_OBJ_PACKET_ID:
+	case BTHOME_OBJ_BATTERY:
+	case BTHOME_OBJ_HUMIDITY_1:
+	case 0x09: /* count */
+	case 0x0F: /* generic boolean */
+	case 0x10: /* power */
+	case 0x11: /* opening */
+	case 0x2F: /* moisture */
+		return 1u;
+	case BTHOME_OBJ_TEMPERATURE:
+	case BTHOME_OBJ_HUMIDITY:
+	case BTHOME_OBJ_VOLTAGE:
+	case BTHOME_OBJ_TEMPERATURE_1:
+	case 0x06: /* mass (kg) */
+	case 0x07: /* mass (lb) */
+	case 0x08: /* dew point */
+	case 0x0D: /* pm2.5 */
+	case 0x0E: /* pm10 */
+	case 0x12: /* co2 */
+	case 0x13: /* tvoc */
+	case 0x14: /* moisture */
+		return 2u;
+	case 0x04: /* pressure */
+	case 0x05: /* illuminance */
+	case 0x0A: /* energy */
+	case 0x0B: /* power */
+		return 3u;
+	default:
+		return 0u;
+	}
+}
+
+static struct xiaomi_key_entry *key_lookup(const bt_addr_t *addr)
+{
+	for (int i = 0; i < ARRAY_SIZE(keys); i++) {
+		if (keys[i].in_use && bt_addr_eq(&keys[i].addr, addr)) {
+			return &keys[i];
+		}
+	}
+
+	return NULL;
+}
+
+int xiaomi_encrypted_init(void)
+{
+	psa_status_t status = psa_crypto_init();
+
+	if (status != PSA_SUCCESS) {
+		LOG_ERR("Failed to initialize PSA crypto: %d", status);
+		return -EIO;
+	}
+
+	return 0;
+}
+
+int xiaomi_key_set(const bt_addr_t *addr, const uint8_t key[XIAOMI_BIND_KEY_SIZE])
+{
+	int ret = 0;
+	psa_status_t status;
+	psa_key_id_t key_id;
+	psa_key_attributes_t attr = PSA_KEY_ATTRIBUTES_INIT;
+	struct xiaomi_key_entry *entry;
+
+	psa_set_key_usage_flags(&attr, PSA_KEY_USAGE_DECRYPT);
+	psa_set_key_lifetime(&attr, PSA_KEY_LIFETIME_VOLATILE);
+	psa_set_key_algorithm(&attr, CCM_ALG);
+	psa_set_key_type(&attr, PSA_KEY_TYPE_AES);
+	psa_set_key_bits(&attr, XIAOMI_BIND_KEY_SIZE * 8u);
+
+	status = psa_import_key(&attr, key, XIAOMI_BIND_KEY_SIZE, &key_id);
+	psa_reset_key_attributes(&attr);
+	if (status != PSA_SUCCESS) {
+		LOG_ERR("Failed to import bind key: %d", status);
+		return -EIO;
+	}
+
+	k_mutex_lock(&keys_mutex, K_FOREVER);
+
+	entry = key_lookup(addr);
+	if (entry != NULL) {
+		/* Replace the key, keep the last measurements */
+		psa_destroy_key(entry->key_id);
+	} else {
+		for (int i = 0; i < ARRAY_SIZE(keys); i++) {
+			if (!keys[i].in_use) {
+				entry = &keys[i];
+				memset(entry, 0, sizeof(*entry));
+				bt_addr_copy(&entry->addr, addr);
+				entry->in_use = true;
+				break;
+			}
+		}
+	}
+
+	if (entry != NULL) {
+		entry->key_id		 = key_id;
+		entry->counter_valid = false;
+	} else {
+		psa_destroy_key(key_id);
+		ret = -ENOMEM;
+	}
+
+	k_mutex_unlock(&keys_mutex);
+
+	return ret;
+}
+
+int xiaomi_key_remove(const bt_addr_t *addr)
+{
+	int ret = -ENOENT;
+	struct xiaomi_key_entry *entry;
+
+	k_mutex_lock(&keys_mutex, K_FOREVER);
+
+	entry = key_lookup(addr);
+	if (entry != NULL) {
+		psa_destroy_key(entry->key_id);
+		entry->in_use = false;
+		ret			  = 0;
+	}
+
+	k_mutex_unlock(&keys_mutex);
+
+	return ret;
+}
+
+bool xiaomi_key_known(const bt_addr_t *addr)
+{
+	bool known;
+
+	k_mutex_lock(&keys_mutex, K_FOREVER);
+	known = key_lookup(addr) != NULL;
+	k_mutex_unlock(&keys_mutex);
+
+	return known;
+}
+
+static int ccm_decrypt(psa_key_id_t key_id,
+					   const uint8_t *nonce,
+					   size_t nonce_len,
+					   const uint8_t *aad,
+					   size_t aad_len,
+					   const uint8_t *ciphertext,
+					   size_t ciphertext_len,
+					   const uint8_t *tag,
+					   uint8_t *plaintext,
+					   size_t *plaintext_len)
+{
+	psa_status_t status;
+	uint8_t input[PLAINTEXT_MAX_SIZE + CCM_TAG_SIZE];
+
+	if (ciphertext_len > PLAINTEXT_MAX_SIZE) {
+		return -EMSGSIZE;
+	}
+
+	/* The tag is not contiguous to the ciphertext in either format */
+	memcpy(input, ciphertext, ciphertext_len);
+	memcpy(&input[ciphertext_len], tag, CCM_TAG_SIZE);
+
+	status = psa_aead_decrypt(key_id,
+							  CCM_ALG,
+							  nonce,
+							  nonce_len,
+							  aad,
+							  aad_len,
+							  input,
+							  ciphertext_len + CCM_TAG_SIZE,
+							  plaintext,
+							  PLAINTEXT_MAX_SIZE,
+							  plaintext_len);
+	if (status != PSA_SUCCESS) {
+		return -EBADMSG;
+	}
+
+	return 0;
+}
+
+/* Returns the MEAS_* flags of the fields set in meas */
+static uint8_t mibeacon_objects_parse(const uint8_t *buf,
+									  size_t len,
+									  xiaomi_measurements_t *meas)
+{
+	uint8_t valid = 0u;
+
+	while (len >= 3u) {
+		uint16_t type	 = sys_get_le16(&buf[0u]);
+		uint8_t obj_len	 = buf[2u];
+		const uint8_t *v = &buf[3u];
+
+		if (obj_len > len - 3u) {
+			break;
+		}
+
+		switch (type) {
+		case MIBEACON_OBJ_TEMPERATURE:
+			if (obj_len >= 2u) {
+				meas->temperature = (int16_t)sys_get_le16(v) * 10;
+				valid |= MEAS_TEMPERATURE;
+			}
+			break;
+		case MIBEACON_OBJ_HUMIDITY:
+			if (obj_len >= 2u) {
+				meas->humidity = sys_get_le16(v) * 10u;
+				valid |= MEAS_HUMIDITY;
+			}
+			break;
+		case MIBEACON_OBJ_BATTERY:
+			if (obj_len >= 1u) {
+				meas->battery_level = v[0u];
+				valid |= MEAS_BATTERY_LVL;
+			}
+			break;
+		case MIBEACON_OBJ_TEMP_HUM:
+			if (obj_len >= 4u) {
+				meas->temperature = (int16_t)sys_get_le16(&v[0u]) * 10;
+				meas->humidity	  = sys_get_le16(&v[2u]) * 10u;
+				valid |= MEAS_TEMPERATURE | MEAS_HUMIDITY;
+			}
+			break;
+		default:
+			break;
+		}
+
+		buf += 3u + obj_len;
+		len -= 3u + obj_len;
+	}
+
+	return valid;
+}
+
+static uint8_t bthome_objects_parse(const uint8_t *buf,
+									size_t len,
+									xiaomi_measurements_t *meas)
+{
+	uint8_t valid = 0u;
+
+	while (len >= 1u) {
+		uint8_t id		 = buf[0u];
+		uint8_t obj_len	 = bthome_object_size(id);
+		const uint8_t *v = &buf[1u];
+
+		/* Objects of unknown size cannot be skipped */
+		if (obj_len == 0u || obj_len > len - 1u) {
+			break;
+		}
+
+		switch (id) {
+		case BTHOME_OBJ_BATTERY:
+			meas->battery_level = v[0u];
+			valid |= MEAS_BATTERY_LVL;
+			break;
+		case BTHOME_OBJ_TEMPERATURE:
+			meas->temperature = (int16_t)sys_get_le16(v);
+			valid |= MEAS_TEMPERATURE;
+			break;
+		case BTHOME_OBJ_TEMPERATURE_1:
+			meas->temperature = (int16_t)sys_get_le16(v) * 10;
+			valid |= MEAS_TEMPERATURE;
+			break;
+		case BTHOME_OBJ_HUMIDITY:
+			meas->humidity = sys_get_le16(v);
+			valid |= MEAS_HUMIDITY;
+			break;
+		case BTHOME_OBJ_HUMIDITY_1:
+			meas->humidity = v[0u] * 100u;
+			valid |= MEAS_HUMIDITY;
+			break;
+		case BTHOME_OBJ_VOLTAGE:
+			meas->battery_mv = sys_get_le16(v);
+			valid |= MEAS_BATTERY_MV;
+			break;
+		default:
+			break;
+		}
+
+		buf += 1u + obj_len;
+		len -= 1u + obj_len;
+	}
+
+	return valid;
+}
+
+/* Decrypt (if needed) the object payload of a MiBeacon frame, buf starts after
+ * the UUID. Returns the plaintext length or a negative error code.
+ */
+static int mibeacon_decode(struct xiaomi_key_entry *entry,
+						   const uint8_t *buf,
+						   size_t len,
+						   uint8_t *plaintext,
+						   uint32_t *counter)
+{
+	int ret;
+	size_t off = 5u; /* frame control, product id, frame counter */
+	size_t plaintext_len;
+	uint16_t fctrl;
+	uint8_t nonce[MIBEACON_NONCE_SIZE];
+	static const uint8_t aad = 0x11;
+
+	if (len < off) {
+		return -EINVAL;
+	}
+
+	fctrl = sys_get_le16(&buf[0u]);
+	if ((fctrl & MIBEACON_FCTRL_OBJECT) == 0u) {
+		return -ENODATA;
+	}
+
+	if (fctrl & MIBEACON_FCTRL_MAC) {
+		off += sizeof(bt_addr_t);
+	}
+
+	if (fctrl & MIBEACON_FCTRL_CAPABILITY) {
+		if (len < off + 1u) {
+			return -EINVAL;
+		}
+		off += (buf[off] & MIBEACON_CAPABILITY_IO) ? 3u : 1u;
+	}
+
+	if (len <= off) {
+		return -EINVAL;
+	}
+
+	if ((fctrl & MIBEACON_FCTRL_ENCRYPTED) == 0u) {
+		*counter = buf[4u];
+		memcpy(plaintext, &buf[off], MIN(len - off, PLAINTEXT_MAX_SIZE));
+		return MIN(len - off, PLAINTEXT_MAX_SIZE);
+	}
+
+	/* Only v4/v5 (AES-CCM) encryption is supported */
+	if (MIBEACON_FCTRL_VERSION(fctrl) < 4u) {
+		return -ENOTSUP;
+	}
+
+	if (len < off + MIBEACON_EXT_COUNTER_SIZE + CCM_TAG_SIZE + 1u) {
+		return -EINVAL;
+	}
+
+	const size_t ct_len		 = len - off - MIBEACON_EXT_COUNTER_SIZE - CCM_TAG_SIZE;
+	const uint8_t *ext_cnt	 = &buf[off + ct_len];
+	const uint8_t *tag		 = ext_cnt + MIBEACON_EXT_COUNTER_SIZE;
+
+	/* Nonce: MAC (LSB first) | product id | frame counter | extended counter */
+	memcpy(&nonce[0u], entry->addr.val, sizeof(bt_addr_t));
+	memcpy(&nonce[6u], &buf[2u], 3u);
+	memcpy(&nonce[9u], ext_cnt, MIBEACON_EXT_COUNTER_SIZE);
+
+	ret = ccm_decrypt(entry->key_id,
+					  nonce,
+					  sizeof(nonce),
+					  &aad,
+					  sizeof(aad),
+					  &buf[off],
+					  ct_len,
+					  tag,
+					  plaintext,
+					  &plaintext_len);
+	if (ret < 0) {
+		return ret;
+	}
+
+	*counter = buf[4u] | (sys_get_le24(ext_cnt) << 8u);
+
+	return plaintext_len;
+}
+
+/* Same as mibeacon_decode() for a BTHome v2 frame, buf starts after the UUID */
+static int bthome_decode(struct xiaomi_key_entry *entry,
+						 const uint8_t *buf,
+						 size_t len,
+						 uint8_t *plaintext,
+						 uint32_t *counter)
+{
+	int ret;
+	size_t plaintext_len;
+	uint8_t nonce[BTHOME_NONCE_SIZE];
+	uint8_t info;
+
+	if (len < 1u) {
+		return -EINVAL;
+	}
+
+	info = buf[0u];
+	if (BTHOME_INFO_VERSION(info) != 2u) {
+		return -ENOTSUP;
+	}
+
+	if ((info & BTHOME_INFO_ENCRYPTED) == 0u) {
+		*counter = 0u;
+		memcpy(plaintext, &buf[1u], MIN(len - 1u, PLAINTEXT_MAX_SIZE));
+		return MIN(len - 1u, PLAINTEXT_MAX_SIZE);
+	}
+
+	if (len < 1u + BTHOME_COUNTER_SIZE + CCM_TAG_SIZE + 1u) {
+		return -EINVAL;
+	}
+
+	const size_t ct_len		 = len - 1u - BTHOME_COUNTER_SIZE - CCM_TAG_SIZE;
+	const uint8_t *cnt		 = &buf[1u + ct_len];
+	const uint8_t *tag		 = cnt + BTHOME_COUNTER_SIZE;
+
+	/* Nonce: MAC (MSB first) | UUID | device info | counter */
+	sys_memcpy_swap(&nonce[0u], entry->addr.val, sizeof(bt_addr_t));
+	sys_put_le16(XIAOMI_BTHOME_UUID, &nonce[6u]);
+	nonce[8u] = info;
+	memcpy(&nonce[9u], cnt, BTHOME_COUNTER_SIZE);
+
+	ret = ccm_decrypt(entry->key_id,
+					  nonce,
+					  sizeof(nonce),
+					  NULL,
+					  0u,
+					  &buf[1u],
+					  ct_len,
+					  tag,
+					  plaintext,
+					  &plaintext_len);
+	if (ret < 0) {
+		return ret;
+	}
+
+	*counter = sys_get_le32(cnt);
+
+	return plaintext_len;
+}
+
+bool xiaomi_encrypted_parse(const uint8_t *svc_data, size_t len, xiaomi_record_t *xc)
+{
+	int ret;
+	bool success = false;
+	uint16_t uuid;
+	uint8_t valid;
+	uint32_t counter;
+	uint8_t plaintext[PLAINTEXT_MAX_SIZE];
+	xiaomi_measurements_t meas = {0};
+	struct xiaomi_key_entry *entry;
+
+	if (len < sizeof(uint16_t)) {
+		return false;
+	}
+
+	uuid = sys_get_le16(svc_data);
+
+	if (uuid != XIAOMI_MIBEACON_UUID && uuid != XIAOMI_BTHOME_UUID) {
+		return false;
+	}
+
+	k_mutex_lock(&keys_mutex, K_FOREVER);
+
+	/* Devices without a bind key are not tracked, even if unencrypted */
+	entry = key_lookup(&xc->addr.a);
+	if (entry == NULL) {
+		goto exit;
+	}
+
+	if (uuid == XIAOMI_MIBEACON_UUID) {
+		ret = mibeacon_decode(entry, &svc_data[2u], len - 2u, plaintext, &counter);
+	} else {
+		ret = bthome_decode(entry, &svc_data[2u], len - 2u, plaintext, &counter);
+	}
+
+	if (ret < 0) {
+		LOG_DBG("Failed to decode advertisement: %d", ret);
+		goto exit;
+	}
+
+	/* Advertisements are repeated, only report new measurements */
+	if (entry->counter_valid && entry->counter == counter) {
+		goto exit;
+	}
+
+	if (uuid == XIAOMI_MIBEACON_UUID) {
+		valid = mibeacon_objects_parse(plaintext, ret, &meas);
+	} else {
+		valid = bthome_objects_parse(plaintext, ret, &meas);
+	}
+
+	if (valid == 0u) {
+		goto exit;
+	}
+
+	entry->counter		 = counter;
+	entry->counter_valid = true;
+
+	if (valid & MEAS_TEMPERATURE) {
+		entry->last.temperature = meas.temperature;
+	}
+	if (valid & MEAS_HUMIDITY) {
+		entry->last.humidity = meas.humidity;
+	}
+	if (valid & MEAS_BATTERY_MV) {
+		entry->last.battery_mv = meas.battery_mv;
+	}
+	if (valid & MEAS_BATTERY_LVL) {
+		entry->last.battery_level = meas.battery_level;
+	}
+	entry->last_valid |= valid;
+
+	/* Wait for both temperature and humidity before reporting the device */
+	if ((entry->last_valid & (MEAS_TEMPERATURE | MEAS_HUMIDITY)) ==
+		(MEAS_TEMPERATURE | MEAS_HUMIDITY)) {
+		xc->measurements = entry->last;
+		success			 = true;
+	}
+
+exit:
+	k_mutex_unlock(&keys_mutex);
+
+	return success;
+}
+
+static void control_addr_get(const uint8_t *data, bt_addr_t *addr)
+{
+	/* Most significant byte first, as in the serialized records */
+	sys_memcpy_swap(addr->val, data, sizeof(addr->val));
+}
+
+int xiaomi_control_key_set(uint8_t type, const uint8_t *data, size_t len)
+{
+	bt_addr_t addr;
+
+	if (len < sizeof(addr.val) + XIAOMI_BIND_KEY_SIZE) {
+		return -EINVAL;
+	}
+
+	control_addr_get(data, &addr);
+
+	return xiaomi_key_set(&addr, &data[sizeof(addr.val)]);
+}
+
+int xiaomi_control_key_remove(uint8_t type, const uint8_t *data, size_t len)
+{
+	bt_addr_t addr;
+
+	if (len < sizeof(addr.val)) {
+		return -EINVAL;
+	}
+
+	control_addr_get(data, &addr);
+
+	return xiaomi_key_remove(&addr);
+}
@@ -0,0 +1,228 @@
+/*
+ * Copyright (c) 2025 Lucas Dietrich <ld.adecy@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <zephyr/device.h>
+#include <zephyr/drivers/serial/uart_emul.h>
+#include <zephyr/kernel.h>
+#include <zephyr/ztest.h>
+
+#include <stream_transport.h>
+
+static const struct device *const euart = DEVICE_DT_GET(DT_CHOSEN(copro_stream_uart));
+
+static const struct stream_transport *const tr = &stream_transport_serial;
+
+/* Delay for the emulated UART to run its interrupt handler */
+#define UART_EMUL_DELAY K_MSEC(10)
+
+#define FRAME_SIZE 300u
+
+/* Reference COBS encoder, the delimiter included */
+static size_t cobs_encode(const uint8_t *in, size_t len, uint8_t *out)
+{
+	size_t o		= 1u;
+	size_t code_idx = 0u;
+	uint8_t code	= 1u;
+
+	for (size_t i = 0u; i < len; i++) {
+		if (in[i] == 0u) {
+			out[code_idx] = code;
+			code		  = 1u;
+			code_idx	  = o++;
+		} else {
+			out[o++] = in[i];
+			if (++code == 0xFFu) {
+				out[code_idx] = code;
+				code		  = 1u;
+				code_idx	  = o++;
+			}
+		}
+	}
+
+	out[code_idx] = code;
+	out[o++]	  = 0u;
+
+	return o;
+}
+
+/* Reference COBS decoder, len excludes the delimiter */
+static size_t cobs_decode(const uint8_t *in, size_t len, uint8_t *out)
+{
+	size_t i = 0u;
+	size_t o = 0u;
+
+	while (i < len) {
+		uint8_t code = in[i++];
+
+		for (uint8_t j = 1u; j < code && i < len; j++) {
+			out[o++] = in[i++];
+		}
+		if (code != 0xFFu && i < len) {
+			out[o++] = 0u;
+		}
+	}
+
+	return o;
+}
+
+/* Zeros, runs longer than a COBS block and a trailing 0x00 */
+static void frame_fill(uint8_t *frame, size_t len, uint8_t seed)
+{
+	for (size_t i = 0u; i < len; i++) {
+		frame[i] = (i % 97u == 0u) ? 0u : (uint8_t)(i + seed) | 0x01u;
+	}
+	frame[len - 1u] = 0u;
+}
+
+static void rx_put(const uint8_t *data, size_t len)
+{
+	zassert_equal(uart_emul_put_rx_data(euart, data, len), len);
+}
+
+static void rx_put_frame(const uint8_t *frame, size_t len)
+{
+	static uint8_t encoded[FRAME_SIZE + FRAME_SIZE / 254u + 2u];
+
+	rx_put(encoded, cobs_encode(frame, len, encoded));
+}
+
+static void stream_transport_serial_before(void *fixture)
+{
+	ARG_UNUSED(fixture);
+
+	uart_emul_flush_rx_data(euart);
+	uart_emul_flush_tx_data(euart);
+	zassert_ok(tr->connect());
+}
+
+static void stream_transport_serial_after(void *fixture)
+{
+	ARG_UNUSED(fixture);
+
+	tr->disconnect();
+}
+
+ZTEST_SUITE(stream_transport_serial,
+			NULL,
+			NULL,
+			stream_transport_serial_before,
+			stream_transport_serial_after,
+			NULL);
+
+ZTEST(stream_transport_serial, test_send_encoding)
+{
+	uint8_t frame[FRAME_SIZE];
+	uint8_t encoded[FRAME_SIZE * 2u];
+	uint8_t decoded[FRAME_SIZE];
+	uint32_t len;
+
+	/* A run of more than 254 non-zero bytes, then zeros */
+	memset(frame, 0x5A, sizeof(frame));
+	frame[280] = 0u;
+	frame[281] = 0u;
+
+	zassert_ok(tr->send(frame, sizeof(frame)));
+	k_sleep(UART_EMUL_DELAY);
+
+	len = uart_emul_get_tx_data(euart, encoded, sizeof(encoded));
+	zassert_true(len > sizeof(frame));
+	zassert_equal(encoded[len - 1u], 0u, "missing delimiter");
+	zassert_is_null(memchr(encoded, 0, len - 1u), "0x00 in the encoded frame");
+
+	zassert_equal(cobs_decode(encoded, len - 1u, decoded), sizeof(frame));
+	zassert_mem_equal(decoded, frame, sizeof(frame));
+}
+
+ZTEST(stream_transport_serial, test_send_too_large)
+{
+	uint8_t frame[FRAME_SIZE];
+
+	memset(frame, 0x01, sizeof(frame));
+
+	zassert_equal(tr->send(frame, 8u + CONFIG_COPRO_STREAM_CHANNEL_MSG_MAX_SIZE + 5u),
+				  -EMSGSIZE);
+}
+
+ZTEST(stream_transport_serial, test_recv_round_trip)
+{
+	uint8_t frame[FRAME_SIZE];
+	uint8_t buf[FRAME_SIZE];
+
+	frame_fill(frame, sizeof(frame), 0u);
+	rx_put_frame(frame, sizeof(frame));
+
+	/* The client reads the header, the payload and the CRC separately */
+	zassert_ok(tr->recv(&buf[0], 8u));
+	zassert_ok(tr->recv(&buf[8], sizeof(buf) - 12u));
+	zassert_ok(tr->recv(&buf[sizeof(buf) - 4u], 4u));
+	zassert_mem_equal(buf, frame, sizeof(frame));
+}
+
+ZTEST(stream_transport_serial, test_recv_empty_packets)
+{
+	static const uint8_t delimiters[] = {0x00, 0x00, 0x00};
+	uint8_t frame[32];
+	uint8_t buf[sizeof(frame)];
+
+	frame_fill(frame, sizeof(frame), 1u);
+	rx_put(delimiters, sizeof(delimiters));
+	rx_put_frame(frame, sizeof(frame));
+
+	zassert_ok(tr->recv(buf, sizeof(buf)));
+	zassert_mem_equal(buf, frame, sizeof(frame));
+}
+
+/* Bytes lost on the link: the delimiter shows up before the end of the frame,
+ * which is dropped, the next one is received
+ */
+ZTEST(stream_transport_serial, test_recv_cut_frame)
+{
+	uint8_t frame[64];
+	uint8_t next[48];
+	uint8_t encoded[sizeof(frame) + 2u];
+	uint8_t buf[sizeof(frame)];
+	size_t len;
+
+	frame_fill(frame, sizeof(frame), 2u);
+	frame_fill(next, sizeof(next), 3u);
+
+	len = cobs_encode(frame, sizeof(frame), encoded);
+	rx_put(encoded, len / 2u);
+	rx_put(&encoded[len - 1u], 1u);
+	rx_put_frame(next, sizeof(next));
+
+	zassert_equal(tr->recv(buf, sizeof(frame)), -EBADMSG);
+
+	/* As done by the client, the delimiter was consumed already */
+	tr->resync();
+
+	zassert_ok(tr->recv(buf, sizeof(next)));
+	zassert_mem_equal(buf, next, sizeof(next));
+}
+
+/* The client rejects a frame (e.g. bad CRC) after reading part of it: the rest
+ * of the packet is dropped
+ */
+ZTEST(stream_transport_serial, test_resync)
+{
+	uint8_t frame[64];
+	uint8_t next[48];
+	uint8_t buf[sizeof(frame)];
+
+	frame_fill(frame, sizeof(frame), 4u);
+	frame_fill(next, sizeof(next), 5u);
+	rx_put_frame(frame, sizeof(frame));
+	rx_put_frame(next, sizeof(next));
+
+	zassert_ok(tr->recv(buf, 8u));
+	tr->resync();
+
+	zassert_ok(tr->recv(buf, sizeof(next)));
+	zassert_mem_equal(buf, next, sizeof(next));
+}
@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) 2025 Lucas Dietrich <ld.adecy@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/ztest.h>
+
+#include <psa/crypto.h>
+#include <xiaomi.h>
+
+/* NIST SP 800-38C, Appendix C, Example 1 (4 bytes tag) */
+static const uint8_t nist_key[16] = {0x40, 0x41, 0x42, 0x43, 0x44, 0x45, 0x46, 0x47,
+									 0x48, 0x49, 0x4a, 0x4b, 0x4c, 0x4d, 0x4e, 0x4f};
+static const uint8_t nist_nonce[7] = {0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16};
+static const uint8_t nist_aad[8]	= {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07};
+static const uint8_t nist_plaintext[4] = {0x20, 0x21, 0x22, 0x23};
+static const uint8_t nist_ciphertext[8] = {
+	0x71, 0x62, 0x01, 0x5b, 0x4d, 0xac, 0x25, 0x5d, /* ciphertext | tag */
+};
+
+/* BTHome v2, MAC 54:48:E6:8F:80:A5, counter 0x33221100: temperature 25.06 °C
+ * (0x02 0x09ca) and humidity 50.55 % (0x03 0x13bf)
+ */
+static const uint8_t bthome_key[XIAOMI_BIND_KEY_SIZE] = {
+	0x23, 0x1d, 0x39, 0xc1, 0xd7, 0xcc, 0x1a, 0xb1,
+	0xae, 0xe2, 0x24, 0xcd, 0x09, 0x6d, 0xb9, 0x32,
+};
+static const bt_addr_le_t bthome_addr = {
+	.type = BT_ADDR_LE_PUBLIC,
+	.a	  = {{0xa5, 0x80, 0x8f, 0xe6, 0x48, 0x54}},
+};
+static const uint8_t bthome_svc_data[] = {
+	0xd2, 0xfc, 0x41, 0xa4, 0x72, 0x66, 0xc9, 0x5f, 0x73,
+	0x00, 0x11, 0x22, 0x33, 0x78, 0x23, 0x72, 0x14,
+};
+
+/* MiBeacon v5 (MAC included), MAC A4:C1:38:12:34:56, product 0x055b, counter
+ * 0x00012a: object 0x100d with temperature 21.5 °C and humidity 45.6 %
+ */
+static const uint8_t mibeacon_key[XIAOMI_BIND_KEY_SIZE] = {
+	0xe9, 0xef, 0x8c, 0xe0, 0xe5, 0xe6, 0xf9, 0xe0,
+	0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xbb,
+};
+static const bt_addr_le_t mibeacon_addr = {
+	.type = BT_ADDR_LE_PUBLIC,
+	.a	  = {{0x56, 0x34, 0x12, 0x38, 0xc1, 0xa4}},
+};
+static const uint8_t mibeacon_svc_data[] = {
+	0x95, 0xfe, 0x58, 0x58, 0x5b, 0x05, 0x2a, 0x56, 0x34, 0x12, 0x38, 0xc1, 0xa4, 0xb6,
+	0x33, 0xdd, 0x39, 0x41, 0x51, 0x11, 0x01, 0x00, 0x00, 0x2d, 0x12, 0xbd, 0x60,
+};
+
+static void *xiaomi_encrypted_setup(void)
+{
+	zassert_ok(xiaomi_encrypted_init());
+
+	return NULL;
+}
+
+static void xiaomi_encrypted_before(void *fixture)
+{
+	ARG_UNUSED(fixture);
+
+	/* Start every test with fresh entries, without counter nor measurements */
+	(void)xiaomi_key_remove(&bthome_addr.a);
+	(void)xiaomi_key_remove(&mibeacon_addr.a);
+	zassert_ok(xiaomi_key_set(&bthome_addr.a, bthome_key));
+	zassert_ok(xiaomi_key_set(&mibeacon_addr.a, mibeacon_key));
+}
+
+ZTEST_SUITE(xiaomi_encrypted,
+			NULL,
+			xiaomi_encrypted_setup,
+			xiaomi_encrypted_before,
+			NULL,
+			NULL);
+
+/* Known answer of the crypto backend itself, with the algorithm the decoder uses */
+ZTEST(xiaomi_encrypted, test_ccm_known_answer)
+{
+	psa_status_t status;
+	psa_key_id_t key_id;
+	psa_key_attributes_t attr = PSA_KEY_ATTRIBUTES_INIT;
+	uint8_t plaintext[sizeof(nist_plaintext)];
+	size_t len;
+
+	psa_set_key_usage_flags(&attr, PSA_KEY_USAGE_DECRYPT);
+	psa_set_key_lifetime(&attr, PSA_KEY_LIFETIME_VOLATILE);
+	psa_set_key_algorithm(&attr, PSA_ALG_AEAD_WITH_SHORTENED_TAG(PSA_ALG_CCM, 4u));
+	psa_set_key_type(&attr, PSA_KEY_TYPE_AES);
+	psa_set_key_bits(&attr, 128u);
+
+	status = psa_import_key(&attr, nist_key, sizeof(nist_key), &key_id);
+	zassert_equal(status, PSA_SUCCESS, "import failed: %d", status);
+
+	status = psa_aead_decrypt(key_id,
+							  PSA_ALG_AEAD_WITH_SHORTENED_TAG(PSA_ALG_CCM, 4u),
+							  nist_nonce,
+							  sizeof(nist_nonce),
+							  nist_aad,
+							  sizeof(nist_aad),
+							  nist_ciphertext,
+							  sizeof(nist_ciphertext),
+							  plaintext,
+							  sizeof(plaintext),
+							  &len);
+	psa_destroy_key(key_id);
+
+	zassert_equal(status, PSA_SUCCESS, "decrypt failed: %d", status);
+	zassert_equal(len, sizeof(nist_plaintext));
+	zassert_mem_equal(plaintext, nist_plaintext, sizeof(nist_plaintext));
+}
+
+ZTEST(xiaomi_encrypted, test_bthome_decrypt)
+{
+	xiaomi_record_t xc = {.addr = bthome_addr};
+
+	zassert_true(xiaomi_encrypted_parse(bthome_svc_data, sizeof(bthome_svc_data), &xc));
+	zassert_equal(xc.measurements.temperature, 2506);
+	zassert_equal(xc.measurements.humidity, 5055);
+}
+
+ZTEST(xiaomi_encrypted, test_mibeacon_v5_decrypt)
+{
+	xiaomi_record_t xc = {.addr = mibeacon_addr};
+
+	zassert_true(
+		xiaomi_encrypted_parse(mibeacon_svc_data, sizeof(mibeacon_svc_data), &xc));
+	zassert_equal(xc.measurements.temperature, 2150);
+	zassert_equal(xc.measurements.humidity, 4560);
+}
+
+ZTEST(xiaomi_encrypted, test_tag_mismatch)
+{
+	uint8_t svc_data[sizeof(bthome_svc_data)];
+	xiaomi_record_t xc = {.addr = bthome_addr};
+
+	memcpy(svc_data, bthome_svc_data, sizeof(svc_data));
+	svc_data[sizeof(svc_data) - 1u] ^= 0x01u;
+
+	zassert_false(xiaomi_encrypted_parse(svc_data, sizeof(svc_data), &xc));
+}
+
+ZTEST(xiaomi_encrypted, test_wrong_key)
+{
+	/* The BTHome frame decrypted with the MiBeacon key */
+	xiaomi_record_t xc = {.addr = bthome_addr};
+
+	zassert_ok(xiaomi_key_set(&bthome_addr.a, mibeacon_key));
+	zassert_false(xiaomi_encrypted_parse(bthome_svc_data, sizeof(bthome_svc_data), &xc));
+}
+
+ZTEST(xiaomi_encrypted, test_repeated_counter)
+{
+	xiaomi_record_t xc = {.addr = bthome_addr};
+
+	zassert_true(xiaomi_encrypted_parse(bthome_svc_data, sizeof(bthome_svc_data), &xc));
+	zassert_false(xiaomi_encrypted_parse(bthome_svc_data, sizeof(bthome_svc_data), &xc));
+}
+
+ZTEST(xiaomi_encrypted, test_unknown_device)
+{
+	xiaomi_record_t xc = {.addr = bthome_addr};
+
+	zassert_ok(xiaomi_key_remove(&bthome_addr.a));
+	zassert_false(xiaomi_encrypted_parse(bthome_svc_data, sizeof(bthome_svc_data), &xc));
+	zassert_false(xiaomi_key_known(&bthome_addr.a));
+}